@@ -15,11 +15,30 @@
 #include "shaders.h"
 #include "sdl-base.h"
 #include "objects.h"
+#include "matrix.h"
+#include "core.h"
+#include "timer.h"
+#include "lights.h"
+#include "cluster.h"
+#include "parallel.h"
+#include "softrast.h"
+#include "tessellate.h"
+#include "meshcache.h"
+#include "bump.h"
+#include "patches.h"
+#include "resources.h"
+#include "shadow.h"
+#include "meshload.h"
+#include "gldebug.h"
+#include "resolution.h"
+#include "capture.h"
 
 #define CAMERA_VELOCITY 0.005		 /* Units per millisecond */
 #define CAMERA_ANGULAR_VELOCITY 0.05	 /* Degrees per millisecond */
 #define CAMERA_MOUSE_X_VELOCITY 0.3	 /* Degrees per mouse unit */
 #define CAMERA_MOUSE_Y_VELOCITY 0.3	 /* Degrees per mouse unit */
+#define MAX_POINT_LIGHTS 1024
+#define MB (1024.0f * 1024.0f)
 
 #ifndef min
 #define min(a, b) ((a)>(b)?(b):(a))
@@ -37,11 +56,23 @@ static float camera_pitch;	/* Up/down degrees for camera */
 static int mouse1_down;		/* Left mouse button Up/Down. Only move camera when down. */
 static int mouse2_down;		/* Right mouse button Up/Down. Only zoom camera when down. */
 
-/* Object data */
+/* Object data. The object is owned by the rendering side, geometry is
+ * generated on the main thread and handed over in the next frame packet */
 Object* object = NULL;
+static ObjectData* pending_geometry = NULL; /* generated, not yet published */
+static ObjectData* upload_geometry = NULL; /* consumed, not yet uploaded */
+/* createObjectData mesh for the CPU reference of the next frame, see write_reference */
+static ObjectData* pending_reference = NULL;
+static ObjectData* upload_reference = NULL;
 static int tessellation = 2; /* Tessellation level */
 const int min_tess = 2;
 const int max_tess = 10;
+const int max_tess_attribless = 13; /* nothing is allocated, so go further */
+/* Adaptive meshes, measured when generated */
+static int adaptive_triangles = 0;
+static float adaptive_error = 0.0f;
+/* What the closed sphere and torus meshes share and drop, when generated */
+static TopologyCounts topology_counts;
 const int min_shininess = 10.0;
 const int max_shininess = 120.0;
 float shapeRotation = 0; /* Shape Rotation */
@@ -51,6 +82,90 @@ static char key_state[1024];
 
 /* The opengl handle to our shader */
 GLuint shader = 0;
+GLuint shader_attribless = 0; /* variant that needs no vertex data, 0 if unsupported */
+GLuint shader_capture = 0; /* geometry only, for transform feedback */
+GLuint shader_cached = 0; /* lighting only, over captured geometry */
+static int core_supported = 0;
+static int debug_supported = 0; /* the driver reports through gldebug.h */
+
+/* Bump normals for pixel lighting, baked once in init, see bump.h */
+#define BUMP_UNIT 3 /* clear of the core backend's cluster textures */
+static GLuint bump_texture = 0;
+static size_t bump_texture_bytes = 0;
+
+/* Projection for the core backend, which can't read the matrix stack */
+static mat4_t projection_matrix;
+
+/* Clustered point lights. The count and animation time are set on the main
+ * thread, the lights themselves are built on the rendering side */
+static int num_point_lights = 64;
+static float point_light_time = 0.0f;
+static PointLight point_lights[MAX_POINT_LIGHTS]; /* world space */
+static PointLight view_point_lights[MAX_POINT_LIGHTS];
+static ClusterGrid* clusters = NULL;
+static int viewport_width, viewport_height; /* the scene's, scaled with dynamic resolution */
+static float cluster_time = 0.0f; /* light assignment, smoothed */
+static float cluster_occupancy = 0.0f; /* lights per non-empty cluster */
+static int cluster_dropped = 0;
+
+/* Offscreen benchmark run, see run_perf */
+#define PERF_SIZE 256 /* framebuffer width and height */
+#define PERF_TRIALS 9
+#define PERF_FRAMES 3 /* frames timed per trial, at least */
+#define PERF_MIN_TIME 0.02 /* seconds of frames timed per trial, at least */
+static const char* perf_output = NULL;
+
+/* Generated meshes are saved here and mapped back on later runs, see meshcache.h */
+static const char* mesh_cache_dir = NULL;
+static int mesh_cache_lz4 = 0;
+
+/* A mesh file drawn in place of the shapes, see meshload.h. Scaled to fit
+ * the unit sphere like them */
+#define MESH_RADIUS 1.0f
+static const char* mesh_file = NULL;
+static MeshLoadStats mesh_stats;
+
+/* Dynamic resolution, see resolution.h. Frame time aimed for, set with
+ * --target-ms, and timed on the CPU with --cpu-timed */
+#define DEFAULT_TARGET_MS 16.7f
+static float target_ms = DEFAULT_TARGET_MS;
+static int resolution_cpu_timed = 0;
+static DynamicResolution* dynamic_resolution = NULL;
+static int window_width, window_height;
+
+/* Every frame written out as it is drawn, see capture.h. Set with --capture
+ * or --capture-yuv */
+static const char* capture_path = NULL;
+static CaptureFormat capture_format = CAPTURE_PPM;
+static Capture* capture = NULL;
+
+/* CPU time to submit the scene and GL calls it took, smoothed */
+static float submit_time = 0.0f;
+static float submit_gl_calls = 0.0f;
+
+/* Overdraw view: shaded fragments per pixel the object covers, last frame */
+static float overdraw_average = 0.0f;
+
+/* Patch culling, see patches.h. What the last frame culled, the CPU time
+ * it took, and the GPU time of the object's passes with culling off [0]
+ * and on [1], smoothed, for the time it saves */
+static PatchStats patch_stats;
+static float patch_cull_time = 0.0f;
+static float draw_gpu_time[2] = {0.0f, 0.0f};
+static int draw_gpu_generation = -1; /* object the times are for */
+static GLuint draw_query = 0; /* 0 without timer queries */
+static int draw_query_culled = -1; /* what the query in flight measures, -1 for none */
+static int draw_query_generation;
+
+/* Shadow map of light 0, see shadow.h. The GPU time of its pass per
+ * frame, smoothed, with the cache off [0] and on [1], where a frame that
+ * reuses the map costs nothing */
+static ShadowMap* shadow_map = NULL;
+static int shadows_bound = 0; /* the map is on SHADOW_UNIT for the legacy shaders */
+static float shadow_gpu_time[2] = {0.0f, 0.0f};
+static int shadow_gpu_samples[2] = {0, 0};
+static GLuint shadow_query = 0; /* 0 without timer queries */
+static int shadow_query_cached = -1; /* what the query in flight measures, -1 for none */
 
 /* Shapes */
 enum Shape {
@@ -69,8 +184,15 @@ enum Bump {
   NUM_BUMP_STATES
 } bump_t = NO_BUMPS;
 
+/* What the object's geometry cache was captured with */
+static int object_generation = 0;
+static int cache_generation = -1;
+static enum Shape cache_shape;
+static enum Bump cache_bumps;
+static int cache_captures = 0;
+
 /* Store render state variables.  Can be toggled with function keys. */
-static struct {
+typedef struct {
   int wireframe;
   int lighting;
   int flatOrSmooth;
@@ -81,7 +203,21 @@ static struct {
   int stateOSDorConsole;  // 0 - console, 1 - osd
   int animation;
   int normals;
-} renderstate;
+  int attribless;
+  int geometryCache;
+  int coreProfile;
+  int clusteredLights;
+  int adaptive;
+  int bumpMap;
+  int culling;
+  int depthPrepass;
+  int overdraw;
+  int patchCulling;
+  int shadows;
+  int shadowCache;
+  int dynamicResolution;
+} RenderState;
+static RenderState renderstate;
 
 /* Light and materials */
 static float light0_position[] = {2.0, 2.0, 2.0, 0.0};
@@ -94,38 +230,672 @@ static float material_shininess = 50.0;
 int currentFramerate;
 float currentFrametime;
 
-void update_renderstate()
+/* Everything display() needs for one frame. Filled in by publish() on the
+ * main thread and never modified after, see sdl-base.h */
+typedef struct {
+  /* Camera */
+  float camera_zoom;
+  float camera_heading;
+  float camera_pitch;
+  float shapeRotation;
+
+  RenderState renderstate;
+  enum Shape shape;
+  enum Bump bumps;
+
+  /* Light and materials */
+  float light0_position[4];
+  float material_ambient[4];
+  float material_diffuse[4];
+  float material_specular[4];
+  float material_shininess;
+  int numPointLights;
+  float pointLightTime;
+
+  /* New geometry to replace the object with, or NULL. Owned by the packet */
+  ObjectData* geometry;
+  /* Mesh to render a CPU reference of this frame with, or NULL. Owned by the packet */
+  ObjectData* reference;
+
+  /* For the OSD */
+  int tessellation;
+  int adaptiveTriangles;
+  float adaptiveError;
+  TopologyCounts topology; /* zeros unless the mesh is closed */
+  int framerate;
+  float inputLatency, inputLatencyMax; /* ms, see sdl-base.h */
+  CaptureStats capture; /* zeros without --capture */
+  ResolutionStats resolution;
+} RenderPacket;
+
+size_t frame_packet_size = sizeof(RenderPacket);
+
+/* The packet being drawn, and the state last sent to GL */
+static RenderPacket frame;
+static RenderPacket applied;
+static int applied_valid = 0;
+
+/* Sets an int uniform on every variant of our shader */
+void set_shader_int(const char* name, int value)
+{
+  GLuint programs[] = {shader, shader_attribless, shader_capture, shader_cached};
+  int i;
+  for (i = 0; i < (int)(sizeof(programs) / sizeof(programs[0])); ++i) {
+    GLint location;
+    if (!programs[i])
+      continue;
+    location = glGetUniformLocation(programs[i], name);
+    if (location != -1) {
+      glUseProgram(programs[i]);
+      glUniform1i(location, value);
+    }
+  }
+  glUseProgram(0);
+}
+
+/* Grid size for the current tessellation, in vertices along u and v */
+int grid_size(int tess)
+{
+  return (1 << tess) + 1;
+}
+
+void update_renderstate(const RenderState* state)
 {
-  if (renderstate.lighting)
+  if (state->lighting)
     glEnable(GL_LIGHTING);
   else
     glDisable(GL_LIGHTING);
 
-  glShadeModel(renderstate.flatOrSmooth ? GL_FLAT : GL_SMOOTH);
+  glShadeModel(state->flatOrSmooth ? GL_FLAT : GL_SMOOTH);
 
-  glPolygonMode(GL_FRONT_AND_BACK, renderstate.wireframe ? GL_LINE : GL_FILL);
+  glPolygonMode(GL_FRONT_AND_BACK, state->wireframe ? GL_LINE : GL_FILL);
 }
 
-void regenerate_geometry()
+/* Which way round the closed shapes' outsides are on screen. The sphere's
+ * (u, v) grid runs clockwise seen from outside, and shader.vert swaps the
+ * torus's u and v, so only the torus generated on the CPU is anticlockwise.
+ * Mesh files are anticlockwise, as OBJ and PLY have them */
+GLenum front_face(const RenderPacket* p)
 {
-  int subdivs;
-  subdivs = 1 << (tessellation);
+  int cpuMesh = !p->renderstate.shaders || p->renderstate.coreProfile;
+  if (mesh_file)
+    return GL_CCW;
+  return p->shape == TORUS_S && cpuMesh ? GL_CCW : GL_CW;
+}
 
-  /* Free previous object */
-  if (object) 
-    freeObject(object);
+/* Sends whatever differs between the packet and the current GL state */
+void apply_packet_state(const RenderPacket* p)
+{
+#define CHANGED(field) (!applied_valid || p->field != applied.field)
+  if (CHANGED(renderstate.lighting) || CHANGED(renderstate.flatOrSmooth) || CHANGED(renderstate.wireframe))
+    update_renderstate(&p->renderstate);
+
+  if (!applied_valid || memcmp(p->material_ambient, applied.material_ambient, sizeof(p->material_ambient)))
+    glMaterialfv(GL_FRONT, GL_AMBIENT, p->material_ambient);
+  if (!applied_valid || memcmp(p->material_diffuse, applied.material_diffuse, sizeof(p->material_diffuse)))
+    glMaterialfv(GL_FRONT, GL_DIFFUSE, p->material_diffuse);
+  if (!applied_valid || memcmp(p->material_specular, applied.material_specular, sizeof(p->material_specular)))
+    glMaterialfv(GL_FRONT, GL_SPECULAR, p->material_specular);
+  if (CHANGED(material_shininess))
+    glMaterialf(GL_FRONT, GL_SHININESS, p->material_shininess);
+
+  // set viewer position in fixed pipeline
+  /* Back faces of the closed shapes are hidden, the grid is seen from both sides */
+  if (CHANGED(renderstate.culling) || CHANGED(shape)) {
+    if (p->renderstate.culling && p->shape != GRID_S)
+      glEnable(GL_CULL_FACE);
+    else
+      glDisable(GL_CULL_FACE);
+  }
+  if (CHANGED(shape) || CHANGED(renderstate.shaders) || CHANGED(renderstate.coreProfile))
+    glFrontFace(front_face(p));
+
+  if (CHANGED(renderstate.viewer_model))
+    glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, p->renderstate.viewer_model);
+
+  // set shader uniforms
+  if (CHANGED(renderstate.normals))
+    set_shader_int("normal_view", p->renderstate.normals);
+  if (CHANGED(renderstate.viewer_model))
+    set_shader_int("viewer", p->renderstate.viewer_model);
+  if (CHANGED(bumps))
+    set_shader_int("bumps", p->bumps);
+  if (CHANGED(renderstate.bumpMap))
+    set_shader_int("bump_map", p->renderstate.bumpMap);
+  if (CHANGED(renderstate.lightingModel))
+    set_shader_int("lighting_model", p->renderstate.lightingModel);
+  if (CHANGED(renderstate.vertexOrPixelLighting))
+    set_shader_int("shader_type", p->renderstate.vertexOrPixelLighting);
+  if (CHANGED(shape))
+    set_shader_int("shape", p->shape);
+  if (shader_attribless && CHANGED(tessellation)) {
+    glUseProgram(shader_attribless);
+    glUniform2i(glGetUniformLocation(shader_attribless, "grid"), grid_size(p->tessellation), grid_size(p->tessellation));
+    glUseProgram(0);
+  }
+#undef CHANGED
+
+  applied = *p;
+  applied_valid = 1;
+}
+
+/* Surface error the adaptive mesh is allowed at each tessellation level,
+ * about what the uniform grid of that level has on the sphere */
+float adaptive_tolerance(int tess)
+{
+  return 10.0f / (float)(1 << (2 * tess));
+}
+
+/* The torus shader.vert draws: it takes u and v the other way round */
+vertex_t shader_torus(float u, float v, va_list* args)
+{
+  return parametricTorus(v, u, args);
+}
+
+/* How the current shape's CPU mesh closes up. The shaders' grids stay
+ * open: (u, v) interpolated across a shared seam vertex would run from 1
+ * back to 0, and the poles need a u for each quad */
+Topology shape_topology()
+{
+  if (shape_t == SPHERE_S)
+    return TOPOLOGY_SPHERE;
+  if (shape_t == TORUS_S)
+    return TOPOLOGY_TORUS;
+  return TOPOLOGY_OPEN;
+}
+
+/* Builds the mesh for the current shape and tessellation. parametric is
+ * for the shaders, which only need (u, v). Grids are cut into patches for
+ * cull_object, bounded by the surface the shaders will make of them */
+ObjectData* generate_mesh(int parametric)
+{
+  int size = grid_size(tessellation);
+  Topology topology = parametric ? TOPOLOGY_OPEN : shape_topology();
+  ObjectData* data;
+
+  /* NOTE: different equations require different arguments. see objects.h */
+  if (!parametric && renderstate.adaptive)
+    return createObjectDataAdaptive(shape_func, adaptive_tolerance(tessellation), max_tess, 1.0, 0.5, 0.4);
+  if (parametric)
+    data = createObjectDataShader(shape_func, size, size, 1.0, 0.5, 0.4);
+  else if (topology != TOPOLOGY_OPEN)
+    data = createObjectDataClosed(shape_func, size, size, topology, 1.0, 0.5, 0.4);
+  else
+    data = createObjectData(shape_func, size, size, 1.0, 0.5, 0.4);
+  createObjectPatches(data, size, size, topology, parametric && shape_t == TORUS_S ? shader_torus : shape_func,
+    1.0, 0.5, 0.4);
+  return data;
+}
+
+/* The --mesh file, with its load rate */
+ObjectData* load_mesh_file()
+{
+  ObjectData* data = meshLoad(mesh_file, MESH_RADIUS, &mesh_stats);
+
+  if (data)
+    printf("Mesh: %s, %.1f MB in %.1f ms (%.0f MB/s, %.1f M triangles/s): parse %.1f ms, weld %.1f ms, "
+      "%d triangles, %d of %d vertices kept%s\n", mesh_file, mesh_stats.bytes / 1048576.0, mesh_stats.seconds * 1e3,
+      mesh_stats.bytes / 1048576.0 / mesh_stats.seconds, mesh_stats.triangles * 1e-6 / mesh_stats.seconds,
+      mesh_stats.parseSeconds * 1e3, mesh_stats.weldSeconds * 1e3, mesh_stats.triangles, mesh_stats.vertices,
+      mesh_stats.corners, mesh_stats.computedNormals ? ", normals from faces" : "");
+  return data;
+}
+
+/* generate_mesh, through the mesh cache when there is one */
+ObjectData* load_mesh(int parametric)
+{
+  char key[MESH_KEY_SIZE], path[1024];
+  ObjectData* data;
+  double start = timerNow(), generated;
+
+  if (!mesh_cache_dir)
+    return generate_mesh(parametric);
+
+  /* Everything generate_mesh's result depends on */
+  if (parametric)
+    snprintf(key, sizeof key, "parametric shape %d %dx%d", shape_t, grid_size(tessellation), grid_size(tessellation));
+  else if (renderstate.adaptive)
+    snprintf(key, sizeof key, "adaptive shape %d tolerance %g depth %d args 1.0 0.5 0.4",
+      shape_t, adaptive_tolerance(tessellation), max_tess);
+  else
+    snprintf(key, sizeof key, "%s shape %d %dx%d args 1.0 0.5 0.4", shape_topology() != TOPOLOGY_OPEN ?
+      "closed" : "uniform", shape_t, grid_size(tessellation), grid_size(tessellation));
+  meshCachePath(path, sizeof path, mesh_cache_dir, key);
+
+  if ((data = meshCacheRead(path, key))) {
+    printf("Mesh cache: %s, %d vertices, loaded in %.1f ms\n", key, data->numVertices, (timerNow() - start) * 1e3);
+    return data;
+  }
+  data = generate_mesh(parametric);
+  generated = timerNow();
+  if (!meshCacheWrite(path, key, data, mesh_cache_lz4))
+    printf("Mesh cache: could not write %s\n", path);
+  printf("Mesh cache: %s, %d vertices, generated in %.1f ms, saved in %.1f ms\n", key, data->numVertices,
+    (generated - start) * 1e3, (timerNow() - generated) * 1e3);
+  return data;
+}
+
+/* Mesh for the fixed pipeline, core profile and CPU reference */
+ObjectData* create_mesh()
+{
+  ObjectData* data;
+
+  if (mesh_file)
+    return load_mesh_file();
+  data = load_mesh(0);
+
+  if (renderstate.adaptive) {
+    adaptive_triangles = countObjectTriangles(data);
+    adaptive_error = measureObjectError(data, shape_func, 1.0, 0.5, 0.4);
+  } else if (shape_topology() != TOPOLOGY_OPEN)
+    countGridTopology(shape_topology(), grid_size(tessellation), grid_size(tessellation), &topology_counts);
+  return data;
+}
+
+void regenerate_geometry()
+{
+  /* Drop previous geometry nobody has seen yet */
+  if (pending_geometry)
+    freeObjectData(pending_geometry);
+  pending_geometry = NULL;
+  memset(&topology_counts, 0, sizeof(topology_counts));
+
+  /* The shader builds the grid itself. Just redraw with the new size */
+  if (renderstate.shaders && renderstate.attribless && !renderstate.coreProfile && !mesh_file) {
+    postRedisplay();
+    return;
+  }
 
   fflush(stdout);
 
-  /* Generate the new object. NOTE: different equations require different arguments. see objects.h */
-  if (!renderstate.shaders)
-    object = createObject(shape_func, subdivs + 1, subdivs + 1, 1.0, 0.5, 0.4);
+  /* Generate the new object. Mesh files are read again, which times the
+   * load with the file cached */
+  if (!renderstate.shaders || renderstate.coreProfile || mesh_file)
+    pending_geometry = create_mesh();
   else
-    object = createObjectShader(shape_func, subdivs + 1, subdivs + 1, 1.0, 0.5, 0.4);
+    pending_geometry = load_mesh(1);
 
   fflush(stdout);
+  postRedisplay();
+}
+
+/* Copies the current scene state, without geometry */
+void snapshot(RenderPacket* p)
+{
+  p->camera_zoom = camera_zoom;
+  p->camera_heading = camera_heading;
+  p->camera_pitch = camera_pitch;
+  p->shapeRotation = shapeRotation;
+  p->renderstate = renderstate;
+  p->shape = shape_t;
+  p->bumps = bump_t;
+  memcpy(p->light0_position, light0_position, sizeof(p->light0_position));
+  memcpy(p->material_ambient, material_ambient, sizeof(p->material_ambient));
+  memcpy(p->material_diffuse, material_diffuse, sizeof(p->material_diffuse));
+  memcpy(p->material_specular, material_specular, sizeof(p->material_specular));
+  p->material_shininess = material_shininess;
+  p->numPointLights = num_point_lights;
+  p->pointLightTime = point_light_time;
+  p->geometry = NULL;
+  p->reference = NULL;
+  p->tessellation = tessellation;
+  p->adaptiveTriangles = adaptive_triangles;
+  p->adaptiveError = adaptive_error;
+  p->topology = topology_counts;
+  p->framerate = frameRate();
+  inputLatency(&p->inputLatency, &p->inputLatencyMax);
+  if (dynamic_resolution)
+    dynamicResolutionStats(dynamic_resolution, &p->resolution);
+  else
+    memset(&p->resolution, 0, sizeof(p->resolution));
+  if (capture)
+    captureStats(capture, &p->capture);
+  else
+    memset(&p->capture, 0, sizeof(p->capture));
+}
+
+void publish(void* packet)
+{
+  RenderPacket* p = (RenderPacket*)packet;
+  snapshot(p);
+  p->geometry = pending_geometry;
+  pending_geometry = NULL;
+  p->reference = pending_reference;
+  pending_reference = NULL;
+}
+
+void consume(const void* packet)
+{
+  const RenderPacket* p = (const RenderPacket*)packet;
+
+  /* Only the newest geometry is worth uploading */
+  if (p->geometry) {
+    if (upload_geometry)
+      freeObjectData(upload_geometry);
+    upload_geometry = p->geometry;
+  }
+  if (p->reference) {
+    if (upload_reference)
+      freeObjectData(upload_reference);
+    upload_reference = p->reference;
+  }
+  frame = *p;
+  frame.geometry = NULL;
+  frame.reference = NULL;
+}
+
+/* FNV-1a, to tell whether two runs drew the same picture */
+unsigned int checksum(const unsigned char* data, size_t size)
+{
+  unsigned int hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
 }
 
+/* One benchmark scene */
+typedef struct {
+  char name[48];
+  enum Shape shape;
+  int tessellation;
+  int mode; /* fixed, shader vertex lighting, shader pixel lighting */
+  enum Bump bumps;
+  int bumpMap; /* pixel lighting bumps from the baked map */
+  int attribless; /* the shader generates the grid, see drawGridAttribless */
+  double generate[PERF_TRIALS], upload[PERF_TRIALS], frame[PERF_TRIALS];
+} PerfConfig;
+
+/* Times one trial of a scene, or warms it up if trial < 0 */
+void perf_trial(PerfConfig* c, int trial)
+{
+  static const ParametricObjFunc shapes[] = {parametricSphere, parametricTorus, parametricGrid};
+  ObjectData* data;
+  int frames;
+  double start, generated;
+
+  shape_t = c->shape;
+  shape_func = shapes[c->shape];
+  tessellation = c->tessellation;
+  bump_t = c->bumps;
+  renderstate.bumpMap = c->bumpMap;
+  renderstate.shaders = c->mode > 0;
+  renderstate.vertexOrPixelLighting = c->mode == 2;
+  renderstate.attribless = c->attribless;
+
+  start = timerNow();
+  data = generate_mesh(renderstate.shaders);
+  generated = timerNow() - start;
+
+  start = timerNow();
+  if (object)
+    freeObject(object);
+  object = uploadObject(data);
+  glFinish();
+  if (trial >= 0) {
+    c->generate[trial] = generated;
+    c->upload[trial] = timerNow() - start;
+  }
+  freeObjectData(data);
+  object_generation++;
+
+  /* Enough frames that scheduler noise averages out */
+  snapshot(&frame);
+  start = timerNow();
+  frames = 0;
+  do {
+    display(NULL);
+    glFinish();
+    frames++;
+  } while (frames < PERF_FRAMES || timerNow() - start < PERF_MIN_TIME);
+  if (trial >= 0)
+    c->frame[trial] = (timerNow() - start) / frames;
+}
+
+void perf_write_samples(FILE* file, const char* name, const char* metric, const double* samples)
+{
+  int i;
+  fprintf(file, "%s %s", name, metric);
+  for (i = 0; i < PERF_TRIALS; ++i)
+    fprintf(file, " %.4f", samples[i] * 1e3);
+  fprintf(file, "\n");
+}
+
+/* Root mean square difference of two RGBA pictures, in 0-255 steps of RGB */
+double image_difference(const unsigned char* a, const unsigned char* b, int pixels)
+{
+  double sum = 0.0;
+  int i;
+  for (i = 0; i < pixels * 4; ++i)
+    if (i % 4 != 3)
+      sum += (double)(a[i] - b[i]) * (a[i] - b[i]);
+  return sqrt(sum / (pixels * 3));
+}
+
+/* Prints how coarse a grid each way of bumping gets away with: pixel lit
+ * normal bumps at each tessellation, per vertex and from the baked map,
+ * against the same on the finest grid. Displacement is left off so only
+ * the shading differs */
+void perf_bump_quality(unsigned char* pixels)
+{
+  static const char* shape_names[] = {"sphere", "torus", "grid"};
+  static const char* method_names[] = {"per vertex", "baked map"};
+  const double good = 4.0; /* difference that passes for the same picture */
+  unsigned char* reference[2];
+  PerfConfig c;
+  int shape, tess, baked;
+
+  reference[0] = (unsigned char*)malloc(PERF_SIZE * PERF_SIZE * 4);
+  reference[1] = (unsigned char*)malloc(PERF_SIZE * PERF_SIZE * 4);
+  printf("perf: pixel lit bumps against the same at tessellation %d (rms difference, frame ms)\n", max_tess);
+  printf("%-8s %5s %10s %20s %20s\n", "shape", "tess", "triangles", "per vertex", "baked map");
+  memset(&c, 0, sizeof(c));
+  c.mode = 2;
+  c.bumps = BUMP_NORMALS_ONLY;
+  for (shape = 0; shape < NUM_SHAPES; ++shape) {
+    int needed[2] = {0, 0};
+    double frame[2][16];
+
+    c.shape = shape;
+    c.tessellation = max_tess;
+    for (baked = 0; baked <= 1; ++baked) {
+      c.bumpMap = baked;
+      perf_trial(&c, -1);
+      glReadPixels(0, 0, PERF_SIZE, PERF_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, reference[baked]);
+    }
+
+    for (tess = min_tess; tess < max_tess; ++tess) {
+      double difference[2];
+      int quads = (grid_size(tess) - 1) * (grid_size(tess) - 1);
+      for (baked = 0; baked <= 1; ++baked) {
+        c.tessellation = tess;
+        c.bumpMap = baked;
+        perf_trial(&c, 0);
+        glReadPixels(0, 0, PERF_SIZE, PERF_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        difference[baked] = image_difference(pixels, reference[baked], PERF_SIZE * PERF_SIZE);
+        frame[baked][tess] = c.frame[0];
+        if (!needed[baked] && difference[baked] < good)
+          needed[baked] = tess;
+      }
+      printf("%-8s %5d %10d %12.2f %7.2f %12.2f %7.2f\n", shape_names[shape], tess, quads * 2,
+        difference[0], frame[0][tess] * 1e3, difference[1], frame[1][tess] * 1e3);
+    }
+    /* The map is filtered where per vertex bumps alias, so they never quite agree */
+    printf("%s: the two differ by %.2f at tessellation %d", shape_names[shape],
+      image_difference(reference[0], reference[1], PERF_SIZE * PERF_SIZE), max_tess);
+    for (baked = 0; baked <= 1; ++baked) {
+      if (needed[baked])
+        printf(", %s within %.0f from tessellation %d (%.2f ms)", method_names[baked], good,
+          needed[baked], frame[baked][needed[baked]] * 1e3);
+      else
+        printf(", %s not within %.0f below %d", method_names[baked], good, max_tess);
+    }
+    printf("\n");
+  }
+  free(reference[0]);
+  free(reference[1]);
+}
+
+/* Renders a fixed set of scenes into an offscreen framebuffer and writes
+ * raw timing samples and an image checksum for each to filename. The
+ * perfcheck tool compares them with a baseline, see "make perf-check".
+ * Trials go round robin over the scenes, so a machine that slows down
+ * part way through widens every scene's spread instead of shifting a few.
+ * The bump comparison of perf_bump_quality follows on stdout */
+int run_perf(const char* filename)
+{
+  static const char* shape_names[] = {"sphere", "torus", "grid"};
+  static const int levels[] = {2, 5, 8};
+  static const char* mode_names[] = {"fixed", "vertex", "pixel"};
+  /* fixed, vertex and pixel lighting with and without bumps, baked bumps,
+   * and displaced bumps without vertex data */
+  PerfConfig configs[NUM_SHAPES * 3 * 7];
+  GLuint framebuffer, renderbuffers[2];
+  unsigned char *pixels, *buffered;
+  FILE* file;
+  int numConfigs = 0, shape, level, mode, bumps, baked, attribless, trial, i;
+
+  file = fopen(filename, "w");
+  if (!file) {
+    printf("Error: could not write %s\n", filename);
+    return 0;
+  }
+  fprintf(file, "renderer %s\n", (const char*)glGetString(GL_RENDERER));
+
+  for (shape = 0; shape < NUM_SHAPES; ++shape)
+  for (level = 0; level < 3; ++level)
+  for (mode = 0; mode < 3; ++mode)
+  for (bumps = NO_BUMPS; bumps <= BUMP_DISPLACEMENT; bumps += BUMP_DISPLACEMENT)
+  for (baked = 0; baked <= 1; ++baked)
+  for (attribless = 0; attribless <= 1; ++attribless) {
+    PerfConfig* c = &configs[numConfigs];
+    /* Bumps only exist in the shaders, and only pixel lighting uses the map.
+     * The attribute-less scene follows the same scene drawn from buffers */
+    if ((mode == 0 && bumps) || (baked && (mode != 2 || !bumps)))
+      continue;
+    if (attribless && (!shader_attribless || mode != 2 || !bumps || baked))
+      continue;
+    c->shape = shape;
+    c->tessellation = levels[level];
+    c->mode = mode;
+    c->bumps = bumps;
+    c->bumpMap = baked;
+    c->attribless = attribless;
+    snprintf(c->name, sizeof c->name, "%s-t%d-%s-bumps%d%s%s", shape_names[shape], levels[level], mode_names[mode], bumps,
+      baked ? "-baked" : "", attribless ? "-attribless" : "");
+    numConfigs++;
+  }
+
+  /* Same size on every machine, whatever the window is */
+  glGenFramebuffers(1, &framebuffer);
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, PERF_SIZE, PERF_SIZE);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, PERF_SIZE, PERF_SIZE);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+  resourceAlloc(RES_TEXTURES, RES_GPU, PERF_SIZE * PERF_SIZE * 8);
+  reshape(PERF_SIZE, PERF_SIZE);
+  pixels = (unsigned char*)malloc(PERF_SIZE * PERF_SIZE * 4);
+  buffered = (unsigned char*)malloc(PERF_SIZE * PERF_SIZE * 4);
+  renderstate.stateOSDorConsole = 0;
+  renderstate.shadows = 0; /* the scenes are timed as they were before shadows */
+
+  /* Trial -1 warms up shaders and driver paths and isn't recorded */
+  for (trial = -1; trial < PERF_TRIALS; ++trial) {
+    printf("perf: trial %d of %d, %d scenes\n", trial + 2, PERF_TRIALS + 1, numConfigs);
+    fflush(stdout);
+    for (i = 0; i < numConfigs; ++i)
+      perf_trial(&configs[i], trial);
+  }
+
+  for (i = 0; i < numConfigs; ++i) {
+    PerfConfig* c = &configs[i];
+    perf_write_samples(file, c->name, "generate_ms", c->generate);
+    perf_write_samples(file, c->name, "upload_ms", c->upload);
+    perf_write_samples(file, c->name, "frame_ms", c->frame);
+
+    /* The picture, drawn once more on its own */
+    perf_trial(c, -1);
+    glReadPixels(0, 0, PERF_SIZE, PERF_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    fprintf(file, "%s image %08x\n", c->name, checksum(pixels, PERF_SIZE * PERF_SIZE * 4));
+
+    /* Generating the grid in the shader must not change the picture. The
+     * baseline then has the buffered scene's checksum for both */
+    if (!c->attribless)
+      memcpy(buffered, pixels, PERF_SIZE * PERF_SIZE * 4);
+    else if (memcmp(buffered, pixels, PERF_SIZE * PERF_SIZE * 4))
+      printf("perf: %s differs from the same scene drawn from buffers (rms difference %.2f)\n", c->name,
+        image_difference(buffered, pixels, PERF_SIZE * PERF_SIZE));
+  }
+  renderstate.attribless = 0;
+  perf_bump_quality(pixels);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(2, renderbuffers);
+  resourceFree(RES_TEXTURES, RES_GPU, PERF_SIZE * PERF_SIZE * 8);
+  free(pixels);
+  free(buffered);
+  fclose(file);
+  printf("perf: results in %s\n", filename);
+  return 1;
+}
+
+int option(int argc, char** argv, int i)
+{
+  if (!strcmp(argv[i], "--perf") && i + 1 < argc) {
+    perf_output = argv[i + 1];
+    return 2;
+  }
+  if (!strcmp(argv[i], "--mesh-cache") && i + 1 < argc) {
+    mesh_cache_dir = argv[i + 1];
+    return 2;
+  }
+  if (!strcmp(argv[i], "--mesh-cache-lz4")) {
+    mesh_cache_lz4 = 1;
+    return 1;
+  }
+  if (!strcmp(argv[i], "--mesh") && i + 1 < argc) {
+    mesh_file = argv[i + 1];
+    return 2;
+  }
+  if (!strcmp(argv[i], "--target-ms") && i + 1 < argc) {
+    target_ms = (float)atof(argv[i + 1]);
+    if (target_ms <= 0.0f)
+      target_ms = DEFAULT_TARGET_MS;
+    return 2;
+  }
+  if (!strcmp(argv[i], "--cpu-timed")) {
+    resolution_cpu_timed = 1;
+    return 1;
+  }
+  if ((!strcmp(argv[i], "--capture") || !strcmp(argv[i], "--capture-yuv")) && i + 1 < argc) {
+    capture_format = strcmp(argv[i], "--capture") ? CAPTURE_YUV : CAPTURE_PPM;
+    capture_path = argv[i + 1];
+    return 2;
+  }
+  if (!strcmp(argv[i], "--gpu-budget") && i + 1 < argc) {
+    resourceSetBudget(RES_GPU, (size_t)(atof(argv[i + 1]) * 1024 * 1024));
+    return 2;
+  }
+  return 0;
+}
+
+const char* option_usage =
+  "  --perf <file>        render the benchmark scenes offscreen, write timings to file and quit\n"
+  "  --mesh-cache <dir>   save generated meshes in dir and map them back instead of regenerating\n"
+  "  --mesh-cache-lz4     LZ4 compress the meshes saved\n"
+  "  --gpu-budget <MB>    refuse meshes and caches that would take GPU memory past MB\n"
+  "  --mesh <file>        draw an OBJ or binary PLY mesh instead of the shapes\n"
+  "  --target-ms <ms>     frame time dynamic resolution aims for, default 16.7\n"
+  "  --cpu-timed          time dynamic resolution frames on the CPU, not with timer queries\n"
+  "  --capture <dir>      write every frame, without the OSD, to dir as frame000000.ppm on\n"
+  "  --capture-yuv <file> write every frame to file as one raw yuv420p stream, for a video encoder\n";
+
 void init()
 {
   int argc = 0;
@@ -134,9 +904,58 @@ void init()
 #ifndef __APPLE__
   glewInit();
 #endif
+  /* Before anything the driver could complain about */
+  debug_supported = debugInit();
 
   /* Load the shader */
   shader = getShader("shader.vert", "shader.frag");
+  shader_attribless = getShaderDefines("shader.vert", "shader.frag", "#define ATTRIBLESS\n");
+  {
+    /* drawGridAttribless needs a divisor for its dummy attribute */
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (shader_attribless && !(extensions && strstr(extensions, "_instanced_arrays"))) {
+      freeShader(shader_attribless);
+      shader_attribless = 0;
+    }
+  }
+  {
+    const char* captured[] = {"capturedPosition", "capturedNormal"};
+    shader_capture = getShaderFeedback("shader.vert", NULL, "#define CAPTURE\n", captured, 2);
+    shader_cached = getShaderDefines("shader.vert", "shader.frag", "#define CACHED\n");
+  }
+  core_supported = coreInit();
+  clusters = clusterCreate();
+  {
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (extensions && strstr(extensions, "_timer_query")) {
+      glGenQueries(1, &draw_query);
+      glGenQueries(1, &shadow_query);
+    }
+  }
+  shadow_map = createShadowMap(SHADOW_SIZE);
+  if (!shadow_map)
+    printf("Shadow maps unavailable\n");
+  set_shader_int("shadow_map", SHADOW_UNIT);
+  dynamic_resolution = createDynamicResolution(target_ms * 1e-3f, resolution_cpu_timed);
+  parallelInit(0);
+
+  /* Bake the bumps and leave them bound on their own unit */
+  {
+    double start = timerNow();
+    BumpMap* baked = bakeBumpMap(BUMP_MAP_SIZE);
+    int i;
+    printf("Bump map: %dx%d, %d levels, baked in %.1f ms on %d threads\n",
+      baked->size, baked->size, baked->levels, (timerNow() - start) * 1e3, parallelThreads());
+    bump_texture = uploadBumpMap(baked);
+    for (i = 0; i < baked->levels; ++i)
+      bump_texture_bytes += (size_t)(baked->size >> i) * (baked->size >> i) * 4;
+    resourceAlloc(RES_TEXTURES, RES_GPU, bump_texture_bytes);
+    freeBumpMap(baked);
+    glActiveTexture(GL_TEXTURE0 + BUMP_UNIT);
+    glBindTexture(GL_TEXTURE_2D, bump_texture);
+    glActiveTexture(GL_TEXTURE0);
+    set_shader_int("bump_texture", BUMP_UNIT);
+  }
 
   /* Lighting and colours */
   glClearColor(0, 0, 0, 0);
@@ -168,11 +987,28 @@ void init()
   renderstate.stateOSDorConsole = 1;
   renderstate.animation = 0;
   renderstate.normals = 0;
+  renderstate.attribless = 0;
+  renderstate.geometryCache = 0;
+  renderstate.coreProfile = 0;
+  renderstate.clusteredLights = 0;
+  renderstate.bumpMap = 1;
+  renderstate.culling = 1;
+  renderstate.depthPrepass = 0;
+  renderstate.overdraw = 0;
+  renderstate.patchCulling = 1;
+  renderstate.shadows = 1;
+  renderstate.shadowCache = 1;
+  renderstate.dynamicResolution = 0;
   glGetBooleanv(GL_LIGHT_MODEL_LOCAL_VIEWER, &renderstate.viewer_model);
 
-  update_renderstate();
-
   regenerate_geometry();
+  debugFlush();
+
+  if (perf_output) {
+    run_perf(perf_output);
+    quit();
+  } else if (capture_path)
+    capture = createCapture(capture_path, capture_format);
 }
 
 void reshape(int width, int height)
@@ -184,6 +1020,12 @@ void reshape(int width, int height)
   glLoadIdentity();
   gluPerspective(60.0, width / (double) height, 0.1, 100.0);
   glMatrixMode(GL_MODELVIEW);
+
+  mat4Identity(&projection_matrix);
+  mat4Perspective(&projection_matrix, 60.0, width / (float) height, 0.1, 100.0);
+  clusterSetProjection(clusters, 60.0, width / (float) height, 0.1, 100.0);
+  viewport_width = window_width = width;
+  viewport_height = window_height = height;
 }
 
 /* Draws buffer on screen. */
@@ -196,69 +1038,250 @@ void drawString(char buffer[], int posX, int posY)
     glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *bufp);
 }
 
+/* Live bytes by subsystem, for the console */
+void print_memory()
+{
+  int kind;
+  printf("Memory: GPU %.1f MB (peak %.1f), host %.1f MB (peak %.1f)",
+    resourceBytes(RES_KINDS, RES_GPU) / MB, resourcePeak(RES_KINDS, RES_GPU) / MB,
+    resourceBytes(RES_KINDS, RES_HOST) / MB, resourcePeak(RES_KINDS, RES_HOST) / MB);
+  if (resourceBudget(RES_GPU))
+    printf(", GPU budget %.1f MB%s", resourceBudget(RES_GPU) / MB, object ? "" : ", mesh refused");
+  printf("\n");
+  for (kind = 0; kind < RES_KINDS; ++kind)
+    printf("  %s: %d GPU (%.2f MB), %d host (%.2f MB)\n", resourceName(kind),
+      resourceCount(kind, RES_GPU), resourceBytes(kind, RES_GPU) / MB,
+      resourceCount(kind, RES_HOST), resourceBytes(kind, RES_HOST) / MB);
+}
+
+/* The driver's messages so far, see gldebug.h */
+void print_debug_counts(char* buffer, size_t size)
+{
+  DebugCounts counts;
+  if (!debug_supported) {
+    snprintf(buffer, size, "GL Debug: unavailable");
+    return;
+  }
+  debugCounts(&counts);
+  snprintf(buffer, size, "GL Debug: %u errors, %u performance warnings, %u other",
+    counts.errors, counts.performance, counts.warnings);
+  if (counts.dropped)
+    snprintf(buffer + strlen(buffer), size - strlen(buffer), ", %u dropped", counts.dropped);
+}
+
+/* The scale dynamic resolution draws at and the frame time it measured */
+void print_resolution(char* buffer, size_t size, const RenderPacket* p)
+{
+  const ResolutionStats* r = &p->resolution;
+  if (!p->renderstate.dynamicResolution || !dynamic_resolution)
+    snprintf(buffer, size, "Dynamic Resolution (R): 0");
+  else if (r->incomplete)
+    snprintf(buffer, size, "Dynamic Resolution (R): unavailable");
+  else
+    snprintf(buffer, size, "Dynamic Resolution (R): scale %.2f, %dx%d, %s %.1f ms for %.1f",
+      r->scale, r->scaledWidth, r->scaledHeight, r->gpuTimed ? "GPU" : "frame",
+      r->frameTime * 1e3f, r->target * 1e3f);
+}
+
+/* Frames written and dropped by --capture, and how long they took */
+void print_capture(char* buffer, size_t size, const RenderPacket* p)
+{
+  const CaptureStats* stats = &p->capture;
+  snprintf(buffer, size, "Capture: %u written, %u dropped, latency %.1f ms (max %.1f), %.2f ms a frame",
+    stats->written, stats->dropped + stats->failed, stats->latency * 1e3f, stats->latencyMax * 1e3f, stats->cost * 1e3f);
+}
+
 /* Prints State Information */
-void printStateInfo(SDL_Surface *surface)
+void printStateInfo(SDL_Surface *surface, const RenderPacket* p)
 {
+  char buffer[96];
+
   /* if surface provided - draw on surface, else print on console */
   /* -> expects the surface to have correct projection setup for drawing bitmap. */
   if (surface) {
-    char buffer[64];
     int posX = 10;
     int posY = surface->h - 5;
     int lineDelta = 15;
     int lineNum = 1;
 
-    snprintf(buffer, sizeof buffer, "Shaders (s): %d", renderstate.shaders);
+    snprintf(buffer, sizeof buffer, "Shaders (s): %d", p->renderstate.shaders);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Attribute-less (i): %d", p->renderstate.attribless);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Geometry Cache (c): %d (%d captures)", p->renderstate.geometryCache, cache_captures);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Core Profile (k): %d", p->renderstate.coreProfile);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Clustered Lights (u): %d, %d lights (J/j)", p->renderstate.clusteredLights, p->numPointLights);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    if (p->renderstate.clusteredLights) {
+      snprintf(buffer, sizeof buffer, "Cluster Assign: %.2f ms, %.1f per cluster, %d dropped", cluster_time * 1e3f, cluster_occupancy, cluster_dropped);
+      drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    }
+    snprintf(buffer, sizeof buffer, "Submit: %.1f us, %.0f GL calls", submit_time * 1e6f, submit_gl_calls);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Memory: GPU %.1f MB (peak %.1f), host %.1f MB (peak %.1f)",
+      resourceBytes(RES_KINDS, RES_GPU) / MB, resourcePeak(RES_KINDS, RES_GPU) / MB,
+      resourceBytes(RES_KINDS, RES_HOST) / MB, resourcePeak(RES_KINDS, RES_HOST) / MB);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    if (resourceBudget(RES_GPU)) {
+      snprintf(buffer, sizeof buffer, "GPU Budget: %.1f MB%s", resourceBudget(RES_GPU) / MB,
+        object ? "" : ", mesh refused");
+      drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    }
+    print_debug_counts(buffer, sizeof buffer);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    print_resolution(buffer, sizeof buffer, p);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    if (capture) {
+      print_capture(buffer, sizeof buffer, p);
+      drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    }
+    snprintf(buffer, sizeof buffer, "FR: %d", p->framerate);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Lighting (l): %d", p->renderstate.lighting);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Light Position (d): %d", (int)p->light0_position[3]);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Shadows (D): %d, cache (C): %d, %d hits, %d misses", p->renderstate.shadows,
+      p->renderstate.shadowCache, shadow_map ? shadow_map->hits : 0, shadow_map ? shadow_map->misses : 0);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    if (shadow_gpu_samples[0] && shadow_gpu_samples[1]) {
+      snprintf(buffer, sizeof buffer, "Shadow Pass GPU: %.2f ms per frame cached, %.2f ms not",
+        shadow_gpu_time[1] * 1e3f, shadow_gpu_time[0] * 1e3f);
+      drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    }
+    snprintf(buffer, sizeof buffer, "Viewer Position (v): %d", p->renderstate.viewer_model);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Wireframe/Fill (w): %d", p->renderstate.wireframe);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Lighting Model (m): %d", p->renderstate.lightingModel);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "FR: %d", currentFramerate);
+    snprintf(buffer, sizeof buffer, "Vertex/Pixel Lighting (p): %d", p->renderstate.vertexOrPixelLighting);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Lighting (l): %d", renderstate.lighting);
+    snprintf(buffer, sizeof buffer, "Culling (q): %d, Depth Pre-pass (z): %d", p->renderstate.culling, p->renderstate.depthPrepass);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Light Position (d): %d", (int)light0_position[3]);
+    snprintf(buffer, sizeof buffer, "Overdraw (Z): %d", p->renderstate.overdraw);
+    if (p->renderstate.overdraw)
+      snprintf(buffer, sizeof buffer, "Overdraw (Z): 1, %.2f fragments per covered pixel", overdraw_average);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Viewer Position (v): %d", renderstate.viewer_model);
+    snprintf(buffer, sizeof buffer, "Patch Culling (y): %d", p->renderstate.patchCulling);
+    if (p->renderstate.patchCulling && patch_stats.patches)
+      snprintf(buffer, sizeof buffer, "Patch Culling (y): 1, %d%% of %d patches culled, %d draws, %.3f ms",
+        (patch_stats.backfacing + patch_stats.outside) * 100 / patch_stats.patches, patch_stats.patches,
+        patch_stats.draws, patch_cull_time * 1e3f);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Wireframe/Fill (w): %d", renderstate.wireframe);
+    if (draw_gpu_time[0] > 0.0f && draw_gpu_time[1] > 0.0f) {
+      snprintf(buffer, sizeof buffer, "Scene GPU: %.2f ms culled, %.2f ms not, %.2f ms saved",
+        draw_gpu_time[1] * 1e3f, draw_gpu_time[0] * 1e3f, (draw_gpu_time[0] - draw_gpu_time[1]) * 1e3f);
+      drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    }
+    snprintf(buffer, sizeof buffer, "Animation (a): %d", p->renderstate.animation);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Lighting Model (m): %d", renderstate.lightingModel);
+    snprintf(buffer, sizeof buffer, "Normals (n): %d", p->renderstate.normals);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Vertex/Pixel Lighting (p): %d", renderstate.vertexOrPixelLighting);
+    snprintf(buffer, sizeof buffer, "Shape (g): %d", p->shape);
+    if (mesh_file)
+      snprintf(buffer, sizeof buffer, "Mesh: %d triangles, %d vertices, loaded at %.0f MB/s",
+        mesh_stats.triangles, mesh_stats.vertices, mesh_stats.bytes / 1048576.0 / mesh_stats.seconds);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Animation (a): %d", renderstate.animation);
+    snprintf(buffer, sizeof buffer, "Bumps (b): %d, baked map (B): %d", p->bumps, p->renderstate.bumpMap);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Normals (n): %d", renderstate.normals);
+    snprintf(buffer, sizeof buffer, "Flat/Smooth Shading(f): %d", p->renderstate.flatOrSmooth);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Shape (g): %d", shape_t);
+    snprintf(buffer, sizeof buffer, "Tesselation(T/t): %d", p->tessellation);
+    if (p->topology.vertices)
+      snprintf(buffer, sizeof buffer, "Tesselation(T/t): %d, closed: %d fewer vertices, %d fewer triangles",
+        p->tessellation, p->topology.gridVertices - p->topology.vertices,
+        p->topology.stripTriangles - p->topology.triangles);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Bumps (b): %d", bump_t);
+    snprintf(buffer, sizeof buffer, "Adaptive (e): %d", p->renderstate.adaptive);
+    if (p->renderstate.adaptive)
+      snprintf(buffer, sizeof buffer, "Adaptive (e): 1, tolerance %.1e, %d tris, error %.1e",
+        adaptive_tolerance(p->tessellation), p->adaptiveTriangles, p->adaptiveError);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Flat/Smooth Shading(f): %d", renderstate.flatOrSmooth);
+    snprintf(buffer, sizeof buffer, "Shininess(H/h): %.0f", p->material_shininess);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Tesselation(T/t): %d", tessellation);
+    snprintf(buffer, sizeof buffer, "Render On Demand (r): %d", render_on_demand);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Shininess(H/h): %.0f", material_shininess);
+    snprintf(buffer, sizeof buffer, "Threaded: %d", threaded);
     drawString(buffer, posX, posY-(lineNum++ * lineDelta));
-    snprintf(buffer, sizeof buffer, "Switch between OSD and Console (o)");
+    snprintf(buffer, sizeof buffer, "Input Latency: %.1f ms (max %.1f)", p->inputLatency, p->inputLatencyMax);
+    drawString(buffer, posX, posY-(lineNum++ * lineDelta));
+    snprintf(buffer, sizeof buffer, "Switch between OSD and Console (o), CPU reference (x)");
     drawString(buffer, 10, 10);
   }
   else
   {
-    printf("Shaders (s): %d\n", renderstate.shaders);
-    printf("FR: %d\n", currentFramerate);
-    printf("Lighting (l): %d\n", renderstate.lighting);
-    printf("Light Position (d): %d\n", (int)light0_position[3]);
-    printf("Viewer Position (v): %d\n", renderstate.viewer_model);
-    printf("Wireframe/Fill (w): %d\n", renderstate.wireframe);
-    printf("Lighting Model (m): %d\n", renderstate.lightingModel);
-    printf("Vertex/Pixel Lighting (p): %d\n", renderstate.vertexOrPixelLighting);
-    printf("Animation (a): %d\n", renderstate.animation);
-    printf("Normals (n): %d\n", renderstate.normals);
-    printf("Shape (g): %d\n", shape_t);
-    printf("Bumps (b): %d\n", bump_t);
-    printf("Flat/Smooth Shading(f): %d\n", renderstate.flatOrSmooth);
-    printf("Tesselation(T/t): %d\n", tessellation);
-    printf("Shininess(H/h): %.0f\n", material_shininess);
-    printf("Switch between OSD and Console (o)\n");
+    printf("Shaders (s): %d\n", p->renderstate.shaders);
+    printf("Attribute-less (i): %d\n", p->renderstate.attribless);
+    printf("Geometry Cache (c): %d\n", p->renderstate.geometryCache);
+    printf("Core Profile (k): %d\n", p->renderstate.coreProfile);
+    printf("Clustered Lights (u): %d, %d lights (J/j)\n", p->renderstate.clusteredLights, p->numPointLights);
+    if (p->renderstate.clusteredLights)
+      printf("Cluster Assign: %.2f ms, %.1f per cluster, %d dropped\n", cluster_time * 1e3f, cluster_occupancy, cluster_dropped);
+    printf("Submit: %.1f us, %.0f GL calls\n", submit_time * 1e6f, submit_gl_calls);
+    print_memory();
+    print_debug_counts(buffer, sizeof buffer);
+    printf("%s\n", buffer);
+    print_resolution(buffer, sizeof buffer, p);
+    printf("%s\n", buffer);
+    if (capture) {
+      print_capture(buffer, sizeof buffer, p);
+      printf("%s\n", buffer);
+    }
+    printf("FR: %d\n", p->framerate);
+    printf("Lighting (l): %d\n", p->renderstate.lighting);
+    printf("Light Position (d): %d\n", (int)p->light0_position[3]);
+    printf("Shadows (D): %d, cache (C): %d, %d hits, %d misses\n", p->renderstate.shadows,
+      p->renderstate.shadowCache, shadow_map ? shadow_map->hits : 0, shadow_map ? shadow_map->misses : 0);
+    if (shadow_gpu_samples[0] && shadow_gpu_samples[1])
+      printf("Shadow Pass GPU: %.2f ms per frame cached, %.2f ms not\n", shadow_gpu_time[1] * 1e3f, shadow_gpu_time[0] * 1e3f);
+    printf("Viewer Position (v): %d\n", p->renderstate.viewer_model);
+    printf("Wireframe/Fill (w): %d\n", p->renderstate.wireframe);
+    printf("Lighting Model (m): %d\n", p->renderstate.lightingModel);
+    printf("Vertex/Pixel Lighting (p): %d\n", p->renderstate.vertexOrPixelLighting);
+    printf("Culling (q): %d, Depth Pre-pass (z): %d\n", p->renderstate.culling, p->renderstate.depthPrepass);
+    if (p->renderstate.overdraw)
+      printf("Overdraw (Z): 1, %.2f fragments per covered pixel\n", overdraw_average);
+    else
+      printf("Overdraw (Z): 0\n");
+    if (p->renderstate.patchCulling && patch_stats.patches)
+      printf("Patch Culling (y): 1, %d of %d patches culled (%d back-facing, %d outside), %d draws, %.3f ms\n",
+        patch_stats.backfacing + patch_stats.outside, patch_stats.patches, patch_stats.backfacing,
+        patch_stats.outside, patch_stats.draws, patch_cull_time * 1e3f);
+    else
+      printf("Patch Culling (y): %d\n", p->renderstate.patchCulling);
+    if (draw_gpu_time[0] > 0.0f && draw_gpu_time[1] > 0.0f)
+      printf("Scene GPU: %.2f ms culled, %.2f ms not, %.2f ms saved\n",
+        draw_gpu_time[1] * 1e3f, draw_gpu_time[0] * 1e3f, (draw_gpu_time[0] - draw_gpu_time[1]) * 1e3f);
+    printf("Animation (a): %d\n", p->renderstate.animation);
+    printf("Normals (n): %d\n", p->renderstate.normals);
+    if (mesh_file)
+      printf("Mesh: %d triangles, %d vertices, loaded at %.0f MB/s\n",
+        mesh_stats.triangles, mesh_stats.vertices, mesh_stats.bytes / 1048576.0 / mesh_stats.seconds);
+    else
+      printf("Shape (g): %d\n", p->shape);
+    printf("Bumps (b): %d, baked map (B): %d\n", p->bumps, p->renderstate.bumpMap);
+    printf("Flat/Smooth Shading(f): %d\n", p->renderstate.flatOrSmooth);
+    if (p->topology.vertices)
+      printf("Tesselation(T/t): %d, closed: %d of %d vertices shared (%d seam, %d pole), "
+        "%d of %d triangles dropped (%d pole, %d strip joins)\n", p->tessellation,
+        p->topology.gridVertices - p->topology.vertices, p->topology.gridVertices, p->topology.seamVertices,
+        p->topology.poleVertices, p->topology.stripTriangles - p->topology.triangles, p->topology.stripTriangles,
+        p->topology.poleTriangles, p->topology.joinTriangles);
+    else
+      printf("Tesselation(T/t): %d\n", p->tessellation);
+    if (p->renderstate.adaptive)
+      printf("Adaptive (e): 1, tolerance %.1e, %d triangles, max error %.1e\n",
+        adaptive_tolerance(p->tessellation), p->adaptiveTriangles, p->adaptiveError);
+    else
+      printf("Adaptive (e): 0\n");
+    printf("Shininess(H/h): %.0f\n", p->material_shininess);
+    printf("Render On Demand (r): %d\n", render_on_demand);
+    printf("Threaded: %d\n", threaded);
+    printf("Input Latency: %.1f ms (max %.1f)\n", p->inputLatency, p->inputLatencyMax);
+    printf("Switch between OSD and Console (o), CPU reference (x)\n");
   }
 }
 
@@ -279,7 +1302,7 @@ void drawOSD(SDL_Surface *surface)
   glLoadIdentity();
 
   /* Draw state info. */
-  printStateInfo(surface);
+  printStateInfo(surface, &frame);
 
   glPopMatrix();	/* Pop modelview */
   glMatrixMode(GL_PROJECTION);
@@ -290,38 +1313,531 @@ void drawOSD(SDL_Surface *surface)
   glPopAttrib();
 }
 
-void display(SDL_Surface *surface)
+/* Whether light 0 is shadowed this frame. Shadows are looked up in the
+ * shaders, so the fixed pipeline has none */
+int shadows_enabled()
 {
-  /* Clear the colour and depth buffer */
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  return shadow_map && frame.renderstate.shadows && frame.renderstate.lighting &&
+    (frame.renderstate.shaders || frame.renderstate.coreProfile);
+}
+
+/* Radius around the origin the shape stays within, bumps included */
+float shape_radius(enum Shape shape, enum Bump bumps)
+{
+  static const float radius[NUM_SHAPES] = {1.0f, 1.5f, 1.4143f};
+  return (mesh_file ? MESH_RADIUS : radius[shape]) + (bumps == BUMP_DISPLACEMENT ? BUMP_HEIGHT : 0.0f);
+}
+
+/* Draws the object once for each pass the render state asks for: depth
+ * only first if the pre-pass is on, then shaded, or counted for the
+ * overdraw view, where the depth is equal. The shaded pass then runs the
+ * fragment shader once per pixel whatever the overlap */
+void draw_passes(void (*draw)(enum RenderPass pass))
+{
+  if (frame.renderstate.depthPrepass) {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    draw(PASS_DEPTH);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    draw_gl_calls += 4;
+  }
+  if (frame.renderstate.overdraw) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    draw(PASS_COUNT);
+    glDisable(GL_BLEND);
+    draw_gl_calls += 3;
+  } else {
+    draw(PASS_SHADE);
+  }
+  if (frame.renderstate.depthPrepass) {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    draw_gl_calls += 2;
+  }
+}
+
+/* The object with whichever of our programs the render state picks, or
+ * the fixed pipeline */
+void draw_object_legacy(enum RenderPass pass)
+{
+  GLuint program = 0;
+
+  if (frame.renderstate.shaders && frame.renderstate.attribless && !mesh_file) {
+    program = shader_attribless;
+  } else if (!object) {
+    return; /* refused by the GPU budget */
+  } else if (mesh_file) {
+    /* Positions and normals are already there, as the cached variant takes them */
+    if (frame.renderstate.shaders)
+      program = shader_cached;
+  } else if (frame.renderstate.shaders && frame.renderstate.geometryCache && shader_cached && shader_capture) {
+    /* Re-capture only when the geometry inputs change. Without room for
+     * the cache, the geometry is worked out every frame as without it */
+    program = shader_cached;
+    if (cache_generation != object_generation || cache_shape != frame.shape || cache_bumps != frame.bumps) {
+      glUseProgram(shader_capture);
+      if (captureObjectShader(object)) {
+        cache_generation = object_generation;
+        cache_shape = frame.shape;
+        cache_bumps = frame.bumps;
+        cache_captures++;
+      } else {
+        program = shader;
+      }
+    }
+  } else if (frame.renderstate.shaders) {
+    program = shader;
+  }
 
+  if (program) {
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "render_pass"), pass);
+    glUniform1i(glGetUniformLocation(program, "shadows"), shadows_bound);
+    if (shadows_bound)
+      glUniformMatrix4fv(glGetUniformLocation(program, "shadow_matrix"), 1, GL_FALSE, shadow_map->matrix.m);
+    draw_gl_calls += shadows_bound ? 7 : 5;
+    if (program == shader_attribless)
+      drawGridAttribless(grid_size(frame.tessellation), grid_size(frame.tessellation));
+    else if (mesh_file)
+      drawObject(object);
+    else if (program == shader_cached)
+      drawObjectCached(object);
+    else
+      drawObjectShader(object);
+  } else if (pass == PASS_COUNT) {
+    /* Unlit, so every fragment is the same 1/255 */
+    glDisable(GL_LIGHTING);
+    glColor4f(1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f);
+    drawObject(object);
+    if (frame.renderstate.lighting)
+      glEnable(GL_LIGHTING);
+    draw_gl_calls += 3;
+  } else {
+    drawObject(object);
+  }
+}
+
+/* Draws the scene with the fixed pipeline matrix stack and light state */
+void draw_scene_legacy()
+{
   /* Camera transformation */
   glLoadIdentity();
-  glTranslatef(0, 0, -camera_zoom);
-  glRotatef(-camera_pitch, 1, 0, 0);
-  glRotatef(-camera_heading, 0, 1, 0);
+  glTranslatef(0, 0, -frame.camera_zoom);
+  glRotatef(-frame.camera_pitch, 1, 0, 0);
+  glRotatef(-frame.camera_heading, 0, 1, 0);
 
   /* Set the light position (gets multiplied by the modelview matrix) */
-  glLightfv(GL_LIGHT0, GL_POSITION, light0_position);
+  glLightfv(GL_LIGHT0, GL_POSITION, frame.light0_position);
 
   /* Draw the scene */
   /* Apply shape rotation and draw shape */
-  glRotatef(shapeRotation, 0.0f, 1.0f, 0.0f);
-  if (renderstate.shaders) {
-    glUseProgram(shader); /* Use our shader for future rendering */
-    drawObjectShader(object);
-  } else {
-    drawObject(object);
-    if (renderstate.normals)
-      drawObjectNormals(object);
+  glRotatef(frame.shapeRotation, 0.0f, 1.0f, 0.0f);
+  if (shadows_enabled() && frame.renderstate.shaders) {
+    glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D, shadow_map->texture);
+    glActiveTexture(GL_TEXTURE0);
+    shadows_bound = 1;
+    draw_gl_calls += 3;
+  }
+  draw_passes(draw_object_legacy);
+  if (shadows_bound) {
+    /* Unbound before the map is next rendered into */
+    glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    shadows_bound = 0;
+    draw_gl_calls += 3;
   }
+  if (!frame.renderstate.shaders && frame.renderstate.normals && !frame.renderstate.overdraw && object)
+    drawObjectNormals(object);
 
   glUseProgram(0);
+  draw_gl_calls += 7; /* matrices, light and program */
+}
+
+/* Animates the point lights, sorts them into clusters and uploads both */
+void update_clusters(const mat4_t* view)
+{
+  double start = timerNow();
+  int i, occupied = 0;
+
+  animateLights(point_lights, frame.numPointLights, frame.pointLightTime);
+  transformLights(view_point_lights, point_lights, frame.numPointLights, view);
+  clusterAssign(clusters, view_point_lights, frame.numPointLights);
+  cluster_time = cluster_time * 0.95f + (float)(timerNow() - start) * 0.05f;
+
+  for (i = 0; i < CLUSTER_COUNT; ++i)
+    occupied += clusters->ranges[i * 2 + 1] > 0;
+  cluster_occupancy = occupied ? clusters->numIndices / (float)occupied : 0.0f;
+  cluster_dropped = clusters->droppedLights;
+
+  coreSetClusters(clusters, view_point_lights, frame.numPointLights, viewport_width, viewport_height);
+}
+
+/* Camera and object matrices, as draw_scene_legacy builds on the matrix
+ * stack, and light and material as the fixed pipeline has them */
+void scene_setup(mat4_t* view, mat4_t* modelView, CoreLighting* lighting)
+{
+  mat4Identity(view);
+  mat4Translate(view, 0, 0, -frame.camera_zoom);
+  mat4Rotate(view, -frame.camera_pitch, 1, 0, 0);
+  mat4Rotate(view, -frame.camera_heading, 0, 1, 0);
+  *modelView = *view;
+  mat4Rotate(modelView, frame.shapeRotation, 0.0f, 1.0f, 0.0f);
+
+  /* Light position in eye space, as glLightfv would store it */
+  coreDefaultLighting(lighting);
+  mat4TransformVec4(lighting->lightPosition, view, frame.light0_position);
+  memcpy(lighting->materialAmbient, frame.material_ambient, sizeof(lighting->materialAmbient));
+  memcpy(lighting->materialDiffuse, frame.material_diffuse, sizeof(lighting->materialDiffuse));
+  memcpy(lighting->materialSpecular, frame.material_specular, sizeof(lighting->materialSpecular));
+  lighting->materialShininess = frame.material_shininess;
+  lighting->lightingModel = frame.renderstate.lightingModel;
+  lighting->shaderType = frame.renderstate.vertexOrPixelLighting;
+  lighting->viewer = frame.renderstate.viewer_model;
+  lighting->normalView = frame.renderstate.normals;
+  lighting->lighting = frame.renderstate.lighting;
+}
+
+void draw_object_core(enum RenderPass pass)
+{
+  coreSetRenderPass(pass);
+  if (object)
+    coreDrawObject(object);
+}
+
+/* Draws the scene with the core profile backend. Matrices and light are
+ * computed here instead of on the matrix stack */
+void draw_scene_core()
+{
+  mat4_t view, modelView;
+  CoreLighting lighting;
+
+  scene_setup(&view, &modelView, &lighting);
+
+  if (frame.renderstate.clusteredLights)
+    update_clusters(&view);
+
+  if (shadows_enabled())
+    coreSetShadow(&shadow_map->matrix, shadow_map->texture);
+  else
+    coreSetShadow(NULL, 0);
+  coreBeginFrame(&projection_matrix, &modelView, &lighting, frame.renderstate.flatOrSmooth, frame.renderstate.clusteredLights);
+  draw_passes(draw_object_core);
+  coreEndFrame();
+}
+
+/* Adds a frame's shadow pass time to the average for the cache on or off */
+void add_shadow_time(int cached, float seconds)
+{
+  float* average = &shadow_gpu_time[cached];
+  *average = shadow_gpu_samples[cached]++ ? *average * 0.95f + seconds * 0.05f : seconds;
+}
+
+void read_shadow_query()
+{
+  GLuint available, nanoseconds;
+
+  if (shadow_query_cached < 0)
+    return;
+  glGetQueryObjectuiv(shadow_query, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return;
+  glGetQueryObjectuiv(shadow_query, GL_QUERY_RESULT, &nanoseconds);
+  add_shadow_time(shadow_query_cached, nanoseconds * 1e-9f);
+  shadow_query_cached = -1;
+}
+
+/* Renders light 0's shadow map again if the light, the object's rotation
+ * or its geometry changed since the last time, or every frame with the
+ * cache off. The pass is timed on the GPU when no other is in flight.
+ * Patch culling is for the camera, so the pass draws the whole object */
+void update_shadow_map()
+{
+  ShadowKey key;
+  mat4_t lightModelView;
+  int cached = frame.renderstate.shadowCache, timed;
+
+  memset(&key, 0, sizeof(key));
+  memcpy(key.light, frame.light0_position, sizeof(key.light));
+  mat4Identity(&key.model);
+  mat4Rotate(&key.model, frame.shapeRotation, 0.0f, 1.0f, 0.0f);
+  key.generation = object_generation;
+  key.tessellation = frame.tessellation;
+  key.shape = frame.shape;
+  key.bumps = frame.bumps;
+  /* GL_CULL_FACE applies to the depth pass too, see update_renderstate */
+  key.culling = frame.renderstate.culling && frame.shape != GRID_S;
+  /* The backends displace differently, the attribute-less grid has no object */
+  key.variant = frame.renderstate.coreProfile ? 2 : frame.renderstate.attribless;
+
+  if (shadow_query)
+    read_shadow_query();
+  shadow_map->cache = cached;
+  if (!shadowMapBegin(shadow_map, &key, shape_radius(frame.shape, frame.bumps))) {
+    add_shadow_time(1, 0.0f);
+    return;
+  }
+  timed = shadow_query && shadow_query_cached < 0;
+  if (timed)
+    glBeginQuery(GL_TIME_ELAPSED_EXT, shadow_query);
+
+  if (object)
+    resetObjectPatches(object);
+  mat4Multiply(&lightModelView, &shadow_map->view, &key.model);
+  if (frame.renderstate.coreProfile) {
+    CoreLighting lighting;
+    coreDefaultLighting(&lighting);
+    coreSetShadow(NULL, 0);
+    coreBeginFrame(&shadow_map->projection, &lightModelView, &lighting, 0, 0);
+    draw_object_core(PASS_DEPTH);
+    coreEndFrame();
+  } else {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadMatrixf(shadow_map->projection.m);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(lightModelView.m);
+    draw_object_legacy(PASS_DEPTH);
+    glUseProgram(0);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    draw_gl_calls += 9;
+  }
+
+  if (timed) {
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    shadow_query_cached = cached;
+  }
+  shadowMapEnd(shadow_map);
+}
+
+/* Leaves the object drawing only the patches that can be seen, see
+ * patches.h. Back-facing patches go only where GL would cull them, and
+ * displaced surfaces get their bounds grown by the most they move */
+void cull_object()
+{
+  mat4_t view, modelView;
+  CoreLighting lighting;
+  int legacyShaders = frame.renderstate.shaders && !frame.renderstate.coreProfile;
+  int displaced = legacyShaders && frame.bumps == BUMP_DISPLACEMENT;
+  double start;
+
+  if (!frame.renderstate.patchCulling || (legacyShaders && frame.renderstate.attribless)) {
+    resetObjectPatches(object);
+    memset(&patch_stats, 0, sizeof(patch_stats));
+    return;
+  }
+
+  scene_setup(&view, &modelView, &lighting);
+  start = timerNow();
+  cullObjectPatches(object, &projection_matrix, &modelView, displaced ? BUMP_HEIGHT : 0.0f,
+    frame.renderstate.culling && frame.shape != GRID_S && !displaced, &patch_stats);
+  patch_cull_time = patch_cull_time * 0.95f + (float)(timerNow() - start) * 0.05f;
+}
+
+/* Adds the last timed frame's GPU time to the average for whether it was
+ * culled, once GL has it. The averages start again with each object */
+void read_draw_query()
+{
+  GLuint available, nanoseconds;
+  float* average;
+
+  if (draw_query_culled < 0)
+    return;
+  glGetQueryObjectuiv(draw_query, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return;
+  glGetQueryObjectuiv(draw_query, GL_QUERY_RESULT, &nanoseconds);
+  if (draw_query_generation != draw_gpu_generation) {
+    draw_gpu_time[0] = draw_gpu_time[1] = 0.0f;
+    draw_gpu_generation = draw_query_generation;
+  }
+  average = &draw_gpu_time[draw_query_culled];
+  *average = *average > 0.0f ? *average * 0.9f + nanoseconds * 1e-9f * 0.1f : nanoseconds * 1e-9f;
+  draw_query_culled = -1;
+}
+
+/* Overdraw view: the scene left its fragment count per pixel in the
+ * colour buffer. Replaces it with a heatmap and measures the average */
+void draw_overdraw()
+{
+  /* black for none, then blue, cyan, green, yellow, orange, red, magenta, white for 8 or more */
+  static const unsigned char heat[][3] = {
+    {0, 0, 0}, {0, 0, 192}, {0, 160, 255}, {0, 208, 0}, {255, 255, 0},
+    {255, 144, 0}, {255, 0, 0}, {255, 0, 255}, {255, 255, 255}};
+  const int levels = sizeof(heat) / sizeof(heat[0]);
+  int pixels = viewport_width * viewport_height, covered = 0, i;
+  unsigned char* counts = (unsigned char*)malloc(pixels);
+  unsigned char* colors = (unsigned char*)malloc(pixels * 3);
+  long total = 0;
+
+  resourceAlloc(RES_OSD, RES_HOST, pixels * 4);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, viewport_width, viewport_height, GL_RED, GL_UNSIGNED_BYTE, counts);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  for (i = 0; i < pixels; ++i) {
+    total += counts[i];
+    covered += counts[i] > 0;
+    memcpy(colors + i * 3, heat[min(counts[i], levels - 1)], 3);
+  }
+  overdraw_average = covered ? total / (float)covered : 0.0f;
+
+  glPushAttrib(GL_ENABLE_BIT);
+  glDisable(GL_DEPTH_TEST);
+  glWindowPos2i(0, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glDrawPixels(viewport_width, viewport_height, GL_RGB, GL_UNSIGNED_BYTE, colors);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPopAttrib();
+  draw_gl_calls += 10;
+
+  free(counts);
+  free(colors);
+  resourceFree(RES_OSD, RES_HOST, pixels * 4);
+}
+
+/* Saves what GL just drew and the CPU rasterizer's version of the same
+ * frame, and reports how far apart they are */
+void write_reference(ObjectData* data)
+{
+  mat4_t view, modelView;
+  CoreLighting lighting;
+  SoftTarget* gl = softCreateTarget(viewport_width, viewport_height);
+  SoftTarget* cpu = softCreateTarget(viewport_width, viewport_height);
+  float clear[4] = {0, 0, 0, 0};
+  float mean;
+  int maxDiff;
+  double start;
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glPixelStorei(GL_PACK_ROW_LENGTH, gl->stride);
+  glReadPixels(0, 0, viewport_width, viewport_height, GL_RGB, GL_UNSIGNED_BYTE, gl->color);
+  glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+  scene_setup(&view, &modelView, &lighting);
+  start = timerNow();
+  softClear(cpu, clear);
+  softDrawObject(cpu, data, &projection_matrix, &modelView, &lighting, frame.renderstate.flatOrSmooth);
+  printf("CPU reference: %.1f ms on %d threads\n", (timerNow() - start) * 1e3, parallelThreads());
+
+  mean = softCompare(gl, cpu, &maxDiff);
+  printf("GL vs CPU: mean difference %.3f, max %d\n", mean, maxDiff);
+  if (frame.renderstate.shaders && frame.bumps)
+    printf("(the CPU reference has no bumps)\n");
+  softWritePPM(gl, "reference-gl.ppm");
+  softWritePPM(cpu, "reference-cpu.ppm");
+
+  softFreeTarget(gl);
+  softFreeTarget(cpu);
+}
+
+void display(SDL_Surface *surface)
+{
+  int scaled = 0;
+
+  /* Replace the object if new geometry arrived */
+  if (upload_geometry) {
+    if (object)
+      freeObject(object);
+    object = uploadObject(upload_geometry);
+    freeObjectData(upload_geometry);
+    upload_geometry = NULL;
+    object_generation++;
+  }
+  apply_packet_state(&frame);
+
+  /* The scene goes offscreen at a scale that holds the frame time, and
+   * is stretched over the window before the OSD */
+  if (frame.renderstate.dynamicResolution)
+    scaled = dynamicResolutionBegin(dynamic_resolution, window_width, window_height);
+  else
+    dynamicResolutionRelease(dynamic_resolution);
+  if (scaled) {
+    viewport_width = dynamic_resolution->scaledWidth;
+    viewport_height = dynamic_resolution->scaledHeight;
+  }
+
+  /* Clear the colour and depth buffer */
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  if (shadows_enabled()) {
+    debugScopePush("shadow");
+    update_shadow_map();
+    debugScopePop();
+  }
+  if (object)
+    cull_object();
+
+  /* Draw the scene, timing how long the CPU takes to submit it, and on
+   * the GPU, one frame in flight at a time */
+  {
+    double start = timerNow();
+    int calls = draw_gl_calls, timed;
+
+    if (draw_query)
+      read_draw_query();
+    timed = draw_query && draw_query_culled < 0 && object;
+    if (timed)
+      glBeginQuery(GL_TIME_ELAPSED_EXT, draw_query);
+
+    debugScopePush("scene");
+    if (frame.renderstate.coreProfile)
+      draw_scene_core();
+    else
+      draw_scene_legacy();
+    debugScopePop();
+
+    if (timed) {
+      glEndQuery(GL_TIME_ELAPSED_EXT);
+      draw_query_culled = object->numDraws >= 0;
+      draw_query_generation = object_generation;
+    }
+
+    submit_time = submit_time * 0.95f + (float)(timerNow() - start) * 0.05f;
+    submit_gl_calls = submit_gl_calls * 0.95f + (draw_gl_calls - calls) * 0.05f;
+  }
+
+  if (frame.renderstate.overdraw) {
+    debugScopePush("overdraw");
+    draw_overdraw();
+    debugScopePop();
+  }
+
+  /* Before the OSD goes on top */
+  if (upload_reference) {
+    write_reference(upload_reference);
+    freeObjectData(upload_reference);
+    upload_reference = NULL;
+  }
+
+  if (scaled) {
+    dynamicResolutionEnd(dynamic_resolution);
+    viewport_width = window_width;
+    viewport_height = window_height;
+  }
+
+  /* The scene at the window's size, without the OSD */
+  if (capture) {
+    debugScopePush("capture");
+    captureFrame(capture, window_width, window_height);
+    debugScopePop();
+  }
 
   /* Draw OSD */
-  if (renderstate.stateOSDorConsole)
+  if (frame.renderstate.stateOSDorConsole) {
+    debugScopePush("OSD");
     drawOSD(surface);
+    debugScopePop();
+  }
 
+  /* Whatever the driver reported since the last frame. Polling is only
+   * built in with GL_ERROR_CHECKS, see shaders.h */
+  debugFlush();
   CHECK_GL_ERROR;
 }
 
@@ -333,6 +1849,7 @@ void animate(float dt)
   shapeRotation += dt * speed;
   if (shapeRotation > 360.0f)
     shapeRotation -= 360.0f;
+  point_light_time += dt;
 }
 
 
@@ -351,13 +1868,18 @@ void update(float dt)
     fpsFrames = 0;
 
     /* if console info turned on - update every one second */
-    if (!renderstate.stateOSDorConsole)
-      printStateInfo(0);
+    if (!renderstate.stateOSDorConsole) {
+      RenderPacket state;
+      snapshot(&state);
+      printStateInfo(0, &state);
+    }
   }
 
   /* if animation turned on - change shape rotation */
-  if (renderstate.animation)
+  if (renderstate.animation) {
     animate(dt);
+    postRedisplay();
+  }
 }
 
 void set_mousestate(unsigned char button, int state)
@@ -379,6 +1901,7 @@ void event(SDL_Event *event)
   switch (event->type) {
     case SDL_KEYDOWN:
       key_state[event->key.keysym.sym] = 1;
+      postRedisplay();
 
       /* Handle non-state keys */
       switch (event->key.keysym.sym) {
@@ -390,37 +1913,92 @@ void event(SDL_Event *event)
           break;
         case SDLK_f:
           renderstate.flatOrSmooth = !renderstate.flatOrSmooth;
-          update_renderstate();
           break;
         case SDLK_o:
           renderstate.stateOSDorConsole = !renderstate.stateOSDorConsole;
           break;
+        case SDLK_r:
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            renderstate.dynamicResolution = !renderstate.dynamicResolution; // scale the scene to hold --target-ms
+          else
+            render_on_demand = !render_on_demand;
+          break;
         case SDLK_s:
           renderstate.shaders = !renderstate.shaders;
+          if (tessellation > max_tess)
+            tessellation = max_tess;
+          regenerate_geometry();
+          break;
+        case SDLK_c:
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            renderstate.shadowCache = !renderstate.shadowCache; // reuse the shadow map while it holds
+          else
+            renderstate.geometryCache = !renderstate.geometryCache; // cache shader generated geometry with transform feedback
+          break;
+        case SDLK_k:
+          // switch between the legacy and core profile backends
+          if (!core_supported) {
+            printf("Core profile backend unavailable\n");
+            break;
+          }
+          renderstate.coreProfile = !renderstate.coreProfile;
+          renderstate.clusteredLights = 0;
+          regenerate_geometry();
+          break;
+        case SDLK_u:
+          // clustered point lights, only in the core profile backend
+          if (!core_supported) {
+            printf("Clustered lighting needs the core profile backend\n");
+            break;
+          }
+          renderstate.clusteredLights = !renderstate.clusteredLights;
+          if (renderstate.clusteredLights && !renderstate.coreProfile) {
+            renderstate.coreProfile = 1;
+            regenerate_geometry();
+          }
+          break;
+        case SDLK_x:
+          // write the frame and a CPU rendered reference of it as PPMs
+          if (pending_reference)
+            freeObjectData(pending_reference);
+          pending_reference = create_mesh();
+          break;
+        case SDLK_e:
+          // curvature adaptive meshes, T/t set the tolerance instead of the grid
+          renderstate.adaptive = !renderstate.adaptive;
+          if (renderstate.adaptive && renderstate.shaders && !renderstate.coreProfile)
+            printf("Adaptive meshes are for the fixed pipeline and core profile, the shaders bump a uniform grid\n");
+          regenerate_geometry();
+          break;
+        case SDLK_j:
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            num_point_lights = min(num_point_lights * 2, MAX_POINT_LIGHTS);
+          else
+            num_point_lights = max(num_point_lights / 2, 1);
+          break;
+        case SDLK_i:
+          // attribute-less shader rendering, only the shader's grid uniform changes with tessellation
+          if (!shader_attribless) {
+            printf("Attribute-less rendering needs GL_EXT_gpu_shader4 and instanced arrays\n");
+            break;
+          }
+          renderstate.attribless = !renderstate.attribless;
+          if (tessellation > max_tess)
+            tessellation = max_tess;
           regenerate_geometry();
           break;
         case SDLK_l:
           renderstate.lighting = !renderstate.lighting;
-          update_renderstate();
           break;
         case SDLK_n:
           renderstate.normals = !renderstate.normals;
-          // Set normal_view in shader
-          GLint normal_view = glGetUniformLocation(shader, "normal_view");
-          if (normal_view != -1)
-          {
-            glUseProgram(shader); 
-            glUniform1i(normal_view, renderstate.normals);
-            glUseProgram(0);
-          }
           break;
         case SDLK_w:
           renderstate.wireframe = !renderstate.wireframe;
-          update_renderstate();
           break;
         case SDLK_t:
           if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT])) {
-            if (tessellation < max_tess) {
+            if (tessellation < (renderstate.shaders && renderstate.attribless ? max_tess_attribless : max_tess)) {
               ++tessellation;
               regenerate_geometry();
             } 
@@ -443,59 +2021,44 @@ void event(SDL_Event *event)
               material_shininess -= 10.0;
             }
           }
-          glMaterialf(GL_FRONT, GL_SHININESS, material_shininess);
           break;
         case SDLK_v:
-          {
-            renderstate.viewer_model = !renderstate.viewer_model;
-            // set viewer position in fixed pipeline
-            glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, renderstate.viewer_model);
-            // set viewer position in shaders
-            GLint viewer = glGetUniformLocation(shader, "viewer");
-            if (viewer != -1)
-            {
-              glUseProgram(shader); 
-              glUniform1i(viewer, renderstate.viewer_model);
-              glUseProgram(0);
-            }
-          }
+          renderstate.viewer_model = !renderstate.viewer_model;
           break;
         case SDLK_d:
-          // change light 'w' value - directional/positional
-          light0_position[3] = !light0_position[3];
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            renderstate.shadows = !renderstate.shadows; // shadow map of light 0, with the shaders
+          else
+            light0_position[3] = !light0_position[3]; // change light 'w' value - directional/positional
           break;
         case SDLK_b:
-          // set bump state in shader
-          bump_t = (bump_t + 1) % (NUM_BUMP_STATES);
-          GLint bumps = glGetUniformLocation(shader, "bumps");
-          if (bumps != -1)
-          {
-            glUseProgram(shader);
-            glUniform1i(bumps, bump_t);
-            glUseProgram(0);
-          }
+          // change bump state (applied to the shader in display)
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            renderstate.bumpMap = !renderstate.bumpMap; // per pixel from the baked map, or per vertex
+          else
+            bump_t = (bump_t + 1) % (NUM_BUMP_STATES);
+          break;
+        case SDLK_q:
+          // hide the back faces of closed shapes
+          renderstate.culling = !renderstate.culling;
+          break;
+        case SDLK_z:
+          if ((key_state[SDLK_LSHIFT] || key_state[SDLK_RSHIFT]))
+            renderstate.overdraw = !renderstate.overdraw; // fragments shaded per pixel, as a heatmap
+          else
+            renderstate.depthPrepass = !renderstate.depthPrepass; // depth first, then shade once per pixel
+          break;
+        case SDLK_y:
+          // draw only the patches of the surface that can be seen
+          renderstate.patchCulling = !renderstate.patchCulling;
           break;
         case SDLK_m:
-          // set lighting model (phong/blinn-phong) in shader
+          // set lighting model (phong/blinn-phong)
           renderstate.lightingModel = !renderstate.lightingModel;
-          GLint lighting_model = glGetUniformLocation(shader, "lighting_model");
-          if (lighting_model != -1)
-          {
-            glUseProgram(shader); 
-            glUniform1i(lighting_model, renderstate.lightingModel);
-            glUseProgram(0);
-          }
           break;
         case SDLK_p:
-          // set lighting mode (vertex / pixel) in shader
+          // set lighting mode (vertex / pixel)
           renderstate.vertexOrPixelLighting = !renderstate.vertexOrPixelLighting;
-          GLint shader_type = glGetUniformLocation(shader, "shader_type");
-          if (shader_type != -1)
-          {
-            glUseProgram(shader);
-            glUniform1i(shader_type, renderstate.vertexOrPixelLighting);
-            glUseProgram(0);
-          }
           break;
         case SDLK_g:
           // set appropriate shape func based on switch
@@ -514,14 +2077,6 @@ void event(SDL_Event *event)
             default:
               break;
           }
-          // set shape type in shader
-          GLint shape = glGetUniformLocation(shader, "shape");
-          if (shape != -1)
-          {
-            glUseProgram(shader);
-            glUniform1i(shape, shape_t);
-            glUseProgram(0);
-          }
           regenerate_geometry(); 
           break;
         default:
@@ -555,6 +2110,8 @@ void event(SDL_Event *event)
       if (mouse2_down) {
         camera_zoom -= event->motion.yrel * CAMERA_MOUSE_Y_VELOCITY * 0.1;
       }
+      if (mouse1_down || mouse2_down)
+        postRedisplay();
       break;
     default:
       break;
@@ -564,9 +2121,38 @@ void event(SDL_Event *event)
 void cleanup()
 {
   /* Delete the shader */
-  glDeleteProgram(shader);
+  freeShader(shader);
+  freeShader(shader_attribless);
+  freeGridAttribless();
+  freeShader(shader_capture);
+  freeShader(shader_cached);
+  coreCleanup();
+  clusterFree(clusters);
+  parallelCleanup();
+  glDeleteTextures(1, &bump_texture);
+  resourceFree(RES_TEXTURES, RES_GPU, bump_texture_bytes);
+  if (shadow_map)
+    freeShadowMap(shadow_map);
+  freeDynamicResolution(dynamic_resolution);
+  if (capture)
+    freeCapture(capture);
+  if (draw_query) {
+    glDeleteQueries(1, &draw_query);
+    glDeleteQueries(1, &shadow_query);
+  }
 
   /* Free object data */
   if (object) 
     freeObject(object);
+  if (pending_geometry)
+    freeObjectData(pending_geometry);
+  if (upload_geometry)
+    freeObjectData(upload_geometry);
+  if (pending_reference)
+    freeObjectData(pending_reference);
+  if (upload_reference)
+    freeObjectData(upload_reference);
+
+  /* Everything should be back by now */
+  resourceReport();
 }
@@ -0,0 +1,143 @@
+/* bump.c - baked bump map */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bump.h"
+#include "parallel.h"
+
+#define BUMP_SAMPLES 4 /* per texel along each axis, for the bump edges */
+
+/* What one parallelFor over rows works on */
+typedef struct {
+	unsigned char* dst;
+	const unsigned char* src; /* the level above, when downsampling */
+	int size; /* of dst */
+} BumpLevel;
+
+/* Height and unnormalized tangent space normal at (x, y) in the cell,
+ * from -0.5 to 0.5, as shader.vert had them */
+static float bumpAt(float x, float y, float* normal)
+{
+	float d = x * x + y * y;
+	float height;
+
+	if (d >= BUMP_SIZE) {
+		normal[0] = 0.0f;
+		normal[1] = 0.0f;
+		normal[2] = 1.0f;
+		return 0.0f;
+	}
+	height = sqrtf(0.25f - d);
+	normal[0] = x;
+	normal[1] = -y;
+	normal[2] = height;
+	return height;
+}
+
+static void encode(unsigned char* texel, float* n, float height)
+{
+	float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	int i;
+
+	for (i = 0; i < 3; ++i)
+		texel[i] = (unsigned char)((n[i] / length * 0.5f + 0.5f) * 255.0f + 0.5f);
+	texel[3] = (unsigned char)(height * 255.0f + 0.5f);
+}
+
+static void bakeRow(int y, void* data)
+{
+	BumpLevel* level = (BumpLevel*)data;
+	float step = 1.0f / (level->size * BUMP_SAMPLES);
+	int x, i, j;
+
+	for (x = 0; x < level->size; ++x) {
+		float sum[3] = {0.0f, 0.0f, 0.0f}, height = 0.0f;
+
+		/* The normal is steepest right at a bump's edge, so average the
+		 * directions over the texel rather than point sample it */
+		for (j = 0; j < BUMP_SAMPLES; ++j)
+		for (i = 0; i < BUMP_SAMPLES; ++i) {
+			float n[3], length;
+			float h = bumpAt((x * BUMP_SAMPLES + i + 0.5f) * step - 0.5f,
+				(y * BUMP_SAMPLES + j + 0.5f) * step - 0.5f, n);
+			length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			sum[0] += n[0] / length;
+			sum[1] += n[1] / length;
+			sum[2] += n[2] / length;
+			height += h;
+		}
+		encode(level->dst + (y * level->size + x) * 4, sum, height * 2.0f / (BUMP_SAMPLES * BUMP_SAMPLES));
+	}
+}
+
+/* 2x2 box filter of the level above, renormalized */
+static void downsampleRow(int y, void* data)
+{
+	BumpLevel* level = (BumpLevel*)data;
+	int srcSize = level->size * 2;
+	int x, i, k;
+
+	for (x = 0; x < level->size; ++x) {
+		float sum[3] = {0.0f, 0.0f, 0.0f}, height = 0.0f;
+		for (i = 0; i < 4; ++i) {
+			const unsigned char* texel = level->src + ((y * 2 + i / 2) * srcSize + x * 2 + i % 2) * 4;
+			for (k = 0; k < 3; ++k)
+				sum[k] += texel[k] / 255.0f * 2.0f - 1.0f;
+			height += texel[3] / 255.0f;
+		}
+		if (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2] < 1e-6f)
+			sum[2] = 1.0f;
+		encode(level->dst + (y * level->size + x) * 4, sum, height / 4.0f);
+	}
+}
+
+BumpMap* bakeBumpMap(int size)
+{
+	BumpMap* map = (BumpMap*)malloc(sizeof(BumpMap));
+	BumpLevel level;
+
+	map->size = size;
+	map->levels = 0;
+	for (; size >= 1 && map->levels < BUMP_MAX_LEVELS; size /= 2) {
+		level.dst = (unsigned char*)malloc(size * size * 4);
+		level.size = size;
+		if (map->levels == 0) {
+			parallelFor(size, bakeRow, &level);
+		} else {
+			level.src = map->texels[map->levels - 1];
+			parallelFor(size, downsampleRow, &level);
+		}
+		map->texels[map->levels++] = level.dst;
+	}
+	return map;
+}
+
+GLuint uploadBumpMap(const BumpMap* map)
+{
+	GLuint texture;
+	int i;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (i = 0; i < map->levels; ++i)
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, map->size >> i, map->size >> i, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, map->texels[i]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, map->levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+void freeBumpMap(BumpMap* map)
+{
+	int i;
+	for (i = 0; i < map->levels; ++i)
+		free(map->texels[i]);
+	free(map);
+}
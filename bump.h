@@ -0,0 +1,43 @@
+/* bump.h - baked bump map
+
+shader.vert used to work out the bumps per vertex: the cell each (u, v)
+falls in, the bump's height and normal there, and the tangent frame to
+turn it into. Interpolated between vertices, the bumps only look right
+once the grid has many vertices per bump. bakeBumpMap does the same maths
+once, on the CPU across the thread pool, for one cell of the pattern and
+its mip levels. The texture repeats BUMP_DENSITY times across u and v and
+the fragment shader looks the normal up per pixel, so a coarse grid shades
+the same as a fine one.
+
+Texels are RGBA8: the tangent space normal, scaled and biased into RGB,
+and the height in alpha, 1 at the top of a bump.
+
+USAGE:
+parallelInit first, then
+map = bakeBumpMap(BUMP_MAP_SIZE)
+texture = uploadBumpMap(map), mipmapped, GL_REPEAT
+freeBumpMap(map)
+*/
+
+#ifndef BUMP_H
+#define BUMP_H
+
+#include "objects.h"
+
+#define BUMP_DENSITY 16 /* bumps across u, and across v */
+#define BUMP_SIZE 0.25f /* squared radius of a bump, in cells */
+#define BUMP_MAP_SIZE 256 /* texels across one cell */
+#define BUMP_MAX_LEVELS 16
+#define BUMP_HEIGHT 0.08f /* furthest shader.vert displaces the surface along its normal */
+
+typedef struct {
+	int size; /* of level 0, a power of two */
+	int levels; /* down to 1x1 */
+	unsigned char* texels[BUMP_MAX_LEVELS]; /* RGBA8, (size >> level) squared */
+} BumpMap;
+
+BumpMap* bakeBumpMap(int size);
+GLuint uploadBumpMap(const BumpMap* map);
+void freeBumpMap(BumpMap* map);
+
+#endif
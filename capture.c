@@ -0,0 +1,330 @@
+/* capture.c - every frame read back through a ring of pixel buffers and written on a worker thread */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __APPLE__
+#include <GL/glew.h>
+#endif
+
+#include "capture.h"
+#include "resources.h"
+#include "timer.h"
+
+/* BT.601 limited range, in 8.8 fixed point */
+static unsigned char lumaOf(const unsigned char* p)
+{
+	return (unsigned char)(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+}
+
+/* Chroma of the 2x2 block at a and b, a row apart */
+static void chromaOf(const unsigned char* a, const unsigned char* b, unsigned char* u, unsigned char* v)
+{
+	int r = a[0] + a[4] + b[0] + b[4];
+	int g = a[1] + a[5] + b[1] + b[5];
+	int bl = a[2] + a[6] + b[2] + b[6];
+	*u = (unsigned char)(((-38 * r - 74 * g + 112 * bl + 512) >> 10) + 128);
+	*v = (unsigned char)(((112 * r - 94 * g - 18 * bl + 512) >> 10) + 128);
+}
+
+static int reserveScratch(Capture* c, size_t bytes)
+{
+	if (bytes <= c->scratchBytes)
+		return 1;
+	free(c->scratch);
+	c->scratch = (unsigned char*)malloc(bytes);
+	c->scratchBytes = c->scratch ? bytes : 0;
+	return c->scratch != NULL;
+}
+
+static int writePPM(Capture* c, const CaptureJob* job)
+{
+	char filename[1100];
+	FILE* file;
+	int x, y, ok;
+
+	snprintf(filename, sizeof filename, "%s/frame%06u.ppm", c->path, job->frame);
+	if (!reserveScratch(c, (size_t)job->width * 3) || !(file = fopen(filename, "wb")))
+		return 0;
+	/* PPM rows go top to bottom */
+	fprintf(file, "P6\n%d %d\n255\n", job->width, job->height);
+	for (y = job->height - 1; y >= 0; --y) {
+		const unsigned char* row = job->pixels + (size_t)y * job->width * 4;
+		for (x = 0; x < job->width; ++x) {
+			c->scratch[x * 3] = row[x * 4];
+			c->scratch[x * 3 + 1] = row[x * 4 + 1];
+			c->scratch[x * 3 + 2] = row[x * 4 + 2];
+		}
+		fwrite(c->scratch, 3, job->width, file);
+	}
+	ok = !ferror(file);
+	return fclose(file) == 0 && ok;
+}
+
+/* The stream's size from the lower left, which is the top left flipped */
+static int writeYUV(Capture* c, const CaptureJob* job)
+{
+	int w = c->streamWidth, h = c->streamHeight, x, y;
+	size_t stride = (size_t)job->width * 4;
+	unsigned char *luma, *u, *v;
+
+	if (!reserveScratch(c, (size_t)w * h * 3 / 2))
+		return 0;
+	luma = c->scratch;
+	u = luma + (size_t)w * h;
+	v = u + (size_t)w * h / 4;
+	for (y = 0; y < h; ++y) {
+		const unsigned char* row = job->pixels + (size_t)(h - 1 - y) * stride;
+		for (x = 0; x < w; ++x)
+			luma[(size_t)y * w + x] = lumaOf(row + x * 4);
+	}
+	for (y = 0; y < h / 2; ++y) {
+		const unsigned char* upper = job->pixels + (size_t)(h - 1 - y * 2) * stride;
+		for (x = 0; x < w / 2; ++x)
+			chromaOf(upper + x * 8, upper - stride + x * 8, &u[(size_t)y * w / 2 + x], &v[(size_t)y * w / 2 + x]);
+	}
+	return fwrite(c->scratch, 1, (size_t)w * h * 3 / 2, c->stream) == (size_t)w * h * 3 / 2;
+}
+
+static void* captureWorker(void* data)
+{
+	Capture* c = (Capture*)data;
+	CaptureJob* job;
+	double latency;
+	int ok;
+
+	for (;;) {
+		pthread_mutex_lock(&c->lock);
+		while (!(job = (CaptureJob*)queueFront(&c->jobs)) && !c->stopping)
+			pthread_cond_wait(&c->wake, &c->lock);
+		pthread_mutex_unlock(&c->lock);
+		/* Stopping only once the queue is empty */
+		if (!job)
+			break;
+
+		ok = job->pixels && (c->format == CAPTURE_YUV ? writeYUV(c, job) : writePPM(c, job));
+		latency = timerNow() - job->issued;
+
+		pthread_mutex_lock(&c->lock);
+		if (ok)
+			c->written++;
+		else if (c->failed++ == 0)
+			printf("Capture: could not write frame %u to %s\n", job->frame, c->path);
+		c->latencySum += latency;
+		c->latencyMax = latency > c->latencyMax ? latency : c->latencyMax;
+		c->latencyCount++;
+		pthread_mutex_unlock(&c->lock);
+
+		queuePop(&c->jobs);
+		/* Release: the render thread may unmap the buffer once it sees this */
+		__atomic_add_fetch(&c->finished, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+Capture* createCapture(const char* path, CaptureFormat format)
+{
+	Capture* c = (Capture*)calloc(1, sizeof(Capture));
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	int i;
+
+	c->format = format;
+	snprintf(c->path, sizeof c->path, "%s", path);
+	if (format == CAPTURE_YUV && !(c->stream = fopen(path, "wb"))) {
+		printf("Capture: could not create %s\n", path);
+		free(c);
+		return NULL;
+	}
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	c->stats.gpuFenced = extensions && strstr(extensions, "GL_ARB_sync") != NULL;
+#endif
+	(void)extensions;
+	for (i = 0; i < CAPTURE_BUFFERS; ++i)
+		glGenBuffers(1, &c->buffers[i].buffer);
+
+	/* Never more jobs than mapped buffers, so pushing can't fail */
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->wake, NULL);
+	if (queueInit(&c->jobs, sizeof(CaptureJob), CAPTURE_BUFFERS) &&
+		pthread_create(&c->worker, NULL, captureWorker, c) != 0)
+		queueFree(&c->jobs);
+	if (!c->jobs.slots) {
+		printf("Capture: could not start the writer thread\n");
+		freeCapture(c);
+		return NULL;
+	}
+	c->intervalStart = timerNow();
+	c->published = c->stats;
+	printf("Capture: %s to %s, %d buffers%s\n", format == CAPTURE_YUV ? "I420 stream" : "PPM frames", path,
+		CAPTURE_BUFFERS, c->stats.gpuFenced ? ", fenced" : "");
+	return c;
+}
+
+/* Whether the read into b is done. force waits for it */
+static int readDone(Capture* c, CaptureBuffer* b, int force)
+{
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	if (b->fence) {
+		GLenum status = glClientWaitSync((GLsync)b->fence, force ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+			force ? 1000000000 : 0);
+		if (status == GL_TIMEOUT_EXPIRED && !force)
+			return 0;
+		glDeleteSync((GLsync)b->fence);
+		b->fence = NULL;
+		return 1;
+	}
+#endif
+	return force || c->issued - c->mapped >= CAPTURE_BUFFERS - 1;
+}
+
+/* Hands finished reads to the worker, in order */
+static void mapReads(Capture* c, int force)
+{
+	while (c->mapped != c->issued) {
+		CaptureBuffer* b = &c->buffers[c->mapped % CAPTURE_BUFFERS];
+		CaptureJob* job;
+
+		if (!readDone(c, b, force))
+			break;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, b->buffer);
+		job = (CaptureJob*)queueBeginPush(&c->jobs);
+		b->mapping = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		job->pixels = (const unsigned char*)b->mapping;
+		job->width = b->width;
+		job->height = b->height;
+		job->frame = b->frame;
+		job->issued = b->issued;
+		draw_gl_calls += 2;
+		/* A failed map is still a job, so the buffer comes back in order */
+		pthread_mutex_lock(&c->lock);
+		queueEndPush(&c->jobs);
+		pthread_cond_signal(&c->wake);
+		pthread_mutex_unlock(&c->lock);
+		c->mapped++;
+	}
+}
+
+/* Unmaps the buffers the worker is done with */
+static void releaseBuffers(Capture* c)
+{
+	unsigned int finished = __atomic_load_n(&c->finished, __ATOMIC_ACQUIRE);
+	while (c->released != finished) {
+		CaptureBuffer* b = &c->buffers[c->released % CAPTURE_BUFFERS];
+		if (b->mapping) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, b->buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			b->mapping = NULL;
+			draw_gl_calls += 2;
+		}
+		c->released++;
+	}
+}
+
+void captureFrame(Capture* c, int width, int height)
+{
+	double start = timerNow();
+	CaptureBuffer* b;
+	size_t bytes = (size_t)width * height * 4;
+
+	c->stats.frames++;
+	releaseBuffers(c);
+	mapReads(c, 0);
+
+	if (c->format == CAPTURE_YUV && !c->streamWidth && width > 1 && height > 1) {
+		c->streamWidth = width & ~1;
+		c->streamHeight = height & ~1;
+		printf("Capture: stream is %dx%d\n", c->streamWidth, c->streamHeight);
+	}
+	if (width <= 0 || height <= 0 || (c->format == CAPTURE_YUV &&
+		((width & ~1) != c->streamWidth || (height & ~1) != c->streamHeight)))
+		c->stats.dropped++;
+	else if (c->issued - c->released == CAPTURE_BUFFERS)
+		c->stats.dropped++;
+	else {
+		b = &c->buffers[c->issued % CAPTURE_BUFFERS];
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, b->buffer);
+		if (b->bytes != bytes) {
+			if (b->bytes)
+				resourceFree(RES_TEXTURES, RES_GPU, b->bytes);
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			resourceAlloc(RES_TEXTURES, RES_GPU, bytes);
+			b->bytes = bytes;
+			draw_gl_calls++;
+		}
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		draw_gl_calls += 2;
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		if (c->stats.gpuFenced) {
+			b->fence = (void*)glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			draw_gl_calls++;
+		}
+#endif
+		b->width = width;
+		b->height = height;
+		b->frame = c->stats.frames - 1;
+		b->issued = start;
+		c->issued++;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	draw_gl_calls++;
+
+	c->stats.cost = c->stats.cost * 0.95f + (float)(timerNow() - start) * 0.05f;
+
+	/* The worker's latency, an interval at a time, and a copy of the stats
+	 * for captureStats on other threads */
+	pthread_mutex_lock(&c->lock);
+	if (start - c->intervalStart >= CAPTURE_INTERVAL) {
+		c->stats.latency = c->latencyCount ? (float)(c->latencySum / c->latencyCount) : 0.0f;
+		c->stats.latencyMax = (float)c->latencyMax;
+		c->latencySum = c->latencyMax = 0.0;
+		c->latencyCount = 0;
+		c->intervalStart = start;
+	}
+	c->published = c->stats;
+	pthread_mutex_unlock(&c->lock);
+}
+
+void captureStats(Capture* c, CaptureStats* stats)
+{
+	pthread_mutex_lock(&c->lock);
+	*stats = c->published;
+	stats->written = c->written;
+	stats->failed = c->failed;
+	pthread_mutex_unlock(&c->lock);
+}
+
+void freeCapture(Capture* c)
+{
+	int i;
+
+	/* A queue means the worker started */
+	if (c->jobs.slots) {
+		/* Everything read goes to the worker, which finishes before it stops */
+		mapReads(c, 1);
+		pthread_mutex_lock(&c->lock);
+		c->stopping = 1;
+		pthread_cond_signal(&c->wake);
+		pthread_mutex_unlock(&c->lock);
+		pthread_join(c->worker, NULL);
+		releaseBuffers(c);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		printf("Capture: %u of %u frames written to %s, %u dropped, %u failed\n", c->written,
+			c->stats.frames, c->path, c->stats.dropped, c->failed);
+	}
+	queueFree(&c->jobs);
+	for (i = 0; i < CAPTURE_BUFFERS; ++i) {
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		if (c->buffers[i].fence)
+			glDeleteSync((GLsync)c->buffers[i].fence);
+#endif
+		if (c->buffers[i].bytes)
+			resourceFree(RES_TEXTURES, RES_GPU, c->buffers[i].bytes);
+		glDeleteBuffers(1, &c->buffers[i].buffer);
+	}
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->wake);
+	if (c->stream)
+		fclose(c->stream);
+	free(c->scratch);
+	free(c);
+}
@@ -0,0 +1,117 @@
+/* capture.h - every frame read back through a ring of pixel buffers and written on a worker thread
+
+glReadPixels into client memory waits for the GPU to finish the frame and
+copies it out before it returns, so capturing every frame that way stalls
+the pipeline each time. Here each frame is read into the next of
+CAPTURE_BUFFERS pixel buffer objects instead, which returns at once, with
+a fence after it. A later captureFrame maps the buffer once its fence has
+passed and hands the pointer to a worker thread through a queue. The
+worker converts and writes the frame, then counts it finished, and the
+next captureFrame unmaps the buffer so it can be read into again. The
+render thread issues reads and maps but never waits and never touches a
+pixel.
+
+When every buffer is still in flight, because the worker is behind or the
+GPU is, the frame is dropped and counted rather than waited for. Without
+ARB_sync there are no fences, and a buffer is mapped CAPTURE_BUFFERS - 1
+frames after its read, which may wait.
+
+Frames are written as a sequence of PPM files, frame000000.ppm on,
+numbered by the frame so drops leave gaps, or as one raw I420 (yuv420p)
+stream, BT.601 limited range, to pipe to a video encoder through a file
+or a fifo:
+  ffmpeg -f rawvideo -pix_fmt yuv420p -s WxH -r 60 -i capture.yuv out.mp4
+A stream has one size, that of its first frame with odd edges cut, and
+frames of any other size are dropped. Latency runs from the read being
+issued to the frame being written.
+
+USAGE:
+capture = createCapture(path, format) with the context current, path a
+directory for CAPTURE_PPM or a file for CAPTURE_YUV
+captureFrame(capture, width, height) once a frame, with the framebuffer
+to read bound, after drawing and before the swap
+captureStats(capture, &stats) from any thread, as of the last captureFrame
+freeCapture(capture) writes whatever is in flight and stops the worker
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "objects.h"
+#include "queue.h"
+
+#define CAPTURE_BUFFERS 4 /* frames read back at once */
+#define CAPTURE_INTERVAL 1.0 /* seconds latency is averaged over */
+
+typedef enum {
+	CAPTURE_PPM,
+	CAPTURE_YUV
+} CaptureFormat;
+
+typedef struct {
+	unsigned int frames; /* captureFrame calls */
+	unsigned int written;
+	unsigned int dropped; /* no buffer free, or not the stream's size */
+	unsigned int failed; /* couldn't be written */
+	float latency, latencyMax; /* seconds, over the last interval */
+	float cost; /* seconds per frame in captureFrame, averaged */
+	int gpuFenced; /* reads are checked with fences */
+} CaptureStats;
+
+/* One buffer of the ring */
+typedef struct {
+	GLuint buffer;
+	size_t bytes;
+	void* fence; /* GLsync */
+	void* mapping; /* while the worker has it */
+	int width, height;
+	unsigned int frame;
+	double issued;
+} CaptureBuffer;
+
+/* A mapped buffer, from captureFrame to the worker */
+typedef struct {
+	const unsigned char* pixels; /* RGBA, bottom row first */
+	int width, height;
+	unsigned int frame;
+	double issued;
+} CaptureJob;
+
+typedef struct {
+	CaptureFormat format;
+	char path[1024];
+	CaptureStats stats; /* the render thread's */
+	/* Internal */
+	CaptureStats published; /* stats, under lock */
+	CaptureBuffer buffers[CAPTURE_BUFFERS];
+	/* Frames read, mapped and handed to the worker, and unmapped again:
+	 * released <= mapped <= issued */
+	unsigned int issued, mapped, released;
+	unsigned int finished; /* by the worker, atomic */
+	int streamWidth, streamHeight; /* CAPTURE_YUV */
+	FILE* stream;
+	Queue jobs;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int stopping;
+	/* The worker's, under lock: written, failed and this interval's latency */
+	unsigned int written, failed;
+	double latencySum, latencyMax;
+	int latencyCount;
+	double intervalStart;
+	unsigned char* scratch; /* the worker's row or planes */
+	size_t scratchBytes;
+} Capture;
+
+/* NULL, with a message, if the file can't be created or the worker started */
+Capture* createCapture(const char* path, CaptureFormat format);
+void captureFrame(Capture* capture, int width, int height);
+void captureStats(Capture* capture, CaptureStats* stats);
+/* Prints a summary */
+void freeCapture(Capture* capture);
+
+#endif
@@ -0,0 +1,226 @@
+/* cluster.c - clustered light assignment for forward shading */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster.h"
+#include "parallel.h"
+
+/* Four lanes of floats or comparison masks. GCC and clang vector extensions
+ * compile to SSE or NEON as available */
+typedef float float4 __attribute__((vector_size(16)));
+typedef int int4 __attribute__((vector_size(16)));
+
+/* Lights that reach one depth slice, structure of arrays and padded to a
+ * multiple of four with lights that can't touch anything */
+typedef struct ClusterSliceType {
+	float* x;
+	float* y;
+	float* z;
+	float* r2;
+	int* index;
+	int count;
+	/* Light lists for the slice's tiles, CLUSTER_MAX_LIGHTS each */
+	unsigned int* lists;
+	unsigned int counts[CLUSTER_TILES];
+	int dropped;
+} ClusterSlice;
+
+typedef struct {
+	ClusterGrid* grid;
+	const PointLight* lights;
+	int count;
+} AssignJob;
+
+static float4 max4(float4 a, float4 b)
+{
+	int4 m = a > b;
+	return (float4)(((int4)a & m) | ((int4)b & ~m));
+}
+
+ClusterGrid* clusterCreate()
+{
+	int z;
+	ClusterGrid* grid = (ClusterGrid*)calloc(1, sizeof(ClusterGrid));
+	grid->slices = (ClusterSlice*)calloc(CLUSTER_Z, sizeof(ClusterSlice));
+	for (z = 0; z < CLUSTER_Z; ++z)
+		grid->slices[z].lists = (unsigned int*)malloc(sizeof(unsigned int) * CLUSTER_TILES * CLUSTER_MAX_LIGHTS);
+	grid->indices = (unsigned int*)malloc(sizeof(unsigned int) * CLUSTER_COUNT * CLUSTER_MAX_LIGHTS);
+	clusterSetProjection(grid, 60.0f, 1.0f, 0.1f, 100.0f);
+	return grid;
+}
+
+static void freeSliceLights(ClusterSlice* slice)
+{
+	free(slice->x);
+	free(slice->y);
+	free(slice->z);
+	free(slice->r2);
+	free(slice->index);
+}
+
+void clusterFree(ClusterGrid* grid)
+{
+	int z;
+	for (z = 0; z < CLUSTER_Z; ++z) {
+		freeSliceLights(&grid->slices[z]);
+		free(grid->slices[z].lists);
+	}
+	free(grid->slices);
+	free(grid->indices);
+	free(grid);
+}
+
+void clusterSetProjection(ClusterGrid* grid, float fovy, float aspect, float zNear, float zFar)
+{
+	int x, y, z;
+	float tanY = tanf(fovy * acosf(-1.0f) / 360.0f);
+	float tanX = tanY * aspect;
+
+	grid->zNear = zNear;
+	grid->zFar = zFar;
+	for (z = 0; z < CLUSTER_Z; ++z) {
+		/* Exponential slices keep clusters roughly cube shaped */
+		float n = zNear * powf(zFar / zNear, z / (float)CLUSTER_Z);
+		float f = zNear * powf(zFar / zNear, (z + 1) / (float)CLUSTER_Z);
+		grid->sliceNear[z] = n;
+		grid->sliceFar[z] = f;
+		for (y = 0; y < CLUSTER_Y; ++y) {
+			float y0 = (-1.0f + 2.0f * y / CLUSTER_Y) * tanY;
+			float y1 = (-1.0f + 2.0f * (y + 1) / CLUSTER_Y) * tanY;
+			for (x = 0; x < CLUSTER_X; ++x) {
+				float x0 = (-1.0f + 2.0f * x / CLUSTER_X) * tanX;
+				float x1 = (-1.0f + 2.0f * (x + 1) / CLUSTER_X) * tanX;
+				int c = x + y * CLUSTER_X + z * CLUSTER_TILES;
+				/* The tile's frustum piece widens with depth, so its box
+				 * spans both ends */
+				grid->minX[c] = fminf(x0 * n, x0 * f);
+				grid->maxX[c] = fmaxf(x1 * n, x1 * f);
+				grid->minY[c] = fminf(y0 * n, y0 * f);
+				grid->maxY[c] = fmaxf(y1 * n, y1 * f);
+			}
+		}
+	}
+}
+
+static void reserveSlices(ClusterGrid* grid, int count)
+{
+	int z, padded = (count + 3) & ~3;
+	if (padded <= grid->capacity)
+		return;
+	for (z = 0; z < CLUSTER_Z; ++z) {
+		ClusterSlice* slice = &grid->slices[z];
+		freeSliceLights(slice);
+		slice->x = (float*)malloc(sizeof(float) * padded);
+		slice->y = (float*)malloc(sizeof(float) * padded);
+		slice->z = (float*)malloc(sizeof(float) * padded);
+		slice->r2 = (float*)malloc(sizeof(float) * padded);
+		slice->index = (int*)malloc(sizeof(int) * padded);
+	}
+	grid->capacity = padded;
+}
+
+/* Assigns lights to the clusters of one depth slice */
+static void assignSlice(int z, void* data)
+{
+	AssignJob* job = (AssignJob*)data;
+	ClusterGrid* grid = job->grid;
+	ClusterSlice* slice = &grid->slices[z];
+	float sliceMinZ = -grid->sliceFar[z];
+	float sliceMaxZ = -grid->sliceNear[z];
+	float4 zero = {0.0f, 0.0f, 0.0f, 0.0f};
+	int i, t;
+
+	/* Gather the lights whose spheres reach this slice's depth range */
+	slice->count = 0;
+	slice->dropped = 0;
+	for (i = 0; i < job->count; ++i) {
+		const PointLight* light = &job->lights[i];
+		float z0 = light->position[2] - light->radius;
+		float z1 = light->position[2] + light->radius;
+		if (z1 < sliceMinZ || z0 > sliceMaxZ)
+			continue;
+		slice->x[slice->count] = light->position[0];
+		slice->y[slice->count] = light->position[1];
+		slice->z[slice->count] = light->position[2];
+		slice->r2[slice->count] = light->radius * light->radius;
+		slice->index[slice->count] = i;
+		slice->count++;
+	}
+	/* Pad with lights that fail every test */
+	while (slice->count & 3) {
+		slice->x[slice->count] = slice->y[slice->count] = slice->z[slice->count] = 0.0f;
+		slice->r2[slice->count] = -1.0f;
+		slice->index[slice->count] = -1;
+		slice->count++;
+	}
+
+	/* Sphere against box, four lights at a time: the squared distance from
+	 * the centre to the box is the sum of the per axis gaps squared */
+	for (t = 0; t < CLUSTER_TILES; ++t) {
+		int c = t + z * CLUSTER_TILES;
+		float4 minX = {grid->minX[c], grid->minX[c], grid->minX[c], grid->minX[c]};
+		float4 maxX = {grid->maxX[c], grid->maxX[c], grid->maxX[c], grid->maxX[c]};
+		float4 minY = {grid->minY[c], grid->minY[c], grid->minY[c], grid->minY[c]};
+		float4 maxY = {grid->maxY[c], grid->maxY[c], grid->maxY[c], grid->maxY[c]};
+		float4 minZ = {sliceMinZ, sliceMinZ, sliceMinZ, sliceMinZ};
+		float4 maxZ = {sliceMaxZ, sliceMaxZ, sliceMaxZ, sliceMaxZ};
+		unsigned int* list = slice->lists + t * CLUSTER_MAX_LIGHTS;
+		unsigned int n = 0;
+
+		for (i = 0; i < slice->count; i += 4) {
+			float4 x, y, zz, r2, dx, dy, dz, d2;
+			int4 hit;
+			int lane;
+
+			memcpy(&x, slice->x + i, sizeof(float4));
+			memcpy(&y, slice->y + i, sizeof(float4));
+			memcpy(&zz, slice->z + i, sizeof(float4));
+			memcpy(&r2, slice->r2 + i, sizeof(float4));
+			dx = max4(max4(minX - x, x - maxX), zero);
+			dy = max4(max4(minY - y, y - maxY), zero);
+			dz = max4(max4(minZ - zz, zz - maxZ), zero);
+			d2 = dx * dx + dy * dy + dz * dz;
+			hit = d2 <= r2;
+
+			for (lane = 0; lane < 4; ++lane) {
+				if (!hit[lane])
+					continue;
+				if (n < CLUSTER_MAX_LIGHTS)
+					list[n++] = slice->index[i + lane];
+				else
+					slice->dropped++;
+			}
+		}
+		slice->counts[t] = n;
+	}
+}
+
+void clusterAssign(ClusterGrid* grid, const PointLight* lights, int count)
+{
+	AssignJob job;
+	int z, t;
+	unsigned int offset = 0;
+
+	reserveSlices(grid, count);
+	job.grid = grid;
+	job.lights = lights;
+	job.count = count;
+	parallelFor(CLUSTER_Z, assignSlice, &job);
+
+	/* Pack the per slice lists into one index list */
+	grid->droppedLights = 0;
+	for (z = 0; z < CLUSTER_Z; ++z) {
+		ClusterSlice* slice = &grid->slices[z];
+		for (t = 0; t < CLUSTER_TILES; ++t) {
+			int c = t + z * CLUSTER_TILES;
+			grid->ranges[c * 2] = offset;
+			grid->ranges[c * 2 + 1] = slice->counts[t];
+			memcpy(grid->indices + offset, slice->lists + t * CLUSTER_MAX_LIGHTS, sizeof(unsigned int) * slice->counts[t]);
+			offset += slice->counts[t];
+		}
+		grid->droppedLights += slice->dropped;
+	}
+	grid->numIndices = offset;
+}
@@ -0,0 +1,57 @@
+/* cluster.h - clustered light assignment for forward shading
+
+The view frustum is split into CLUSTER_X by CLUSTER_Y screen tiles and
+CLUSTER_Z slices, spaced exponentially in depth. Each frame every light is
+tested against every cluster box it could touch, and each cluster gets a
+list of the lights that reach it. The fragment shader then loops over the
+list for its own cluster only.
+
+USAGE:
+grid = clusterCreate()
+clusterSetProjection(grid, ...) when the projection changes
+clusterAssign(grid, viewSpaceLights, count) each frame, then upload
+grid->ranges and grid->indices
+clusterFree(grid)
+*/
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "lights.h"
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_TILES (CLUSTER_X * CLUSTER_Y)
+#define CLUSTER_COUNT (CLUSTER_TILES * CLUSTER_Z)
+/* Lights past this in one cluster are dropped and counted in droppedLights */
+#define CLUSTER_MAX_LIGHTS 128
+
+typedef struct ClusterGridType {
+	/* View space bounding box of each cluster, index x + y * X + z * X * Y */
+	float minX[CLUSTER_COUNT], maxX[CLUSTER_COUNT];
+	float minY[CLUSTER_COUNT], maxY[CLUSTER_COUNT];
+	float sliceNear[CLUSTER_Z], sliceFar[CLUSTER_Z]; /* distance along -z */
+	float zNear, zFar;
+
+	/* Output: offset and count into indices for each cluster */
+	unsigned int ranges[CLUSTER_COUNT * 2];
+	unsigned int* indices;
+	int numIndices;
+	int droppedLights;
+
+	/* Per slice working space, see cluster.c */
+	struct ClusterSliceType* slices;
+	int capacity; /* lights the slices have room for */
+} ClusterGrid;
+
+ClusterGrid* clusterCreate();
+void clusterFree(ClusterGrid* grid);
+
+/* Same arguments as gluPerspective */
+void clusterSetProjection(ClusterGrid* grid, float fovy, float aspect, float zNear, float zFar);
+
+/* lights must already be in view space */
+void clusterAssign(ClusterGrid* grid, const PointLight* lights, int count);
+
+#endif
@@ -0,0 +1,65 @@
+/* clusterbench.c - times clustered light assignment from 1 to 1024 lights
+
+Build with "make clusterbench". Needs no window or GL context. Lights and
+camera are the same as ass2-base's clustered mode at the default zoom.
+USAGE: clusterbench [threads], default one per core
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cluster.h"
+#include "lights.h"
+#include "parallel.h"
+#include "timer.h"
+
+#define MAX_LIGHTS 1024
+#define REPEATS 50
+
+static PointLight lights[MAX_LIGHTS];
+static PointLight viewLights[MAX_LIGHTS];
+
+/* Average seconds per clusterAssign over REPEATS animated frames */
+static double timeAssign(ClusterGrid* grid, const mat4_t* view, int count, int* indices)
+{
+	int i;
+	double start, total = 0.0;
+
+	for (i = 0; i < REPEATS; ++i) {
+		animateLights(lights, count, i / 60.0f);
+		transformLights(viewLights, lights, count, view);
+		start = timerNow();
+		clusterAssign(grid, viewLights, count);
+		total += timerNow() - start;
+	}
+	*indices = grid->numIndices;
+	return total / REPEATS;
+}
+
+int main(int argc, char** argv)
+{
+	ClusterGrid* grid = clusterCreate();
+	mat4_t view;
+	int count, serialIndices, indices, threads;
+	double serial, threaded;
+
+	mat4Identity(&view);
+	mat4Translate(&view, 0.0f, 0.0f, -5.0f);
+	clusterSetProjection(grid, 60.0f, 640.0f / 480.0f, 0.1f, 100.0f);
+
+	parallelInit(argc > 1 ? atoi(argv[1]) : 0);
+	threads = parallelThreads();
+	printf("%d clusters, %d threads\n", CLUSTER_COUNT, threads);
+	printf("%6s %12s %12s %8s %10s\n", "lights", "1 thread ms", "all ms", "speedup", "indices");
+	for (count = 1; count <= MAX_LIGHTS; count *= 2) {
+		parallelInit(1);
+		serial = timeAssign(grid, &view, count, &serialIndices);
+		parallelInit(threads);
+		threaded = timeAssign(grid, &view, count, &indices);
+		printf("%6d %12.3f %12.3f %8.2f %10d%s\n", count, serial * 1e3, threaded * 1e3, serial / threaded, indices,
+			indices == serialIndices ? "" : " MISMATCH");
+	}
+	parallelCleanup();
+	clusterFree(grid);
+	return 0;
+}
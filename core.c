@@ -0,0 +1,284 @@
+/* core.c - core profile rendering backend */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef __APPLE__
+#include <GL/glew.h>
+#endif
+
+#include "core.h"
+#include "shaders.h"
+#include "resources.h"
+#include "shadow.h"
+
+/* Uniform block binding points */
+#define TRANSFORM_BINDING 0
+#define LIGHTING_BINDING 1
+
+/* Texture units for the clustered light buffers */
+#define LIGHTS_UNIT 0
+#define RANGES_UNIT 1
+#define INDICES_UNIT 2
+
+/* Program variants, or'd together to index programs */
+#define VARIANT_FLAT 1
+#define VARIANT_CLUSTERED 2
+#define NUM_VARIANTS 4
+
+/* std140 mirror of the Transform block in core.vert */
+typedef struct {
+	mat4_t modelView;
+	mat4_t projection;
+	mat4_t normalMatrix;
+} CoreTransform;
+
+static GLuint programs[NUM_VARIANTS];
+static GLuint currentProgram; /* chosen by coreBeginFrame */
+static GLuint transformBuffer;
+static GLuint lightingBuffer;
+
+/* Clustered lights: buffers and the texture buffer views onto them */
+static GLuint clusterBuffers[3]; /* lights, ranges, indices */
+static GLuint clusterTextures[3];
+static size_t clusterSizes[3]; /* bytes, for the resource tracker */
+static int clusterViewport[2];
+static float clusterDepth[2]; /* near, log(far / near) */
+static int clusterBound = 0; /* textures bound by coreBeginFrame */
+
+/* Shadow map for the next frames, 0 for none */
+static GLuint shadowTexture = 0;
+static mat4_t shadowMatrix;
+static int shadowBound = 0;
+
+void coreDefaultLighting(CoreLighting* lighting)
+{
+	static const float black[] = {0.0, 0.0, 0.0, 1.0};
+	static const float white[] = {1.0, 1.0, 1.0, 1.0};
+	static const float attenuation[] = {1.0, 0.0, 0.0, 0.0};
+	static const float global[] = {0.2, 0.2, 0.2, 1.0};
+
+	memset(lighting, 0, sizeof(CoreLighting));
+	memcpy(lighting->lightAmbient, black, sizeof(black));
+	memcpy(lighting->lightDiffuse, white, sizeof(white));
+	memcpy(lighting->lightSpecular, white, sizeof(white));
+	memcpy(lighting->lightAttenuation, attenuation, sizeof(attenuation));
+	memcpy(lighting->globalAmbient, global, sizeof(global));
+	lighting->lighting = 1;
+}
+
+static GLuint buildProgram(const char* defines)
+{
+	GLuint program = getShaderDefines("core.vert", "core.frag", defines);
+	if (!program)
+		return 0;
+
+	/* GLSL 1.50 can't give attribute locations in the shader, so bind to
+	 * match buildObjectVertexArray and link again */
+	glBindAttribLocation(program, 0, "position");
+	glBindAttribLocation(program, 1, "normal");
+	glBindFragDataLocation(program, 0, "fragColor");
+	glLinkProgram(program);
+
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Transform"), TRANSFORM_BINDING);
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lighting"), LIGHTING_BINDING);
+
+	/* Samplers never change units */
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "clusterLights"), LIGHTS_UNIT);
+	glUniform1i(glGetUniformLocation(program, "clusterRanges"), RANGES_UNIT);
+	glUniform1i(glGetUniformLocation(program, "clusterIndices"), INDICES_UNIT);
+	glUniform3i(glGetUniformLocation(program, "clusterDims"), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+	glUniform1i(glGetUniformLocation(program, "shadowMap"), SHADOW_UNIT);
+	glUseProgram(0);
+	return program;
+}
+
+int coreInit()
+{
+	static const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+	int i;
+
+	programs[0] = buildProgram(NULL);
+	programs[VARIANT_FLAT] = buildProgram("#define FLAT\n");
+	programs[VARIANT_CLUSTERED] = buildProgram("#define CLUSTERED\n");
+	programs[VARIANT_FLAT | VARIANT_CLUSTERED] = buildProgram("#define FLAT\n#define CLUSTERED\n");
+	for (i = 0; i < NUM_VARIANTS; ++i) {
+		if (!programs[i]) {
+			coreCleanup();
+			return 0;
+		}
+	}
+
+	/* Buffers stay bound to their binding points for good */
+	glGenBuffers(1, &transformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, transformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CoreTransform), NULL, GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &lightingBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightingBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CoreLighting), NULL, GL_DYNAMIC_DRAW);
+	resourceAlloc(RES_SHADERS, RES_GPU, sizeof(CoreTransform) + sizeof(CoreLighting));
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, TRANSFORM_BINDING, transformBuffer);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTING_BINDING, lightingBuffer);
+
+	glGenBuffers(3, clusterBuffers);
+	glGenTextures(3, clusterTextures);
+	for (i = 0; i < 3; ++i) {
+		glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		clusterSizes[i] = 16;
+		resourceAlloc(RES_TEXTURES, RES_GPU, clusterSizes[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, clusterTextures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], clusterBuffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	return 1;
+}
+
+/* Replaces a texture buffer's contents. Orphaning the old store lets the
+ * driver keep it for frames still in flight */
+static void uploadClusterBuffer(int i, const void* data, size_t size)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffers[i]);
+	glBufferData(GL_TEXTURE_BUFFER, size ? size : 16, NULL, GL_STREAM_DRAW);
+	resourceFree(RES_TEXTURES, RES_GPU, clusterSizes[i]);
+	clusterSizes[i] = size ? size : 16;
+	resourceAlloc(RES_TEXTURES, RES_GPU, clusterSizes[i]);
+	if (size)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+}
+
+void coreSetClusters(const ClusterGrid* grid, const PointLight* lights, int count, int width, int height)
+{
+	/* PointLight is already two RGBA texels: position and radius, colour */
+	uploadClusterBuffer(0, lights, sizeof(PointLight) * count);
+	uploadClusterBuffer(1, grid->ranges, sizeof(grid->ranges));
+	uploadClusterBuffer(2, grid->indices, sizeof(unsigned int) * grid->numIndices);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	draw_gl_calls += 10;
+
+	clusterViewport[0] = width;
+	clusterViewport[1] = height;
+	clusterDepth[0] = grid->zNear;
+	clusterDepth[1] = logf(grid->zFar / grid->zNear);
+}
+
+void coreSetShadow(const mat4_t* matrix, GLuint texture)
+{
+	shadowTexture = texture;
+	if (texture)
+		shadowMatrix = *matrix;
+}
+
+void coreBeginFrame(const mat4_t* projection, const mat4_t* modelView, const CoreLighting* lighting, int flat, int clustered)
+{
+	CoreTransform transform;
+	GLuint program = programs[(flat ? VARIANT_FLAT : 0) | (clustered ? VARIANT_CLUSTERED : 0)];
+
+	transform.modelView = *modelView;
+	transform.projection = *projection;
+	/* Only rotations and translations are used, so the rotation part of the
+	 * modelview is already its own inverse transpose */
+	transform.normalMatrix = *modelView;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, transformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CoreTransform), &transform);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightingBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CoreLighting), lighting);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "renderPass"), PASS_SHADE);
+	glUniform1i(glGetUniformLocation(program, "shadows"), shadowTexture != 0);
+	currentProgram = program;
+	draw_gl_calls += 10;
+
+	if (shadowTexture) {
+		glUniformMatrix4fv(glGetUniformLocation(program, "shadowMatrix"), 1, GL_FALSE, shadowMatrix.m);
+		glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+		glBindTexture(GL_TEXTURE_2D, shadowTexture);
+		glActiveTexture(GL_TEXTURE0);
+		shadowBound = 1;
+		draw_gl_calls += 5;
+	}
+
+	if (clustered) {
+		int i;
+		for (i = 0; i < 3; ++i) {
+			glActiveTexture(GL_TEXTURE0 + LIGHTS_UNIT + i);
+			glBindTexture(GL_TEXTURE_BUFFER, clusterTextures[i]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glUniform2f(glGetUniformLocation(program, "clusterViewport"), clusterViewport[0], clusterViewport[1]);
+		glUniform2f(glGetUniformLocation(program, "clusterDepth"), clusterDepth[0], clusterDepth[1]);
+		clusterBound = 1;
+		draw_gl_calls += 11;
+	}
+}
+
+void coreSetRenderPass(enum RenderPass pass)
+{
+	glUniform1i(glGetUniformLocation(currentProgram, "renderPass"), pass);
+	draw_gl_calls += 2;
+}
+
+void coreDrawObject(Object* obj)
+{
+	if (!obj->vertexArray)
+		buildObjectVertexArray(obj);
+
+	glBindVertexArray(obj->vertexArray);
+	drawObjectElements(obj);
+	draw_gl_calls += 2;
+}
+
+void coreEndFrame()
+{
+	int i;
+	if (clusterBound) {
+		for (i = 0; i < 3; ++i) {
+			glActiveTexture(GL_TEXTURE0 + LIGHTS_UNIT + i);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		clusterBound = 0;
+		draw_gl_calls += 7;
+	}
+	if (shadowBound) {
+		/* Unbound before the map is next rendered into */
+		glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+		shadowBound = 0;
+		draw_gl_calls += 3;
+	}
+	glBindVertexArray(0);
+	glUseProgram(0);
+	draw_gl_calls += 2;
+}
+
+void coreCleanup()
+{
+	int i;
+	for (i = 0; i < NUM_VARIANTS; ++i) {
+		freeShader(programs[i]);
+		programs[i] = 0;
+	}
+	if (transformBuffer) {
+		glDeleteBuffers(1, &transformBuffer);
+		glDeleteBuffers(1, &lightingBuffer);
+		resourceFree(RES_SHADERS, RES_GPU, sizeof(CoreTransform) + sizeof(CoreLighting));
+	}
+	transformBuffer = lightingBuffer = 0;
+	if (clusterBuffers[0]) {
+		glDeleteBuffers(3, clusterBuffers);
+		glDeleteTextures(3, clusterTextures);
+		for (i = 0; i < 3; ++i)
+			resourceFree(RES_TEXTURES, RES_GPU, clusterSizes[i]);
+	}
+	memset(clusterBuffers, 0, sizeof(clusterBuffers));
+	memset(clusterTextures, 0, sizeof(clusterTextures));
+}
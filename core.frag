@@ -0,0 +1,146 @@
+#version 150
+// core.frag
+
+// Per pixel half of core.vert. See there for the uniform blocks.
+// CLUSTERED: also adds the point lights listed for this pixel's cluster,
+// see cluster.h for the grid layout
+
+#ifdef FLAT
+#define SHADE flat
+#else
+#define SHADE
+#endif
+
+layout(std140) uniform Lighting
+{
+  vec4 lightPosition;
+  vec4 lightAmbient;
+  vec4 lightDiffuse;
+  vec4 lightSpecular;
+  vec4 lightAttenuation;
+  vec4 globalAmbient;
+  vec4 materialAmbient;
+  vec4 materialDiffuse;
+  vec4 materialSpecular;
+  float materialShininess;
+  int lightingModel;
+  int shaderType;
+  int viewer;
+  int normalView;
+  int lighting;
+};
+
+SHADE in vec4 vertexColor;
+SHADE in vec3 ecNormal;
+in vec3 ecPos;
+in vec4 shadowCoord;
+
+out vec4 fragColor;
+
+uniform int renderPass; // see enum RenderPass in core.h
+uniform int shadows; // as in core.vert
+uniform sampler2DShadow shadowMap;
+
+#ifdef CLUSTERED
+uniform samplerBuffer clusterLights; // view space position and radius, then colour
+uniform usamplerBuffer clusterRanges; // offset and count into clusterIndices
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterViewport;
+uniform vec2 clusterDepth; // near, log(far / near)
+#endif
+
+// Blinn-Phong or Phong specular term for unit vectors
+float specular(vec3 n, vec3 l, vec3 eye)
+{
+  float spec;
+  if (lightingModel == 0)
+    spec = max(dot(n, normalize(l + eye)), 0.0);
+  else
+    spec = max(dot(normalize(-reflect(l, n)), eye), 0.0);
+  return pow(spec, materialShininess);
+}
+
+// lit scales light 0's diffuse and specular, 0 in shadow
+vec4 shade(vec3 n, vec3 p, float lit)
+{
+  vec3 lightDir;
+  float lightAtt = 1.0;
+  vec4 color;
+
+  if (lightPosition.w != 0.0) // Positional light
+  {
+    lightDir = lightPosition.xyz - p;
+    float dist = length(lightDir);
+    lightAtt = min(1.0 / (lightAttenuation.x + lightAttenuation.y * dist + lightAttenuation.z * dist * dist), 1.0);
+  }
+  else // Directional light
+    lightDir = lightPosition.xyz;
+
+  vec3 l = normalize(lightDir);
+  vec3 eye = viewer == 1 ? normalize(-p) : vec3(0.0, 0.0, 1.0);
+
+  // Ambient and diffuse
+  float NdotL = max(dot(n, l), 0.0);
+  color = materialAmbient * globalAmbient + lightAtt * materialAmbient * lightAmbient;
+  color += lit * lightAtt * NdotL * materialDiffuse * lightDiffuse;
+
+  // Specular
+  if (NdotL > 0.0)
+    color += lit * lightAtt * materialSpecular * lightSpecular * specular(n, l, eye);
+  return color;
+}
+
+#ifdef CLUSTERED
+// Diffuse and specular from the point lights in p's cluster
+vec4 shadeClustered(vec3 n, vec3 p)
+{
+  vec3 eye = viewer == 1 ? normalize(-p) : vec3(0.0, 0.0, 1.0);
+  ivec3 cell;
+  cell.xy = ivec2(gl_FragCoord.xy / clusterViewport * vec2(clusterDims.xy));
+  cell.z = int(log(-p.z / clusterDepth.x) / clusterDepth.y * float(clusterDims.z));
+  cell = clamp(cell, ivec3(0), clusterDims - 1);
+
+  uvec2 range = texelFetch(clusterRanges, cell.x + clusterDims.x * (cell.y + clusterDims.y * cell.z)).xy;
+  vec4 color = vec4(0.0);
+  for (uint i = 0u; i < range.y; ++i)
+  {
+    int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+    vec4 positionRadius = texelFetch(clusterLights, light * 2);
+    vec4 lightColor = texelFetch(clusterLights, light * 2 + 1);
+
+    vec3 lightDir = positionRadius.xyz - p;
+    float dist = length(lightDir);
+    if (dist >= positionRadius.w)
+      continue;
+
+    // The usual attenuation, windowed to reach zero at the light's radius
+    // so cutting it off at the cluster boundary doesn't show
+    float window = 1.0 - pow(dist / positionRadius.w, 4.0);
+    float lightAtt = window * window / (lightAttenuation.x + lightAttenuation.y * dist + lightAttenuation.z * dist * dist);
+
+    vec3 l = lightDir / dist;
+    float NdotL = max(dot(n, l), 0.0);
+    color += lightAtt * NdotL * materialDiffuse * lightColor;
+    if (NdotL > 0.0)
+      color += lightAtt * materialSpecular * lightColor * specular(n, l, eye);
+  }
+  return vec4(color.rgb, 0.0);
+}
+#endif
+
+void main(void)
+{
+  if (renderPass != 0) {
+    fragColor = vec4(renderPass == 2 ? 1.0 / 255.0 : 0.0);
+    return;
+  }
+  if (shaderType == 1 && normalView == 0 && lighting == 1)
+    fragColor = shade(normalize(ecNormal), ecPos, shadows == 1 ? textureProj(shadowMap, shadowCoord) : 1.0);
+  else
+    fragColor = vertexColor;
+#ifdef CLUSTERED
+  if (normalView == 0 && lighting == 1)
+    fragColor += shadeClustered(normalize(ecNormal), ecPos);
+#endif
+}
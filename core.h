@@ -0,0 +1,77 @@
+/* core.h - core profile rendering backend
+
+Draws createObject objects with only core profile GL: one VAO per object,
+built on first draw, and uniform blocks for matrices, light and material
+filled once per frame. The fixed pipeline path needs client array setup and
+buffer binds per draw, and the driver uploads the gl_ModelViewMatrix,
+gl_LightSource and gl_FrontMaterial built-ins behind the scenes.
+
+USAGE:
+coreInit() once with a context current
+each frame: coreBeginFrame(), coreDrawObject() per object, coreEndFrame()
+for clustered lighting call coreSetClusters() before coreBeginFrame(), for
+shadows coreSetShadow()
+coreCleanup() to free resources
+*/
+
+#ifndef CORE_H
+#define CORE_H
+
+#include "objects.h"
+#include "matrix.h"
+#include "cluster.h"
+
+/* std140 mirror of the Lighting block in core.vert and core.frag. std140
+ * rounds the block up to a multiple of 16 bytes, hence the padding */
+#define CORE_LIGHTING_BLOCK_SIZE 176
+typedef struct {
+	float lightPosition[4]; /* eye space, w = 0 for directional */
+	float lightAmbient[4];
+	float lightDiffuse[4];
+	float lightSpecular[4];
+	float lightAttenuation[4]; /* constant, linear, quadratic */
+	float globalAmbient[4];
+	float materialAmbient[4];
+	float materialDiffuse[4];
+	float materialSpecular[4];
+	float materialShininess;
+	int lightingModel;
+	int shaderType;
+	int viewer;
+	int normalView;
+	int lighting;
+	int pad[2];
+} CoreLighting;
+
+/* Fails to compile if the struct and the block drift apart */
+typedef char CoreLightingSizeCheck[sizeof(CoreLighting) == CORE_LIGHTING_BLOCK_SIZE ? 1 : -1];
+
+/* What the fragment shaders write: the lit colour, nothing for a depth
+ * pre-pass, or 1/255 per fragment for additive overdraw counting. Also the
+ * values of shader.frag's render_pass */
+enum RenderPass {
+	PASS_SHADE = 0,
+	PASS_DEPTH,
+	PASS_COUNT
+};
+
+/* Fills in the light parameters the fixed pipeline uses for GL_LIGHT0 by default */
+void coreDefaultLighting(CoreLighting* lighting);
+
+/* Returns 0 if the shaders failed to build */
+int coreInit();
+/* Uploads view space point lights and their cluster lists for the next
+ * clustered frame. width and height are the viewport size */
+void coreSetClusters(const ClusterGrid* grid, const PointLight* lights, int count, int width, int height);
+/* Shadows light 0 from texture, a shadow.h map looked up with matrix, in
+ * the frames begun after it. texture 0 turns shadows off */
+void coreSetShadow(const mat4_t* matrix, GLuint texture);
+/* clustered adds the coreSetClusters lights to light 0, always per pixel */
+void coreBeginFrame(const mat4_t* projection, const mat4_t* modelView, const CoreLighting* lighting, int flat, int clustered);
+/* For the coreDrawObject calls after it, until the next coreBeginFrame */
+void coreSetRenderPass(enum RenderPass pass);
+void coreDrawObject(Object* obj);
+void coreEndFrame();
+void coreCleanup();
+
+#endif
@@ -0,0 +1,106 @@
+#version 150
+// core.vert
+
+// Core profile lighting. Matrices, light and material come from uniform
+// blocks filled once per frame instead of fixed pipeline state.
+// FLAT: no interpolation, like glShadeModel(GL_FLAT)
+
+#ifdef FLAT
+#define SHADE flat
+#else
+#define SHADE
+#endif
+
+layout(std140) uniform Transform
+{
+  mat4 modelView;
+  mat4 projection;
+  mat4 normalMatrix; // upper 3x3 used
+};
+
+layout(std140) uniform Lighting
+{
+  vec4 lightPosition; // eye space, w = 0 for directional
+  vec4 lightAmbient;
+  vec4 lightDiffuse;
+  vec4 lightSpecular;
+  vec4 lightAttenuation; // constant, linear, quadratic
+  vec4 globalAmbient;
+  vec4 materialAmbient;
+  vec4 materialDiffuse;
+  vec4 materialSpecular;
+  float materialShininess;
+  int lightingModel; // Blinn-Phong(0), Phong(1)
+  int shaderType; // Vertex (0), Fragment(1)
+  int viewer; // infinite(0) or local(1)
+  int normalView; // normal-visual-disabled(0), normal-visual-enabled(1)
+  int lighting; // fixed white when 0, like glDisable(GL_LIGHTING)
+};
+
+// Shadow map of light 0, see shadow.h. Outside the blocks, since they
+// change when the map is rendered again rather than every frame
+uniform int shadows; // unshadowed(0) or shadowed(1)
+uniform mat4 shadowMatrix; // object space to shadow map coordinates
+uniform sampler2DShadow shadowMap;
+
+in vec3 position;
+in vec3 normal;
+
+SHADE out vec4 vertexColor;
+SHADE out vec3 ecNormal;
+out vec3 ecPos;
+out vec4 shadowCoord;
+
+// lit scales light 0's diffuse and specular, 0 in shadow
+vec4 shade(vec3 n, vec3 p, float lit)
+{
+  vec3 lightDir;
+  float lightAtt = 1.0;
+  vec4 color;
+
+  if (lightPosition.w != 0.0) // Positional light
+  {
+    lightDir = lightPosition.xyz - p;
+    float dist = length(lightDir);
+    lightAtt = 1.0 / (lightAttenuation.x + lightAttenuation.y * dist + lightAttenuation.z * dist * dist);
+  }
+  else // Directional light
+    lightDir = lightPosition.xyz;
+
+  vec3 l = normalize(lightDir);
+  vec3 eye = viewer == 1 ? normalize(-p) : vec3(0.0, 0.0, 1.0);
+
+  // Ambient and diffuse
+  float NdotL = max(dot(n, l), 0.0);
+  color = materialAmbient * globalAmbient + lightAtt * materialAmbient * lightAmbient;
+  color += lit * lightAtt * NdotL * materialDiffuse * lightDiffuse;
+
+  // Specular
+  if (NdotL > 0.0)
+  {
+    float spec;
+    if (lightingModel == 0)
+      spec = max(dot(n, normalize(l + eye)), 0.0);
+    else
+      spec = max(dot(normalize(-reflect(l, n)), eye), 0.0);
+    color += lit * lightAtt * materialSpecular * lightSpecular * pow(spec, materialShininess);
+  }
+  return color;
+}
+
+void main(void)
+{
+  vec4 ec = modelView * vec4(position, 1.0);
+  ecPos = ec.xyz;
+  ecNormal = normalize(mat3(normalMatrix) * normal);
+  shadowCoord = shadowMatrix * vec4(position, 1.0);
+
+  if (normalView == 1)
+    vertexColor = vec4((ecNormal + 1.0) / 2.0, 1.0);
+  else if (lighting == 0)
+    vertexColor = vec4(1.0);
+  else if (shaderType == 0)
+    vertexColor = shade(ecNormal, ecPos, shadows == 1 ? textureProjLod(shadowMap, shadowCoord, 0.0) : 1.0);
+
+  gl_Position = projection * ec;
+}
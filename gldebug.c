@@ -0,0 +1,243 @@
+/* gldebug.c - GL errors and warnings reported by the driver, as they happen */
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef __APPLE__
+#include <GL/glew.h>
+#endif
+#include <GLUT/glut.h> /* Mac OS X */
+
+#include "gldebug.h"
+
+#ifdef GL_KHR_debug
+
+/* Distinct messages remembered as printed. Past this, repeats print again */
+#define DEBUG_SEEN_LENGTH 256
+
+typedef struct {
+	unsigned int sequence; /* position + 1 when filled, + DEBUG_RING_LENGTH when free */
+	GLenum source, type, severity;
+	GLuint id;
+	const char* scope;
+	char text[DEBUG_MESSAGE_LENGTH];
+} DebugMessage;
+
+static DebugMessage ring[DEBUG_RING_LENGTH];
+/* Producers claim positions with a compare and swap on head. There is one
+ * consumer, the flush, so tail is its own. Apart so they don't false-share */
+static struct {
+	char pad0[64];
+	unsigned int head;
+	char pad1[64];
+	unsigned int tail;
+	char pad2[64];
+} cursor;
+
+static const char* scopes[DEBUG_SCOPE_DEPTH];
+static int depth;
+static int enabled;
+static DebugCounts counts;
+
+static struct {
+	GLenum source, type;
+	GLuint id;
+} seen[DEBUG_SEEN_LENGTH];
+static int numSeen;
+
+static const char* sourceName(GLenum source)
+{
+	switch (source) {
+	case GL_DEBUG_SOURCE_API: return "API";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+	case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+	case GL_DEBUG_SOURCE_APPLICATION: return "application";
+	default: return "other";
+	}
+}
+
+static const char* typeName(GLenum type)
+{
+	switch (type) {
+	case GL_DEBUG_TYPE_ERROR: return "error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behaviour";
+	case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+	case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+	default: return "other";
+	}
+}
+
+static const char* severityName(GLenum severity)
+{
+	switch (severity) {
+	case GL_DEBUG_SEVERITY_HIGH: return "high";
+	case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+	case GL_DEBUG_SEVERITY_LOW: return "low";
+	default: return "notification";
+	}
+}
+
+/* Any thread, any time. Counts, then copies into a free slot if there is one */
+static void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar* message, const void* user)
+{
+	unsigned int position = __atomic_load_n(&cursor.head, __ATOMIC_RELAXED);
+	DebugMessage* slot;
+	int d;
+	(void)user;
+
+	if (type == GL_DEBUG_TYPE_ERROR)
+		__atomic_add_fetch(&counts.errors, 1, __ATOMIC_RELAXED);
+	else if (type == GL_DEBUG_TYPE_PERFORMANCE)
+		__atomic_add_fetch(&counts.performance, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&counts.warnings, 1, __ATOMIC_RELAXED);
+
+	for (;;) {
+		int ahead;
+		slot = &ring[position % DEBUG_RING_LENGTH];
+		ahead = (int)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+		if (ahead == 0) {
+			/* Free, and ours if no other producer got there first */
+			if (__atomic_compare_exchange_n(&cursor.head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (ahead < 0) {
+			/* Still holding a message from a lap ago: full */
+			__atomic_add_fetch(&counts.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else
+			position = __atomic_load_n(&cursor.head, __ATOMIC_RELAXED);
+	}
+
+	slot->source = source;
+	slot->type = type;
+	slot->id = id;
+	slot->severity = severity;
+	d = __atomic_load_n(&depth, __ATOMIC_ACQUIRE);
+	if (d > DEBUG_SCOPE_DEPTH)
+		d = DEBUG_SCOPE_DEPTH;
+	slot->scope = d > 0 ? __atomic_load_n(&scopes[d - 1], __ATOMIC_RELAXED) : "frame";
+	if (length < 0)
+		length = (GLsizei)strlen(message);
+	if (length >= DEBUG_MESSAGE_LENGTH)
+		length = DEBUG_MESSAGE_LENGTH - 1;
+	memcpy(slot->text, message, length);
+	slot->text[length] = '\0';
+	/* Release publishes the message with its sequence */
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns 1 the first time a message is seen */
+static int firstSeen(const DebugMessage* m)
+{
+	int i;
+	for (i = 0; i < numSeen; ++i)
+		if (seen[i].id == m->id && seen[i].source == m->source && seen[i].type == m->type)
+			return 0;
+	if (numSeen < DEBUG_SEEN_LENGTH) {
+		seen[numSeen].source = m->source;
+		seen[numSeen].type = m->type;
+		seen[numSeen].id = m->id;
+		numSeen++;
+	}
+	return 1;
+}
+
+int debugInit()
+{
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	unsigned int i;
+
+	if (!extensions || !strstr(extensions, "GL_KHR_debug"))
+		return 0;
+	for (i = 0; i < DEBUG_RING_LENGTH; ++i)
+		ring[i].sequence = i;
+	cursor.head = cursor.tail = 0;
+
+	glDebugMessageCallback((GLDEBUGPROC)debugCallback, NULL);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+	glEnable(GL_DEBUG_OUTPUT);
+#ifdef GL_ERROR_CHECKS
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#else
+	glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+	enabled = 1;
+	return 1;
+}
+
+void debugScopePush(const char* name)
+{
+	if (depth < DEBUG_SCOPE_DEPTH)
+		__atomic_store_n(&scopes[depth], name, __ATOMIC_RELAXED);
+	/* Release so the callback sees the name with the new depth */
+	__atomic_store_n(&depth, depth + 1, __ATOMIC_RELEASE);
+}
+
+void debugScopePop()
+{
+	__atomic_store_n(&depth, depth - 1, __ATOMIC_RELEASE);
+}
+
+int debugFlush()
+{
+	int printed = 0;
+	DebugMessage* slot;
+
+	if (!enabled)
+		return 0;
+	for (;;) {
+		slot = &ring[cursor.tail % DEBUG_RING_LENGTH];
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != cursor.tail + 1)
+			break;
+		if (firstSeen(slot)) {
+			printf("GL %s %s 0x%x (%s) in %s: %s\n", sourceName(slot->source), typeName(slot->type),
+				slot->id, severityName(slot->severity), slot->scope, slot->text);
+			printed++;
+		} else
+			__atomic_add_fetch(&counts.repeats, 1, __ATOMIC_RELAXED);
+		/* Free for the producers' next lap */
+		__atomic_store_n(&slot->sequence, cursor.tail + DEBUG_RING_LENGTH, __ATOMIC_RELEASE);
+		cursor.tail++;
+	}
+	return printed;
+}
+
+void debugCounts(DebugCounts* out)
+{
+	out->errors = __atomic_load_n(&counts.errors, __ATOMIC_RELAXED);
+	out->performance = __atomic_load_n(&counts.performance, __ATOMIC_RELAXED);
+	out->warnings = __atomic_load_n(&counts.warnings, __ATOMIC_RELAXED);
+	out->repeats = __atomic_load_n(&counts.repeats, __ATOMIC_RELAXED);
+	out->dropped = __atomic_load_n(&counts.dropped, __ATOMIC_RELAXED);
+}
+
+#else
+
+int debugInit()
+{
+	return 0;
+}
+
+void debugScopePush(const char* name)
+{
+	(void)name;
+}
+
+void debugScopePop()
+{
+}
+
+int debugFlush()
+{
+	return 0;
+}
+
+void debugCounts(DebugCounts* out)
+{
+	memset(out, 0, sizeof(DebugCounts));
+}
+
+#endif
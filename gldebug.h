@@ -0,0 +1,58 @@
+/* gldebug.h - GL errors and warnings reported by the driver, as they happen
+
+Polling glGetError after every frame asks the driver for its error state,
+which on some drivers waits for the command stream to catch up, and it
+only ever says that something went wrong, not what. KHR_debug has the
+driver call back instead, with the source, type, severity and a message,
+including performance warnings glGetError never sees.
+
+The callback can run on a driver thread, or several, so it does no more
+than copy the message into a fixed ring of slots, lock free with a
+sequence number per slot, tagged with the innermost scope the application
+pushed. debugFlush, once a frame, prints what arrived. Each distinct
+message is printed the first time only and counted after that, so a
+warning raised every frame doesn't drown the console. When the ring is
+full messages are dropped and counted. Notifications are turned off at
+the driver, so they cost nothing.
+
+Messages arrive asynchronously, and the scope is the one current when the
+callback ran, which may be a little after the call that raised it.
+Building with GL_ERROR_CHECKS makes the output synchronous as well, so
+scopes are exact, at some cost to the driver.
+
+Without KHR_debug at build time (Mac OS X's GL 2.1) or at run time,
+debugInit returns 0 and the rest does nothing.
+
+USAGE:
+debugInit() once, with the context current
+debugScopePush("name"), debugScopePop() around passes, names must outlive
+the scope (string literals)
+debugFlush() once a frame on the thread drawing it
+debugCounts(&counts) from any thread, for the OSD
+*/
+
+#ifndef GLDEBUG_H
+#define GLDEBUG_H
+
+#define DEBUG_RING_LENGTH 256 /* messages between flushes */
+#define DEBUG_MESSAGE_LENGTH 192 /* longer ones are cut */
+#define DEBUG_SCOPE_DEPTH 16
+
+/* Totals since debugInit */
+typedef struct {
+	unsigned int errors;
+	unsigned int performance;
+	unsigned int warnings; /* anything else, deprecated or undefined behaviour, portability */
+	unsigned int repeats; /* counted above but not printed again */
+	unsigned int dropped; /* counted above but the ring was full */
+} DebugCounts;
+
+/* Returns 1 if the driver reports through the callback */
+int debugInit();
+void debugScopePush(const char* name);
+void debugScopePop();
+/* Prints the messages queued since the last flush and returns how many */
+int debugFlush();
+void debugCounts(DebugCounts* counts);
+
+#endif
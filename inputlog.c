@@ -0,0 +1,212 @@
+/* inputlog.c - recorded input, replayed frame for frame */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "inputlog.h"
+
+static void put16(unsigned char* p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char* p, unsigned int v)
+{
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+
+static unsigned int get16(const unsigned char* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned int get32(const unsigned char* p)
+{
+	return get16(p) | get16(p + 2) << 16;
+}
+
+/* Record: frame, time in microseconds, type, state, button, pad, key, key
+ * modifiers, x, y, xrel, yrel. Resizes keep the size in x and y */
+static void encode(unsigned char* r, unsigned int frame, double seconds, const SDL_Event* e)
+{
+	memset(r, 0, INPUT_LOG_RECORD);
+	put32(r, frame);
+	put32(r + 4, (unsigned int)(seconds * 1e6));
+	r[8] = e->type;
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		r[9] = e->key.state;
+		put16(r + 12, e->key.keysym.sym);
+		put16(r + 14, e->key.keysym.mod);
+		break;
+	case SDL_MOUSEMOTION:
+		r[9] = e->motion.state;
+		put16(r + 16, e->motion.x);
+		put16(r + 18, e->motion.y);
+		put16(r + 20, (Uint16)e->motion.xrel);
+		put16(r + 22, (Uint16)e->motion.yrel);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		r[9] = e->button.state;
+		r[10] = e->button.button;
+		put16(r + 16, e->button.x);
+		put16(r + 18, e->button.y);
+		break;
+	case SDL_ACTIVEEVENT:
+		r[9] = e->active.state;
+		r[10] = e->active.gain;
+		break;
+	case SDL_VIDEORESIZE:
+		put16(r + 16, e->resize.w);
+		put16(r + 18, e->resize.h);
+		break;
+	}
+}
+
+static void decode(const unsigned char* r, SDL_Event* e)
+{
+	memset(e, 0, sizeof(*e));
+	e->type = r[8];
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		e->key.state = r[9];
+		e->key.keysym.sym = (SDLKey)get16(r + 12);
+		e->key.keysym.mod = (SDLMod)get16(r + 14);
+		break;
+	case SDL_MOUSEMOTION:
+		e->motion.state = r[9];
+		e->motion.x = get16(r + 16);
+		e->motion.y = get16(r + 18);
+		e->motion.xrel = (Sint16)get16(r + 20);
+		e->motion.yrel = (Sint16)get16(r + 22);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		e->button.state = r[9];
+		e->button.button = r[10];
+		e->button.x = get16(r + 16);
+		e->button.y = get16(r + 18);
+		break;
+	case SDL_ACTIVEEVENT:
+		e->active.state = r[9];
+		e->active.gain = r[10];
+		break;
+	case SDL_VIDEORESIZE:
+		e->resize.w = get16(r + 16);
+		e->resize.h = get16(r + 18);
+		break;
+	}
+}
+
+/* Reads the record after the ones handed out. A log cut short ends there */
+static void readAhead(InputLog* log)
+{
+	unsigned char r[INPUT_LOG_RECORD];
+
+	if (fread(r, INPUT_LOG_RECORD, 1, log->file) != 1) {
+		log->hasNext = 0;
+		log->ended = 1;
+		return;
+	}
+	log->hasNext = 1;
+	log->nextFrame = get32(r);
+	log->nextTime = get32(r + 4) * 1e-6;
+	decode(r, &log->next);
+	log->ended = log->next.type == SDL_NOEVENT;
+}
+
+InputLog* inputLogCreate(const char* path, int width, int height)
+{
+	unsigned char header[INPUT_LOG_HEADER];
+	InputLog* log;
+	FILE* file;
+
+	if (!(file = fopen(path, "wb")))
+		return NULL;
+	memcpy(header, INPUT_LOG_MAGIC, 8);
+	put32(header + 8, width);
+	put32(header + 12, height);
+	if (fwrite(header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+
+	log = (InputLog*)calloc(1, sizeof(InputLog));
+	log->file = file;
+	log->writing = 1;
+	log->width = width;
+	log->height = height;
+	return log;
+}
+
+InputLog* inputLogOpen(const char* path)
+{
+	unsigned char header[INPUT_LOG_HEADER];
+	InputLog* log;
+	FILE* file;
+
+	if (!(file = fopen(path, "rb")))
+		return NULL;
+	if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, INPUT_LOG_MAGIC, 8)) {
+		fclose(file);
+		return NULL;
+	}
+
+	log = (InputLog*)calloc(1, sizeof(InputLog));
+	log->file = file;
+	log->width = get32(header + 8);
+	log->height = get32(header + 12);
+	readAhead(log);
+	return log;
+}
+
+void inputLogWrite(InputLog* log, unsigned int frame, double seconds, const SDL_Event* event)
+{
+	unsigned char r[INPUT_LOG_RECORD];
+
+	/* The end marker is written by inputLogClose only */
+	if (event->type == SDL_NOEVENT)
+		return;
+	encode(r, frame, seconds, event);
+	fwrite(r, sizeof(r), 1, log->file);
+	log->events++;
+}
+
+int inputLogNext(InputLog* log, unsigned int frame, SDL_Event* event)
+{
+	if (!log->hasNext || log->ended || log->nextFrame > frame)
+		return 0;
+	*event = log->next;
+	log->events++;
+	readAhead(log);
+	return 1;
+}
+
+int inputLogEnded(const InputLog* log, unsigned int frame, double* seconds)
+{
+	if (seconds)
+		*seconds = log->ended && log->hasNext ? log->nextTime : 0.0;
+	if (!log->hasNext)
+		return 1;
+	return log->ended && frame >= log->nextFrame;
+}
+
+void inputLogClose(InputLog* log, unsigned int frames, double seconds)
+{
+	unsigned char r[INPUT_LOG_RECORD];
+	SDL_Event end;
+
+	if (log->writing) {
+		memset(&end, 0, sizeof(end));
+		end.type = SDL_NOEVENT;
+		encode(r, frames, seconds, &end);
+		fwrite(r, sizeof(r), 1, log->file);
+	}
+	fclose(log->file);
+	free(log);
+}
@@ -0,0 +1,66 @@
+/* inputlog.h - recorded input, replayed frame for frame
+
+Comparing performance by pressing keys and dragging the mouse by hand
+never gives quite the same run twice. The base loop can write every event
+it polls to a log, tagged with the main loop frame it was polled in, and
+later feed the log back in place of the window's events, on the same
+frames and with a fixed time step, so the camera path, mesh rebuilds and
+toggles come out the same on any build or machine.
+
+Layout, little endian whatever the machine: an INPUT_LOG_HEADER byte
+header of the magic and the window size, then one INPUT_LOG_RECORD byte
+record per event: frame, microseconds since recording started, the SDL
+event type and the fields the base loop and event() read. Key unicode and
+scancodes aren't kept. A record of type SDL_NOEVENT ends the log with the
+number of frames recorded and how long they took.
+
+USAGE:
+log = inputLogCreate(path, width, height), then each frame
+inputLogWrite(log, frame, seconds, &event) for every event polled, and
+inputLogClose(log, frames, seconds) after the last
+log = inputLogOpen(path), then each frame
+while (inputLogNext(log, frame, &event)) handle event, until
+inputLogEnded(log, frame, NULL); inputLogClose(log, 0, 0.0)
+*/
+
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <stdio.h>
+#include <SDL/SDL.h>
+
+#define INPUT_LOG_MAGIC "INPUTLG1"
+#define INPUT_LOG_HEADER 16 /* magic, width, height */
+#define INPUT_LOG_RECORD 24
+
+typedef struct {
+	FILE* file;
+	int writing;
+	int width, height; /* of the window when recording started */
+	unsigned int events; /* written or read so far */
+	/* Reading: the record after the ones handed out, read ahead */
+	int hasNext;
+	unsigned int nextFrame;
+	double nextTime;
+	SDL_Event next;
+	int ended; /* next is the end marker */
+} InputLog;
+
+/* NULL if the file can't be created or isn't a log */
+InputLog* inputLogCreate(const char* path, int width, int height);
+InputLog* inputLogOpen(const char* path);
+
+/* seconds since recording started */
+void inputLogWrite(InputLog* log, unsigned int frame, double seconds, const SDL_Event* event);
+
+/* Fills event with the next one polled on or before frame and returns 1,
+ * or returns 0 when the rest belong to later frames */
+int inputLogNext(InputLog* log, unsigned int frame, SDL_Event* event);
+/* Whether frame is past the last one recorded, or the log is cut short.
+ * Once ended, seconds, if not NULL, gets how long the recording ran */
+int inputLogEnded(const InputLog* log, unsigned int frame, double* seconds);
+
+/* frames and seconds recorded, ignored when reading */
+void inputLogClose(InputLog* log, unsigned int frames, double seconds);
+
+#endif
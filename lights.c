@@ -0,0 +1,59 @@
+/* lights.c - sets of animated point lights */
+
+#include <math.h>
+
+#include "lights.h"
+
+void animateLights(PointLight* lights, int count, float t)
+{
+	int i;
+	float pi = acosf(-1.0f);
+	float golden = pi * (3.0f - sqrtf(5.0f));
+	/* Fewer, bigger lights for small counts so coverage stays similar.
+	 * Intensity falls off so the total stays about the same */
+	float radius = 2.0f / cbrtf((float)count);
+	float intensity = 1.5f / sqrtf((float)count);
+
+	if (radius < 0.35f)
+		radius = 0.35f;
+	if (intensity > 1.0f)
+		intensity = 1.0f;
+
+	for (i = 0; i < count; ++i) {
+		/* Spread over a sphere shell with a golden angle spiral, each band
+		 * spinning at its own rate */
+		float y = count > 1 ? 1.0f - 2.0f * i / (float)(count - 1) : 0.0f;
+		float ring = sqrtf(1.0f - y * y);
+		float angle = golden * i + t * (0.3f + 0.7f * (i % 7) / 7.0f);
+		float orbit = 1.4f + 0.4f * sinf(i * 1.3f + t * 0.5f);
+		float hue = i * 0.618034f;
+
+		hue -= floorf(hue);
+		lights[i].position[0] = orbit * ring * cosf(angle);
+		lights[i].position[1] = orbit * y;
+		lights[i].position[2] = orbit * ring * sinf(angle);
+		lights[i].radius = radius;
+		/* Cheap hue to rgb */
+		lights[i].color[0] = intensity * (0.5f + 0.5f * cosf(2.0f * pi * hue));
+		lights[i].color[1] = intensity * (0.5f + 0.5f * cosf(2.0f * pi * (hue - 1.0f / 3.0f)));
+		lights[i].color[2] = intensity * (0.5f + 0.5f * cosf(2.0f * pi * (hue - 2.0f / 3.0f)));
+		lights[i].pad = 0.0f;
+	}
+}
+
+void transformLights(PointLight* out, const PointLight* lights, int count, const mat4_t* m)
+{
+	int i;
+	for (i = 0; i < count; ++i) {
+		float p[4], r[4];
+		p[0] = lights[i].position[0];
+		p[1] = lights[i].position[1];
+		p[2] = lights[i].position[2];
+		p[3] = 1.0f;
+		mat4TransformVec4(r, m, p);
+		out[i] = lights[i];
+		out[i].position[0] = r[0];
+		out[i].position[1] = r[1];
+		out[i].position[2] = r[2];
+	}
+}
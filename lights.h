@@ -0,0 +1,22 @@
+/* lights.h - sets of animated point lights */
+
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "matrix.h"
+
+typedef struct {
+	float position[3];
+	float radius; /* no contribution beyond this distance */
+	float color[3];
+	float pad;
+} PointLight;
+
+/* Fills lights with count lights orbiting the origin at time t (seconds).
+ * The same count and time always give the same lights. */
+void animateLights(PointLight* lights, int count, float t);
+
+/* Moves positions into the space m transforms to, eg. world to view */
+void transformLights(PointLight* out, const PointLight* lights, int count, const mat4_t* m);
+
+#endif
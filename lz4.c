@@ -0,0 +1,175 @@
+/* lz4.c - LZ4 block format compression */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5 /* the block always ends in this many literals */
+#define MATCH_LIMIT 12 /* no match starts in the last this many bytes */
+#define MAX_OFFSET 65535
+#define HASH_BITS 16
+#define SKIP_SHIFT 6 /* skip faster through data that doesn't compress */
+
+static unsigned int read32(const unsigned char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned int hash32(unsigned int v)
+{
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* A length field's extra bytes, after the 15 in its token nibble */
+static unsigned char* writeLength(unsigned char* op, const unsigned char* opEnd, size_t length)
+{
+	for (; length >= 255; length -= 255) {
+		if (op >= opEnd)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op >= opEnd)
+		return NULL;
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+/* Token, literals and, unless it is the last sequence, the match */
+static unsigned char* writeSequence(unsigned char* op, const unsigned char* opEnd,
+	const unsigned char* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+	unsigned char* token = op++;
+	int last = matchLength == 0;
+
+	if (op > opEnd)
+		return NULL;
+	*token = (unsigned char)((numLiterals >= 15 ? 15 : numLiterals) << 4);
+	if (numLiterals >= 15 && !(op = writeLength(op, opEnd, numLiterals - 15)))
+		return NULL;
+	if ((size_t)(opEnd - op) < numLiterals)
+		return NULL;
+	memcpy(op, literals, numLiterals);
+	op += numLiterals;
+	if (last)
+		return op;
+
+	if (opEnd - op < 2)
+		return NULL;
+	*op++ = (unsigned char)(offset & 0xff);
+	*op++ = (unsigned char)(offset >> 8);
+	matchLength -= MIN_MATCH;
+	*token |= (unsigned char)(matchLength >= 15 ? 15 : matchLength);
+	if (matchLength >= 15 && !(op = writeLength(op, opEnd, matchLength - 15)))
+		return NULL;
+	return op;
+}
+
+size_t lz4Bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const void* source, size_t size, void* dest, size_t capacity)
+{
+	const unsigned char* src = (const unsigned char*)source;
+	const unsigned char* ip = src;
+	const unsigned char* anchor = src; /* first byte not yet written */
+	const unsigned char* end = src + size;
+	const unsigned char* limit = size > MATCH_LIMIT ? end - MATCH_LIMIT : src;
+	unsigned char* op = (unsigned char*)dest;
+	unsigned char* opEnd = op + capacity;
+	size_t* table = (size_t*)calloc(1 << HASH_BITS, sizeof(size_t)); /* position + 1 */
+	unsigned int misses = 0;
+
+	while (ip < limit) {
+		unsigned int sequence = read32(ip);
+		unsigned int h = hash32(sequence);
+		size_t candidate = table[h];
+		const unsigned char* match = src + candidate - 1;
+		const unsigned char* p;
+
+		table[h] = ip - src + 1;
+		if (!candidate || ip - match > MAX_OFFSET || read32(match) != sequence) {
+			ip += 1 + (misses++ >> SKIP_SHIFT);
+			continue;
+		}
+		misses = 0;
+
+		for (p = ip + MIN_MATCH; p < end - LAST_LITERALS && *p == match[p - ip]; ++p)
+			;
+		op = writeSequence(op, opEnd, anchor, ip - anchor, ip - match, p - ip);
+		if (!op)
+			break;
+		anchor = ip = p;
+	}
+	if (op)
+		op = writeSequence(op, opEnd, anchor, end - anchor, 0, 0);
+	free(table);
+	return op ? (size_t)(op - (unsigned char*)dest) : 0;
+}
+
+int lz4Decompress(const void* source, size_t size, void* dest, size_t outSize)
+{
+	const unsigned char* ip = (const unsigned char*)source;
+	const unsigned char* end = ip + size;
+	unsigned char* out = (unsigned char*)dest;
+	unsigned char* op = out;
+	unsigned char* opEnd = out + outSize;
+
+	while (ip < end) {
+		unsigned int token = *ip++;
+		size_t length = token >> 4, offset;
+
+		if (length == 15) {
+			unsigned int extra;
+			do {
+				if (ip >= end)
+					return 0;
+				extra = *ip++;
+				length += extra;
+			} while (extra == 255);
+		}
+		if ((size_t)(end - ip) < length || (size_t)(opEnd - op) < length)
+			return 0;
+		memcpy(op, ip, length);
+		ip += length;
+		op += length;
+		if (ip == end)
+			break; /* the last sequence has no match */
+
+		if (end - ip < 2)
+			return 0;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out))
+			return 0;
+		length = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15) {
+			unsigned int extra;
+			do {
+				if (ip >= end)
+					return 0;
+				extra = *ip++;
+				length += extra;
+			} while (extra == 255);
+		}
+		if ((size_t)(opEnd - op) < length)
+			return 0;
+
+		/* A match may overlap what it writes. Copying whole periods of it,
+		 * doubling each time, keeps every memcpy's ends apart */
+		while (length > offset) {
+			memcpy(op, op - offset, offset);
+			op += offset;
+			length -= offset;
+			offset *= 2;
+		}
+		memcpy(op, op - offset, length);
+		op += length;
+	}
+	return op == opEnd;
+}
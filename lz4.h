@@ -0,0 +1,23 @@
+/* lz4.h - LZ4 block format compression
+
+A small greedy compressor and a bounds checked decompressor for the LZ4
+block format (no frame header, sizes are kept by the caller). Blocks are
+interchangeable with liblz4's LZ4_compress_default/LZ4_decompress_safe.
+Meshes compress mostly from repeated index runs and bit patterns of
+normals, at a few hundred MB/s.
+
+USAGE:
+compressed = lz4Compress(src, size, dst, lz4Bound(size)), 0 if it won't fit
+lz4Decompress(dst, compressed, out, size), 1 if out holds exactly size bytes
+*/
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+
+size_t lz4Bound(size_t size);
+size_t lz4Compress(const void* src, size_t size, void* dst, size_t capacity);
+int lz4Decompress(const void* src, size_t size, void* dst, size_t outSize);
+
+#endif
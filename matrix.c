@@ -0,0 +1,151 @@
+/* matrix.c - 4x4 matrices for code that can't use the GL matrix stack */
+
+#include <math.h>
+#include <string.h>
+
+#include "matrix.h"
+
+#define M(mat, row, col) ((mat)->m[(col) * 4 + (row)])
+
+void mat4Identity(mat4_t* m)
+{
+	memset(m, 0, sizeof(mat4_t));
+	M(m, 0, 0) = M(m, 1, 1) = M(m, 2, 2) = M(m, 3, 3) = 1.0f;
+}
+
+void mat4Multiply(mat4_t* out, const mat4_t* a, const mat4_t* b)
+{
+	mat4_t r;
+	int i, j, k;
+	for (i = 0; i < 4; ++i) {
+		for (j = 0; j < 4; ++j) {
+			float sum = 0.0f;
+			for (k = 0; k < 4; ++k)
+				sum += M(a, i, k) * M(b, k, j);
+			M(&r, i, j) = sum;
+		}
+	}
+	*out = r;
+}
+
+void mat4Translate(mat4_t* m, float x, float y, float z)
+{
+	mat4_t t;
+	mat4Identity(&t);
+	M(&t, 0, 3) = x;
+	M(&t, 1, 3) = y;
+	M(&t, 2, 3) = z;
+	mat4Multiply(m, m, &t);
+}
+
+void mat4Rotate(mat4_t* m, float degrees, float x, float y, float z)
+{
+	/* Same matrix as the glRotate man page */
+	mat4_t r;
+	float len, c, s, t;
+	float a = degrees * acosf(-1.0f) / 180.0f;
+
+	len = sqrtf(x*x + y*y + z*z);
+	if (len == 0.0f)
+		return;
+	x /= len;
+	y /= len;
+	z /= len;
+	c = cosf(a);
+	s = sinf(a);
+	t = 1.0f - c;
+
+	mat4Identity(&r);
+	M(&r, 0, 0) = x*x*t + c;
+	M(&r, 0, 1) = x*y*t - z*s;
+	M(&r, 0, 2) = x*z*t + y*s;
+	M(&r, 1, 0) = y*x*t + z*s;
+	M(&r, 1, 1) = y*y*t + c;
+	M(&r, 1, 2) = y*z*t - x*s;
+	M(&r, 2, 0) = x*z*t - y*s;
+	M(&r, 2, 1) = y*z*t + x*s;
+	M(&r, 2, 2) = z*z*t + c;
+	mat4Multiply(m, m, &r);
+}
+
+void mat4Perspective(mat4_t* m, float fovy, float aspect, float zNear, float zFar)
+{
+	mat4_t p;
+	float f = 1.0f / tanf(fovy * acosf(-1.0f) / 360.0f);
+
+	memset(&p, 0, sizeof(mat4_t));
+	M(&p, 0, 0) = f / aspect;
+	M(&p, 1, 1) = f;
+	M(&p, 2, 2) = (zFar + zNear) / (zNear - zFar);
+	M(&p, 2, 3) = 2.0f * zFar * zNear / (zNear - zFar);
+	M(&p, 3, 2) = -1.0f;
+	mat4Multiply(m, m, &p);
+}
+
+void mat4Ortho(mat4_t* m, float left, float right, float bottom, float top, float zNear, float zFar)
+{
+	mat4_t o;
+
+	mat4Identity(&o);
+	M(&o, 0, 0) = 2.0f / (right - left);
+	M(&o, 1, 1) = 2.0f / (top - bottom);
+	M(&o, 2, 2) = -2.0f / (zFar - zNear);
+	M(&o, 0, 3) = -(right + left) / (right - left);
+	M(&o, 1, 3) = -(top + bottom) / (top - bottom);
+	M(&o, 2, 3) = -(zFar + zNear) / (zFar - zNear);
+	mat4Multiply(m, m, &o);
+}
+
+void mat4LookAt(mat4_t* m, const float eye[3], const float center[3], const float up[3])
+{
+	/* Same matrix as the gluLookAt man page */
+	mat4_t r;
+	float f[3], s[3], u[3], len;
+	int i;
+
+	for (i = 0; i < 3; ++i)
+		f[i] = center[i] - eye[i];
+	len = sqrtf(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+	for (i = 0; i < 3; ++i)
+		f[i] /= len;
+	s[0] = f[1]*up[2] - f[2]*up[1];
+	s[1] = f[2]*up[0] - f[0]*up[2];
+	s[2] = f[0]*up[1] - f[1]*up[0];
+	len = sqrtf(s[0]*s[0] + s[1]*s[1] + s[2]*s[2]);
+	for (i = 0; i < 3; ++i)
+		s[i] /= len;
+	u[0] = s[1]*f[2] - s[2]*f[1];
+	u[1] = s[2]*f[0] - s[0]*f[2];
+	u[2] = s[0]*f[1] - s[1]*f[0];
+
+	mat4Identity(&r);
+	for (i = 0; i < 3; ++i) {
+		M(&r, 0, i) = s[i];
+		M(&r, 1, i) = u[i];
+		M(&r, 2, i) = -f[i];
+	}
+	mat4Multiply(m, m, &r);
+	mat4Translate(m, -eye[0], -eye[1], -eye[2]);
+}
+
+void mat4TransformVec4(float out[4], const mat4_t* m, const float v[4])
+{
+	int i;
+	for (i = 0; i < 4; ++i)
+		out[i] = M(m, i, 0) * v[0] + M(m, i, 1) * v[1] + M(m, i, 2) * v[2] + M(m, i, 3) * v[3];
+}
+
+void mat4InverseRigid(mat4_t* out, const mat4_t* m)
+{
+	/* Transpose the rotation, rotate the negated translation */
+	mat4_t r;
+	int i, j;
+
+	mat4Identity(&r);
+	for (i = 0; i < 3; ++i)
+		for (j = 0; j < 3; ++j)
+			M(&r, i, j) = M(m, j, i);
+	for (i = 0; i < 3; ++i)
+		M(&r, i, 3) = -(M(&r, i, 0) * M(m, 0, 3) + M(&r, i, 1) * M(m, 1, 3) + M(&r, i, 2) * M(m, 2, 3));
+	*out = r;
+}
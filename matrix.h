@@ -0,0 +1,28 @@
+/* matrix.h - 4x4 matrices for code that can't use the GL matrix stack */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+/* Column major, as glUniformMatrix4fv and glLoadMatrixf expect */
+typedef struct {
+	float m[16];
+} mat4_t;
+
+void mat4Identity(mat4_t* m);
+/* out = a * b. out may alias either argument */
+void mat4Multiply(mat4_t* out, const mat4_t* a, const mat4_t* b);
+
+/* These post-multiply like their fixed pipeline namesakes: m = m * T */
+void mat4Translate(mat4_t* m, float x, float y, float z);
+void mat4Rotate(mat4_t* m, float degrees, float x, float y, float z); /* glRotatef */
+void mat4Perspective(mat4_t* m, float fovy, float aspect, float zNear, float zFar); /* gluPerspective */
+void mat4Ortho(mat4_t* m, float left, float right, float bottom, float top, float zNear, float zFar); /* glOrtho */
+void mat4LookAt(mat4_t* m, const float eye[3], const float center[3], const float up[3]); /* gluLookAt */
+
+/* out = m * v. out must not alias v */
+void mat4TransformVec4(float out[4], const mat4_t* m, const float v[4]);
+
+/* Inverse of a rigid transform (rotation and translation only) */
+void mat4InverseRigid(mat4_t* out, const mat4_t* m);
+
+#endif
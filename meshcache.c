@@ -0,0 +1,241 @@
+/* meshcache.c - binary mesh files, mapped straight into memory */
+
+#ifndef __APPLE__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meshcache.h"
+#include "lz4.h"
+
+#define MESH_MAGIC "MESHBIN3" /* changes with the layout, so older files read as a miss */
+#define MESH_ALIGN 4096 /* header size and section alignment */
+#define FNV_PRIME 0x100000001b3ULL
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+
+/* FNV-1a over 64 bit words, four at a time so the multiplies overlap */
+static unsigned long long checksum(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	unsigned long long lane[4] = {FNV_OFFSET, FNV_OFFSET + 1, FNV_OFFSET + 2, FNV_OFFSET + 3};
+	unsigned long long h, word;
+	size_t n = size;
+	int k;
+
+	for (; n >= 32; n -= 32, p += 32) {
+		for (k = 0; k < 4; ++k) {
+			memcpy(&word, p + k * 8, sizeof(word));
+			lane[k] = (lane[k] ^ word) * FNV_PRIME;
+		}
+	}
+	h = FNV_OFFSET;
+	for (k = 0; k < 4; ++k)
+		h = (h ^ lane[k]) * FNV_PRIME;
+	for (; n; --n)
+		h = (h ^ *p++) * FNV_PRIME;
+	return (h ^ size) * FNV_PRIME;
+}
+
+static unsigned long long alignUp(unsigned long long x)
+{
+	return (x + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+}
+
+void meshCachePath(char* path, size_t size, const char* dir, const char* key)
+{
+	mkdir(dir, 0777); /* fine if it exists */
+	snprintf(path, size, "%s/%016llx.mesh", dir, checksum(key, strlen(key)));
+}
+
+/* The arrays as they are in an ObjectData, in file section order */
+static void sectionArrays(const ObjectData* data, const void** arrays, unsigned long long* sizes)
+{
+	arrays[0] = data->vertices;
+	sizes[0] = (unsigned long long)data->vertexSize * data->numVertices;
+	arrays[1] = data->indices;
+	sizes[1] = sizeof(unsigned int) * (unsigned long long)data->numIndices;
+	arrays[2] = data->normals;
+	sizes[2] = data->normals ? sizeof(vector_t) * 2 * (unsigned long long)data->numVertices : 0;
+	arrays[3] = data->params;
+	sizes[3] = data->params ? sizeof(parametric_t) * (unsigned long long)data->numVertices : 0;
+	arrays[4] = data->patches;
+	sizes[4] = sizeof(patch_t) * (unsigned long long)data->numPatches;
+}
+
+int meshCacheWrite(const char* path, const char* key, const ObjectData* data, int compress)
+{
+	static const char zeros[MESH_ALIGN];
+	char temp[1024];
+	MeshFileHeader header;
+	const void* arrays[MESH_SECTIONS];
+	unsigned long long sizes[MESH_SECTIONS], offset = MESH_ALIGN;
+	FILE* file;
+	int i, ok = 1;
+
+	/* Written next to it and renamed, so readers never see half a file */
+	snprintf(temp, sizeof temp, "%s.tmp", path);
+	if (!(file = fopen(temp, "wb")))
+		return 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_MAGIC, sizeof(header.magic));
+	header.flags = compress ? MESH_LZ4 : 0;
+	header.mode = data->mode;
+	header.vertexSize = data->vertexSize;
+	header.indexSize = sizeof(unsigned int);
+	header.numVertices = data->numVertices;
+	header.numIndices = data->numIndices;
+	header.numPatches = data->numPatches;
+	strncpy(header.key, key, sizeof(header.key) - 1);
+	ok = fwrite(zeros, MESH_ALIGN, 1, file) == 1; /* header goes here last */
+
+	sectionArrays(data, arrays, sizes);
+	for (i = 0; i < MESH_SECTIONS && ok; ++i) {
+		MeshSection* section = &header.sections[i];
+		const void* stored = arrays[i];
+		void* compressed = NULL;
+
+		section->rawSize = sizes[i];
+		section->size = sizes[i];
+		if (compress && sizes[i]) {
+			size_t capacity = lz4Bound(sizes[i]);
+			compressed = malloc(capacity);
+			section->size = lz4Compress(arrays[i], sizes[i], compressed, capacity);
+			stored = compressed;
+			ok = section->size > 0;
+		}
+		section->offset = offset;
+		section->checksum = checksum(stored, section->size);
+		if (ok && section->size)
+			ok = fwrite(stored, section->size, 1, file) == 1;
+		offset = alignUp(offset + section->size);
+		if (ok && offset > section->offset + section->size)
+			ok = fwrite(zeros, offset - section->offset - section->size, 1, file) == 1;
+		free(compressed);
+	}
+	header.fileSize = offset;
+
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+		ok = rename(temp, path) == 0;
+	if (!ok)
+		remove(temp);
+	return ok;
+}
+
+/* release callback for data that points into a mapping */
+static void unmapFile(void* mapping)
+{
+	munmap(mapping, ((const MeshFileHeader*)mapping)->fileSize);
+}
+
+/* Whether the header describes this mesh and stays inside the file */
+static int validHeader(const MeshFileHeader* header, const char* key, unsigned long long fileSize)
+{
+	unsigned long long expected[MESH_SECTIONS];
+	int i;
+
+	if (memcmp(header->magic, MESH_MAGIC, sizeof(header->magic)) || header->fileSize != fileSize ||
+		strncmp(header->key, key, sizeof(header->key) - 1) || header->indexSize != sizeof(unsigned int) ||
+		header->flags & ~MESH_LZ4)
+		return 0;
+	expected[0] = (unsigned long long)header->vertexSize * header->numVertices;
+	expected[1] = sizeof(unsigned int) * (unsigned long long)header->numIndices;
+	expected[2] = sizeof(vector_t) * 2 * (unsigned long long)header->numVertices;
+	expected[3] = sizeof(parametric_t) * (unsigned long long)header->numVertices;
+	expected[4] = sizeof(patch_t) * (unsigned long long)header->numPatches;
+	for (i = 0; i < MESH_SECTIONS; ++i) {
+		const MeshSection* s = &header->sections[i];
+		if (s->offset % MESH_ALIGN || s->offset < MESH_ALIGN || s->offset > fileSize || s->size > fileSize - s->offset)
+			return 0;
+		/* Normals, params and patches are optional, vertices and indices aren't */
+		if (s->rawSize != expected[i] && (i < 2 || s->rawSize))
+			return 0;
+		if (!(header->flags & MESH_LZ4) && s->size != s->rawSize)
+			return 0;
+	}
+	return 1;
+}
+
+ObjectData* meshCacheRead(const char* path, const char* key)
+{
+	const MeshFileHeader* header;
+	ObjectData* data;
+	void* arrays[MESH_SECTIONS];
+	unsigned char* mapping;
+	struct stat info;
+	int fd, i, compressed;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &info) || info.st_size < MESH_ALIGN) {
+		close(fd);
+		return NULL;
+	}
+	mapping = (unsigned char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /* the mapping keeps the file */
+	if (mapping == (unsigned char*)MAP_FAILED)
+		return NULL;
+	posix_madvise(mapping, info.st_size, POSIX_MADV_WILLNEED);
+
+	header = (const MeshFileHeader*)mapping;
+	if (!validHeader(header, key, info.st_size)) {
+		munmap(mapping, info.st_size);
+		return NULL;
+	}
+	for (i = 0; i < MESH_SECTIONS; ++i) {
+		const MeshSection* s = &header->sections[i];
+		if (checksum(mapping + s->offset, s->size) != s->checksum) {
+			munmap(mapping, info.st_size);
+			return NULL;
+		}
+	}
+
+	/* Uncompressed sections are used where they are, compressed ones are
+	 * unpacked and the file let go */
+	compressed = header->flags & MESH_LZ4;
+	for (i = 0; i < MESH_SECTIONS; ++i) {
+		const MeshSection* s = &header->sections[i];
+		arrays[i] = NULL;
+		if (!s->rawSize)
+			continue;
+		if (!compressed) {
+			arrays[i] = mapping + s->offset;
+			continue;
+		}
+		arrays[i] = malloc(s->rawSize);
+		if (!lz4Decompress(mapping + s->offset, s->size, arrays[i], s->rawSize)) {
+			while (i >= 0)
+				free(arrays[i--]);
+			munmap(mapping, info.st_size);
+			return NULL;
+		}
+	}
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = arrays[0];
+	data->vertexSize = header->vertexSize;
+	data->numVertices = header->numVertices;
+	data->indices = (unsigned int*)arrays[1];
+	data->numIndices = header->numIndices;
+	data->mode = header->mode;
+	data->normals = (vector_t*)arrays[2];
+	data->params = (parametric_t*)arrays[3];
+	data->patches = (patch_t*)arrays[4];
+	data->numPatches = data->patches ? header->numPatches : 0;
+	data->release = compressed ? NULL : unmapFile;
+	data->owner = compressed ? NULL : mapping;
+	data->trackedBytes = data->trackedNormals = 0;
+	trackObjectData(data);
+	if (compressed)
+		munmap(mapping, info.st_size);
+	return data;
+}
@@ -0,0 +1,61 @@
+/* meshcache.h - binary mesh files, mapped straight into memory
+
+Generating a 1025x1025 or larger surface takes long enough to notice at
+every launch. meshCacheWrite saves a generated ObjectData, and
+meshCacheRead maps it back: the sections point into the mapped pages,
+which uploadObject hands to glBufferData as they are, so nothing is
+generated, parsed or copied on the way.
+
+Layout, in native byte order since the cache is per machine:
+one page of MeshFileHeader, then the vertex, index, normal and parameter
+and patch sections, each starting on a page boundary. Sections may be LZ4
+compressed, which makes the file smaller but needs a decompressed copy
+when reading. Every section has a checksum, and the header keeps the key
+the mesh was made for, so a stale or damaged file reads as a miss.
+
+USAGE:
+meshCachePath(path, sizeof path, dir, key), key naming the generator,
+shape, arguments and resolution
+data = meshCacheRead(path, key), or on NULL generate it and
+meshCacheWrite(path, key, data, compress)
+freeObjectData(data) unmaps it
+*/
+
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "objects.h"
+
+#define MESH_KEY_SIZE 256
+#define MESH_SECTIONS 5 /* vertices, indices, normals, params, patches */
+#define MESH_LZ4 1 /* MeshFileHeader flags */
+
+typedef struct {
+	unsigned long long offset; /* from the start of the file, page aligned */
+	unsigned long long size; /* as stored, 0 if the mesh doesn't have it */
+	unsigned long long rawSize; /* decompressed */
+	unsigned long long checksum; /* of the stored bytes */
+} MeshSection;
+
+typedef struct {
+	char magic[8];
+	unsigned int flags;
+	unsigned int mode; /* GL primitive */
+	unsigned int vertexSize;
+	unsigned int indexSize; /* bytes per index */
+	unsigned int numVertices;
+	unsigned int numIndices;
+	unsigned int numPatches;
+	unsigned long long fileSize;
+	MeshSection sections[MESH_SECTIONS];
+	char key[MESH_KEY_SIZE];
+} MeshFileHeader;
+
+/* File name in dir for key, creating dir if needed */
+void meshCachePath(char* path, size_t size, const char* dir, const char* key);
+/* Returns 0 if the file couldn't be written */
+int meshCacheWrite(const char* path, const char* key, const ObjectData* data, int compress);
+/* NULL if there is no file for key, or it doesn't check out */
+ObjectData* meshCacheRead(const char* path, const char* key);
+
+#endif
@@ -0,0 +1,998 @@
+/* meshload.c - OBJ and binary PLY meshes, loaded in parallel */
+
+#ifndef __APPLE__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meshload.h"
+#include "parallel.h"
+#include "timer.h"
+
+#define CHUNK_SIZE (256 * 1024) /* bytes of OBJ text per job, about */
+#define MAX_CHUNKS 4096
+#define BATCH 16384 /* PLY vertices or faces per job */
+#define NORMAL_LENGTH 0.2f /* of the lines for drawObjectNormals, as objects.c */
+#define NO_NORMAL -1
+#define EMPTY 0xffffffffu
+
+#define PLY_MAX_ELEMENTS 16
+#define PLY_MAX_PROPERTIES 32
+
+/* Everything parsed, before welding. Corners are three per triangle and
+ * index positions and normals, NO_NORMAL where there is none */
+typedef struct {
+	vector_t* positions;
+	int numPositions;
+	vector_t* normals;
+	int numNormals;
+	int* cornerPositions;
+	int* cornerNormals; /* NULL if no corner has one, or cornerPositions for PLY */
+	int numCorners;
+} RawMesh;
+
+static void freeRawMesh(RawMesh* raw)
+{
+	if (raw->cornerNormals != raw->cornerPositions)
+		free(raw->cornerNormals);
+	free(raw->positions);
+	free(raw->normals);
+	free(raw->cornerPositions);
+}
+
+/* Numbers */
+
+static const double powers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define IS_DIGIT(c) ((unsigned)((c) - '0') < 10u)
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+static const char* skipSpace(const char* p, const char* end)
+{
+	while (p < end && IS_SPACE(*p))
+		++p;
+	return p;
+}
+
+/* A decimal with optional sign, fraction and exponent. Digits past the
+ * 19th only scale it. Returns where it stopped, p if there was no number */
+static const char* parseFloat(const char* p, const char* end, float* out)
+{
+	const char* start = p;
+	unsigned long long mantissa = 0;
+	int exponent = 0, digits = 0, negative = 0;
+	double value;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	for (; p < end && IS_DIGIT(*p); ++p, ++digits) {
+		if (mantissa < 1000000000000000000ULL)
+			mantissa = mantissa * 10 + (*p - '0');
+		else
+			++exponent;
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && IS_DIGIT(*p); ++p, ++digits) {
+			if (mantissa < 1000000000000000000ULL) {
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+		}
+	}
+	if (!digits)
+		return start;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		int e = 0, eNegative = 0;
+		if (q < end && (*q == '-' || *q == '+'))
+			eNegative = *q++ == '-';
+		if (q < end && IS_DIGIT(*q)) {
+			for (; q < end && IS_DIGIT(*q); ++q)
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+			exponent += eNegative ? -e : e;
+			p = q;
+		}
+	}
+
+	value = (double)mantissa;
+	if (mantissa) {
+		for (; exponent > 22; exponent -= 22)
+			value *= 1e22;
+		for (; exponent < -22; exponent += 22)
+			value /= 1e22;
+		value = exponent >= 0 ? value * powers[exponent] : value / powers[-exponent];
+	}
+	*out = (float)(negative ? -value : value);
+	return p;
+}
+
+/* Returns where it stopped, p if there was no number */
+static const char* parseInt(const char* p, const char* end, int* out)
+{
+	const char* start = p;
+	long long value = 0;
+	int negative = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	if (p >= end || !IS_DIGIT(*p))
+		return start;
+	for (; p < end && IS_DIGIT(*p); ++p)
+		if (value <= INT_MAX)
+			value = value * 10 + (*p - '0');
+	if (value > INT_MAX)
+		value = INT_MAX; /* out of range whichever way, caught as a bad index */
+	*out = (int)(negative ? -value : value);
+	return p;
+}
+
+/* OBJ */
+
+typedef struct {
+	const char* begin;
+	const char* end;
+	int positions, normals, triangles; /* in the chunk */
+	int firstPosition, firstNormal, firstTriangle; /* of the whole file before it */
+	int error;
+} ObjChunk;
+
+typedef struct {
+	ObjChunk* chunks;
+	RawMesh* raw;
+} ObjJob;
+
+static const char* lineEnd(const char* p, const char* end)
+{
+	const char* n = (const char*)memchr(p, '\n', end - p);
+	return n ? n : end;
+}
+
+/* Vertices a face line lists: tokens up to the end or a comment */
+static int countFaceVertices(const char* p, const char* end)
+{
+	int n = 0;
+	for (;;) {
+		p = skipSpace(p, end);
+		if (p >= end || *p == '#')
+			return n;
+		++n;
+		while (p < end && !IS_SPACE(*p))
+			++p;
+	}
+}
+
+static void countObjChunk(int index, void* data)
+{
+	ObjChunk* c = ((ObjJob*)data)->chunks + index;
+	const char* p = c->begin;
+
+	while (p < c->end) {
+		const char* e = lineEnd(p, c->end);
+		p = skipSpace(p, e);
+		if (e - p > 1 && p[0] == 'v' && IS_SPACE(p[1]))
+			c->positions++;
+		else if (e - p > 2 && p[0] == 'v' && p[1] == 'n' && IS_SPACE(p[2]))
+			c->normals++;
+		else if (e - p > 1 && p[0] == 'f' && IS_SPACE(p[1])) {
+			int n = countFaceVertices(p + 1, e);
+			if (n >= 3)
+				c->triangles += n - 2;
+		}
+		p = e + 1;
+	}
+}
+
+static const char* parseVector(const char* p, const char* end, vector_t* v, int* error)
+{
+	const char* q;
+	float* f = &v->x;
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		p = skipSpace(p, end);
+		q = parseFloat(p, end, f + i);
+		if (q == p) {
+			*error = 1;
+			return p;
+		}
+		p = q;
+	}
+	return p;
+}
+
+/* One face line into a fan of corners. Relative indices count back from
+ * the vertices so far */
+static void parseFace(const char* p, const char* e, RawMesh* raw, int* corner, int positions, int normals, int* error)
+{
+	int first[2] = {0, 0}, previous[2] = {0, 0}, current[2], n = 0, value;
+	const char* q;
+
+	for (;;) {
+		p = skipSpace(p, e);
+		if (p >= e || *p == '#')
+			return;
+		q = parseInt(p, e, &value);
+		if (q == p || !value) {
+			*error = 1;
+			return;
+		}
+		current[0] = value > 0 ? value - 1 : positions + value;
+		current[1] = NO_NORMAL;
+		p = q;
+		if (p < e && *p == '/') {
+			p = parseInt(p + 1, e, &value); /* texture coordinate, if any */
+			if (p < e && *p == '/') {
+				q = parseInt(p + 1, e, &value);
+				if (q == p + 1 || !value) {
+					*error = 1;
+					return;
+				}
+				current[1] = value > 0 ? value - 1 : normals + value;
+				p = q;
+			}
+		}
+		while (p < e && !IS_SPACE(*p))
+			++p;
+
+		if (n == 0) {
+			first[0] = current[0];
+			first[1] = current[1];
+		} else if (n >= 2) {
+			int k = *corner;
+			raw->cornerPositions[k] = first[0];
+			raw->cornerNormals[k] = first[1];
+			raw->cornerPositions[k + 1] = previous[0];
+			raw->cornerNormals[k + 1] = previous[1];
+			raw->cornerPositions[k + 2] = current[0];
+			raw->cornerNormals[k + 2] = current[1];
+			*corner = k + 3;
+		}
+		previous[0] = current[0];
+		previous[1] = current[1];
+		++n;
+	}
+}
+
+static void parseObjChunk(int index, void* data)
+{
+	ObjJob* job = (ObjJob*)data;
+	ObjChunk* c = job->chunks + index;
+	RawMesh* raw = job->raw;
+	const char* p = c->begin;
+	int positions = c->firstPosition, normals = c->firstNormal, corner = c->firstTriangle * 3;
+
+	while (p < c->end && !c->error) {
+		const char* e = lineEnd(p, c->end);
+		p = skipSpace(p, e);
+		if (e - p > 1 && p[0] == 'v' && IS_SPACE(p[1]))
+			parseVector(p + 1, e, &raw->positions[positions++], &c->error);
+		else if (e - p > 2 && p[0] == 'v' && p[1] == 'n' && IS_SPACE(p[2]))
+			parseVector(p + 2, e, &raw->normals[normals++], &c->error);
+		else if (e - p > 1 && p[0] == 'f' && IS_SPACE(p[1]))
+			parseFace(p + 1, e, raw, &corner, positions, normals, &c->error);
+		p = e + 1;
+	}
+}
+
+static const char* parseObj(const char* text, size_t size, RawMesh* raw)
+{
+	ObjJob job;
+	ObjChunk* chunks;
+	long long triangles = 0;
+	int numChunks, i, positions = 0, normals = 0;
+
+	/* Chunks start after a newline, so every line is in exactly one */
+	numChunks = (int)(size / CHUNK_SIZE) + 1;
+	if (numChunks > MAX_CHUNKS)
+		numChunks = MAX_CHUNKS;
+	chunks = (ObjChunk*)calloc(numChunks, sizeof(ObjChunk));
+	for (i = 0; i < numChunks; ++i) {
+		const char* p = text + size / numChunks * i;
+		if (i > 0) {
+			p = lineEnd(p > chunks[i - 1].begin ? p : chunks[i - 1].begin, text + size);
+			p = p < text + size ? p + 1 : p;
+		}
+		chunks[i].begin = p;
+		if (i > 0)
+			chunks[i - 1].end = p;
+	}
+	chunks[numChunks - 1].end = text + size;
+
+	job.chunks = chunks;
+	job.raw = raw;
+	parallelFor(numChunks, countObjChunk, &job);
+	for (i = 0; i < numChunks; ++i) {
+		chunks[i].firstPosition = positions;
+		chunks[i].firstNormal = normals;
+		chunks[i].firstTriangle = (int)triangles;
+		positions += chunks[i].positions;
+		normals += chunks[i].normals;
+		triangles += chunks[i].triangles;
+	}
+	if (triangles > INT_MAX / 3) {
+		free(chunks);
+		return "too many triangles";
+	}
+
+	raw->numPositions = positions;
+	raw->numNormals = normals;
+	raw->numCorners = (int)triangles * 3;
+	raw->positions = (vector_t*)malloc(sizeof(vector_t) * (positions + 1));
+	raw->normals = (vector_t*)malloc(sizeof(vector_t) * (normals + 1));
+	raw->cornerPositions = (int*)malloc(sizeof(int) * (raw->numCorners + 1));
+	raw->cornerNormals = (int*)malloc(sizeof(int) * (raw->numCorners + 1));
+	parallelFor(numChunks, parseObjChunk, &job);
+
+	for (i = 0; i < numChunks; ++i)
+		if (chunks[i].error) {
+			free(chunks);
+			return "unreadable v, vn or f line";
+		}
+	free(chunks);
+	return NULL;
+}
+
+/* PLY */
+
+enum PlyType {
+	PLY_INT8 = 0, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_TYPES
+};
+
+static const char* plyTypeNames[PLY_TYPES][2] = {
+	{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+	{"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}
+};
+static const int plyTypeSizes[PLY_TYPES] = {1, 1, 2, 2, 4, 4, 4, 8};
+
+typedef struct {
+	char name[32];
+	int type; /* of the value, or of each list item */
+	int countType; /* -1 unless it's a list */
+	int offset; /* from the start of the element, when it has a stride */
+} PlyProperty;
+
+typedef struct {
+	char name[32];
+	int count;
+	PlyProperty properties[PLY_MAX_PROPERTIES];
+	int numProperties;
+	int stride; /* bytes each, 0 if a property is a list */
+	const unsigned char* data; /* first byte in the file */
+} PlyElement;
+
+typedef struct {
+	int swap; /* the file's byte order isn't ours */
+	PlyElement* vertex;
+	int x, y, z, nx, ny, nz; /* property indices, nx -1 without normals */
+	PlyElement* face;
+	int indices;
+	RawMesh* raw;
+	int failed;
+} PlyJob;
+
+static int plyType(const char* name)
+{
+	int t;
+	for (t = 0; t < PLY_TYPES; ++t)
+		if (!strcmp(name, plyTypeNames[t][0]) || !strcmp(name, plyTypeNames[t][1]))
+			return t;
+	return -1;
+}
+
+/* One value as a double, for coordinates */
+static double plyValue(const unsigned char* p, int type, int swap)
+{
+	unsigned char b[8];
+	int size = plyTypeSizes[type], i;
+	union { signed char i8; unsigned char u8; short i16; unsigned short u16; int i32;
+		unsigned int u32; float f32; double f64; } v;
+
+	for (i = 0; i < size; ++i)
+		b[i] = p[swap ? size - 1 - i : i];
+	memcpy(&v, b, size);
+	switch (type) {
+	case PLY_INT8: return v.i8;
+	case PLY_UINT8: return v.u8;
+	case PLY_INT16: return v.i16;
+	case PLY_UINT16: return v.u16;
+	case PLY_INT32: return v.i32;
+	case PLY_UINT32: return v.u32;
+	case PLY_FLOAT32: return v.f32;
+	default: return v.f64;
+	}
+}
+
+/* An integer, for counts and indices. Past INT_MAX reads as -1, a bad index */
+static int plyInt(const unsigned char* p, int type, int swap)
+{
+	double v = plyValue(p, type, swap);
+	return v >= 0.0 && v <= INT_MAX ? (int)v : -1;
+}
+
+static int nativeLittleEndian()
+{
+	unsigned int one = 1;
+	return *(unsigned char*)&one == 1;
+}
+
+static const char* parsePlyHeader(const char* text, size_t size, PlyElement* elements, int* numElements,
+	int* swap, const unsigned char** body)
+{
+	const char* end = text + size;
+	const char* p = text;
+	char word[4][32];
+	int n, format = -1;
+
+	*numElements = 0;
+	for (;;) {
+		const char* e;
+		char line[256];
+		size_t length;
+
+		if (p >= end)
+			return "no end_header";
+		e = lineEnd(p, end);
+		length = e - p < (long)sizeof(line) - 1 ? (size_t)(e - p) : sizeof(line) - 1;
+		memcpy(line, p, length);
+		line[length] = '\0';
+		p = e + 1;
+
+		n = sscanf(line, "%31s %31s %31s %31s", word[0], word[1], word[2], word[3]);
+		if (n <= 0 || !strcmp(word[0], "ply") || !strcmp(word[0], "comment") || !strcmp(word[0], "obj_info"))
+			continue;
+		if (!strcmp(word[0], "end_header"))
+			break;
+		if (!strcmp(word[0], "format") && n >= 2) {
+			if (!strcmp(word[1], "binary_little_endian"))
+				format = 1;
+			else if (!strcmp(word[1], "binary_big_endian"))
+				format = 0;
+			else
+				return "only binary PLY is supported";
+		} else if (!strcmp(word[0], "element") && n == 3) {
+			PlyElement* element = &elements[*numElements];
+			if (*numElements == PLY_MAX_ELEMENTS)
+				return "too many elements";
+			memset(element, 0, sizeof(*element));
+			strcpy(element->name, word[1]);
+			element->count = atoi(word[2]);
+			if (element->count < 0)
+				return "bad element count";
+			++*numElements;
+		} else if (!strcmp(word[0], "property") && *numElements) {
+			PlyElement* element = &elements[*numElements - 1];
+			PlyProperty* property = &element->properties[element->numProperties];
+			if (element->numProperties == PLY_MAX_PROPERTIES)
+				return "too many properties";
+			if (n == 4 && !strcmp(word[1], "list")) {
+				/* list <count type> <item type> <name>, sscanf stopped at 4 words */
+				char name[32];
+				if (sscanf(line, "%*s %*s %*s %*s %31s", name) != 1)
+					return "bad list property";
+				property->countType = plyType(word[2]);
+				property->type = plyType(word[3]);
+				strcpy(property->name, name);
+				if (property->countType < 0 || property->type < 0)
+					return "unknown property type";
+			} else if (n == 3) {
+				property->countType = -1;
+				property->type = plyType(word[1]);
+				strcpy(property->name, word[2]);
+				if (property->type < 0)
+					return "unknown property type";
+			} else {
+				return "bad property";
+			}
+			element->numProperties++;
+		} else {
+			return "bad header line";
+		}
+	}
+	if (format < 0)
+		return "no format";
+	*swap = format != nativeLittleEndian();
+	*body = (const unsigned char*)p;
+	return NULL;
+}
+
+/* Byte size of an element's data, walking it if it has lists. 0 if it
+ * runs past end */
+static size_t plyElementSize(const PlyElement* element, const unsigned char* end, int swap)
+{
+	const unsigned char* p = element->data;
+	int i, k;
+
+	if (element->stride) {
+		size_t size = (size_t)element->stride * element->count;
+		return size <= (size_t)(end - p) ? size : 0;
+	}
+	for (i = 0; i < element->count; ++i) {
+		for (k = 0; k < element->numProperties; ++k) {
+			const PlyProperty* property = &element->properties[k];
+			int count = 1;
+			if (property->countType >= 0) {
+				if (end - p < plyTypeSizes[property->countType])
+					return 0;
+				count = plyInt(p, property->countType, swap);
+				p += plyTypeSizes[property->countType];
+				if (count < 0)
+					return 0;
+			}
+			if ((size_t)(end - p) < (size_t)count * plyTypeSizes[property->type])
+				return 0;
+			p += (size_t)count * plyTypeSizes[property->type];
+		}
+	}
+	return p - element->data;
+}
+
+static int plyFind(const PlyElement* element, const char* name)
+{
+	int k;
+	for (k = 0; k < element->numProperties; ++k)
+		if (!strcmp(element->properties[k].name, name))
+			return k;
+	return -1;
+}
+
+static void convertPlyVertices(int index, void* data)
+{
+	PlyJob* job = (PlyJob*)data;
+	const PlyElement* element = job->vertex;
+	const PlyProperty* properties = element->properties;
+	int i, last = (index + 1) * BATCH < element->count ? (index + 1) * BATCH : element->count;
+
+	for (i = index * BATCH; i < last; ++i) {
+		const unsigned char* p = element->data + (size_t)element->stride * i;
+		vector_t* v = &job->raw->positions[i];
+		v->x = (float)plyValue(p + properties[job->x].offset, properties[job->x].type, job->swap);
+		v->y = (float)plyValue(p + properties[job->y].offset, properties[job->y].type, job->swap);
+		v->z = (float)plyValue(p + properties[job->z].offset, properties[job->z].type, job->swap);
+		if (job->nx < 0)
+			continue;
+		v = &job->raw->normals[i];
+		v->x = (float)plyValue(p + properties[job->nx].offset, properties[job->nx].type, job->swap);
+		v->y = (float)plyValue(p + properties[job->ny].offset, properties[job->ny].type, job->swap);
+		v->z = (float)plyValue(p + properties[job->nz].offset, properties[job->nz].type, job->swap);
+	}
+}
+
+/* Faces that are all triangles with nothing else have a stride. A face
+ * with another count shows up where the stride puts it, since all before
+ * it were triangles, and sends the load to readPlyFaces */
+static void convertPlyTriangles(int index, void* data)
+{
+	PlyJob* job = (PlyJob*)data;
+	const PlyProperty* list = &job->face->properties[job->indices];
+	int countSize = plyTypeSizes[list->countType], indexSize = plyTypeSizes[list->type];
+	int stride = countSize + 3 * indexSize;
+	int i, k, last = (index + 1) * BATCH < job->face->count ? (index + 1) * BATCH : job->face->count;
+
+	for (i = index * BATCH; i < last; ++i) {
+		const unsigned char* p = job->face->data + (size_t)stride * i;
+		if (plyInt(p, list->countType, job->swap) != 3) {
+			__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		for (k = 0; k < 3; ++k)
+			job->raw->cornerPositions[i * 3 + k] = plyInt(p + countSize + k * indexSize, list->type, job->swap);
+	}
+}
+
+/* Any faces, one at a time: counted, then split into fans. Returns the
+ * corners, or -1 if the data runs out */
+static long long readPlyFaces(PlyJob* job, const unsigned char* end, int* corners)
+{
+	const PlyElement* element = job->face;
+	const unsigned char* p = element->data;
+	long long numCorners = 0;
+	int i, j, k;
+
+	for (i = 0; i < element->count; ++i) {
+		for (k = 0; k < element->numProperties; ++k) {
+			const PlyProperty* property = &element->properties[k];
+			int count = 1, size = plyTypeSizes[property->type];
+			if (property->countType >= 0) {
+				if (end - p < plyTypeSizes[property->countType])
+					return -1;
+				count = plyInt(p, property->countType, job->swap);
+				p += plyTypeSizes[property->countType];
+				if (count < 0)
+					return -1;
+			}
+			if ((size_t)(end - p) < (size_t)count * size)
+				return -1;
+			if (k == job->indices) {
+				for (j = 2; j < count; ++j, numCorners += 3) {
+					if (!corners)
+						continue;
+					corners[numCorners] = plyInt(p, property->type, job->swap);
+					corners[numCorners + 1] = plyInt(p + (j - 1) * size, property->type, job->swap);
+					corners[numCorners + 2] = plyInt(p + j * size, property->type, job->swap);
+				}
+			}
+			p += (size_t)count * size;
+		}
+	}
+	return numCorners;
+}
+
+static const char* parsePly(const char* text, size_t size, RawMesh* raw)
+{
+	PlyElement elements[PLY_MAX_ELEMENTS];
+	const unsigned char* body;
+	const unsigned char* end = (const unsigned char*)text + size;
+	const char* error;
+	PlyJob job;
+	PlyProperty* list;
+	int numElements, i, k;
+	long long corners;
+	size_t bytes = 0;
+
+	memset(&job, 0, sizeof(job));
+	if ((error = parsePlyHeader(text, size, elements, &numElements, &job.swap, &body)))
+		return error;
+
+	/* Where each element starts, as far as the vertices and faces */
+	for (i = 0; i < numElements; ++i) {
+		PlyElement* element = &elements[i];
+		int offset = 0;
+		for (k = 0; k < element->numProperties; ++k) {
+			element->properties[k].offset = offset;
+			if (element->properties[k].countType >= 0)
+				break;
+			offset += plyTypeSizes[element->properties[k].type];
+		}
+		element->stride = k == element->numProperties ? offset : 0;
+		element->data = body;
+		if (!strcmp(element->name, "vertex"))
+			job.vertex = element;
+		else if (!strcmp(element->name, "face"))
+			job.face = element;
+		if (job.vertex && job.face)
+			break;
+		if (element->count && !(bytes = plyElementSize(element, end, job.swap)))
+			return "data ends early";
+		body += element->count ? bytes : 0;
+	}
+	if (!job.vertex || !job.face)
+		return "no vertex or face element";
+
+	job.x = plyFind(job.vertex, "x");
+	job.y = plyFind(job.vertex, "y");
+	job.z = plyFind(job.vertex, "z");
+	job.nx = plyFind(job.vertex, "nx");
+	job.ny = plyFind(job.vertex, "ny");
+	job.nz = plyFind(job.vertex, "nz");
+	if (job.x < 0 || job.y < 0 || job.z < 0 || !job.vertex->stride)
+		return "vertices need x, y and z and no lists";
+	if (job.ny < 0 || job.nz < 0)
+		job.nx = -1;
+	if ((size_t)job.vertex->stride * job.vertex->count > (size_t)(end - job.vertex->data))
+		return "data ends early";
+	if ((job.indices = plyFind(job.face, "vertex_indices")) < 0)
+		job.indices = plyFind(job.face, "vertex_index");
+	if (job.indices < 0 || job.face->properties[job.indices].countType < 0)
+		return "faces need a vertex_indices list";
+	list = &job.face->properties[job.indices];
+
+	job.raw = raw;
+	raw->numPositions = job.vertex->count;
+	raw->positions = (vector_t*)malloc(sizeof(vector_t) * (raw->numPositions + 1));
+	if (job.nx >= 0) {
+		raw->numNormals = job.vertex->count;
+		raw->normals = (vector_t*)malloc(sizeof(vector_t) * (raw->numNormals + 1));
+	}
+	parallelFor((job.vertex->count + BATCH - 1) / BATCH, convertPlyVertices, &job);
+
+	/* Triangles only, the usual case, in parallel */
+	if (job.face->numProperties == 1 && job.face->count <= INT_MAX / 3 &&
+		(size_t)job.face->count * (plyTypeSizes[list->countType] + 3 * plyTypeSizes[list->type]) <=
+			(size_t)(end - job.face->data)) {
+		raw->numCorners = job.face->count * 3;
+		raw->cornerPositions = (int*)malloc(sizeof(int) * (raw->numCorners + 1));
+		parallelFor((job.face->count + BATCH - 1) / BATCH, convertPlyTriangles, &job);
+		if (!job.failed) {
+			raw->cornerNormals = job.nx >= 0 ? raw->cornerPositions : NULL;
+			return NULL;
+		}
+		free(raw->cornerPositions);
+	}
+
+	if ((corners = readPlyFaces(&job, end, NULL)) < 0)
+		return "data ends early";
+	if (corners > INT_MAX)
+		return "too many triangles";
+	raw->numCorners = (int)corners;
+	raw->cornerPositions = (int*)malloc(sizeof(int) * (raw->numCorners + 1));
+	readPlyFaces(&job, end, raw->cornerPositions);
+	raw->cornerNormals = job.nx >= 0 ? raw->cornerPositions : NULL;
+	return NULL;
+}
+
+/* Welding */
+
+static unsigned int hashVertex(const vertex_t* v)
+{
+	unsigned int words[6], h = 2166136261u;
+	int i;
+
+	memcpy(words, v, sizeof(words));
+	for (i = 0; i < 6; ++i)
+		h = (h ^ words[i]) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+/* A table of mask + 1 slots holding vertices [0, count), all different */
+static unsigned int* rehash(const vertex_t* vertices, int count, unsigned int mask)
+{
+	unsigned int* table = (unsigned int*)malloc(sizeof(unsigned int) * ((size_t)mask + 1));
+	unsigned int h;
+	int i;
+
+	memset(table, 0xff, sizeof(unsigned int) * ((size_t)mask + 1));
+	for (i = 0; i < count; ++i) {
+		for (h = hashVertex(&vertices[i]) & mask; table[h] != EMPTY; h = (h + 1) & mask)
+			;
+		table[h] = i;
+	}
+	return table;
+}
+
+/* Keeps the first of each equal vertex, in the order corners use them.
+ * With computed normals, equal positions are enough. Most corners repeat
+ * the position and normal index of an earlier one, so the vertex each
+ * position first made, and with which normal, is remembered and only the
+ * rest are hashed */
+static const char* weld(const RawMesh* raw, int computeNormals, vertex_t* vertices, unsigned int* indices, int* numVertices)
+{
+	unsigned int* table;
+	unsigned int* positionVertex;
+	int* positionNormal;
+	unsigned int mask = 15;
+	int c, count = 0;
+
+	while (mask < (unsigned int)raw->numPositions * 2u && mask < 0x7fffffffu)
+		mask = mask * 2 + 1;
+	table = (unsigned int*)malloc(sizeof(unsigned int) * ((size_t)mask + 1));
+	memset(table, 0xff, sizeof(unsigned int) * ((size_t)mask + 1));
+	positionVertex = (unsigned int*)malloc(sizeof(unsigned int) * (raw->numPositions + 1));
+	memset(positionVertex, 0xff, sizeof(unsigned int) * (raw->numPositions + 1));
+	positionNormal = (int*)malloc(sizeof(int) * (raw->numPositions + 1));
+
+	for (c = 0; c < raw->numCorners; ++c) {
+		int p = raw->cornerPositions[c];
+		int n = raw->cornerNormals && !computeNormals ? raw->cornerNormals[c] : NO_NORMAL;
+		unsigned int h;
+		vertex_t v;
+
+		if (p < 0 || p >= raw->numPositions || n >= raw->numNormals || (n < 0 && n != NO_NORMAL)) {
+			free(table);
+			free(positionVertex);
+			free(positionNormal);
+			return "face refers to a missing vertex";
+		}
+		if (positionVertex[p] != EMPTY && positionNormal[p] == n) {
+			indices[c] = positionVertex[p];
+			continue;
+		}
+		v.vert = raw->positions[p];
+		if (n >= 0)
+			v.norm = raw->normals[n];
+		else
+			v.norm.x = v.norm.y = v.norm.z = 0.0f;
+		/* -0 and 0 are the same vertex */
+		v.vert.x += 0.0f;
+		v.vert.y += 0.0f;
+		v.vert.z += 0.0f;
+		v.norm.x += 0.0f;
+		v.norm.y += 0.0f;
+		v.norm.z += 0.0f;
+
+		for (h = hashVertex(&v) & mask; table[h] != EMPTY; h = (h + 1) & mask)
+			if (!memcmp(&vertices[table[h]], &v, sizeof(v)))
+				break;
+		if (table[h] == EMPTY) {
+			/* Grows with the vertices, which can outnumber the positions */
+			if ((unsigned int)count >= (mask + 1) / 2 && mask < 0x7fffffffu) {
+				free(table);
+				mask = mask * 2 + 1;
+				table = rehash(vertices, count, mask);
+				for (h = hashVertex(&v) & mask; table[h] != EMPTY; h = (h + 1) & mask)
+					;
+			}
+			table[h] = count;
+			vertices[count++] = v;
+		}
+		indices[c] = table[h];
+		if (positionVertex[p] == EMPTY) {
+			positionVertex[p] = table[h];
+			positionNormal[p] = n;
+		}
+	}
+	free(table);
+	free(positionVertex);
+	free(positionNormal);
+	*numVertices = count;
+	return NULL;
+}
+
+/* Sums of the faces' normals, weighted by area, normalized */
+static void faceNormals(vertex_t* vertices, int numVertices, const unsigned int* indices, int numIndices)
+{
+	int i, k;
+
+	for (i = 0; i + 2 < numIndices; i += 3) {
+		vector_t* a = &vertices[indices[i]].vert;
+		vector_t* b = &vertices[indices[i + 1]].vert;
+		vector_t* c = &vertices[indices[i + 2]].vert;
+		vector_t u = {b->x - a->x, b->y - a->y, b->z - a->z};
+		vector_t v = {c->x - a->x, c->y - a->y, c->z - a->z};
+		vector_t n = {u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x};
+		for (k = 0; k < 3; ++k) {
+			vector_t* sum = &vertices[indices[i + k]].norm;
+			sum->x += n.x;
+			sum->y += n.y;
+			sum->z += n.z;
+		}
+	}
+	for (i = 0; i < numVertices; ++i) {
+		vector_t* n = &vertices[i].norm;
+		float length = sqrtf(n->x * n->x + n->y * n->y + n->z * n->z);
+		if (length > 0.0f) {
+			n->x /= length;
+			n->y /= length;
+			n->z /= length;
+		} else {
+			n->x = n->y = 0.0f;
+			n->z = 1.0f;
+		}
+	}
+}
+
+/* Centres the vertices on their bounding box and scales its corners onto
+ * the sphere */
+static void fitVertices(vertex_t* vertices, int numVertices, float radius)
+{
+	float lo[3], hi[3], center[3], scale, half = 0.0f;
+	int i, k;
+
+	if (!numVertices)
+		return;
+	for (k = 0; k < 3; ++k)
+		lo[k] = hi[k] = (&vertices[0].vert.x)[k];
+	for (i = 1; i < numVertices; ++i)
+		for (k = 0; k < 3; ++k) {
+			float x = (&vertices[i].vert.x)[k];
+			lo[k] = x < lo[k] ? x : lo[k];
+			hi[k] = x > hi[k] ? x : hi[k];
+		}
+	for (k = 0; k < 3; ++k) {
+		center[k] = (lo[k] + hi[k]) * 0.5f;
+		half += (hi[k] - center[k]) * (hi[k] - center[k]);
+	}
+	half = sqrtf(half);
+	scale = half > 0.0f ? radius / half : 1.0f;
+	for (i = 0; i < numVertices; ++i)
+		for (k = 0; k < 3; ++k)
+			(&vertices[i].vert.x)[k] = ((&vertices[i].vert.x)[k] - center[k]) * scale;
+}
+
+ObjectData* meshLoad(const char* path, float radius, MeshLoadStats* stats)
+{
+	MeshLoadStats local;
+	RawMesh raw;
+	ObjectData* data;
+	vertex_t* vertices;
+	unsigned int* indices;
+	vector_t* normals;
+	const char* error;
+	const char* text;
+	struct stat info;
+	double start = timerNow(), parsed;
+	int fd, i, numVertices, computeNormals;
+
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+	memset(&raw, 0, sizeof(raw));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		printf("Mesh load: can't open %s\n", path);
+		return NULL;
+	}
+	if (fstat(fd, &info) || info.st_size == 0) {
+		close(fd);
+		printf("Mesh load: %s is empty\n", path);
+		return NULL;
+	}
+	text = (const char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /* the mapping keeps the file */
+	if (text == (const char*)MAP_FAILED) {
+		printf("Mesh load: can't map %s\n", path);
+		return NULL;
+	}
+	posix_madvise((void*)text, info.st_size, POSIX_MADV_WILLNEED);
+	stats->bytes = info.st_size;
+
+	if (info.st_size >= 4 && !memcmp(text, "ply", 3) && (text[3] == '\n' || text[3] == '\r'))
+		error = parsePly(text, info.st_size, &raw);
+	else
+		error = parseObj(text, info.st_size, &raw);
+	munmap((void*)text, info.st_size);
+	parsed = timerNow();
+	stats->parseSeconds = parsed - start;
+
+	/* One corner without a normal and they are all made from the faces */
+	computeNormals = !raw.cornerNormals;
+	for (i = 0; !error && !computeNormals && i < raw.numCorners; ++i)
+		computeNormals = raw.cornerNormals[i] == NO_NORMAL;
+
+	vertices = NULL;
+	indices = NULL;
+	if (!error && !raw.numCorners)
+		error = "no triangles";
+	if (!error) {
+		vertices = (vertex_t*)malloc(sizeof(vertex_t) * raw.numCorners);
+		indices = (unsigned int*)malloc(sizeof(unsigned int) * raw.numCorners);
+		error = weld(&raw, computeNormals, vertices, indices, &numVertices);
+	}
+	stats->corners = raw.numCorners;
+	freeRawMesh(&raw);
+	if (error) {
+		free(vertices);
+		free(indices);
+		printf("Mesh load: %s: %s\n", path, error);
+		return NULL;
+	}
+
+	vertices = (vertex_t*)realloc(vertices, sizeof(vertex_t) * numVertices);
+	if (computeNormals)
+		faceNormals(vertices, numVertices, indices, stats->corners);
+	if (radius > 0.0f)
+		fitVertices(vertices, numVertices, radius);
+	stats->weldSeconds = timerNow() - parsed;
+
+	normals = (vector_t*)malloc(sizeof(vector_t) * numVertices * 2);
+	for (i = 0; i < numVertices; ++i) {
+		normals[i * 2] = vertices[i].vert;
+		normals[i * 2 + 1].x = vertices[i].vert.x + vertices[i].norm.x * NORMAL_LENGTH;
+		normals[i * 2 + 1].y = vertices[i].vert.y + vertices[i].norm.y * NORMAL_LENGTH;
+		normals[i * 2 + 1].z = vertices[i].vert.z + vertices[i].norm.z * NORMAL_LENGTH;
+	}
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = vertices;
+	data->vertexSize = sizeof(vertex_t);
+	data->numVertices = numVertices;
+	data->indices = indices;
+	data->numIndices = stats->corners;
+	data->mode = GL_TRIANGLES;
+	data->normals = normals;
+	data->params = NULL;
+	data->patches = NULL;
+	data->numPatches = 0;
+	data->release = NULL;
+	data->owner = NULL;
+	data->trackedBytes = data->trackedNormals = 0;
+	trackObjectData(data);
+
+	stats->triangles = stats->corners / 3;
+	stats->vertices = numVertices;
+	stats->computedNormals = computeNormals;
+	stats->seconds = timerNow() - start;
+	return data;
+}
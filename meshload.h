@@ -0,0 +1,51 @@
+/* meshload.h - OBJ and binary PLY meshes, loaded in parallel
+
+Production assets run to millions of triangles, and reading them a line
+at a time with sscanf takes longer than drawing them for minutes. The file
+is memory mapped instead and cut into chunks at line boundaries. One
+parallelFor counts the vertices, normals and triangles in each chunk, so
+every chunk knows where its output starts, and a second parses them
+straight into place with a number parser that neither allocates nor
+depends on the locale. Binary PLY vertices are a fixed stride and are
+converted the same way; faces are too when every one is a triangle.
+
+Corners are then welded: each (position, normal) pair is looked up in an
+open addressing hash table and only the first of equal ones is kept, so
+a mesh saved with a vertex per face corner comes out indexed. Welding is
+serial so vertices keep the order faces first use them in, which suits
+the GPU's vertex fetch.
+
+The result is an ObjectData of vertex_t and GL_TRIANGLES indices, as
+createObjectData would make, with normal lines for drawObjectNormals.
+Missing normals are made from the faces around each vertex, weighted by
+their area. OBJ polygons are split into fans, texture coordinates, groups
+and materials ignored; PLY must be binary, either byte order.
+
+USAGE:
+data = meshLoad(path, radius, &stats), NULL with the reason printed if
+the file can't be read; radius > 0 centres the mesh and scales it to fit
+a sphere of that radius
+object = uploadObject(data), freeObjectData(data) as usual
+*/
+
+#ifndef MESHLOAD_H
+#define MESHLOAD_H
+
+#include <stddef.h>
+
+#include "objects.h"
+
+typedef struct {
+	size_t bytes; /* of the file */
+	double seconds; /* all of it, mapping to ObjectData */
+	double parseSeconds, weldSeconds;
+	int triangles;
+	int corners; /* vertices before welding, three per triangle */
+	int vertices; /* after */
+	int computedNormals; /* the file had none, or not for every corner */
+} MeshLoadStats;
+
+/* stats may be NULL */
+ObjectData* meshLoad(const char* path, float radius, MeshLoadStats* stats);
+
+#endif
@@ -0,0 +1,332 @@
+/* objbench.c - timings of the objects.c geometry kernels
+
+Build with "make objbench". Needs no SDL or window. Times the phases of
+createObject and createObjectShader apart, for each shape at each
+tessellation level ass2-base offers (an n by n grid, n = 2^level + 1):
+  vertices  evaluateGrid, or evaluateGridParams for the shader version
+  indices   buildGridIndices
+  upload    uploadObject and glFinish, when a GL context can be made
+The shader version's vertices are only (u, v), the same for every shape,
+so it is timed once per level as shape "any".
+
+Each phase runs once untimed, to warm the caches and fault the arrays in,
+then is sampled BENCH_TRIALS times, or at least BENCH_MIN_TRIALS when that
+takes longer than BENCH_BUDGET seconds. A sample repeats the phase until
+it has run for BENCH_MIN_SAMPLE seconds and divides by the repeats, so
+the small levels aren't lost in the timer's resolution and call overhead.
+The arrays are allocated once per level, so allocation isn't timed. The table gives the min and median, and
+vertices and bytes written per second at the median.
+
+Before the timings, a table of what createObjectDataClosed shares and
+drops of each shape's grid at each level: vertices on the seam and at
+the poles, and the strip's zero area triangles at the poles and between
+its rows.
+
+The GL context has no window: CGL on Mac OS X, a 1x1 GLX pbuffer elsewhere.
+Without one the upload phase is left out.
+
+USAGE: objbench [--levels MIN MAX] [--trials N] [-o FILE]
+  --levels MIN MAX  tessellation levels, default 2 13
+  --trials N        timed runs per phase, default 9
+  -o FILE           also write every sample, in microseconds, in ass2-base
+                    --perf's format, so two runs compare with perfcheck:
+                    perfcheck --tolerance 10 before.txt after.txt
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenGL/OpenGL.h>
+#else
+#include <GL/glew.h>
+#include <GL/glx.h>
+#endif
+
+#include "objects.h"
+#include "timer.h"
+
+#define BENCH_TRIALS 9
+#define BENCH_MAX_TRIALS 64 /* as many samples as perfcheck reads */
+#define BENCH_MIN_TRIALS 3
+#define BENCH_BUDGET 2.0
+#define BENCH_MIN_SAMPLE 1e-3 /* seconds each sample runs for */
+#define MIN_LEVEL 2
+#define MAX_LEVEL 13
+
+typedef struct {
+	const char* name;
+	ParametricObjFunc func; /* NULL for the shader version's (u, v) */
+	Topology topology;
+} Shape;
+
+/* The shader version's vertices don't depend on the shape */
+static const Shape shapes[] = {
+	{"sphere", parametricSphere, TOPOLOGY_SPHERE},
+	{"torus", parametricTorus, TOPOLOGY_TORUS},
+	{"grid", parametricGrid, TOPOLOGY_OPEN},
+	{"any", NULL, TOPOLOGY_OPEN},
+};
+
+/* One shape at one level, and the arrays its phases fill */
+typedef struct {
+	const Shape* shape;
+	int n;
+	int numIndices;
+	vertex_t* vertices;
+	vector_t* normals;
+	parametric_t* params;
+	unsigned int* indices;
+	size_t vertexBytes, indexBytes, uploadBytes;
+} Bench;
+
+typedef void (*PhaseFunc)(Bench* b);
+
+/* With ass2-base's arguments */
+static void evaluate(Bench* b, ...)
+{
+	va_list args;
+	va_start(args, b);
+	evaluateGrid(b->shape->func, b->n, b->n, &args, b->vertices, b->normals);
+	va_end(args);
+}
+
+static void vertexPhase(Bench* b)
+{
+	if (b->shape->func)
+		evaluate(b, 1.0, 0.5, 0.4);
+	else
+		evaluateGridParams(b->n, b->n, b->params);
+}
+
+static void indexPhase(Bench* b)
+{
+	buildGridIndices(b->n, b->n, b->indices);
+}
+
+static void uploadPhase(Bench* b)
+{
+	ObjectData data;
+	Object* obj;
+
+	memset(&data, 0, sizeof(data));
+	data.vertices = b->shape->func ? (void*)b->vertices : (void*)b->params;
+	data.vertexSize = b->shape->func ? sizeof(vertex_t) : sizeof(parametric_t);
+	data.numVertices = b->n * b->n;
+	data.indices = b->indices;
+	data.numIndices = b->numIndices;
+	data.mode = GL_TRIANGLE_STRIP;
+	data.normals = b->shape->func ? b->normals : NULL;
+	obj = uploadObject(&data);
+	glFinish();
+	if (obj)
+		freeObject(obj);
+}
+
+/* Makes a GL context current without a window. Returns 0 if there is none */
+static int createContext()
+{
+#ifdef __APPLE__
+	CGLPixelFormatAttribute attributes[] = {kCGLPFAAccelerated, (CGLPixelFormatAttribute)0};
+	CGLPixelFormatObj format;
+	CGLContextObj context;
+	GLint count;
+
+	if (CGLChoosePixelFormat(attributes, &format, &count) != kCGLNoError || !format)
+		return 0;
+	if (CGLCreateContext(format, NULL, &context) != kCGLNoError)
+		context = NULL;
+	CGLDestroyPixelFormat(format);
+	return context && CGLSetCurrentContext(context) == kCGLNoError;
+#else
+	static const int attributes[] = {GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT, GLX_RENDER_TYPE, GLX_RGBA_BIT, None};
+	static const int size[] = {GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None};
+	Display* display = XOpenDisplay(NULL);
+	GLXFBConfig* configs;
+	GLXPbuffer pbuffer;
+	GLXContext context;
+	int count;
+
+	if (!display)
+		return 0;
+	configs = glXChooseFBConfig(display, DefaultScreen(display), attributes, &count);
+	if (!configs || !count)
+		return 0;
+	pbuffer = glXCreatePbuffer(display, configs[0], size);
+	context = glXCreateNewContext(display, configs[0], GLX_RGBA_TYPE, NULL, True);
+	XFree(configs);
+	if (!context || !glXMakeContextCurrent(display, pbuffer, pbuffer, context))
+		return 0;
+	glewInit();
+	return 1;
+#endif
+}
+
+static int compareDoubles(const void* x, const void* y)
+{
+	double a = *(const double*)x, b = *(const double*)y;
+	return a < b ? -1 : a > b;
+}
+
+/* Fills samples with seconds per run and returns how many */
+static int timePhase(Bench* b, PhaseFunc phase, double* samples, int trials)
+{
+	double total = 0.0, start, elapsed;
+	int count = 0, repeats;
+
+	phase(b);
+	while (count < trials && (count < BENCH_MIN_TRIALS || total < BENCH_BUDGET)) {
+		repeats = 0;
+		start = timerNow();
+		do {
+			phase(b);
+			repeats++;
+		} while ((elapsed = timerNow() - start) < BENCH_MIN_SAMPLE);
+		samples[count++] = elapsed / repeats;
+		total += elapsed;
+	}
+	return count;
+}
+
+static void report(FILE* output, const Bench* b, int level, const char* phase, const double* samples, int count, size_t bytes)
+{
+	double sorted[BENCH_MAX_TRIALS], median;
+	int vertices = b->n * b->n, i;
+
+	memcpy(sorted, samples, sizeof(double) * count);
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) * 0.5;
+	printf("%-7s %-6s %5d %10d | %-8s %6d %10.3f %10.3f %10.1f %10.1f\n", b->shape->func ? "fixed" : "shader",
+		b->shape->name, level, vertices, phase, count, sorted[0] * 1e3, median * 1e3,
+		vertices / median * 1e-6, bytes / median / (1024.0 * 1024.0));
+
+	if (output) {
+		fprintf(output, "%s-t%d-%s %s_us", b->shape->name, level, b->shape->func ? "fixed" : "shader", phase);
+		for (i = 0; i < count; ++i)
+			fprintf(output, " %.4f", samples[i] * 1e6);
+		fprintf(output, "\n");
+	}
+}
+
+/* What the closed meshes leave out, for the shapes that have one */
+static void reportTopology(int minLevel, int maxLevel)
+{
+	TopologyCounts c;
+	int level, s, n;
+
+	printf("%-6s %5s %10s %10s %8s %8s | %10s %10s %8s %8s\n", "shape", "level", "vertices", "closed",
+		"seam", "pole", "strip tris", "closed", "pole", "joins");
+	for (s = 0; s < (int)(sizeof(shapes) / sizeof(shapes[0])); ++s) {
+		if (shapes[s].topology == TOPOLOGY_OPEN)
+			continue;
+		for (level = minLevel; level <= maxLevel; ++level) {
+			n = (1 << level) + 1;
+			countGridTopology(shapes[s].topology, n, n, &c);
+			printf("%-6s %5d %10d %10d %8d %8d | %10d %10d %8d %8d\n", shapes[s].name, level, c.gridVertices,
+				c.vertices, c.seamVertices, c.poleVertices, c.stripTriangles, c.triangles, c.poleTriangles,
+				c.joinTriangles);
+		}
+	}
+	printf("\n");
+}
+
+static void usage(const char* name)
+{
+	printf("Usage: %s [--levels MIN MAX] [--trials N] [-o FILE]\n", name);
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	int minLevel = MIN_LEVEL, maxLevel = MAX_LEVEL, trials = BENCH_TRIALS, context, level, s, i;
+	const char* filename = NULL;
+	double samples[BENCH_MAX_TRIALS];
+	FILE* output = NULL;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--levels") && i + 2 < argc) {
+			minLevel = atoi(argv[++i]);
+			maxLevel = atoi(argv[++i]);
+			if (minLevel < 1 || maxLevel < minLevel || maxLevel > 14)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "--trials") && i + 1 < argc) {
+			trials = atoi(argv[++i]);
+			if (trials < 1 || trials > BENCH_MAX_TRIALS)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			filename = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+	reportTopology(minLevel, maxLevel);
+	context = createContext();
+	if (filename) {
+		output = fopen(filename, "w");
+		if (!output) {
+			printf("Error: could not write %s\n", filename);
+			return 1;
+		}
+		fprintf(output, "renderer objbench, %s\n", context ? (const char*)glGetString(GL_RENDERER) : "no GL");
+	}
+	if (context)
+		printf("Upload to %s\n", (const char*)glGetString(GL_RENDERER));
+	else
+		printf("No GL context, upload not timed\n");
+	printf("%-7s %-6s %5s %10s | %-8s %6s %10s %10s %10s %10s\n", "version", "shape", "level", "vertices",
+		"phase", "trials", "min ms", "median ms", "Mverts/s", "MB/s");
+
+	for (level = minLevel; level <= maxLevel; ++level) {
+		Bench b;
+		size_t numVertices;
+
+		memset(&b, 0, sizeof(b));
+		b.n = (1 << level) + 1;
+		b.numIndices = gridIndexCount(b.n, b.n);
+		numVertices = (size_t)b.n * b.n;
+		b.vertices = (vertex_t*)malloc(sizeof(vertex_t) * numVertices);
+		b.normals = (vector_t*)malloc(sizeof(vector_t) * numVertices * 2);
+		b.params = (parametric_t*)malloc(sizeof(parametric_t) * numVertices);
+		b.indices = (unsigned int*)malloc(sizeof(unsigned int) * b.numIndices);
+		if (!b.vertices || !b.normals || !b.params || !b.indices) {
+			printf("level %d: out of memory, stopping\n", level);
+			free(b.vertices);
+			free(b.normals);
+			free(b.params);
+			free(b.indices);
+			break;
+		}
+		b.indexBytes = sizeof(unsigned int) * b.numIndices;
+
+		for (s = 0; s < (int)(sizeof(shapes) / sizeof(shapes[0])); ++s) {
+			b.shape = &shapes[s];
+			if (b.shape->func)
+				b.vertexBytes = (sizeof(vertex_t) + sizeof(vector_t) * 2) * numVertices;
+			else
+				b.vertexBytes = sizeof(parametric_t) * numVertices;
+			b.uploadBytes = b.vertexBytes + b.indexBytes;
+
+			i = timePhase(&b, vertexPhase, samples, trials);
+			report(output, &b, level, "vertices", samples, i, b.vertexBytes);
+			i = timePhase(&b, indexPhase, samples, trials);
+			report(output, &b, level, "indices", samples, i, b.indexBytes);
+			if (context) {
+				i = timePhase(&b, uploadPhase, samples, trials);
+				report(output, &b, level, "upload", samples, i, b.uploadBytes);
+			}
+			fflush(stdout);
+		}
+
+		free(b.vertices);
+		free(b.normals);
+		free(b.params);
+		free(b.indices);
+	}
+
+	if (output) {
+		fclose(output);
+		printf("Samples in %s\n", filename);
+	}
+	return 0;
+}
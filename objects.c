@@ -7,6 +7,9 @@
 #include <stdio.h>
 
 #include "objects.h"
+#include "resources.h"
+
+int draw_gl_calls = 0;
 
 vertex_t parametricGrid(float u, float v, va_list* args)
 {
@@ -61,37 +64,28 @@ vertex_t parametricTorus(float u, float v, va_list* args)
 	return ret;
 }
 
-Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
+int gridIndexCount(int x, int y)
+{
+	return (y-1) * (x * 2 + 2);
+}
+
+/* args is restarted (copied) for each vertex since the function consumes it. */
+void evaluateGrid(ParametricObjFunc paramObjFunc, int x, int y, va_list* baseArgs, vertex_t* vertices, vector_t* normals)
 {
 	va_list args;
 	unsigned int i, j;
 	float u, v;
-	int ci = 0; /* current index */
-	vertex_t* vertices;
-	unsigned int* indices;
-	vector_t* normals;
-	int numVertices;
-	int numIndices;
-	Object* obj;
-#define INDEX(I, J) ((I)*y + (J))
-
-	/* Initialize data */
-	numVertices = x * y;
-	numIndices = (y-1) * (x * 2 + 2);
-	vertices = (vertex_t*)malloc(sizeof(vertex_t) * numVertices);
-	indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
-	normals = (vector_t*)malloc(sizeof(vector_t) * numVertices * 2);
-
-
 	int normalCount = 0;
 	float normalLength = 0.2;
-	/* Construct vertex data */
+#define INDEX(I, J) ((I)*y + (J))
+
 	for (i = 0; i < x; ++i) {
 		u = i/(float)(x-1);
 		for (j = 0; j < y; ++j) {
 			v = j/(float)(y-1);
-			va_start(args, y);
+			va_copy(args, *baseArgs);
 			vertices[INDEX(i, j)] = paramObjFunc(u, v, &args);
+			va_end(args);
 
 			/* normal data */
 			vector_t nv1, nv2;
@@ -103,8 +97,31 @@ Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
 			normals[normalCount++] = nv2 ;
 		}
 	}
+#undef INDEX
+}
+
+void evaluateGridParams(int x, int y, parametric_t* vertices)
+{
+	unsigned int i, j;
+	float u, v;
+#define INDEX(I, J) ((I)*y + (J))
+
+	for (i = 0; i < x; ++i) {
+		u = i/(float)(x-1);
+		for (j = 0; j < y; ++j) {
+			v = j/(float)(y-1);
+			vertices[INDEX(i, j)] = (parametric_t){.u = u, .v = v};
+		}
+	}
+#undef INDEX
+}
+
+void buildGridIndices(int x, int y, unsigned int* indices)
+{
+	unsigned int i, j;
+	int ci = 0; /* current index */
+#define INDEX(I, J) ((I)*y + (J))
 
-	/* Construct index data */
 	for (j = 0; j < y-1; ++j) {
 		indices[ci++] = INDEX(0, j);
 		for (i = 0; i < x; ++i) {
@@ -115,37 +132,319 @@ Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
 	}
 
 	/* Double check the loops populated the data correctly */
-	assert(ci == numIndices);
+	assert(ci == gridIndexCount(x, y));
+#undef INDEX
+}
+
+/* Evaluates the surface on an x by y grid and builds triangle strip indices. */
+static ObjectData* generateObjectData(ParametricObjFunc paramObjFunc, int x, int y, va_list* baseArgs)
+{
+	vertex_t* vertices;
+	unsigned int* indices;
+	vector_t* normals;
+	int numVertices;
+	int numIndices;
+	ObjectData* data;
+
+	/* Initialize data */
+	numVertices = x * y;
+	numIndices = gridIndexCount(x, y);
+	vertices = (vertex_t*)malloc(sizeof(vertex_t) * numVertices);
+	indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
+	normals = (vector_t*)malloc(sizeof(vector_t) * numVertices * 2);
+
+	evaluateGrid(paramObjFunc, x, y, baseArgs, vertices, normals);
+	buildGridIndices(x, y, indices);
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = vertices;
+	data->vertexSize = sizeof(vertex_t);
+	data->numVertices = numVertices;
+	data->indices = indices;
+	data->numIndices = numIndices;
+	data->mode = GL_TRIANGLE_STRIP;
+	data->normals = normals;
+	data->params = NULL;
+	data->patches = NULL;
+	data->numPatches = 0;
+	data->release = NULL;
+	data->owner = NULL;
+	data->trackedBytes = data->trackedNormals = 0;
+	trackObjectData(data);
+	return data;
+}
+
+ObjectData* createObjectData(ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	ObjectData* data;
+
+	va_start(args, y);
+	data = generateObjectData(paramObjFunc, x, y, &args);
+	va_end(args);
+	return data;
+}
+
+Object* createObject(ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	va_list args;
+	ObjectData* data;
+	Object* obj;
+
+	va_start(args, y);
+	data = generateObjectData(paramObjFunc, x, y, &args);
+	va_end(args);
+	obj = uploadObject(data);
+	freeObjectData(data);
+	return obj;
+}
+
+int gridTopologyIndex(Topology topology, int x, int y, int i, int j)
+{
+	switch (topology) {
+	case TOPOLOGY_SPHERE:
+		/* Columns of the rows between the poles, then the two poles */
+		if (j == 0)
+			return (x - 1) * (y - 2);
+		if (j == y - 1)
+			return (x - 1) * (y - 2) + 1;
+		return i % (x - 1) * (y - 2) + j - 1;
+	case TOPOLOGY_TORUS:
+		return i % (x - 1) * (y - 1) + j % (y - 1);
+	default:
+		return i * y + j;
+	}
+}
+
+void countGridTopology(Topology topology, int x, int y, TopologyCounts* counts)
+{
+	memset(counts, 0, sizeof(TopologyCounts));
+	counts->gridVertices = x * y;
+	counts->stripIndices = gridIndexCount(x, y);
+	counts->stripTriangles = counts->stripIndices - 2;
+	/* Besides two per quad, the strip turns at the end of every row */
+	counts->joinTriangles = counts->stripTriangles - 2 * (x - 1) * (y - 1);
+	if (topology == TOPOLOGY_SPHERE) {
+		counts->seamVertices = y - 2;
+		counts->poleVertices = 2 * (x - 1);
+		counts->poleTriangles = 2 * (x - 1);
+	} else if (topology == TOPOLOGY_TORUS)
+		counts->seamVertices = x + y - 1;
+	counts->vertices = counts->gridVertices - counts->seamVertices - counts->poleVertices;
+	counts->triangles = 2 * (x - 1) * (y - 1) - counts->poleTriangles;
+	counts->indices = counts->triangles * 3;
+}
+
+int buildGridTriangles(Topology topology, int x, int y, int i0, int i1, int j0, int j1, unsigned int* indices)
+{
+	unsigned int a, b, c, d;
+	int i, j, ci = 0;
+
+	/* The strip's two triangles of each quad, c a b then c b d, which
+	 * keeps its winding and its last, provoking, vertex. Sharing a pole
+	 * leaves one of them with no area */
+	for (j = j0; j < j1; ++j) {
+		for (i = i0; i < i1; ++i) {
+			a = gridTopologyIndex(topology, x, y, i, j);
+			b = gridTopologyIndex(topology, x, y, i+1, j);
+			c = gridTopologyIndex(topology, x, y, i, j+1);
+			d = gridTopologyIndex(topology, x, y, i+1, j+1);
+			if (a != b && a != c) {
+				if (indices) {
+					indices[ci] = c;
+					indices[ci+1] = a;
+					indices[ci+2] = b;
+				}
+				ci += 3;
+			}
+			if (d != c && d != b) {
+				if (indices) {
+					indices[ci] = c;
+					indices[ci+1] = b;
+					indices[ci+2] = d;
+				}
+				ci += 3;
+			}
+		}
+	}
+	return ci;
+}
+
+/* Evaluates the surface once per point, the first grid vertex there */
+static ObjectData* generateObjectDataClosed(ParametricObjFunc paramObjFunc, int x, int y, Topology topology, va_list* baseArgs)
+{
+	TopologyCounts counts;
+	vertex_t* vertices;
+	unsigned int* indices;
+	vector_t* normals;
+	va_list args;
+	int i, j, k, shared;
+	float normalLength = 0.2;
+	ObjectData* data;
+
+	countGridTopology(topology, x, y, &counts);
+	vertices = (vertex_t*)malloc(sizeof(vertex_t) * counts.vertices);
+	indices = (unsigned int*)malloc(sizeof(unsigned int) * counts.indices);
+	normals = (vector_t*)malloc(sizeof(vector_t) * counts.vertices * 2);
+
+	for (i = 0; i < x; ++i) {
+		for (j = 0; j < y; ++j) {
+			shared = (topology != TOPOLOGY_OPEN && i == x - 1) ||
+				(topology == TOPOLOGY_TORUS && j == y - 1) ||
+				(topology == TOPOLOGY_SPHERE && i > 0 && (j == 0 || j == y - 1));
+			if (shared)
+				continue;
+			k = gridTopologyIndex(topology, x, y, i, j);
+			va_copy(args, *baseArgs);
+			vertices[k] = paramObjFunc(i/(float)(x-1), j/(float)(y-1), &args);
+			va_end(args);
+
+			/* normal data */
+			normals[k*2] = vertices[k].vert;
+			normals[k*2+1].x = vertices[k].vert.x + vertices[k].norm.x * normalLength;
+			normals[k*2+1].y = vertices[k].vert.y + vertices[k].norm.y * normalLength;
+			normals[k*2+1].z = vertices[k].vert.z + vertices[k].norm.z * normalLength;
+		}
+	}
+
+	k = buildGridTriangles(topology, x, y, 0, x - 1, 0, y - 1, indices);
+	assert(k == counts.indices);
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = vertices;
+	data->vertexSize = sizeof(vertex_t);
+	data->numVertices = counts.vertices;
+	data->indices = indices;
+	data->numIndices = counts.indices;
+	data->mode = GL_TRIANGLES;
+	data->normals = normals;
+	data->params = NULL;
+	data->patches = NULL;
+	data->numPatches = 0;
+	data->release = NULL;
+	data->owner = NULL;
+	data->trackedBytes = data->trackedNormals = 0;
+	trackObjectData(data);
+	return data;
+}
+
+ObjectData* createObjectDataClosed(ParametricObjFunc paramObjFunc, int x, int y, Topology topology, ...)
+{
+	va_list args;
+	ObjectData* data;
+
+	va_start(args, topology);
+	data = generateObjectDataClosed(paramObjFunc, x, y, topology, &args);
+	va_end(args);
+	return data;
+}
+
+/* The Object itself and its patch arrays */
+static size_t objectHostBytes(const Object* obj)
+{
+	size_t bytes = sizeof(Object);
+	if (obj->patches)
+		bytes += (sizeof(patch_t) + sizeof(GLsizei) + sizeof(GLvoid*)) * obj->numPatches;
+	return bytes;
+}
+
+Object* uploadObject(ObjectData* data)
+{
+	Object* obj;
+	size_t geometryBytes = (size_t)data->vertexSize * data->numVertices + sizeof(unsigned int) * data->numIndices;
+	size_t normalBytes = data->normals ? sizeof(vector_t) * data->numVertices * 2 : 0;
+
+	if (!resourceFits(RES_GPU, geometryBytes + normalBytes))
+		return NULL;
 
 	/* Create VBOs */
 	obj = (Object*)malloc(sizeof(Object));
+	obj->geometryBytes = geometryBytes;
+	obj->normalBytes = normalBytes;
+	resourceAlloc(RES_GEOMETRY, RES_GPU, geometryBytes);
+	if (normalBytes)
+		resourceAlloc(RES_NORMALS, RES_GPU, normalBytes);
 	glGenBuffers(1, &obj->vertexBuffer);
 	glGenBuffers(1, &obj->elementBuffer);
-	glGenBuffers(1, &obj->normalBuffer);
+	obj->normalBuffer = 0;
+	obj->cacheBuffer = 0;
+	obj->vertexArray = 0;
 
 	/* Buffer the vertex data */
 	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_t) * numVertices, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, data->vertexSize * data->numVertices, data->vertices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	/* Buffer the normal data */
-	glBindBuffer(GL_ARRAY_BUFFER, obj->normalBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vector_t) * numVertices * 2, normals, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (data->normals) {
+		glGenBuffers(1, &obj->normalBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, obj->normalBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vector_t) * data->numVertices * 2, data->normals, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
 	/* Buffer the index data */
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numIndices, indices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * data->numIndices, data->indices, GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	/* Cleanup and return the object struct */
-	obj->numElements = numIndices;
-	free(vertices);
-	free(normals);
-	free(indices);
+	obj->mode = data->mode;
+	obj->numElements = data->numIndices;
+	obj->numVertices = data->numVertices;
+
+	/* Kept for culling, which also needs room for a range per patch */
+	obj->patches = NULL;
+	obj->numPatches = data->numPatches;
+	obj->numDraws = -1;
+	obj->drawCounts = NULL;
+	obj->drawOffsets = NULL;
+	if (data->patches) {
+		obj->patches = (patch_t*)malloc(sizeof(patch_t) * data->numPatches);
+		memcpy(obj->patches, data->patches, sizeof(patch_t) * data->numPatches);
+		obj->drawCounts = (GLsizei*)malloc(sizeof(GLsizei) * data->numPatches);
+		obj->drawOffsets = (GLvoid**)malloc(sizeof(GLvoid*) * data->numPatches);
+	}
+	resourceAlloc(RES_GEOMETRY, RES_HOST, objectHostBytes(obj));
 	return obj;
 }
 
+void trackObjectData(ObjectData* data)
+{
+	/* Mapped arrays count too, they are as big in memory */
+	size_t bytes = sizeof(ObjectData) + (size_t)data->vertexSize * data->numVertices +
+		sizeof(unsigned int) * data->numIndices + sizeof(patch_t) * data->numPatches +
+		(data->params ? sizeof(parametric_t) * data->numVertices : 0);
+	size_t normals = data->normals ? sizeof(vector_t) * data->numVertices * 2 : 0;
+
+	if (data->trackedBytes)
+		resourceFree(RES_GEOMETRY, RES_HOST, data->trackedBytes);
+	resourceAlloc(RES_GEOMETRY, RES_HOST, bytes);
+	data->trackedBytes = bytes;
+	if (data->trackedNormals)
+		resourceFree(RES_NORMALS, RES_HOST, data->trackedNormals);
+	if (normals)
+		resourceAlloc(RES_NORMALS, RES_HOST, normals);
+	data->trackedNormals = normals;
+}
+
+void freeObjectData(ObjectData* data)
+{
+	resourceFree(RES_GEOMETRY, RES_HOST, data->trackedBytes);
+	if (data->trackedNormals)
+		resourceFree(RES_NORMALS, RES_HOST, data->trackedNormals);
+	if (data->release) {
+		data->release(data->owner);
+		free(data);
+		return;
+	}
+	free(data->vertices);
+	free(data->normals);
+	free(data->indices);
+	free(data->params);
+	free(data->patches);
+	free(data);
+}
+
 void drawObject(Object* obj)
 {
 	/* Enable vertex arrays and bind VBOs */
@@ -157,13 +456,14 @@ void drawObject(Object* obj)
 	/* Draw object */
 	glVertexPointer(3, GL_FLOAT, sizeof(vertex_t), (void*)0);
 	glNormalPointer(GL_FLOAT, sizeof(vertex_t), (void*)sizeof(vector_t));
-	glDrawElements(GL_TRIANGLE_STRIP, obj->numElements, GL_UNSIGNED_INT, (void*)0);
+	drawObjectElements(obj);
 
 	/* Unbind/disable arrays. could also push/pop enables */
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_NORMAL_ARRAY);
+	draw_gl_calls += 11;
 }
 
 void drawObjectNormals(Object* obj)
@@ -173,70 +473,55 @@ void drawObjectNormals(Object* obj)
 
 	glVertexPointer(3, GL_FLOAT, 0, (void*)0);
 
-	glDrawArrays(GL_LINES, 0, obj->numElements * 2);
+	glDrawArrays(GL_LINES, 0, obj->numVertices * 2);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDisableClientState(GL_VERTEX_ARRAY);
+	draw_gl_calls += 6;
 }
 
-Object* createObjectShader(ParametricObjFunc paramObjFunc, int x, int y, ...)
+ObjectData* createObjectDataShader(ParametricObjFunc paramObjFunc, int x, int y, ...)
 {
-	unsigned int i, j;
-	float u, v;
-	int ci = 0; /* current index */
 	parametric_t* vertices;
 	unsigned int* indices;
 	int numVertices;
 	int numIndices;
-	Object* obj;
-#define INDEX(I, J) ((I)*y + (J))
+	ObjectData* data;
 
 	/* Initialize data */
 	numVertices = x * y;
-	numIndices = (y-1) * (x * 2 + 2);
+	numIndices = gridIndexCount(x, y);
 	vertices = (parametric_t*)malloc(sizeof(parametric_t) * numVertices);
 	indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
 
-	/* Construct vertex data */
-	for (i = 0; i < x; ++i) {
-		u = i/(float)(x-1);
-		for (j = 0; j < y; ++j) {
-			v = j/(float)(y-1);
-			vertices[INDEX(i, j)] = (parametric_t){.u = u, .v = v};
-		}
-	}
-
-	/* Construct index data */
-	for (j = 0; j < y-1; ++j) {
-		indices[ci++] = INDEX(0, j);
-		for (i = 0; i < x; ++i) {
-			indices[ci++] = INDEX(i, j);
-			indices[ci++] = INDEX(i, j+1);
-		}
-		indices[ci++] = INDEX(i-1, j+1);
-	}
-
-	/* Double check the loops populated the data correctly */
-	assert(ci == numIndices);
-
-	/* Create VBOs */
-	obj = (Object*)malloc(sizeof(Object));
-	glGenBuffers(1, &obj->vertexBuffer);
-	glGenBuffers(1, &obj->elementBuffer);
-
-	/* Buffer the vertex data */
-	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(parametric_t) * numVertices, vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	evaluateGridParams(x, y, vertices);
+	buildGridIndices(x, y, indices);
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = vertices;
+	data->vertexSize = sizeof(parametric_t);
+	data->numVertices = numVertices;
+	data->indices = indices;
+	data->numIndices = numIndices;
+	data->mode = GL_TRIANGLE_STRIP;
+	data->normals = NULL;
+	data->params = NULL;
+	data->patches = NULL;
+	data->numPatches = 0;
+	data->release = NULL;
+	data->owner = NULL;
+	data->trackedBytes = data->trackedNormals = 0;
+	trackObjectData(data);
+	return data;
+}
 
-	/* Buffer the index data */
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numIndices, indices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+Object* createObjectShader(ParametricObjFunc paramObjFunc, int x, int y, ...)
+{
+	ObjectData* data;
+	Object* obj;
 
-	/* Cleanup and return the object struct */
-	obj->numElements = numIndices;
-	free(vertices);
-	free(indices);
+	data = createObjectDataShader(paramObjFunc, x, y);
+	obj = uploadObject(data);
+	freeObjectData(data);
 	return obj;
 }
 
@@ -250,22 +535,151 @@ void drawObjectShader(Object* obj)
 
 	/* Draw object */
 	glVertexPointer(2, GL_FLOAT, sizeof(parametric_t), (void*)0);
-	glDrawElements(GL_TRIANGLE_STRIP, obj->numElements, GL_UNSIGNED_INT, (void*)0);
+	drawObjectElements(obj);
 
 	/* Unbind/disable arrays. could also push/pop enables */
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDisableClientState(GL_VERTEX_ARRAY);
+	draw_gl_calls += 8;
+}
+
+/* Stands in for vertex data, see drawGridAttribless */
+static GLuint attriblessBuffer = 0;
+
+void drawGridAttribless(int x, int y)
+{
+	/* The vertex shader generates every vertex, but a compatibility context
+	 * draws nothing unless array 0 is enabled. A single dummy element with a
+	 * divisor serves every vertex, so nothing grows with the grid */
+	if (!attriblessBuffer) {
+		static const GLubyte zero[4] = {0, 0, 0, 0};
+		glGenBuffers(1, &attriblessBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, attriblessBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(zero), zero, GL_STATIC_DRAW);
+		resourceAlloc(RES_GEOMETRY, RES_GPU, sizeof(zero));
+	} else
+		glBindBuffer(GL_ARRAY_BUFFER, attriblessBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, (void*)0);
+	glVertexAttribDivisor(0, 1);
+
+	/* Same count as the strip createObjectShader indexes */
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, (y-1) * (x * 2 + 2));
+
+	glVertexAttribDivisor(0, 0);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	draw_gl_calls += 7;
+}
+
+void freeGridAttribless()
+{
+	if (!attriblessBuffer)
+		return;
+	glDeleteBuffers(1, &attriblessBuffer);
+	resourceFree(RES_GEOMETRY, RES_GPU, 4);
+	attriblessBuffer = 0;
+}
+
+int captureObjectShader(Object* obj)
+{
+	if (!obj->cacheBuffer) {
+		size_t bytes = sizeof(captured_vertex_t) * obj->numVertices;
+		if (!resourceFits(RES_GPU, bytes))
+			return 0;
+		resourceAlloc(RES_GEOMETRY, RES_GPU, bytes);
+		glGenBuffers(1, &obj->cacheBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, obj->cacheBuffer);
+		glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	/* Each unique vertex as a point, so the output lines up with the element
+	 * buffer. Nothing needs rasterizing */
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, obj->cacheBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
+	glVertexPointer(2, GL_FLOAT, sizeof(parametric_t), (void*)0);
+
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, obj->numVertices);
+	glEndTransformFeedback();
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	draw_gl_calls += 12;
+	return 1;
+}
+
+void drawObjectCached(Object* obj)
+{
+	/* Enable vertex arrays and bind VBOs */
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, obj->cacheBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
+
+	/* Draw object */
+	glVertexPointer(3, GL_FLOAT, sizeof(captured_vertex_t), (void*)0);
+	glNormalPointer(GL_FLOAT, sizeof(captured_vertex_t), (void*)sizeof(vector_t));
+	drawObjectElements(obj);
+
+	/* Unbind/disable arrays */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	draw_gl_calls += 11;
+}
+
+void drawObjectElements(Object* obj)
+{
+	if (obj->numDraws < 0)
+		glDrawElements(obj->mode, obj->numElements, GL_UNSIGNED_INT, (void*)0);
+	else if (obj->numDraws > 0)
+		glMultiDrawElements(obj->mode, obj->drawCounts, GL_UNSIGNED_INT, (const GLvoid**)obj->drawOffsets, obj->numDraws);
+}
+
+void buildObjectVertexArray(Object* obj)
+{
+	glGenVertexArrays(1, &obj->vertexArray);
+	glBindVertexArray(obj->vertexArray);
+
+	/* The element buffer binding is part of the VAO */
+	glBindBuffer(GL_ARRAY_BUFFER, obj->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->elementBuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void*)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void*)sizeof(vector_t));
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void freeObject(Object* obj)
 {
+	resourceFree(RES_GEOMETRY, RES_GPU, obj->geometryBytes);
+	if (obj->normalBytes)
+		resourceFree(RES_NORMALS, RES_GPU, obj->normalBytes);
+	if (obj->cacheBuffer)
+		resourceFree(RES_GEOMETRY, RES_GPU, sizeof(captured_vertex_t) * obj->numVertices);
+	resourceFree(RES_GEOMETRY, RES_HOST, objectHostBytes(obj));
+
 	glDeleteBuffers(1, &obj->vertexBuffer);
 	glDeleteBuffers(1, &obj->normalBuffer);
 	glDeleteBuffers(1, &obj->elementBuffer);
-	obj->vertexBuffer = 0;
-	obj->normalBuffer = 0;
-	obj->elementBuffer = 0;
-	obj->numElements = 0;
+	glDeleteBuffers(1, &obj->cacheBuffer);
+	if (obj->vertexArray)
+		glDeleteVertexArrays(1, &obj->vertexArray);
+	free(obj->patches);
+	free(obj->drawCounts);
+	free(obj->drawOffsets);
+	free(obj);
 }
 
@@ -27,13 +27,61 @@ typedef struct {
 	vector_t norm;
 } vertex_t;
 
+/* Per vertex output of the CAPTURE variant of shader.vert */
+typedef struct {
+	vector_t vert;
+	vector_t norm;
+} captured_vertex_t;
+
+/* A patch of a grid surface, with its own run of the strip. See patches.h */
+typedef struct {
+	vector_t center; /* bounding sphere, object space */
+	float radius;
+	vector_t axis; /* every triangle faces within a cone around axis */
+	float coneCos, coneSin; /* of the cone's half angle. coneCos <= 0 if it is too wide to cull */
+	unsigned int first, count; /* element range */
+} patch_t;
+
 typedef struct ObjectType {
 	GLuint vertexBuffer;
 	GLuint elementBuffer;
 	GLuint normalBuffer;
+	GLuint cacheBuffer; /* captured_vertex_t per vertex, see captureObjectShader */
+	GLuint vertexArray; /* VAO for the core profile backend, see buildObjectVertexArray */
+	GLenum mode; /* primitive the elements make, from ObjectData */
 	int numElements;
+	int numVertices;
+	patch_t* patches; /* copied from ObjectData, NULL if it had none */
+	int numPatches;
+	/* Element ranges the draw functions draw instead of everything, when
+	 * numDraws >= 0. Set each frame by cullObjectPatches */
+	int numDraws;
+	GLsizei* drawCounts;
+	GLvoid** drawOffsets;
+	size_t geometryBytes, normalBytes; /* on the GPU, as the resource tracker has them */
 } Object;
 
+/* Mesh data generated on the CPU, before it is buffered. Generation needs no GL
+ * context, so it can run on a different thread to uploadObject. */
+typedef struct ObjectDataType {
+	void* vertices; /* vertex_t, or parametric_t for the shader versions */
+	int vertexSize;
+	int numVertices;
+	unsigned int* indices;
+	int numIndices;
+	GLenum mode; /* GL_TRIANGLE_STRIP, or GL_TRIANGLES for adaptive and closed meshes */
+	vector_t* normals; /* line pairs for drawObjectNormals, NULL for the shader versions */
+	parametric_t* params; /* (u, v) of each vertex, or NULL. See measureObjectError */
+	patch_t* patches; /* or NULL, see createObjectPatches */
+	int numPatches;
+	/* When the arrays belong to something else, such as a mapped cache file,
+	 * freeObjectData calls release(owner) instead of freeing them */
+	void (*release)(void* owner);
+	void* owner;
+	/* Host bytes the resource tracker has for it, see trackObjectData */
+	size_t trackedBytes, trackedNormals;
+} ObjectData;
+
 typedef vertex_t (*ParametricObjFunc)(float, float, va_list*);
 
 vertex_t parametricGrid(float u, float v, va_list* args); /* args: null */
@@ -49,6 +97,75 @@ Object* createObjectShader(ParametricObjFunc parametric, int x, int y, ...);
 void drawObject(Object* obj);
 void drawObjectNormals(Object* obj);
 void drawObjectShader(Object* obj);
+/* Draws the x by y grid createObjectShader would build, without any vertex
+ * data. Needs a shader built with ATTRIBLESS and its grid uniform set to
+ * (x, y), and instanced arrays for the dummy attribute 0 it enables.
+ * freeGridAttribless deletes that attribute's 4 byte buffer */
+void drawGridAttribless(int x, int y);
+void freeGridAttribless();
+/* Runs the bound program, which must be the CAPTURE variant of shader.vert,
+ * once over each (u, v) vertex of a createObjectShader object and keeps the
+ * result. drawObjectCached then draws it with a CACHED variant. */
+int captureObjectShader(Object* obj); /* 0 if the GPU budget has no room */
+void drawObjectCached(Object* obj);
+/* Records a createObject object's buffers and layout in obj->vertexArray,
+ * position as generic attribute 0 and normal as 1 */
+void buildObjectVertexArray(Object* obj);
+/* glDrawElements of the whole object, or glMultiDrawElements of just the
+ * ranges cullObjectPatches left. The draw functions above all use it */
+void drawObjectElements(Object* obj);
+
+/* GL calls made by the draw functions, for comparing backends. Never reset here */
+extern int draw_gl_calls;
 void freeObject(Object* obj);
 
+/* Split versions of the above. createObject = createObjectData + uploadObject + freeObjectData */
+ObjectData* createObjectData(ParametricObjFunc parametric, int x, int y, ...);
+ObjectData* createObjectDataShader(ParametricObjFunc parametric, int x, int y, ...);
+/* NULL, with nothing created, if the buffers don't fit the GPU budget. See resources.h */
+Object* uploadObject(ObjectData* data);
+void freeObjectData(ObjectData* data);
+/* The phases of the two above, so they can be timed apart (see objbench.c).
+ * An x by y grid has x * y vertices, twice that many normal line ends, and
+ * gridIndexCount(x, y) triangle strip indices */
+int gridIndexCount(int x, int y);
+void evaluateGrid(ParametricObjFunc parametric, int x, int y, va_list* args, vertex_t* vertices, vector_t* normals);
+void evaluateGridParams(int x, int y, parametric_t* vertices);
+void buildGridIndices(int x, int y, unsigned int* indices);
+
+/* How the edges of a surface's (u, v) square meet */
+typedef enum {
+	TOPOLOGY_OPEN, /* they don't, as the grid's */
+	TOPOLOGY_SPHERE, /* u = 1 is u = 0, and v = 0 and v = 1 are each one point */
+	TOPOLOGY_TORUS /* u = 1 is u = 0 and v = 1 is v = 0 */
+} Topology;
+
+/* What createObjectDataClosed makes of an x by y grid, and what it leaves
+ * out next to createObjectData's strip */
+typedef struct {
+	int vertices, triangles, indices;
+	int seamVertices; /* copies of the first column or row */
+	int poleVertices; /* the rest of each pole's row */
+	int poleTriangles; /* zero area, two corners on the pole */
+	int joinTriangles; /* zero area, joining the strip's rows */
+	int gridVertices, stripTriangles, stripIndices; /* createObjectData's */
+} TopologyCounts;
+
+/* As createObjectData, but with one vertex wherever the topology has one
+ * point: the last column wraps around to the first, and on a torus the
+ * last row too, and each pole is a single vertex the quads beside it fan
+ * around. GL_TRIANGLES, wound as the strip is, without zero area ones */
+ObjectData* createObjectDataClosed(ParametricObjFunc parametric, int x, int y, Topology topology, ...);
+/* Where grid vertex (i, j) is in createObjectDataClosed's vertices */
+int gridTopologyIndex(Topology topology, int x, int y, int i, int j);
+/* Writes the triangles of quads [i0, i1) by [j0, j1) to indices, or only
+ * counts them if it is NULL, and returns how many indices that is */
+int buildGridTriangles(Topology topology, int x, int y, int i0, int i1, int j0, int j1, unsigned int* indices);
+void countGridTopology(Topology topology, int x, int y, TopologyCounts* counts);
+
+/* Brings the resource tracker up to date with data's arrays. Whatever
+ * builds or resizes an ObjectData calls it last, with the tracked sizes 0
+ * for new data */
+void trackObjectData(ObjectData* data);
+
 #endif
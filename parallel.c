@@ -0,0 +1,178 @@
+/* parallel.c - small thread pool for data parallel loops */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#define MAX_THREADS 64
+
+static pthread_t workers[MAX_THREADS];
+static int numWorkers = 0; /* not counting the caller */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t callerLock = PTHREAD_MUTEX_INITIALIZER; /* one loop at a time */
+
+/* Each participant (0 is the caller, workers from 1) owns a range of the
+ * current loop's indices, begin in the low 32 bits and end in the high.
+ * Owners take indices from the front; when a range runs dry its owner
+ * steals the back half of someone else's. Neighbouring indices, eg. tiles
+ * in a row, then tend to run on the same thread, and nobody is left idle
+ * while another range still has work */
+typedef struct {
+	unsigned long long range;
+	char pad[64 - sizeof(unsigned long long)]; /* one cache line each */
+} WorkRange;
+
+/* The current loop. generation changes each parallelFor so sleeping workers
+ * can tell a new loop from a spurious wakeup */
+static ParallelFunc jobFunc;
+static void* jobData;
+static WorkRange ranges[MAX_THREADS];
+static int jobDone; /* workers finished with this loop, under lock */
+static int generation = 0;
+static int startGeneration = 0; /* generation when the workers were started */
+static int stopping = 0;
+
+#define RANGE_BEGIN(r) ((unsigned int)(r))
+#define RANGE_END(r) ((unsigned int)((r) >> 32))
+#define MAKE_RANGE(begin, end) ((unsigned long long)(begin) | ((unsigned long long)(end) << 32))
+
+/* Takes the next index from our own range, or -1 if it's empty */
+static int popFront(int self)
+{
+	unsigned long long r = __atomic_load_n(&ranges[self].range, __ATOMIC_ACQUIRE);
+	while (RANGE_BEGIN(r) < RANGE_END(r)) {
+		if (__atomic_compare_exchange_n(&ranges[self].range, &r, MAKE_RANGE(RANGE_BEGIN(r) + 1, RANGE_END(r)),
+				0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return (int)RANGE_BEGIN(r);
+	}
+	return -1;
+}
+
+/* Moves the back half of another participant's range into ours. Returns 0
+ * once every range is empty */
+static int steal(int self)
+{
+	int i, participants = numWorkers + 1;
+	for (i = 1; i < participants; ++i) {
+		int victim = (self + i) % participants;
+		unsigned long long r = __atomic_load_n(&ranges[victim].range, __ATOMIC_ACQUIRE);
+		while (RANGE_BEGIN(r) < RANGE_END(r)) {
+			unsigned int split = RANGE_END(r) - (RANGE_END(r) - RANGE_BEGIN(r) + 1) / 2;
+			if (__atomic_compare_exchange_n(&ranges[victim].range, &r, MAKE_RANGE(RANGE_BEGIN(r), split),
+					0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				/* Our range is empty, so only we write it now */
+				__atomic_store_n(&ranges[self].range, MAKE_RANGE(split, RANGE_END(r)), __ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Runs indices, our own then stolen ones, until none are left */
+static void runJob(int self)
+{
+	int i;
+	do {
+		while ((i = popFront(self)) >= 0)
+			jobFunc(i, jobData);
+	} while (steal(self));
+}
+
+static void* workerMain(void* arg)
+{
+	int seen = startGeneration;
+	int self = (int)(size_t)arg;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (generation == seen && !stopping)
+			pthread_cond_wait(&wake, &lock);
+		if (stopping)
+			break;
+		seen = generation;
+		pthread_mutex_unlock(&lock);
+
+		runJob(self);
+
+		pthread_mutex_lock(&lock);
+		if (++jobDone == numWorkers)
+			pthread_cond_signal(&finished);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void parallelInit(int threads)
+{
+	int i;
+
+	if (numWorkers)
+		parallelCleanup();
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	stopping = 0;
+	startGeneration = generation;
+	for (i = 0; i < threads - 1; ++i) {
+		if (pthread_create(&workers[numWorkers], NULL, workerMain, (void*)(size_t)(numWorkers + 1)) == 0)
+			numWorkers++;
+	}
+}
+
+void parallelCleanup()
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < numWorkers; ++i)
+		pthread_join(workers[i], NULL);
+	numWorkers = 0;
+}
+
+int parallelThreads()
+{
+	return numWorkers + 1;
+}
+
+void parallelFor(int count, ParallelFunc func, void* data)
+{
+	int i, participants;
+
+	/* Not worth waking anyone */
+	if (numWorkers == 0 || count <= 1) {
+		for (i = 0; i < count; ++i)
+			func(i, data);
+		return;
+	}
+
+	pthread_mutex_lock(&callerLock);
+	pthread_mutex_lock(&lock);
+	jobFunc = func;
+	jobData = data;
+	participants = numWorkers + 1;
+	for (i = 0; i < participants; ++i)
+		ranges[i].range = MAKE_RANGE((long long)count * i / participants, (long long)count * (i + 1) / participants);
+	jobDone = 0;
+	generation++;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+
+	/* Help out, then wait for the stragglers */
+	runJob(0);
+
+	pthread_mutex_lock(&lock);
+	while (jobDone < numWorkers)
+		pthread_cond_wait(&finished, &lock);
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&callerLock);
+}
@@ -0,0 +1,22 @@
+/* parallel.h - small thread pool for data parallel loops */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+USAGE:
+parallelInit(0) once, 0 picks one thread per core
+parallelFor(count, function, data) calls function(i, data) for i in [0, count)
+across the pool and the calling thread, returning when all calls are done.
+Loops started from different threads take turns.
+parallelCleanup() stops the workers
+*/
+
+typedef void (*ParallelFunc)(int index, void* data);
+
+void parallelInit(int threads);
+void parallelCleanup();
+int parallelThreads(); /* including the caller */
+void parallelFor(int count, ParallelFunc func, void* data);
+
+#endif
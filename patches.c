@@ -0,0 +1,322 @@
+/* patches.c - patch clusters of a grid surface, culled on the CPU */
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "patches.h"
+#include "parallel.h"
+
+#define CONE_SLACK 1e-4f /* on the cone's cosine and the sphere's radius, for rounding */
+
+/* What one parallelFor over patches works on */
+typedef struct {
+	const ObjectData* data;
+	int x, y;
+	Topology topology; /* of data's vertices and the indices to make */
+	int patchesU; /* patches along u */
+	ParametricObjFunc func;
+	va_list* args;
+	unsigned int* indices; /* the new strip, or triangles for a closed topology */
+	patch_t* patches;
+} PatchBuilder;
+
+static vector_t sub(vector_t a, vector_t b)
+{
+	vector_t r = {a.x - b.x, a.y - b.y, a.z - b.z};
+	return r;
+}
+
+static vector_t cross(vector_t a, vector_t b)
+{
+	vector_t r = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+	return r;
+}
+
+static float dot(vector_t a, vector_t b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+/* Vertex (i, j) of the grid, evaluated if the data only has (u, v) */
+static vertex_t gridVertex(const PatchBuilder* b, int i, int j)
+{
+	va_list args;
+	vertex_t ret;
+
+	if (b->data->vertexSize == sizeof(vertex_t))
+		return ((const vertex_t*)b->data->vertices)[gridTopologyIndex(b->topology, b->x, b->y, i, j)];
+	va_copy(args, *b->args);
+	ret = b->func(i / (float)(b->x - 1), j / (float)(b->y - 1), &args);
+	va_end(args);
+	return ret;
+}
+
+/* Quad range of patch k: [i0, i1) along u, [j0, j1) along v */
+static void patchQuads(const PatchBuilder* b, int k, int* i0, int* i1, int* j0, int* j1)
+{
+	*i0 = k % b->patchesU * PATCH_SIZE;
+	*j0 = k / b->patchesU * PATCH_SIZE;
+	*i1 = *i0 + PATCH_SIZE < b->x - 1 ? *i0 + PATCH_SIZE : b->x - 1;
+	*j1 = *j0 + PATCH_SIZE < b->y - 1 ? *j0 + PATCH_SIZE : b->y - 1;
+}
+
+/* Adds a triangle's unit normal, turned to face the way the surface does,
+ * to the patch's sum. Returns 0 for degenerate triangles, at the poles */
+static int triangleNormal(vertex_t a, vertex_t b, vertex_t c, vector_t* n)
+{
+	vector_t outside = {a.norm.x + b.norm.x + c.norm.x, a.norm.y + b.norm.y + c.norm.y, a.norm.z + b.norm.z + c.norm.z};
+	float length;
+
+	*n = cross(sub(b.vert, a.vert), sub(c.vert, a.vert));
+	length = sqrtf(dot(*n, *n));
+	if (length < 1e-12f)
+		return 0;
+	if (dot(*n, outside) < 0.0f)
+		length = -length;
+	n->x /= length;
+	n->y /= length;
+	n->z /= length;
+	return 1;
+}
+
+static void buildPatch(int k, void* data)
+{
+	PatchBuilder* b = (PatchBuilder*)data;
+	patch_t* patch = &b->patches[k];
+	int i0, i1, j0, j1, i, j, t, w, numNormals = 0;
+	unsigned int* out = b->indices + patch->first;
+	vertex_t* verts;
+	vector_t lo, hi, sum = {0.0f, 0.0f, 0.0f};
+	vector_t* normals;
+	float length;
+
+	patchQuads(b, k, &i0, &i1, &j0, &j1);
+
+	/* The strip rows of generateObjectData, cut to the patch, or the
+	 * triangles of generateObjectDataClosed */
+#define INDEX(I, J) ((I)*b->y + (J))
+	if (b->topology != TOPOLOGY_OPEN)
+		out += buildGridTriangles(b->topology, b->x, b->y, i0, i1, j0, j1, out);
+	else {
+		for (j = j0; j < j1; ++j) {
+			*out++ = INDEX(i0, j);
+			for (i = i0; i <= i1; ++i) {
+				*out++ = INDEX(i, j);
+				*out++ = INDEX(i, j+1);
+			}
+			*out++ = INDEX(i1, j+1);
+		}
+	}
+#undef INDEX
+	assert(out == b->indices + patch->first + patch->count);
+
+	/* Positions, then the bounding sphere around their box's centre */
+	w = j1 - j0 + 1;
+	verts = (vertex_t*)malloc(sizeof(vertex_t) * (i1 - i0 + 1) * w);
+	for (i = i0; i <= i1; ++i)
+		for (j = j0; j <= j1; ++j)
+			verts[(i - i0) * w + j - j0] = gridVertex(b, i, j);
+	lo = hi = verts[0].vert;
+	for (t = 0; t < (i1 - i0 + 1) * w; ++t) {
+		vector_t p = verts[t].vert;
+		lo.x = p.x < lo.x ? p.x : lo.x;
+		lo.y = p.y < lo.y ? p.y : lo.y;
+		lo.z = p.z < lo.z ? p.z : lo.z;
+		hi.x = p.x > hi.x ? p.x : hi.x;
+		hi.y = p.y > hi.y ? p.y : hi.y;
+		hi.z = p.z > hi.z ? p.z : hi.z;
+	}
+	patch->center.x = (lo.x + hi.x) * 0.5f;
+	patch->center.y = (lo.y + hi.y) * 0.5f;
+	patch->center.z = (lo.z + hi.z) * 0.5f;
+	patch->radius = 0.0f;
+	for (t = 0; t < (i1 - i0 + 1) * w; ++t) {
+		vector_t d = sub(verts[t].vert, patch->center);
+		float r = sqrtf(dot(d, d));
+		patch->radius = r > patch->radius ? r : patch->radius;
+	}
+	patch->radius += CONE_SLACK * (1.0f + patch->radius);
+
+	/* Normal cone: the axis is the average triangle normal and the half
+	 * angle reaches the one furthest from it */
+	normals = (vector_t*)malloc(sizeof(vector_t) * (i1 - i0) * (j1 - j0) * 2);
+	for (i = 0; i < i1 - i0; ++i) {
+		for (j = 0; j < j1 - j0; ++j) {
+			vertex_t a = verts[i * w + j], c = verts[i * w + j + 1];
+			vertex_t bb = verts[(i + 1) * w + j], d = verts[(i + 1) * w + j + 1];
+			numNormals += triangleNormal(a, bb, c, &normals[numNormals]);
+			numNormals += triangleNormal(c, bb, d, &normals[numNormals]);
+		}
+	}
+	for (t = 0; t < numNormals; ++t) {
+		sum.x += normals[t].x;
+		sum.y += normals[t].y;
+		sum.z += normals[t].z;
+	}
+	length = sqrtf(dot(sum, sum));
+	patch->coneCos = -1.0f;
+	if (numNormals && length > 1e-6f) {
+		patch->axis.x = sum.x / length;
+		patch->axis.y = sum.y / length;
+		patch->axis.z = sum.z / length;
+		patch->coneCos = 1.0f;
+		for (t = 0; t < numNormals; ++t) {
+			float c = dot(normals[t], patch->axis);
+			patch->coneCos = c < patch->coneCos ? c : patch->coneCos;
+		}
+		patch->coneCos -= CONE_SLACK;
+	} else {
+		patch->axis.x = patch->axis.y = 0.0f;
+		patch->axis.z = 1.0f;
+	}
+	patch->coneSin = patch->coneCos > -1.0f ? sqrtf(1.0f - patch->coneCos * patch->coneCos) : 0.0f;
+
+	free(normals);
+	free(verts);
+}
+
+void createObjectPatches(ObjectData* data, int x, int y, Topology topology, ParametricObjFunc f, ...)
+{
+	PatchBuilder b;
+	TopologyCounts counts;
+	va_list args;
+	int k, numPatches, numIndices = 0;
+
+	countGridTopology(topology, x, y, &counts);
+	assert(data->mode == (topology == TOPOLOGY_OPEN ? GL_TRIANGLE_STRIP : GL_TRIANGLES) && !data->release &&
+		data->numVertices == counts.vertices);
+
+	b.data = data;
+	b.x = x;
+	b.y = y;
+	b.topology = topology;
+	b.patchesU = (x - 1 + PATCH_SIZE - 1) / PATCH_SIZE;
+	b.func = f;
+	numPatches = b.patchesU * ((y - 1 + PATCH_SIZE - 1) / PATCH_SIZE);
+	b.patches = (patch_t*)malloc(sizeof(patch_t) * numPatches);
+
+	/* Ranges first, so the patches can be built in parallel. Each row of a
+	 * patch's strip is a pair per column plus the two repeats between rows */
+	for (k = 0; k < numPatches; ++k) {
+		int i0, i1, j0, j1;
+		patchQuads(&b, k, &i0, &i1, &j0, &j1);
+		b.patches[k].first = numIndices;
+		if (topology != TOPOLOGY_OPEN)
+			b.patches[k].count = buildGridTriangles(topology, x, y, i0, i1, j0, j1, NULL);
+		else
+			b.patches[k].count = (j1 - j0) * ((i1 - i0 + 1) * 2 + 2);
+		numIndices += b.patches[k].count;
+	}
+	b.indices = (unsigned int*)malloc(sizeof(unsigned int) * numIndices);
+
+	va_start(args, f);
+	b.args = &args;
+	parallelFor(numPatches, buildPatch, &b);
+	va_end(args);
+
+	free(data->indices);
+	free(data->patches);
+	data->indices = b.indices;
+	data->numIndices = numIndices;
+	data->patches = b.patches;
+	data->numPatches = numPatches;
+	trackObjectData(data);
+}
+
+/* Whether the eye is behind every triangle the patch's cone allows: the
+ * direction to any point of the sphere is within asin(r / d) of the
+ * direction to its centre, and every normal within the cone of the axis */
+static int backfacing(const patch_t* p, vector_t eye, float radius)
+{
+	vector_t toPatch = sub(p->center, eye);
+	float d2 = dot(toPatch, toPatch), r2 = radius * radius, tangent;
+
+	if (p->coneCos <= 0.0f || d2 <= r2)
+		return 0;
+	tangent = sqrtf(d2 - r2);
+	/* The two angles together must stay under 90 degrees */
+	if (p->coneCos * tangent <= p->coneSin * radius)
+		return 0;
+	return dot(toPatch, p->axis) > p->coneSin * tangent + radius * p->coneCos;
+}
+
+void cullObjectPatches(Object* obj, const mat4_t* projection, const mat4_t* modelView,
+	float inflate, int backfaces, PatchStats* stats)
+{
+	mat4_t clip, inverse;
+	float planes[6][4];
+	vector_t eye;
+	int k, i, outside = 0, behind = 0, elements = 0;
+
+	if (!obj->patches) {
+		obj->numDraws = -1;
+		if (stats) {
+			stats->patches = stats->backfacing = stats->outside = stats->draws = 0;
+			stats->elements = obj->numElements;
+		}
+		return;
+	}
+
+	/* Eye in object space */
+	mat4InverseRigid(&inverse, modelView);
+	eye.x = inverse.m[12];
+	eye.y = inverse.m[13];
+	eye.z = inverse.m[14];
+
+	/* Frustum planes in object space, from the rows of the combined
+	 * matrix, normalized so they give distances */
+	mat4Multiply(&clip, projection, modelView);
+	for (i = 0; i < 6; ++i) {
+		int row = i / 2;
+		float sign = i % 2 ? -1.0f : 1.0f, length;
+		for (k = 0; k < 4; ++k)
+			planes[i][k] = clip.m[k * 4 + 3] + sign * clip.m[k * 4 + row];
+		length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		for (k = 0; k < 4; ++k)
+			planes[i][k] /= length;
+	}
+
+	obj->numDraws = 0;
+	for (k = 0; k < obj->numPatches; ++k) {
+		const patch_t* p = &obj->patches[k];
+		float radius = p->radius + inflate;
+		int visible = 1;
+
+		for (i = 0; i < 6 && visible; ++i)
+			visible = planes[i][0] * p->center.x + planes[i][1] * p->center.y +
+				planes[i][2] * p->center.z + planes[i][3] >= -radius;
+		if (!visible) {
+			outside++;
+			continue;
+		}
+		if (backfaces && backfacing(p, eye, radius)) {
+			behind++;
+			continue;
+		}
+
+		/* Carry on the last range if this one follows it */
+		elements += p->count;
+		if (obj->numDraws > 0 && (char*)obj->drawOffsets[obj->numDraws - 1] +
+			obj->drawCounts[obj->numDraws - 1] * sizeof(unsigned int) == (char*)0 + p->first * sizeof(unsigned int)) {
+			obj->drawCounts[obj->numDraws - 1] += p->count;
+			continue;
+		}
+		obj->drawOffsets[obj->numDraws] = (GLvoid*)((char*)0 + p->first * sizeof(unsigned int));
+		obj->drawCounts[obj->numDraws] = p->count;
+		obj->numDraws++;
+	}
+
+	if (stats) {
+		stats->patches = obj->numPatches;
+		stats->backfacing = behind;
+		stats->outside = outside;
+		stats->draws = obj->numDraws;
+		stats->elements = elements;
+	}
+}
+
+void resetObjectPatches(Object* obj)
+{
+	obj->numDraws = -1;
+}
@@ -0,0 +1,63 @@
+/* patches.h - patch clusters of a grid surface, culled on the CPU
+
+At high tessellation the sphere and torus are over a million triangles.
+Half of them face away from the camera and, zoomed in, most of the rest
+are off screen, yet every one goes through the vertex shader before GL
+throws it away. createObjectPatches cuts the x by y grid into patches of
+PATCH_SIZE by PATCH_SIZE quads, each its own run of the strip, and keeps a
+bounding sphere and a normal cone for each: an axis and the angle around
+it every triangle of the patch faces within. cullObjectPatches then tests
+each patch against the view frustum and, for closed surfaces, whether the
+eye is behind every triangle the cone allows, and leaves the visible
+ranges for the draw functions to send in one glMultiDrawElements.
+A closed surface from createObjectDataClosed keeps its triangles, cut
+into patches the same way.
+
+Culling only drops triangles GL would have clipped or culled itself, so
+the image doesn't change. Patches are in row-major order, so neighbours
+that are both visible merge into one range. A grid of no more than
+PATCH_SIZE quads across is one patch with the strip it was generated with.
+
+USAGE:
+data = createObjectData(f, x, y, args) or createObjectDataShader(f, x, y)
+or createObjectDataClosed(f, x, y, topology, args)
+createObjectPatches(data, x, y, topology, f, args), topology
+TOPOLOGY_OPEN for the first two, f giving the positions the shaders
+compute for the shader version
+object = uploadObject(data)
+each frame, cullObjectPatches(object, &projection, &modelView, inflate,
+backfaces, &stats) before drawing, or resetObjectPatches(object) to draw all
+*/
+
+#ifndef PATCHES_H
+#define PATCHES_H
+
+#include "objects.h"
+#include "matrix.h"
+
+#define PATCH_SIZE 16 /* quads along u and v */
+
+typedef struct {
+	int patches; /* tested */
+	int backfacing; /* of those, culled by the normal cone */
+	int outside; /* culled by the frustum */
+	int draws; /* ranges left to draw */
+	int elements; /* indices left to draw */
+} PatchStats;
+
+/* Rebuilds data's indices patch by patch and fills in data->patches. The
+ * data must be a grid from createObjectData or createObjectDataShader,
+ * with topology TOPOLOGY_OPEN, or from createObjectDataClosed with the
+ * topology it was made with, and own its arrays */
+void createObjectPatches(ObjectData* data, int x, int y, Topology topology, ParametricObjFunc f, ...);
+
+/* Sets obj's draw ranges to the patches visible with these matrices.
+ * inflate grows every bounding sphere, for surfaces the shader displaces.
+ * backfaces 0 keeps patches facing away, for open or displaced surfaces.
+ * stats may be NULL. Objects without patches are left drawing everything */
+void cullObjectPatches(Object* obj, const mat4_t* projection, const mat4_t* modelView,
+	float inflate, int backfaces, PatchStats* stats);
+/* Draws the whole object again */
+void resetObjectPatches(Object* obj);
+
+#endif
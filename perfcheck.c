@@ -0,0 +1,296 @@
+/* perfcheck.c - compares ass2-base --perf results with a stored baseline
+
+USAGE:
+perfcheck [--tolerance <percent>] <baseline> <results>
+                                         exit status 1 on any regression
+perfcheck --update <baseline> <results>  store results as the baseline
+
+Result files start with a "renderer <name>" line, followed by lines of
+"<config> <metric> <samples...>", or "<config> image <checksum>". A
+baseline file holds one such section per renderer, since timings and
+images only compare on the same GPU and driver.
+
+Each timing is the median of its trials. A regression needs the median to
+be more than the tolerance (default 20%) slower, and each median must lie
+outside the other run's 95% confidence interval for it, so a noisy trial
+alone can't fail the check. Any
+change of image checksum fails, so a speedup that changes the picture is
+caught too.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 1024
+#define MAX_SAMPLES 64
+#define NOISE_FLOOR 0.1 /* ms, changes smaller than this are ignored */
+#define DEFAULT_TOLERANCE 20.0 /* percent, as the Makefile's PERF_TOLERANCE */
+
+typedef struct {
+	char config[64];
+	char metric[32];
+	double samples[MAX_SAMPLES];
+	int numSamples;
+	char image[16]; /* checksum, for the image metric */
+} Entry;
+
+typedef struct {
+	char renderer[256];
+	Entry* entries;
+	int numEntries;
+} Section;
+
+static void addEntry(Section* section, const Entry* entry)
+{
+	section->entries = (Entry*)realloc(section->entries, sizeof(Entry) * (section->numEntries + 1));
+	section->entries[section->numEntries++] = *entry;
+}
+
+/* Reads every section of a file. Returns the section count, -1 if the file
+ * can't be opened */
+static int readSections(const char* filename, Section** sections)
+{
+	FILE* file = fopen(filename, "r");
+	char line[MAX_LINE];
+	int count = 0;
+
+	*sections = NULL;
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof line, file)) {
+		Entry entry;
+		char* token;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!strncmp(line, "renderer ", 9)) {
+			*sections = (Section*)realloc(*sections, sizeof(Section) * (count + 1));
+			memset(&(*sections)[count], 0, sizeof(Section));
+			/* Names longer than the field are cut short */
+			snprintf((*sections)[count].renderer, sizeof((*sections)[count].renderer), "%.*s",
+				(int)sizeof((*sections)[count].renderer) - 1, line + 9);
+			count++;
+			continue;
+		}
+		if (!count || line[0] == '#' || line[0] == '\0')
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+		if (!(token = strtok(line, " ")))
+			continue;
+		strncpy(entry.config, token, sizeof(entry.config) - 1);
+		if (!(token = strtok(NULL, " ")))
+			continue;
+		strncpy(entry.metric, token, sizeof(entry.metric) - 1);
+		while ((token = strtok(NULL, " "))) {
+			if (!strcmp(entry.metric, "image"))
+				strncpy(entry.image, token, sizeof(entry.image) - 1);
+			else if (entry.numSamples < MAX_SAMPLES)
+				entry.samples[entry.numSamples++] = atof(token);
+		}
+		addEntry(&(*sections)[count - 1], &entry);
+	}
+	fclose(file);
+	return count;
+}
+
+static void writeSection(FILE* file, const Section* section)
+{
+	int i, j;
+	fprintf(file, "renderer %s\n", section->renderer);
+	for (i = 0; i < section->numEntries; ++i) {
+		const Entry* e = &section->entries[i];
+		fprintf(file, "%s %s", e->config, e->metric);
+		if (!strcmp(e->metric, "image"))
+			fprintf(file, " %s", e->image);
+		for (j = 0; j < e->numSamples; ++j)
+			fprintf(file, " %.4f", e->samples[j]);
+		fprintf(file, "\n");
+	}
+}
+
+static void freeSections(Section* sections, int count)
+{
+	int i;
+	for (i = 0; i < count; ++i)
+		free(sections[i].entries);
+	free(sections);
+}
+
+static const Entry* findEntry(const Section* section, const Entry* like)
+{
+	int i;
+	for (i = 0; i < section->numEntries; ++i)
+		if (!strcmp(section->entries[i].config, like->config) && !strcmp(section->entries[i].metric, like->metric))
+			return &section->entries[i];
+	return NULL;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Median and a distribution free 95% confidence interval for it: the
+ * interval between order statistics k and n - 1 - k, with k the largest
+ * rank a Binomial(n, 1/2) count stays under with probability 2.5% */
+static void medianInterval(const Entry* e, double* median, double* low, double* high)
+{
+	double sorted[MAX_SAMPLES];
+	double tail = 0.0, term;
+	int n = e->numSamples, k = 0, i;
+
+	memcpy(sorted, e->samples, sizeof(double) * n);
+	qsort(sorted, n, sizeof(double), compareDoubles);
+	*median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+
+	/* term is C(n, i) / 2^n */
+	term = pow(0.5, n);
+	for (i = 0; i < n / 2; ++i) {
+		tail += term;
+		if (tail > 0.025)
+			break;
+		k = i + 1;
+		term = term * (n - i) / (i + 1);
+	}
+	if (k > 0)
+		k--;
+	*low = sorted[k];
+	*high = sorted[n - 1 - k];
+}
+
+/* One line of the diff table, with the heading before the first */
+static void printRow(const Entry* e, const char* before, const char* after, const char* change, const char* status)
+{
+	static int rows = 0;
+	if (!rows++)
+		printf("%-32s %-12s %26s %26s %8s  %s\n", "config", "metric", "baseline median [95% CI]", "current median [95% CI]", "change", "status");
+	printf("%-32s %-12s %26s %26s %8s  %s\n", e->config, e->metric, before, after, change, status);
+}
+
+static int check(const char* baselineFile, const char* resultsFile, double tolerance)
+{
+	Section *baseline, *results;
+	int numBaseline, numResults, i, b = -1;
+	int regressions = 0, improvements = 0, changedImages = 0, missing = 0, checked = 0;
+
+	numResults = readSections(resultsFile, &results);
+	if (numResults < 1) {
+		printf("perfcheck: no results in %s\n", resultsFile);
+		return 2;
+	}
+	numBaseline = readSections(baselineFile, &baseline);
+	for (i = 0; i < numBaseline; ++i)
+		if (!strcmp(baseline[i].renderer, results[0].renderer))
+			b = i;
+	if (b < 0) {
+		printf("perfcheck: %s has no baseline for renderer \"%s\".\n", baselineFile, results[0].renderer);
+		printf("Run \"make perf-baseline\" on this machine and check in %s.\n", baselineFile);
+		freeSections(results, numResults);
+		freeSections(baseline, numBaseline > 0 ? numBaseline : 0);
+		return 2;
+	}
+
+	for (i = 0; i < results[0].numEntries; ++i) {
+		const Entry* now = &results[0].entries[i];
+		const Entry* then = findEntry(&baseline[b], now);
+		char before[64], after[64], percent[16];
+		double m0, lo0, hi0, m1, lo1, hi1, change;
+		const char* status = NULL;
+
+		if (!then) {
+			printRow(now, "-", "-", "", "new");
+			missing++;
+			continue;
+		}
+		checked++;
+		if (!strcmp(now->metric, "image")) {
+			if (strcmp(now->image, then->image)) {
+				printRow(now, then->image, now->image, "", "IMAGE CHANGED");
+				changedImages++;
+			}
+			continue;
+		}
+		if (!now->numSamples || !then->numSamples)
+			continue;
+
+		medianInterval(then, &m0, &lo0, &hi0);
+		medianInterval(now, &m1, &lo1, &hi1);
+		change = m0 > 0.0 ? (m1 - m0) / m0 : 0.0;
+		if (fabs(m1 - m0) >= NOISE_FLOOR && change > tolerance && lo1 > m0 && hi0 < m1) {
+			status = "REGRESSION";
+			regressions++;
+		} else if (fabs(m1 - m0) >= NOISE_FLOOR && change < -tolerance && hi1 < m0 && lo0 > m1) {
+			status = "faster";
+			improvements++;
+		}
+		if (status) {
+			snprintf(before, sizeof before, "%.3f [%.3f, %.3f]", m0, lo0, hi0);
+			snprintf(after, sizeof after, "%.3f [%.3f, %.3f]", m1, lo1, hi1);
+			snprintf(percent, sizeof percent, "%+.1f%%", change * 100.0);
+			printRow(now, before, after, percent, status);
+		}
+	}
+
+	printf("perfcheck: %d metrics compared against \"%s\" at %.0f%% tolerance: %d regressions, %d image changes, %d faster, %d new\n",
+		checked, results[0].renderer, tolerance * 100.0, regressions, changedImages, improvements, missing);
+	if (improvements && !regressions && !changedImages)
+		printf("Consider \"make perf-baseline\" to lock in the improvement.\n");
+
+	freeSections(results, numResults);
+	freeSections(baseline, numBaseline);
+	return regressions || changedImages ? 1 : 0;
+}
+
+/* Replaces, or adds, the baseline section for the results' renderer */
+static int update(const char* baselineFile, const char* resultsFile)
+{
+	Section *baseline, *results;
+	int numBaseline, numResults, i, replaced = 0;
+	FILE* file;
+
+	numResults = readSections(resultsFile, &results);
+	if (numResults < 1) {
+		printf("perfcheck: no results in %s\n", resultsFile);
+		return 2;
+	}
+	numBaseline = readSections(baselineFile, &baseline);
+	if (numBaseline < 0)
+		numBaseline = 0;
+
+	file = fopen(baselineFile, "w");
+	if (!file) {
+		printf("perfcheck: could not write %s\n", baselineFile);
+		return 2;
+	}
+	for (i = 0; i < numBaseline; ++i) {
+		if (!strcmp(baseline[i].renderer, results[0].renderer)) {
+			writeSection(file, &results[0]);
+			replaced = 1;
+		} else
+			writeSection(file, &baseline[i]);
+	}
+	if (!replaced)
+		writeSection(file, &results[0]);
+	fclose(file);
+	printf("perfcheck: %s baseline for \"%s\" in %s\n", replaced ? "replaced" : "added", results[0].renderer, baselineFile);
+
+	freeSections(results, numResults);
+	freeSections(baseline, numBaseline);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 4 && !strcmp(argv[1], "--update"))
+		return update(argv[2], argv[3]);
+	if (argc == 3)
+		return check(argv[1], argv[2], DEFAULT_TOLERANCE / 100.0);
+	if (argc == 5 && !strcmp(argv[1], "--tolerance"))
+		return check(argv[3], argv[4], atof(argv[2]) / 100.0);
+	printf("usage: %s [--tolerance <percent>] <baseline> <results>\n", argv[0]);
+	printf("       %s --update <baseline> <results>\n", argv[0]);
+	return 2;
+}
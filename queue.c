@@ -0,0 +1,59 @@
+/* queue.c - lock-free single producer, single consumer ring buffer */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+
+int queueInit(Queue* q, size_t slotSize, unsigned int capacity)
+{
+	unsigned int size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	memset(q, 0, sizeof(Queue));
+	/* Keep every slot aligned for any member type */
+	q->slotSize = (slotSize + 15) & ~(size_t)15;
+	q->mask = size - 1;
+	q->slots = (char*)malloc(q->slotSize * size);
+	return q->slots != NULL;
+}
+
+void queueFree(Queue* q)
+{
+	free(q->slots);
+	q->slots = NULL;
+}
+
+void* queueBeginPush(Queue* q)
+{
+	/* Acquire pairs with queuePop's release, so the consumer is done with the slot */
+	unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	if (q->head - tail > q->mask)
+		return NULL;
+	return q->slots + (q->head & q->mask) * q->slotSize;
+}
+
+void queueEndPush(Queue* q)
+{
+	/* Release publishes the slot contents before the new head */
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+void* queueFront(Queue* q)
+{
+	unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (head == q->tail)
+		return NULL;
+	return q->slots + (q->tail & q->mask) * q->slotSize;
+}
+
+void queuePop(Queue* q)
+{
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int queueSize(Queue* q)
+{
+	return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,46 @@
+/* queue.h - lock-free single producer, single consumer ring buffer */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+
+/*
+Fixed size slots are written and read in place, so nothing is copied twice.
+Exactly one thread may push and exactly one other thread may pop.
+
+USAGE:
+producer: if ((slot = queueBeginPush(&q))) { fill slot; queueEndPush(&q); }
+consumer: while ((slot = queueFront(&q))) { read slot; queuePop(&q); }
+*/
+
+#define QUEUE_CACHE_LINE 64
+
+typedef struct QueueType {
+	char* slots;
+	size_t slotSize;
+	unsigned int mask; /* capacity - 1, capacity is a power of two */
+	/* Kept on separate cache lines so the two threads don't false-share */
+	char pad0[QUEUE_CACHE_LINE];
+	unsigned int head; /* Next slot to write. Written by the producer only */
+	char pad1[QUEUE_CACHE_LINE];
+	unsigned int tail; /* Next slot to read. Written by the consumer only */
+	char pad2[QUEUE_CACHE_LINE];
+} Queue;
+
+/* capacity is rounded up to a power of two. Returns 0 on allocation failure */
+int queueInit(Queue* q, size_t slotSize, unsigned int capacity);
+void queueFree(Queue* q);
+
+/* Producer side. Returns NULL when the queue is full */
+void* queueBeginPush(Queue* q);
+void queueEndPush(Queue* q);
+
+/* Consumer side. Returns NULL when the queue is empty */
+void* queueFront(Queue* q);
+void queuePop(Queue* q);
+
+/* Approximate when called while the other thread is active */
+unsigned int queueSize(Queue* q);
+
+#endif
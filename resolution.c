@@ -0,0 +1,244 @@
+/* resolution.c - scene drawn at a lower resolution to hold a frame time */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __APPLE__
+#include <GL/glew.h>
+#endif
+
+#include "resolution.h"
+#include "resources.h"
+#include "timer.h"
+
+/* Most the scale moves by per adjustment, down and up. Down is quicker,
+ * a missed frame is worse than a blurry one */
+#define RESOLUTION_STEP_DOWN 0.75f
+#define RESOLUTION_STEP_UP 1.15f
+#define RESOLUTION_QUANTUM 64.0f
+
+DynamicResolution* createDynamicResolution(float target, int cpuTimed)
+{
+	DynamicResolution* dr = (DynamicResolution*)calloc(1, sizeof(DynamicResolution));
+	dr->target = target;
+	dr->scale = 1.0f;
+#ifdef GL_TIMESTAMP
+	{
+		const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+		if (!cpuTimed && extensions && strstr(extensions, "GL_ARB_timer_query")) {
+			glGenQueries(RESOLUTION_QUERIES * 2, dr->queries[0]);
+			dr->gpuTimed = 1;
+		}
+	}
+#endif
+	pthread_mutex_init(&dr->lock, NULL);
+	dr->published.target = target;
+	dr->published.scale = dr->scale;
+	dr->published.gpuTimed = dr->gpuTimed;
+	return dr;
+}
+
+/* Copies what the OSD shows for dynamicResolutionStats */
+static void publishStats(DynamicResolution* dr)
+{
+	pthread_mutex_lock(&dr->lock);
+	dr->published.scale = dr->scale;
+	dr->published.scaledWidth = dr->scaledWidth;
+	dr->published.scaledHeight = dr->scaledHeight;
+	dr->published.frameTime = dr->frameTime;
+	dr->published.incomplete = dr->incomplete;
+	pthread_mutex_unlock(&dr->lock);
+}
+
+static void scaledSize(DynamicResolution* dr)
+{
+	dr->scaledWidth = (int)(dr->width * dr->scale + 0.5f);
+	dr->scaledHeight = (int)(dr->height * dr->scale + 0.5f);
+	if (dr->scaledWidth < 1)
+		dr->scaledWidth = 1;
+	if (dr->scaledHeight < 1)
+		dr->scaledHeight = 1;
+}
+
+static float clampScale(float scale)
+{
+	if (scale < RESOLUTION_MIN_SCALE)
+		return RESOLUTION_MIN_SCALE;
+	return scale > 1.0f ? 1.0f : scale;
+}
+
+/* The controller, given one frame's time */
+static void adjust(DynamicResolution* dr, double seconds)
+{
+	float scale;
+
+	if (dr->settle > 0) {
+		dr->settle--;
+		return;
+	}
+	dr->sum += seconds;
+	if (++dr->samples < RESOLUTION_INTERVAL)
+		return;
+	dr->frameTime = (float)(dr->sum / dr->samples);
+	dr->sum = 0.0;
+	dr->samples = 0;
+	if (dr->frameTime <= dr->target && dr->frameTime >= dr->target * RESOLUTION_HEADROOM)
+		return;
+
+	/* Aim between the headroom and the target */
+	scale = dr->scale * sqrtf(dr->target * (1.0f + RESOLUTION_HEADROOM) * 0.5f / dr->frameTime);
+	if (scale < dr->scale * RESOLUTION_STEP_DOWN)
+		scale = dr->scale * RESOLUTION_STEP_DOWN;
+	if (scale > dr->scale * RESOLUTION_STEP_UP)
+		scale = dr->scale * RESOLUTION_STEP_UP;
+	scale = clampScale(floorf(scale * RESOLUTION_QUANTUM + 0.5f) / RESOLUTION_QUANTUM);
+	if (scale == dr->scale)
+		return;
+	dr->scale = scale;
+	dr->adjustments++;
+	/* CPU times are taken as they happen, so only the next is stale */
+	dr->settle = dr->gpuTimed ? (int)(dr->issued - dr->read) : 1;
+}
+
+/* Feeds the controller with every frame the GPU has finished */
+static void readQueries(DynamicResolution* dr)
+{
+#ifdef GL_TIMESTAMP
+	GLuint available;
+	GLuint64 start, end;
+	while (dr->read != dr->issued) {
+		GLuint* pair = dr->queries[dr->read % RESOLUTION_QUERIES];
+		glGetQueryObjectuiv(pair[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		glGetQueryObjectui64v(pair[0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(pair[1], GL_QUERY_RESULT, &end);
+		dr->read++;
+		adjust(dr, (end - start) * 1e-9);
+	}
+#endif
+}
+
+/* A framebuffer the window's size. Returns 0 if it isn't complete */
+static int allocate(DynamicResolution* dr, int width, int height)
+{
+	GLint previous;
+	GLenum status;
+
+	/* Keep the pixel count through a resize */
+	if (dr->framebuffer && dr->width && dr->height)
+		dr->scale = clampScale(dr->scale * sqrtf((float)dr->width * dr->height / ((float)width * height)));
+	dynamicResolutionRelease(dr);
+
+	glGenFramebuffers(1, &dr->framebuffer);
+	glGenRenderbuffers(2, dr->renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, dr->renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, dr->renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_FRAMEBUFFER, dr->framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, dr->renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dr->renderbuffers[1]);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+	draw_gl_calls += 12;
+
+	dr->width = width;
+	dr->height = height;
+	resourceAlloc(RES_TEXTURES, RES_GPU, (size_t)width * height * 8);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		dynamicResolutionRelease(dr);
+		dr->incomplete = 1;
+		return 0;
+	}
+	/* Whatever is in flight was drawn at another size */
+	dr->settle = (int)(dr->issued - dr->read);
+	dr->sum = 0.0;
+	dr->samples = 0;
+	return 1;
+}
+
+int dynamicResolutionBegin(DynamicResolution* dr, int width, int height)
+{
+	double now = timerNow();
+
+	if (width <= 0 || height <= 0 || dr->incomplete)
+		return 0;
+	if ((!dr->framebuffer || width != dr->width || height != dr->height) && !allocate(dr, width, height)) {
+		publishStats(dr);
+		return 0;
+	}
+
+	if (dr->gpuTimed)
+		readQueries(dr);
+	else if (dr->lastBegin > 0.0)
+		adjust(dr, now - dr->lastBegin);
+	dr->lastBegin = now;
+	scaledSize(dr);
+	publishStats(dr);
+
+	/* One more frame in flight than there are queries would overwrite a result */
+	dr->timing = dr->gpuTimed && dr->issued - dr->read < RESOLUTION_QUERIES;
+#ifdef GL_TIMESTAMP
+	if (dr->timing)
+		glQueryCounter(dr->queries[dr->issued % RESOLUTION_QUERIES][0], GL_TIMESTAMP);
+#endif
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &dr->previousFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, dr->framebuffer);
+	glViewport(0, 0, dr->scaledWidth, dr->scaledHeight);
+	glScissor(0, 0, dr->scaledWidth, dr->scaledHeight);
+	glEnable(GL_SCISSOR_TEST);
+	draw_gl_calls += 6;
+	return 1;
+}
+
+void dynamicResolutionEnd(DynamicResolution* dr)
+{
+	/* Blits are scissored too */
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, dr->framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dr->previousFramebuffer);
+	glBlitFramebuffer(0, 0, dr->scaledWidth, dr->scaledHeight, 0, 0, dr->width, dr->height,
+		GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, dr->previousFramebuffer);
+	glViewport(0, 0, dr->width, dr->height);
+	draw_gl_calls += 6;
+#ifdef GL_TIMESTAMP
+	if (dr->timing) {
+		glQueryCounter(dr->queries[dr->issued % RESOLUTION_QUERIES][1], GL_TIMESTAMP);
+		dr->issued++;
+		draw_gl_calls += 2;
+	}
+#endif
+}
+
+void dynamicResolutionStats(DynamicResolution* dr, ResolutionStats* stats)
+{
+	pthread_mutex_lock(&dr->lock);
+	*stats = dr->published;
+	pthread_mutex_unlock(&dr->lock);
+}
+
+void dynamicResolutionRelease(DynamicResolution* dr)
+{
+	if (!dr->framebuffer)
+		return;
+	glDeleteFramebuffers(1, &dr->framebuffer);
+	glDeleteRenderbuffers(2, dr->renderbuffers);
+	resourceFree(RES_TEXTURES, RES_GPU, (size_t)dr->width * dr->height * 8);
+	dr->framebuffer = 0;
+	dr->lastBegin = 0.0;
+}
+
+void freeDynamicResolution(DynamicResolution* dr)
+{
+	dynamicResolutionRelease(dr);
+	if (dr->gpuTimed)
+		glDeleteQueries(RESOLUTION_QUERIES * 2, dr->queries[0]);
+	pthread_mutex_destroy(&dr->lock);
+	free(dr);
+}
@@ -0,0 +1,92 @@
+/* resolution.h - scene drawn at a lower resolution to hold a frame time
+
+Pixel lighting with bumps costs per fragment, so the frame time follows
+the window's pixel count: making the window larger can take a frame that
+fit comfortably well past its budget. Here the scene is drawn into an
+offscreen framebuffer at scale times the window's width and height and
+stretched over the window with linear filtering, and the scale follows
+the measured frame time.
+
+Frames are timed on the GPU with timestamp queries, from
+dynamicResolutionBegin to the end of the stretch, read back a few frames
+later so nothing waits. Without ARB_timer_query, or when asked for, the
+time between frames on the CPU is used instead, which can't see below the
+swap interval when vsync is on. Drivers that rasterize after the
+timestamp has been taken, such as llvmpipe, need the CPU times. Every interval frames the average is compared with the
+target. Above it, or below RESOLUTION_HEADROOM of it, the scale moves by
+the square root of the ratio, as the cost goes with the pixel count, a
+limited step at a time and in 1/64ths. Frames still in flight measured
+the old scale and are skipped. When the window changes size the scale is
+changed to keep the pixel count, so a resize doesn't cost a frame spike.
+
+The framebuffer is the window's size and the scene is drawn in its lower
+left corner, so changing the scale allocates nothing. Clears are held to
+that corner with the scissor test until dynamicResolutionEnd.
+
+USAGE:
+dr = createDynamicResolution(target seconds, cpuTimed) with a context current
+each frame if (dynamicResolutionBegin(dr, width, height)) { draw the scene
+at dr->scaledWidth x dr->scaledHeight; dynamicResolutionEnd(dr); } and
+anything native resolution, such as text, after
+dynamicResolutionStats(dr, &stats) from any thread, for the OSD
+dynamicResolutionRelease(dr) frees the framebuffer while not in use
+freeDynamicResolution(dr)
+*/
+
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <pthread.h>
+
+#include "objects.h"
+
+#define RESOLUTION_MIN_SCALE 0.25f
+#define RESOLUTION_INTERVAL 8 /* frames averaged per adjustment */
+#define RESOLUTION_HEADROOM 0.8f /* scale up only below this share of the target */
+#define RESOLUTION_QUERIES 4 /* frames timed in flight */
+
+/* What the OSD shows, as of the last dynamicResolutionBegin */
+typedef struct {
+	float target, scale;
+	int scaledWidth, scaledHeight;
+	float frameTime;
+	int gpuTimed;
+	int incomplete;
+} ResolutionStats;
+
+typedef struct {
+	float target; /* seconds per frame */
+	float scale; /* of the window's width and height, RESOLUTION_MIN_SCALE to 1 */
+	int width, height; /* of the window */
+	int scaledWidth, scaledHeight; /* drawn */
+	float frameTime; /* last average measured, 0 until there is one */
+	int gpuTimed; /* frame times are from timestamp queries */
+	int adjustments; /* times the scale changed */
+	/* Internal */
+	GLuint framebuffer, renderbuffers[2];
+	int incomplete; /* the framebuffer can't be made, don't try again */
+	GLuint queries[RESOLUTION_QUERIES][2];
+	unsigned int issued, read; /* timed frames */
+	int timing; /* this frame is timed */
+	int settle; /* samples to skip, they measured an old scale */
+	double sum;
+	int samples;
+	double lastBegin;
+	GLint previousFramebuffer;
+	pthread_mutex_t lock;
+	ResolutionStats published; /* under lock */
+} DynamicResolution;
+
+/* cpuTimed times frames on the CPU even where timestamp queries exist */
+DynamicResolution* createDynamicResolution(float target, int cpuTimed);
+/* Returns 1 with the scaled framebuffer bound, viewport and scissor set,
+ * or 0 if it can't be made, with nothing changed */
+int dynamicResolutionBegin(DynamicResolution* dr, int width, int height);
+/* Stretches the scene over the framebuffer bound before Begin, and
+ * leaves that bound with the window's viewport */
+void dynamicResolutionEnd(DynamicResolution* dr);
+void dynamicResolutionStats(DynamicResolution* dr, ResolutionStats* stats);
+void dynamicResolutionRelease(DynamicResolution* dr);
+void freeDynamicResolution(DynamicResolution* dr);
+
+#endif
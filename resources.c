@@ -0,0 +1,105 @@
+/* resources.c - host and GPU memory accounting */
+
+#include <stdio.h>
+
+#include "resources.h"
+
+#define MB (1024.0 * 1024.0)
+
+/* Index RES_KINDS is the heap's total */
+static size_t bytes[RES_KINDS + 1][RES_HEAPS];
+static size_t peak[RES_KINDS + 1][RES_HEAPS];
+static int count[RES_KINDS][RES_HEAPS];
+static size_t budget[RES_HEAPS];
+static int overBudget[RES_HEAPS]; /* reported already */
+
+static const char* kindNames[RES_KINDS] = {"geometry", "normals", "shaders", "textures", "OSD"};
+static const char* heapNames[RES_HEAPS] = {"host", "GPU"};
+
+/* Raises *max to value unless another thread got it higher */
+static void atomicMax(size_t* max, size_t value)
+{
+	size_t seen = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while (value > seen && !__atomic_compare_exchange_n(max, &seen, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void resourceAlloc(enum ResourceKind kind, enum ResourceHeap heap, size_t size)
+{
+	atomicMax(&peak[kind][heap], __atomic_add_fetch(&bytes[kind][heap], size, __ATOMIC_RELAXED));
+	atomicMax(&peak[RES_KINDS][heap], __atomic_add_fetch(&bytes[RES_KINDS][heap], size, __ATOMIC_RELAXED));
+	__atomic_add_fetch(&count[kind][heap], 1, __ATOMIC_RELAXED);
+}
+
+void resourceFree(enum ResourceKind kind, enum ResourceHeap heap, size_t size)
+{
+	__atomic_sub_fetch(&bytes[kind][heap], size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&bytes[RES_KINDS][heap], size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&count[kind][heap], 1, __ATOMIC_RELAXED);
+}
+
+int resourceFits(enum ResourceHeap heap, size_t size)
+{
+	size_t used = __atomic_load_n(&bytes[RES_KINDS][heap], __ATOMIC_RELAXED);
+
+	if (!budget[heap] || used + size <= budget[heap]) {
+		__atomic_store_n(&overBudget[heap], 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+	if (!__atomic_exchange_n(&overBudget[heap], 1, __ATOMIC_RELAXED))
+		printf("Resource budget: %.1f MB more %s memory refused, %.1f of %.1f MB in use\n",
+			size / MB, heapNames[heap], used / MB, budget[heap] / MB);
+	return 0;
+}
+
+void resourceSetBudget(enum ResourceHeap heap, size_t size)
+{
+	budget[heap] = size;
+	overBudget[heap] = 0;
+}
+
+size_t resourceBudget(enum ResourceHeap heap)
+{
+	return budget[heap];
+}
+
+size_t resourceBytes(enum ResourceKind kind, enum ResourceHeap heap)
+{
+	return __atomic_load_n(&bytes[kind][heap], __ATOMIC_RELAXED);
+}
+
+size_t resourcePeak(enum ResourceKind kind, enum ResourceHeap heap)
+{
+	return __atomic_load_n(&peak[kind][heap], __ATOMIC_RELAXED);
+}
+
+int resourceCount(enum ResourceKind kind, enum ResourceHeap heap)
+{
+	return __atomic_load_n(&count[kind][heap], __ATOMIC_RELAXED);
+}
+
+const char* resourceName(enum ResourceKind kind)
+{
+	return kind < RES_KINDS ? kindNames[kind] : "total";
+}
+
+int resourceReport()
+{
+	int kind, heap, leaks = 0;
+
+	printf("Resources: peak host and GPU MB by subsystem\n");
+	for (kind = 0; kind <= RES_KINDS; ++kind)
+		printf("  %-9s %9.2f %9.2f\n", resourceName(kind), peak[kind][RES_HOST] / MB, peak[kind][RES_GPU] / MB);
+	for (kind = 0; kind < RES_KINDS; ++kind) {
+		for (heap = 0; heap < RES_HEAPS; ++heap) {
+			if (!count[kind][heap] && !bytes[kind][heap])
+				continue;
+			printf("Resources: LEAK %s, %d %s allocations, %zu bytes still live\n",
+				kindNames[kind], count[kind][heap], heapNames[heap], bytes[kind][heap]);
+			leaks += count[kind][heap] > 0 ? count[kind][heap] : 1;
+		}
+	}
+	if (!leaks)
+		printf("Resources: no leaks\n");
+	return leaks;
+}
@@ -0,0 +1,61 @@
+/* resources.h - host and GPU memory accounting
+
+Every GL buffer and texture, and the host memory that lives as long as
+them, is counted here under the subsystem that made it: current bytes,
+peak bytes and how many allocations are live. resourceReport at exit then
+lists anything still live as a leak. Counters are atomic, since geometry
+is generated on the main thread and uploaded and freed on the rendering
+side.
+
+An optional budget caps the bytes in use on either heap. Allocations that
+can be refused check resourceFits first and fail cleanly when it says no;
+everything else is counted regardless, and only reported.
+
+USAGE:
+resourceSetBudget(RES_GPU, bytes) once, 0 for none (the default)
+if (!resourceFits(RES_GPU, size)) fail, else allocate and
+resourceAlloc(RES_GEOMETRY, RES_GPU, size)
+resourceFree(RES_GEOMETRY, RES_GPU, size) with the same size when freed
+resourceReport() before exit
+*/
+
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <stddef.h>
+
+enum ResourceKind {
+	RES_GEOMETRY = 0, /* meshes, their buffers, patches and geometry cache */
+	RES_NORMALS, /* debug normal lines */
+	RES_SHADERS, /* programs and their uniform buffers */
+	RES_TEXTURES, /* bump map, shadow map, light cluster buffers and render targets */
+	RES_OSD, /* overlays, such as the overdraw heatmap */
+	RES_KINDS
+};
+
+enum ResourceHeap {
+	RES_HOST = 0,
+	RES_GPU,
+	RES_HEAPS
+};
+
+void resourceAlloc(enum ResourceKind kind, enum ResourceHeap heap, size_t bytes);
+void resourceFree(enum ResourceKind kind, enum ResourceHeap heap, size_t bytes);
+
+/* 0 if bytes more would go over the heap's budget. The first refusal in
+ * a row is printed */
+int resourceFits(enum ResourceHeap heap, size_t bytes);
+void resourceSetBudget(enum ResourceHeap heap, size_t bytes);
+size_t resourceBudget(enum ResourceHeap heap);
+
+/* For the OSD. kind RES_KINDS gives the heap's total */
+size_t resourceBytes(enum ResourceKind kind, enum ResourceHeap heap);
+size_t resourcePeak(enum ResourceKind kind, enum ResourceHeap heap);
+int resourceCount(enum ResourceKind kind, enum ResourceHeap heap);
+const char* resourceName(enum ResourceKind kind);
+
+/* Peak use of each subsystem and whatever is still live. Returns the
+ * number of leaked allocations */
+int resourceReport();
+
+#endif
@@ -2,90 +2,563 @@
 /* Updated pknowles, gl 2010 */
 
 #include "sdl-base.h"
+#include "timer.h"
+#include "queue.h"
+#include "inputlog.h"
+
+#ifdef __APPLE__
+#include <OpenGL/OpenGL.h>
+#else
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DEFAULT_WIDTH 500
 #define DEFAULT_HEIGHT 500
 #define DEFAULT_DEPTH 32
 #define DEFAULT_FLAGS (SDL_OPENGL | SDL_RESIZABLE)
 
+/* Frame packets in flight between the main and render thread */
+#define FRAME_QUEUE_LENGTH 4
+
 static SDL_Surface *screen;
 static int videoFlags;
 
 /* Frame counting */
 static int frame_count;
-static Uint32 frame_time;
+static double frame_time;
 static int quit_flag;
-int frame_rate;
+static int frame_rate; /* atomic, read from the main thread */
 const int frame_rate_update_interval = 1000;
 
+/* Frame pacing */
+int target_frame_rate = 0;
+int swap_interval = -1;
+int render_on_demand = 0;
+static int redisplay;
+static double next_frame_time;
+
+/* Threading */
+int threaded = 0;
+static Queue frame_queue;
+static SDL_Thread *render_thread;
+static int render_running;
+
+/* Input latency. input_time is when the oldest input not yet drawn was polled */
+static double input_time;
+static float input_latency, input_latency_max; /* atomic, read from either thread */
+static double latency_sum, latency_max, latency_total_sum, latency_total_max;
+static int latency_count, latency_total_count;
+
+/* Input recording and replay. Logged events are tagged with loop_frame,
+ * the number of main loop iterations before the one that polled them */
+#define DEFAULT_REPLAY_DT (1.0 / 60.0)
+static const char *record_path, *replay_path, *replay_timing_path;
+static double replay_dt = DEFAULT_REPLAY_DT;
+static InputLog *record_log, *replay_log;
+static unsigned int loop_frame;
+static double record_start;
+static FILE *replay_timing;
+static double *replay_times; /* per frame, for the summary */
+static unsigned int replay_frames, replay_capacity;
+static int replay_events; /* fed to the current frame */
+
+/* Queue slots hold this followed by frame_packet_size bytes of packet */
+typedef struct {
+	double input_time;
+	double pad;
+} PacketHeader;
+
+#ifdef __APPLE__
+static CGLContextObj gl_context;
+#else
+static Display *gl_display;
+static GLXDrawable gl_drawable;
+static GLXContext gl_context;
+#endif
+
+int frameRate()
+{
+	return __atomic_load_n(&frame_rate, __ATOMIC_RELAXED);
+}
+
+void inputLatency(float *average, float *worst)
+{
+	__atomic_load(&input_latency, average, __ATOMIC_RELAXED);
+	__atomic_load(&input_latency_max, worst, __ATOMIC_RELAXED);
+}
+
 void quit()
 {
 	quit_flag = 1;
 }
 
+void postRedisplay()
+{
+	redisplay = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [--fps <rate>] [--vsync <interval>] [--on-demand] [--threaded]\n", prog);
+	printf("          [--record <file>] [--replay <file>] [--replay-dt <ms>] [--replay-timing <file>] [options]\n");
+	printf("  --fps <rate>         limit the frame rate (0 = unlimited)\n");
+	printf("  --vsync <interval>   buffer swap interval (0 = off, 1 = every retrace)\n");
+	printf("  --on-demand          only render when something changes\n");
+	printf("  --threaded           render on a separate thread\n");
+	printf("  --record <file>      log every input event, frame by frame\n");
+	printf("  --replay <file>      feed a logged run back with a fixed time step, ignoring\n");
+	printf("                       input, print each frame's time and quit at its end\n");
+	printf("  --replay-dt <ms>     time step of --replay (default %.2f)\n", DEFAULT_REPLAY_DT * 1000.0);
+	printf("  --replay-timing <file> per frame times of --replay go here, not stdout\n");
+	printf("%s", option_usage);
+}
+
+static int parseArgs(int argc, char **argv)
+{
+	int i;
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+			target_frame_rate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--vsync") && i + 1 < argc)
+			swap_interval = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--on-demand"))
+			render_on_demand = 1;
+		else if (!strcmp(argv[i], "--threaded"))
+			threaded = 1;
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+			record_path = argv[++i];
+		else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+			replay_path = argv[++i];
+		else if (!strcmp(argv[i], "--replay-dt") && i + 1 < argc)
+			replay_dt = atof(argv[++i]) * 0.001;
+		else if (!strcmp(argv[i], "--replay-timing") && i + 1 < argc)
+			replay_timing_path = argv[++i];
+		else {
+			int used = option(argc, argv, i);
+			if (!used) {
+				usage(argv[0]);
+				return 0;
+			}
+			i += used - 1;
+		}
+	}
+	return 1;
+}
+
+/* SDL 1.2 has no way to move its context between threads, so go to the platform */
+static void captureContext()
+{
+#ifdef __APPLE__
+	gl_context = CGLGetCurrentContext();
+#else
+	gl_display = glXGetCurrentDisplay();
+	gl_drawable = glXGetCurrentDrawable();
+	gl_context = glXGetCurrentContext();
+#endif
+}
+
+static void makeContextCurrent(int current)
+{
+#ifdef __APPLE__
+	CGLSetCurrentContext(current ? gl_context : NULL);
+#else
+	if (current)
+		glXMakeCurrent(gl_display, gl_drawable, gl_context);
+	else
+		glXMakeCurrent(gl_display, None, NULL);
+#endif
+}
+
+static void setVideoMode(int width, int height)
+{
+	/* Must be set before each SDL_SetVideoMode. -1 keeps the driver default */
+	if (swap_interval >= 0)
+		SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, swap_interval);
+	screen = SDL_SetVideoMode(width, height, DEFAULT_DEPTH, videoFlags);
+}
+
+/* Draws and swaps the current frame. inputTime is when the oldest input it
+ * shows arrived, or 0. Runs on whichever thread owns the context. */
+static void presentFrame(double inputTime)
+{
+	double now, latency;
+
+	/* Refresh display and flip buffers */
+	display(screen);
+	SDL_GL_SwapBuffers();
+	now = timerNow();
+
+	/* Measured up to the swap returning. The driver may queue the frame a
+	 * little longer before it reaches the screen */
+	if (inputTime > 0.0)
+	{
+		latency = now - inputTime;
+		latency_sum += latency;
+		latency_total_sum += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		if (latency > latency_total_max)
+			latency_total_max = latency;
+		latency_count++;
+		latency_total_count++;
+	}
+
+	/* Update frame rate and latency */
+	frame_count++;
+	if (now - frame_time > frame_rate_update_interval * 0.001)
+	{
+		int rate = (int)(frame_count / (now - frame_time));
+		float average = latency_count ? (float)(latency_sum / latency_count * 1000.0) : 0.0f;
+		float worst = (float)(latency_max * 1000.0);
+		__atomic_store_n(&frame_rate, rate, __ATOMIC_RELAXED);
+		__atomic_store(&input_latency, &average, __ATOMIC_RELAXED);
+		__atomic_store(&input_latency_max, &worst, __ATOMIC_RELAXED);
+		frame_count = 0;
+		frame_time = now;
+		latency_sum = latency_max = 0.0;
+		latency_count = 0;
+	}
+
+	/* Hold the target frame rate. Deadlines advance by a fixed step so
+	 * sleep jitter doesn't accumulate, but resync after a long stall */
+	if (target_frame_rate > 0)
+	{
+		next_frame_time += 1.0 / target_frame_rate;
+		now = timerNow();
+		if (next_frame_time < now - 1.0 / target_frame_rate)
+			next_frame_time = now;
+		timerSleepUntil(next_frame_time);
+	}
+}
+
+/* Hands every queued packet to consume() in order and draws the result once.
+ * Returns 0 if there was nothing to draw. */
+static int drawQueuedFrames()
+{
+	PacketHeader *header;
+	double oldestInput = 0.0;
+	int count = 0;
+
+	while ((header = (PacketHeader*)queueFront(&frame_queue)))
+	{
+		if (header->input_time > 0.0 && (oldestInput == 0.0 || header->input_time < oldestInput))
+			oldestInput = header->input_time;
+		consume(header + 1);
+		queuePop(&frame_queue);
+		count++;
+	}
+	if (count)
+		presentFrame(oldestInput);
+	return count;
+}
+
+static int renderThread(void *data)
+{
+	makeContextCurrent(1);
+	while (__atomic_load_n(&render_running, __ATOMIC_ACQUIRE))
+	{
+		/* Sleep rather than spin while the main thread has nothing new */
+		if (!drawQueuedFrames())
+			SDL_Delay(1);
+	}
+	makeContextCurrent(0);
+	return 0;
+}
+
+static void startRenderThread()
+{
+	captureContext();
+	makeContextCurrent(0);
+	__atomic_store_n(&render_running, 1, __ATOMIC_RELEASE);
+	render_thread = SDL_CreateThread(renderThread, NULL);
+}
+
+static void stopRenderThread()
+{
+	__atomic_store_n(&render_running, 0, __ATOMIC_RELEASE);
+	SDL_WaitThread(render_thread, NULL);
+	render_thread = NULL;
+	makeContextCurrent(1);
+}
+
+/* Fills the next queue slot from the current state. Returns 0 if the queue is full */
+static int publishFrame()
+{
+	PacketHeader *header = (PacketHeader*)queueBeginPush(&frame_queue);
+	if (!header)
+		return 0;
+	header->input_time = input_time;
+	publish(header + 1);
+	queueEndPush(&frame_queue);
+	input_time = 0.0;
+	return 1;
+}
+
+static void handleEvent(SDL_Event *ev)
+{
+	switch (ev->type)
+	{
+		case SDL_QUIT:
+			quit();
+			break;
+		case SDL_VIDEORESIZE:
+			/* The window (and possibly the context) is recreated, so take the
+			 * context back while that happens */
+			if (threaded)
+				stopRenderThread();
+			setVideoMode(ev->resize.w, ev->resize.h);
+			reshape(screen->w, screen->h);
+			if (threaded)
+				startRenderThread();
+			postRedisplay();
+			break;
+		case SDL_VIDEOEXPOSE:
+			postRedisplay();
+			break;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+		case SDL_MOUSEMOTION:
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			if (input_time == 0.0)
+				input_time = timerNow();
+			event(ev);
+			break;
+		default:
+			event(ev);
+			break;
+	}
+}
+
+/* Takes an event polled from the window. Recording, it is logged first.
+ * Replaying, the log stands in for input, so only closing the window
+ * gets through */
+static void windowEvent(SDL_Event *ev)
+{
+	if (replay_log)
+	{
+		if (ev->type == SDL_QUIT)
+			quit();
+		return;
+	}
+	if (record_log)
+		inputLogWrite(record_log, loop_frame, timerNow() - record_start, ev);
+	handleEvent(ev);
+}
+
+/* Hands the application this frame's logged events. Returns 0 once the
+ * log has run out */
+static int replayEvents()
+{
+	SDL_Event ev;
+
+	if (inputLogEnded(replay_log, loop_frame, NULL))
+		return 0;
+	replay_events = 0;
+	while (inputLogNext(replay_log, loop_frame, &ev))
+	{
+		handleEvent(&ev);
+		replay_events++;
+	}
+	return 1;
+}
+
+/* One line per replayed frame: its number, the events it was given, time
+ * in event() and update() for them, and time since the last frame went out */
+static void replayFrameTime(unsigned int frame, double update_time, double frame_time)
+{
+	FILE *out = replay_timing ? replay_timing : stdout;
+
+	if (frame == 0)
+		fprintf(out, "# frame events update_ms frame_ms\n");
+	fprintf(out, "%u %d %.3f %.3f\n", frame, replay_events, update_time * 1000.0, frame_time * 1000.0);
+
+	if (frame >= replay_capacity)
+	{
+		replay_capacity = replay_capacity ? replay_capacity * 2 : 1024;
+		replay_times = (double*)realloc(replay_times, sizeof(double) * replay_capacity);
+	}
+	replay_times[frame] = frame_time;
+	replay_frames = frame + 1;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void replaySummary()
+{
+	double recorded, sum = 0.0;
+	unsigned int i, frames = replay_frames;
+
+	if (!frames)
+		return;
+	for (i = 0; i < frames; ++i)
+		sum += replay_times[i];
+	qsort(replay_times, frames, sizeof(double), compareTimes);
+	printf("Replay: %u frames, %u events, step %.2f ms, frame time average %.2f ms, median %.2f ms, 99th %.2f ms, max %.2f ms\n",
+			frames, replay_log->events, replay_dt * 1000.0, sum / frames * 1000.0,
+			replay_times[frames / 2] * 1000.0, replay_times[frames * 99 / 100] * 1000.0,
+			replay_times[frames - 1] * 1000.0);
+	if (inputLogEnded(replay_log, frames, &recorded) && recorded > 0.0)
+		printf("Replay: recorded at %.2f ms per frame\n", recorded / frames * 1000.0);
+}
+
 int main(int argc, char **argv)
 {
 	SDL_Event ev;
-	Uint32 now, delta_time, last_frame_time;
+	double now, delta_time, last_frame_time, update_time, frame_end;
+
+	if (!parseArgs(argc, argv))
+		return EXIT_FAILURE;
+
+	if (replay_path && !(replay_log = inputLogOpen(replay_path)))
+	{
+		printf("Can't read input log %s\n", replay_path);
+		return EXIT_FAILURE;
+	}
+	if (replay_timing_path && !(replay_timing = fopen(replay_timing_path, "w")))
+	{
+		printf("Can't write %s\n", replay_timing_path);
+		return EXIT_FAILURE;
+	}
+
+#ifndef __APPLE__
+	/* Xlib is called from the render thread (swaps) and main thread (events) */
+	if (threaded)
+		XInitThreads();
+#endif
 
 	quit_flag = 0;
 	videoFlags = DEFAULT_FLAGS;
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-	screen = SDL_SetVideoMode(DEFAULT_WIDTH, DEFAULT_HEIGHT, 
-			DEFAULT_DEPTH, videoFlags);
+	/* A replay starts in the window size it was recorded in */
+	if (replay_log)
+		setVideoMode(replay_log->width, replay_log->height);
+	else
+		setVideoMode(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+	if (record_path && !(record_log = inputLogCreate(record_path, screen->w, screen->h)))
+	{
+		printf("Can't write input log %s\n", record_path);
+		SDL_Quit();
+		return EXIT_FAILURE;
+	}
 
 	init();
 	reshape(screen->w, screen->h);
+	postRedisplay();
 
-	frame_rate = 0;
+	__atomic_store_n(&frame_rate, 0, __ATOMIC_RELAXED);
 	frame_count = 0;
-	last_frame_time = frame_time = SDL_GetTicks();
+	last_frame_time = frame_time = next_frame_time = record_start = frame_end = timerNow();
+	loop_frame = 0;
+
+	queueInit(&frame_queue, sizeof(PacketHeader) + frame_packet_size, FRAME_QUEUE_LENGTH);
+	if (threaded)
+		startRenderThread();
+
 	while (!quit_flag) 
 	{
+		/* Nothing to draw: block until something happens rather than spin.
+		 * Replays draw every frame, so their times compare */
+		if (render_on_demand && !redisplay && !replay_log)
+		{
+			if (SDL_WaitEvent(&ev))
+				windowEvent(&ev);
+			/* Don't count time spent idle as animation time */
+			last_frame_time = timerNow();
+		}
+
 		/* Process all pending events */
 		while (SDL_PollEvent(&ev))
+			windowEvent(&ev);
+
+		/* Calculate time passed. Replays step by a fixed amount, so the
+		 * same frame sees the same state on any machine */
+		now = timerNow();
+		if (replay_log)
 		{
-			switch (ev.type)
-			{
-				case SDL_QUIT:
-					quit();
-					break;
-				case SDL_VIDEORESIZE:
-					screen = SDL_SetVideoMode(ev.resize.w, 
-							ev.resize.h,
-							DEFAULT_DEPTH, videoFlags);
-					reshape(screen->w, screen->h);
-					break;
-				default:
-					event(&ev);
-					break;
-			}
+			if (!replayEvents())
+				break;
+			delta_time = replay_dt;
 		}
-		/* Calculate time passed */
-		now = SDL_GetTicks();
-		delta_time = now - last_frame_time;
+		else
+			delta_time = now - last_frame_time;
 		/* cpu-side logic, movement/animation etc */
-		update((float)delta_time * 0.001);
+		update((float)delta_time);
+		update_time = timerNow() - now;
 		last_frame_time = now;
+		loop_frame++;
 
-		/* Refresh display and flip buffers */
-		display(screen);
-		SDL_GL_SwapBuffers();
+		if (render_on_demand && !redisplay && !replay_log)
+			continue;
 
-		/* Update frame rate */
-		frame_count++;
-		if (now - frame_time > 1000)
+		if (threaded)
 		{
-			frame_rate = (frame_count * 1000) / (now - frame_time);
-			frame_count = 0;
-			frame_time = now;
+			/* The render thread is behind. Keep simulating and try again */
+			if (!publishFrame())
+			{
+				SDL_Delay(1);
+				continue;
+			}
+			/* Replays wait for the render thread to take each frame rather
+			 * than run ahead, so every step is drawn and timed */
+			while (replay_log && queueSize(&frame_queue))
+				SDL_Delay(0);
+		}
+		else
+		{
+			publishFrame();
+			drawQueuedFrames();
+		}
+		redisplay = 0;
+
+		if (replay_log)
+		{
+			now = timerNow();
+			replayFrameTime(loop_frame - 1, update_time, now - frame_end);
+			frame_end = now;
 		}
 	}
 
+	if (threaded)
+		stopRenderThread();
+
+	/* Let the application release anything still in flight */
+	while (queueFront(&frame_queue))
+	{
+		consume((PacketHeader*)queueFront(&frame_queue) + 1);
+		queuePop(&frame_queue);
+	}
+	queueFree(&frame_queue);
+
+	if (latency_total_count)
+		printf("Input latency (%s): %d frames, average %.2f ms, max %.2f ms\n",
+				threaded ? "threaded" : "single threaded", latency_total_count,
+				latency_total_sum / latency_total_count * 1000.0, latency_total_max * 1000.0);
+
+	if (record_log)
+	{
+		printf("Recorded %u events over %u frames to %s\n", record_log->events, loop_frame, record_path);
+		inputLogClose(record_log, loop_frame, timerNow() - record_start);
+	}
+	if (replay_log)
+	{
+		replaySummary();
+		inputLogClose(replay_log, 0, 0.0);
+		free(replay_times);
+		if (replay_timing)
+			fclose(replay_timing);
+	}
+
 	cleanup();
 	SDL_Quit();
 
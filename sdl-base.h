@@ -12,8 +12,40 @@ void display(SDL_Surface *screen);
 void event(SDL_Event *event);
 void cleanup();
 
-/* Updated in the main loop */
-extern int frame_rate;
+/* Application command line options, parsed before init(). Return how many
+ * arguments from argv[i] on were used, or 0 if argv[i] isn't an option of
+ * yours. option_usage is printed after the base options' help */
+int option(int argc, char **argv, int i);
+extern const char *option_usage;
+
+/* Frame packets. publish() copies everything display() needs into a packet of
+ * frame_packet_size bytes; consume() makes it current for the next display().
+ * Single threaded, they are called back to back. With --threaded, init(),
+ * update(), event(), publish() and cleanup() run on the main thread, which
+ * must not call GL, and consume() and display() run on a render thread that
+ * owns the context. Packets travel between them through a lock-free queue. */
+extern size_t frame_packet_size;
+void publish(void *packet);
+void consume(const void *packet);
+
+/* Frames per second over the last update interval. Safe from any thread */
+int frameRate();
+
+/* Frame pacing, set from the command line (see sdl-base.c usage) */
+extern int target_frame_rate; /* 0 = unlimited */
+extern int swap_interval; /* -1 = driver default, 0 = off, 1 = vsync */
+extern int render_on_demand; /* only draw frames marked with postRedisplay() */
+
+/* Call this when something visible changes. Only needed with render_on_demand. */
+void postRedisplay();
+
+/* Set by --threaded */
+extern int threaded;
+
+/* Average and worst time in ms from polling an input event to swapping the
+ * first frame that includes it, over the last frame rate interval. Safe from
+ * any thread, though the two may come from neighbouring intervals */
+void inputLatency(float *average, float *worst);
 
 /* Call this to quit. */
 void quit();
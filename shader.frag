@@ -3,10 +3,23 @@
 uniform int lighting_model; // Bling-Phong/Phong
 uniform int shader_type; // Vertex/Fragment
 uniform int normal_view; // Normal(N) View
+uniform int bumps; // Bump Type
+uniform int bump_map; // bump normals per vertex/from the baked bump map
+uniform sampler2D bump_texture;
+uniform int render_pass; // shading(0), depth pre-pass(1), overdraw count(2)
+uniform int shadows; // as in shader.vert
+uniform sampler2DShadow shadow_map;
 
 // Varying variables from vertex shader
 varying vec4 ambient, ambientGlobal;
 varying vec3 normal, ecPos, lightDir, halfVector;
+varying vec4 shadowCoord;
+
+#if !defined(CAPTURE) && !defined(CACHED)
+#define BUMP_MAP // as in shader.vert
+varying vec3 tangent;
+varying vec2 bumpCoord;
+#endif
 
 void main(void)
 {
@@ -14,6 +27,16 @@ void main(void)
   float NdotL, NdotHV;
   vec4 color = vec4(0.0);
 
+  // the pre-pass only wants depth, and the overdraw view adds one per fragment
+  if (render_pass == 1) {
+    gl_FragColor = vec4(0.0);
+    return;
+  }
+  if (render_pass == 2) {
+    gl_FragColor = vec4(1.0 / 255.0);
+    return;
+  }
+
   if (shader_type == 1 && normal_view == 0)
   {
     // calculate attenuation again with interpolated light direction (varying length)
@@ -32,14 +55,26 @@ void main(void)
 
     // re-normalize normal and light
     n = normalize(normal);
+#ifdef BUMP_MAP
+    // bump normal from the baked map, in the frame shader.vert bumps in
+    if (bumps > 0 && bump_map == 1)
+    {
+      vec3 t = normalize(tangent);
+      vec3 bump = texture2D(bump_texture, bumpCoord).xyz * 2.0 - 1.0;
+      n = normalize(t * bump.x + cross(n, t) * bump.y + n * bump.z);
+    }
+#endif
     l = normalize(lightDir);
     NdotL = max(dot(n, l),0.0);
 
+    // Light 0's share of the light, 0 in shadow
+    float lit = shadows == 1 ? shadow2DProj(shadow_map, shadowCoord).r : 1.0;
+
     // Add ambient component
     color += ambientGlobal + (lightAtt * ambient);
 
     // Add diffuse component
-    color += lightAtt * (NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse);
+    color += lit * lightAtt * (NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse);
 
     // Add specular component
     if (NdotL > 0.0)
@@ -48,13 +83,13 @@ void main(void)
       {
         halfV = normalize(halfVector);
         NdotHV = max(dot(n,halfV),0.0);
-        color += lightAtt * (gl_FrontMaterial.specular * gl_LightSource[0].specular * 
+        color += lit * lightAtt * (gl_FrontMaterial.specular * gl_LightSource[0].specular * 
             pow(NdotHV,gl_FrontMaterial.shininess));
       } else {
         vec3 eye = normalize(-ecPos);	
         vec3 reflection = normalize(-reflect(l,n));
         float RdotEye = max(dot(reflection,eye),0.0);
-        color += lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
+        color += lit * lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
           pow(RdotEye, gl_FrontMaterial.shininess);
       }
     }
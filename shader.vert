@@ -2,32 +2,94 @@
 
 // Ambient and diffuse lighting shader
 
+// ATTRIBLESS: no vertex data, u and v come from gl_VertexID and the grid size
+// CAPTURE: geometry only, written out with transform feedback
+// CACHED: lighting only, over geometry from the CAPTURE variant
+#ifdef ATTRIBLESS
+#extension GL_EXT_gpu_shader4 : require
+#endif
+
 uniform int lighting_model; // Bling-Phong(0), Phong(1)
 uniform int shader_type; // Vertex (0), Fragment(1)
 uniform int shape; // Shape Type - sphere(0), torus(1), grid(2)
 uniform int bumps; // Bump Type - no-bumps(0), only-normals(1), with-displacement(2)
 uniform int viewer; // Viewer - infinite(0) or local(1)
 uniform int normal_view; // normal-visual-disabled(0), normal-visual-enabled(1)
+uniform int bump_map; // bump normals per vertex(0), or per pixel from the baked bump map(1)
+uniform int shadows; // light 0 unshadowed(0), or shadowed from the shadow map(1), see shadow.h
+uniform mat4 shadow_matrix; // object space to shadow map coordinates
+uniform sampler2DShadow shadow_map;
+#ifdef ATTRIBLESS
+uniform ivec2 grid; // vertices in u and v, as passed to createObjectShader
+#endif
 
 // pass normal, eye position and related variables to fragment shader for interpolation
 varying vec4 ambient, ambientGlobal;
 varying vec3 normal, ecPos, lightDir, halfVector;
+varying vec4 shadowCoord;
+
+#if !defined(CAPTURE) && !defined(CACHED)
+// Captured geometry keeps no u and v to look the bump map up with, so the
+// geometry cache variants always bump per vertex
+#define BUMP_MAP
+// eye space tangent, with normal the frame the bump map's normals are in
+varying vec3 tangent;
+varying vec2 bumpCoord;
+#endif
+
+#ifdef CAPTURE
+// object space geometry, captured per vertex
+varying vec3 capturedPosition, capturedNormal;
+#endif
+
+// Parametric u and v of this vertex
+vec2 parametric()
+{
+#ifdef ATTRIBLESS
+  // Same strip as createObjectShader's indices: each row is a degenerate,
+  // 2 * grid.x alternating vertices from rows j and j+1, then another degenerate
+  int rowLength = 2 * grid.x + 2;
+  int row = gl_VertexID / rowLength;
+  int k = gl_VertexID - row * rowLength;
+  int i, j;
+  if (k == 0) {
+    i = 0;
+    j = row;
+  } else if (k == rowLength - 1) {
+    i = grid.x - 1;
+    j = row + 1;
+  } else {
+    i = (k - 1) / 2;
+    j = row + (k - 1) - i * 2;
+  }
+  return vec2(float(i) / float(grid.x - 1), float(j) / float(grid.y - 1));
+#else
+  return gl_Vertex.xy;
+#endif
+}
 
 void main(void)
 {
   // Vertex color
   vec4 color = vec4(0.0);
+  vec3 N, V, T, B;
+
+#ifdef CACHED
+  // geometry was already generated by the CAPTURE variant
+  V = gl_Vertex.xyz;
+  normal = gl_Normal;
+#else
+  vec2 uv = parametric();
 
   // Calculate vertex and normal coordinates from parametrics u and v
   float pi = acos(-1.0);
   float u, v;
-  vec3 N, V, T, B;
 
   // Also calculate tangent and binormal vectors for bump mapping and displacement
   if (shape == 0) // Sphere
   {
-    u = gl_Vertex.x * (2.0 * pi);
-    v = gl_Vertex.y * pi;
+    u = uv.x * (2.0 * pi);
+    v = uv.y * pi;
 
     float radius = 1.0;
 
@@ -44,8 +106,8 @@ void main(void)
   }
   else if (shape == 1) // Torus
   {
-    u = gl_Vertex.y * 2.0 * pi;
-    v = gl_Vertex.x * 2.0 * pi;
+    u = uv.y * 2.0 * pi;
+    v = uv.x * 2.0 * pi;
 
     float R = 1.0;
     float r = 0.5;
@@ -63,8 +125,8 @@ void main(void)
   }
   else if (shape == 2) // Grid
   {
-    u = gl_Vertex.x;	
-    v = gl_Vertex.y;	
+    u = uv.x;	
+    v = uv.y;	
 
     V.x = (u - 0.5)*2.0;
     V.y = (v - 0.5)*2.0;
@@ -82,12 +144,23 @@ void main(void)
   B.y = -((N.x * T.z) - (N.z * T.x));
   B.z =   (N.x * T.y) - (N.y * T.x);
 
+  // Pixel lighting takes the bump normals from the bump map, see bump.h
+#ifdef BUMP_MAP
+  bool bakedBumps = bump_map == 1 && shader_type == 1 && normal_view == 0;
+#else
+  bool bakedBumps = false;
+#endif
+
   // if bump state enabled - calculate bump normals
   if (bumps > 0) {
     // bump displacement
     float bumpDensity = 16.0;
     float bumpSize = 0.25;
-    vec2 c = bumpDensity * gl_Vertex.xy;
+    vec2 c = bumpDensity * uv;
+#ifdef BUMP_MAP
+    bumpCoord = c;
+    tangent = gl_NormalMatrix * T;
+#endif
     vec2 p = fract(c) - vec2(0.5);
     float d, f;
     d = (p.x * p.x) + (p.y * p.y);
@@ -106,7 +179,9 @@ void main(void)
 
     // bump Normal
     float dis = sqrt(0.25 - sqrt(d) * sqrt(d));
-    if (dis > 0.0) {
+    if (bakedBumps) // looked up per pixel instead
+      normal = N;
+    else if (dis > 0.0) {
       normal = vec3(p.x, -p.y, dis) * f;
       // convert to eye space
       normal = T * normal.x + B * normal.y + N * normal.z;
@@ -118,9 +193,16 @@ void main(void)
     // shape Normal
     normal = N;
   }
+#endif
 
   //end
 
+#ifdef CAPTURE
+  capturedPosition = V;
+  capturedNormal = normalize(normal);
+  gl_Position = vec4(V, 1.0);
+#else
+
   // Normalized vertex normal
   normal = normalize(vec3(gl_NormalMatrix * normalize(normal)));
 
@@ -168,8 +250,14 @@ void main(void)
   ambient = gl_FrontMaterial.ambient * gl_LightSource[0].ambient;
   ambientGlobal = gl_FrontMaterial.ambient * gl_LightModel.ambient; 
 
+  // Where the vertex is in the shadow map, for lighting per pixel or here
+  shadowCoord = shadow_matrix * vec4(V, 1.0);
+
   if (shader_type == 0) // if vertex shader is enabled - calculate vertex color
   {
+    // Light 0's share of the light, 0 in shadow
+    float lit = shadows == 1 ? shadow2DProjLod(shadow_map, shadowCoord, 0.0).r : 1.0;
+
     // Add global and light ambient component
     color += ambientGlobal + (lightAtt * ambient);
 
@@ -179,7 +267,7 @@ void main(void)
 
     // Add diffuse component
     float NdotL = max(dot(normal, light), 0.0);
-    color += lightAtt * (NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse);
+    color += lit * lightAtt * (NdotL * gl_FrontMaterial.diffuse * gl_LightSource[0].diffuse);
 
     // Add specular component
     if (NdotL > 0.0)
@@ -187,13 +275,13 @@ void main(void)
       if (lighting_model == 0) // blinn-phong calculate color on basis of half vector
       {
         float NdotHV = max(dot(normal,halfVector),0.0);
-        color += lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
+        color += lit * lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
           pow(NdotHV, gl_FrontMaterial.shininess);
       } else { // phong calculate color on basis of reflection vector
         vec3 eye = normalize(-ecPos);	
         vec3 reflection = normalize(-reflect(light,normal));
         float RdotEye = max(dot(reflection,eye),0.0);
-        color += lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
+        color += lit * lightAtt * gl_FrontMaterial.specular * gl_LightSource[0].specular * 
           pow(RdotEye, gl_FrontMaterial.shininess);
       }
     }
@@ -205,4 +293,5 @@ void main(void)
 
   // Apply matrix transforms to vertex position to give clip space
   gl_Position = gl_ModelViewProjectionMatrix * vec4(V, 1.0);
+#endif
 }
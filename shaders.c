@@ -17,6 +17,7 @@
 #endif
 
 #include "shaders.h"
+#include "resources.h"
 
 int oglError(int line, const char* file)
 {
@@ -103,27 +104,61 @@ char* readFile(const char* filename)
 void cleanupShader(GLuint vert, GLuint frag, char *vertSrc, char *fragSrc) 
 {
   glDeleteShader(vert);
-  glDeleteShader(frag);
+  if (frag)
+    glDeleteShader(frag);
   free(vertSrc);
   free(fragSrc);
 }
 
+/* Passes src to the shader with defines inserted at the start, or after the
+ * #version line if there is one, since that has to come first */
+void shaderSourceDefines(GLuint shader, const char* src, const char* defines)
+{
+  const GLchar* sources[3];
+  GLint lengths[3];
+  const char* body = src;
+
+  if (strncmp(src, "#version", 8) == 0) {
+    body = strchr(src, '\n');
+    body = body ? body + 1 : src + strlen(src);
+  }
+  sources[0] = src;
+  lengths[0] = (GLint)(body - src);
+  sources[1] = defines ? defines : "";
+  lengths[1] = (GLint)strlen(sources[1]);
+  sources[2] = body;
+  lengths[2] = (GLint)strlen(body);
+  glShaderSource(shader, 3, sources, lengths);
+}
+
 GLuint getShader(const char* vertexFile, const char* fragmentFile)
+{
+  return getShaderFeedback(vertexFile, fragmentFile, NULL, NULL, 0);
+}
+
+GLuint getShaderDefines(const char* vertexFile, const char* fragmentFile, const char* defines)
+{
+  return getShaderFeedback(vertexFile, fragmentFile, defines, NULL, 0);
+}
+
+GLuint getShaderFeedback(const char* vertexFile, const char* fragmentFile, const char* defines,
+    const char** varyings, int numVaryings)
 {
   char* vertSrc;
   char* fragSrc;
 
   CHECK_GL_ERROR;
 
-  /* Read the contents of the source files */
+  /* Read the contents of the source files. The fragment shader is optional
+   * for programs that only feed transform feedback */
   vertSrc = readFile(vertexFile);
-  fragSrc = readFile(fragmentFile);
+  fragSrc = fragmentFile ? readFile(fragmentFile) : NULL;
 
   /* Check they exist */
-  if (!vertSrc || !fragSrc) {
+  if (!vertSrc || (fragmentFile && !fragSrc)) {
     free(vertSrc); 
     free(fragSrc); 
-    printf("Error reading shaders %s & %s\n", vertexFile, fragmentFile); 
+    printf("Error reading shaders %s & %s\n", vertexFile, fragmentFile ? fragmentFile : "(none)"); 
     fflush(stdout); 
     return 0;
   }
@@ -131,11 +166,12 @@ GLuint getShader(const char* vertexFile, const char* fragmentFile)
   /* Create the shaders */
   GLuint vert, frag, program;
   vert = glCreateShader(GL_VERTEX_SHADER);
-  frag = glCreateShader(GL_FRAGMENT_SHADER);
+  frag = fragmentFile ? glCreateShader(GL_FRAGMENT_SHADER) : 0;
 
-  /* Pass in the source code for the shaders */
-  glShaderSource(vert, 1, (const GLchar**)&vertSrc, NULL);
-  glShaderSource(frag, 1, (const GLchar**)&fragSrc, NULL);
+  /* Pass in the source code for the shaders, with any defines */
+  shaderSourceDefines(vert, vertSrc, defines);
+  if (frag)
+    shaderSourceDefines(frag, fragSrc, defines);
 
   /* Compile and check each for errors */
   glCompileShader(vert);
@@ -143,26 +179,42 @@ GLuint getShader(const char* vertexFile, const char* fragmentFile)
     cleanupShader(vert, frag, vertSrc, fragSrc);
     return 0;
   }
-  glCompileShader(frag);
-  if (shaderError(frag, fragmentFile)) {
-    cleanupShader(vert, frag, vertSrc, fragSrc);
-    return 0;
+  if (frag) {
+    glCompileShader(frag);
+    if (shaderError(frag, fragmentFile)) {
+      cleanupShader(vert, frag, vertSrc, fragSrc);
+      return 0;
+    }
   }
 
   /* Create program, attach shaders, link and check for errors */
   program = glCreateProgram();
   glAttachShader(program, vert);
-  glAttachShader(program, frag);
+  if (frag)
+    glAttachShader(program, frag);
+  /* Must be given before linking */
+  if (numVaryings > 0)
+    glTransformFeedbackVaryings(program, numVaryings, (const GLchar**)varyings, GL_INTERLEAVED_ATTRIBS);
   glLinkProgram(program);
-  if (programError(program, vertexFile, fragmentFile)) {
+  if (programError(program, vertexFile, fragmentFile ? fragmentFile : "(none)")) {
     cleanupShader(vert, frag, vertSrc, fragSrc);
     glDeleteProgram(program); 
     return 0;
   }
 
-  /* Clean up intermediates and return the program */
+  /* Clean up intermediates and return the program. Its size on the GPU
+   * is the driver's business, so only the count is tracked */
   cleanupShader(vert, frag, vertSrc, fragSrc);
+  resourceAlloc(RES_SHADERS, RES_GPU, 0);
+
+  return program; /* NOTE: use freeShader to free resources */
+}
 
-  return program; /* NOTE: use glDeleteProgram to free resources */
+void freeShader(GLuint program)
+{
+  if (!program)
+    return;
+  glDeleteProgram(program);
+  resourceFree(RES_SHADERS, RES_GPU, 0);
 }
 
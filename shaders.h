@@ -4,15 +4,30 @@
 NOTE: make sure to call glewInit before loading shaders
 
 use getShader() to load, compile shaders and return a program
+use getShaderDefines() to compile a variant with preprocessor defines
 use glUseProgram(program) to activate it
 use glUseProgram(0) to return to fixed pipeline rendering
-use glDeleteProgram() to free resources
+use freeShader() to free resources
 */
 
 #ifndef SHADERS_H
 #define SHADERS_H
 
+/* Polls glGetError, which can stall the driver, so only in builds with
+   GL_ERROR_CHECKS (make CHECK_GL=1). Otherwise gldebug.h reports errors */
+#ifdef GL_ERROR_CHECKS
 #define CHECK_GL_ERROR oglError(__LINE__, __FILE__)
+#else
+#define CHECK_GL_ERROR ((void)0)
+#endif
 int oglError(int line, const char* file);
 GLuint getShader(const char* vertexFile, const char* fragmentFile);
+/* As getShader, with source text (eg. "#define X\n") inserted before both shaders */
+GLuint getShaderDefines(const char* vertexFile, const char* fragmentFile, const char* defines);
+/* As getShaderDefines, with varyings captured interleaved by transform feedback.
+   fragmentFile may be NULL, for programs only used with GL_RASTERIZER_DISCARD */
+GLuint getShaderFeedback(const char* vertexFile, const char* fragmentFile, const char* defines,
+    const char** varyings, int numVaryings);
+/* glDeleteProgram, and the program off the resource tracker's count. 0 is ignored */
+void freeShader(GLuint program);
 #endif
@@ -0,0 +1,147 @@
+/* shadow.c - shadow map of light 0, rendered again only when it changes */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __APPLE__
+#include <GL/glew.h>
+#endif
+
+#include "shadow.h"
+#include "resources.h"
+
+/* Against surfaces shadowing themselves: depth is pushed back by the
+ * slope while rendering, and the lookup by a constant of the map's range */
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS 4.0f
+#define SHADOW_BIAS 0.0005f
+
+ShadowMap* createShadowMap(int size)
+{
+	ShadowMap* map = (ShadowMap*)calloc(1, sizeof(ShadowMap));
+	GLint previous;
+	GLenum status;
+
+	/* Compared on lookup and linearly filtered, so four samples are
+	 * blended into a softer edge at no cost */
+	glGenTextures(1, &map->texture);
+	glBindTexture(GL_TEXTURE_2D, map->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glGenFramebuffers(1, &map->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, map->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, map->texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		glDeleteFramebuffers(1, &map->framebuffer);
+		glDeleteTextures(1, &map->texture);
+		free(map);
+		return NULL;
+	}
+	map->size = size;
+	map->cache = 1;
+	resourceAlloc(RES_TEXTURES, RES_GPU, (size_t)size * size * 4);
+	return map;
+}
+
+/* The light's view of a sphere of radius around the origin */
+static void lightMatrices(ShadowMap* map, const float light[4], float radius)
+{
+	float eye[3], center[3] = {0.0f, 0.0f, 0.0f}, up[3] = {0.0f, 1.0f, 0.0f};
+	float distance = sqrtf(light[0] * light[0] + light[1] * light[1] + light[2] * light[2]);
+	int i;
+
+	mat4Identity(&map->projection);
+	if (light[3] == 0.0f) {
+		/* Parallel rays: a box around the sphere, seen from outside it */
+		for (i = 0; i < 3; ++i)
+			eye[i] = light[i] / distance * 2.0f * radius;
+		mat4Ortho(&map->projection, -radius, radius, -radius, radius, radius, 3.0f * radius);
+	} else {
+		/* A frustum just holding the sphere, or wide open from inside it */
+		for (i = 0; i < 3; ++i)
+			eye[i] = light[i] / light[3];
+		distance /= fabsf(light[3]);
+		if (distance > radius * 1.01f)
+			mat4Perspective(&map->projection, 2.0f * asinf(radius / distance) * 180.0f / acosf(-1.0f),
+				1.0f, distance - radius, distance + radius);
+		else
+			mat4Perspective(&map->projection, 150.0f, 1.0f, radius * 0.01f, distance + radius);
+	}
+
+	/* Any up will do, as long as it isn't along the light */
+	if (fabsf(eye[1]) > 0.99f * sqrtf(eye[0] * eye[0] + eye[1] * eye[1] + eye[2] * eye[2])) {
+		up[1] = 0.0f;
+		up[2] = 1.0f;
+	}
+	mat4Identity(&map->view);
+	mat4LookAt(&map->view, eye, center, up);
+}
+
+int shadowMapBegin(ShadowMap* map, const ShadowKey* key, float radius)
+{
+	mat4_t bias;
+
+	if (map->cache && map->valid && !memcmp(&map->key, key, sizeof(ShadowKey))) {
+		map->hits++;
+		return 0;
+	}
+	map->misses++;
+	map->key = *key;
+	map->valid = 1;
+
+	/* Clip space to [0, 1] map coordinates and depth */
+	lightMatrices(map, key->light, radius);
+	mat4Identity(&bias);
+	bias.m[0] = bias.m[5] = bias.m[10] = 0.5f;
+	bias.m[12] = bias.m[13] = 0.5f;
+	bias.m[14] = 0.5f - SHADOW_BIAS;
+	mat4Multiply(&map->matrix, &bias, &map->projection);
+	mat4Multiply(&map->matrix, &map->matrix, &map->view);
+	mat4Multiply(&map->matrix, &map->matrix, &key->model);
+
+	/* Filled and depth only, whatever the scene draws with */
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &map->previousFramebuffer);
+	glPushAttrib(GL_VIEWPORT_BIT | GL_POLYGON_BIT | GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, map->framebuffer);
+	glViewport(0, 0, map->size, map->size);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST); /* held to the scene by dynamic resolution */
+	glClear(GL_DEPTH_BUFFER_BIT);
+	draw_gl_calls += 13;
+	return 1;
+}
+
+void shadowMapEnd(ShadowMap* map)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, map->previousFramebuffer);
+	glPopAttrib();
+	draw_gl_calls += 2;
+}
+
+void freeShadowMap(ShadowMap* map)
+{
+	glDeleteFramebuffers(1, &map->framebuffer);
+	glDeleteTextures(1, &map->texture);
+	resourceFree(RES_TEXTURES, RES_GPU, (size_t)map->size * map->size * 4);
+	free(map);
+}
@@ -0,0 +1,68 @@
+/* shadow.h - shadow map of light 0, rendered again only when it changes
+
+A shadow pass draws the whole object once more, from the light, and at
+high tessellation that costs about as much as the frame itself. What the
+map holds only depends on the light, the object's transform and its
+geometry though, and the usual change between frames, the camera moving,
+touches none of them. So the map keeps the ShadowKey it was rendered
+with, and shadowMapBegin only asks for the pass again when the key
+differs, counting hits and misses.
+
+The light looks at a sphere of the given radius around the object's
+origin: a directional light (w = 0) through an orthographic box, a
+positional one through a perspective frustum from where it is.
+
+USAGE:
+map = createShadowMap(size) with a context current, NULL without
+framebuffer objects
+each frame fill a ShadowKey, memset first so padding compares equal, then
+if (shadowMapBegin(map, &key, radius)) { draw the object's depth with
+map->projection and map->view * key.model; shadowMapEnd(map); }
+sample map->texture on SHADOW_UNIT as a sampler2DShadow with
+map->matrix, object space to map coordinates, and projective lookups
+freeShadowMap(map)
+*/
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "objects.h"
+#include "matrix.h"
+
+#define SHADOW_UNIT 4 /* clear of the core backend's cluster textures and the bump map */
+#define SHADOW_SIZE 1024
+
+/* Everything the map depends on */
+typedef struct {
+	float light[4]; /* light 0 in world space, as glLightfv is given it */
+	mat4_t model; /* object to world */
+	int generation; /* of the object's geometry */
+	int tessellation;
+	int shape;
+	int bumps;
+	int culling; /* back faces left out of the pass */
+	int variant; /* whatever else changes the depth, such as the program */
+} ShadowKey;
+
+typedef struct {
+	GLuint framebuffer, texture;
+	int size;
+	mat4_t projection, view; /* of the light, from world space */
+	mat4_t matrix; /* object space to map coordinates and depth */
+	int cache; /* 0 renders every frame, for comparison */
+	int hits, misses; /* frames the map was reused and rendered */
+	/* Internal */
+	ShadowKey key;
+	int valid;
+	GLint previousFramebuffer;
+} ShadowMap;
+
+ShadowMap* createShadowMap(int size);
+/* Returns 1, with the map's framebuffer bound and cleared, if the pass
+ * needs drawing, or 0 if the map already holds key */
+int shadowMapBegin(ShadowMap* map, const ShadowKey* key, float radius);
+/* Back to the framebuffer and state before shadowMapBegin */
+void shadowMapEnd(ShadowMap* map);
+void freeShadowMap(ShadowMap* map);
+
+#endif
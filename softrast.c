@@ -0,0 +1,456 @@
+/* softrast.c - multithreaded tile based CPU rasterizer */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "softrast.h"
+#include "parallel.h"
+
+/* Four lanes of doubles or comparison masks, see cluster.c */
+typedef double double4 __attribute__((vector_size(32)));
+typedef long long long4 __attribute__((vector_size(32)));
+
+/* Window positions are snapped to 1/256 of a pixel, as GPUs do. Edge
+ * functions of snapped positions are whole numbers well inside a double's
+ * exact range, so triangles sharing an edge agree exactly on which side
+ * every pixel is and small triangles leave no cracks */
+#define SUBPIXEL 256.0
+
+/* Vertices and triangles per parallelFor index */
+#define VERTEX_BATCH 4096
+#define TRIANGLE_BATCH 4096
+
+typedef struct {
+	float clip[4];
+	float eye[3];
+	float normal[3]; /* eye space, unit length */
+	float color[4]; /* per vertex lighting, normal colours or white */
+} SoftVertex;
+
+typedef struct {
+	/* Edge function k, a[k] x + b[k] y + c[k] in SUBPIXEL units, is
+	 * positive inside and area times the barycentric weight of vertex k */
+	double a[3], b[3], c[3];
+	float invArea;
+	float z[3]; /* window depth */
+	float invW[3];
+	unsigned int v[3];
+	int minX, minY, maxX, maxY; /* pixel bounds, empty if maxX < minX */
+} SoftTriangle;
+
+/* Everything one softDrawObject call shares between its jobs */
+typedef struct {
+	SoftTarget* target;
+	const ObjectData* data;
+	const mat4_t* projection;
+	const mat4_t* modelView;
+	const CoreLighting* lighting;
+	int flat;
+	SoftVertex* vertices;
+	SoftTriangle* triangles;
+	int numTriangles;
+	int indexStep; /* between the first indices of triangles, 1 for strips */
+	int tilesX, tilesY;
+	int* binStart; /* per tile offsets into binned, one extra at the end */
+	int* binned; /* triangle indices, in draw order for each tile */
+} SoftDraw;
+
+SoftTarget* softCreateTarget(int width, int height)
+{
+	SoftTarget* target = (SoftTarget*)malloc(sizeof(SoftTarget));
+	int rows = (height + SOFT_TILE - 1) / SOFT_TILE * SOFT_TILE;
+
+	target->width = width;
+	target->height = height;
+	target->stride = (width + SOFT_TILE - 1) / SOFT_TILE * SOFT_TILE;
+	target->color = (unsigned char*)malloc(target->stride * rows * 3);
+	target->depth = (float*)malloc(sizeof(float) * target->stride * rows);
+	return target;
+}
+
+void softFreeTarget(SoftTarget* target)
+{
+	free(target->color);
+	free(target->depth);
+	free(target);
+}
+
+void softClear(SoftTarget* target, const float color[4])
+{
+	int i, pixels = target->stride * ((target->height + SOFT_TILE - 1) / SOFT_TILE * SOFT_TILE);
+	unsigned char rgb[3];
+
+	for (i = 0; i < 3; ++i)
+		rgb[i] = (unsigned char)(fminf(fmaxf(color[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+	for (i = 0; i < pixels; ++i) {
+		memcpy(target->color + i * 3, rgb, 3);
+		target->depth[i] = 1.0f;
+	}
+}
+
+static float dot3(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void normalize3(float* v)
+{
+	float len = sqrtf(dot3(v, v));
+	if (len > 0.0f) {
+		v[0] /= len;
+		v[1] /= len;
+		v[2] /= len;
+	}
+}
+
+/* C version of shade() in core.frag. n is unit length, p the eye space position */
+static void shade(float color[4], const CoreLighting* l, const float n[3], const float p[3])
+{
+	float lightDir[3], eye[3] = {0.0f, 0.0f, 1.0f};
+	float lightAtt = 1.0f, NdotL, spec = 0.0f;
+	int i;
+
+	if (l->lightPosition[3] != 0.0f) { /* Positional light */
+		float dist;
+		for (i = 0; i < 3; ++i)
+			lightDir[i] = l->lightPosition[i] - p[i];
+		dist = sqrtf(dot3(lightDir, lightDir));
+		lightAtt = fminf(1.0f / (l->lightAttenuation[0] + l->lightAttenuation[1] * dist + l->lightAttenuation[2] * dist * dist), 1.0f);
+	} else { /* Directional light */
+		for (i = 0; i < 3; ++i)
+			lightDir[i] = l->lightPosition[i];
+	}
+	normalize3(lightDir);
+	if (l->viewer == 1) {
+		for (i = 0; i < 3; ++i)
+			eye[i] = -p[i];
+		normalize3(eye);
+	}
+
+	NdotL = fmaxf(dot3(n, lightDir), 0.0f);
+	if (NdotL > 0.0f) {
+		float r[3];
+		if (l->lightingModel == 0) { /* Blinn-Phong, half vector */
+			for (i = 0; i < 3; ++i)
+				r[i] = lightDir[i] + eye[i];
+		} else { /* Phong, reflection vector */
+			float d = 2.0f * dot3(n, lightDir);
+			for (i = 0; i < 3; ++i)
+				r[i] = d * n[i] - lightDir[i];
+		}
+		normalize3(r);
+		spec = powf(fmaxf(dot3(n, r), 0.0f), l->materialShininess);
+	}
+
+	for (i = 0; i < 4; ++i) {
+		color[i] = l->materialAmbient[i] * l->globalAmbient[i] + lightAtt * l->materialAmbient[i] * l->lightAmbient[i];
+		color[i] += lightAtt * NdotL * l->materialDiffuse[i] * l->lightDiffuse[i];
+		color[i] += lightAtt * l->materialSpecular[i] * l->lightSpecular[i] * spec;
+	}
+}
+
+/* Same as core.vert: eye space position and normal, clip position and
+ * the colour for everything but per pixel lighting */
+static void transformVertices(int batch, void* arg)
+{
+	SoftDraw* d = (SoftDraw*)arg;
+	const vertex_t* in = (const vertex_t*)d->data->vertices;
+	const float* mv = d->modelView->m;
+	int i, k, end = (batch + 1) * VERTEX_BATCH;
+
+	if (end > d->data->numVertices)
+		end = d->data->numVertices;
+	for (i = batch * VERTEX_BATCH; i < end; ++i) {
+		SoftVertex* out = &d->vertices[i];
+		float v[4], p[4], n[3];
+
+		v[0] = in[i].vert.x;
+		v[1] = in[i].vert.y;
+		v[2] = in[i].vert.z;
+		v[3] = 1.0f;
+		mat4TransformVec4(p, d->modelView, v);
+		memcpy(out->eye, p, sizeof(out->eye));
+		mat4TransformVec4(out->clip, d->projection, p);
+
+		/* The modelview is only rotations and translations, see core.c */
+		for (k = 0; k < 3; ++k)
+			n[k] = mv[k] * in[i].norm.x + mv[4 + k] * in[i].norm.y + mv[8 + k] * in[i].norm.z;
+		normalize3(n);
+		memcpy(out->normal, n, sizeof(out->normal));
+
+		if (d->lighting->normalView == 1) {
+			for (k = 0; k < 3; ++k)
+				out->color[k] = (n[k] + 1.0f) / 2.0f;
+			out->color[3] = 1.0f;
+		} else if (d->lighting->lighting == 0) {
+			out->color[0] = out->color[1] = out->color[2] = out->color[3] = 1.0f;
+		} else if (d->lighting->shaderType == 0) {
+			shade(out->color, d->lighting, out->normal, out->eye);
+		}
+	}
+}
+
+/* Projects triangles to the window and sets up their edge functions */
+static void setupTriangles(int batch, void* arg)
+{
+	SoftDraw* d = (SoftDraw*)arg;
+	float width = (float)d->target->width, height = (float)d->target->height;
+	int t, k, end = (batch + 1) * TRIANGLE_BATCH;
+
+	if (end > d->numTriangles)
+		end = d->numTriangles;
+	for (t = batch * TRIANGLE_BATCH; t < end; ++t) {
+		SoftTriangle* tri = &d->triangles[t];
+		double x[3], y[3], area, sign;
+		int culled = 0;
+
+		tri->maxX = -1;
+		tri->minX = 0;
+		for (k = 0; k < 3; ++k) {
+			const float* clip;
+			tri->v[k] = d->data->indices[t * d->indexStep + k];
+			clip = d->vertices[tri->v[k]].clip;
+			/* No clipping, see softrast.h */
+			if (clip[3] <= 0.0f || clip[2] < -clip[3] || clip[2] > clip[3]) {
+				culled = 1;
+				break;
+			}
+			tri->invW[k] = 1.0f / clip[3];
+			x[k] = rint((clip[0] * tri->invW[k] * 0.5f + 0.5f) * width * SUBPIXEL);
+			y[k] = rint((clip[1] * tri->invW[k] * 0.5f + 0.5f) * height * SUBPIXEL);
+			tri->z[k] = clip[2] * tri->invW[k] * 0.5f + 0.5f;
+		}
+		if (culled)
+			continue;
+
+		/* Twice the signed area. Zero for the strip's degenerate joins */
+		area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area == 0.0)
+			continue;
+
+		/* Edge k is opposite vertex k. Flipping clockwise triangles makes
+		 * inside all edges >= 0 whichever way the triangle winds */
+		sign = area > 0.0 ? 1.0 : -1.0;
+		for (k = 0; k < 3; ++k) {
+			int i = (k + 1) % 3, j = (k + 2) % 3;
+			tri->a[k] = sign * (y[i] - y[j]);
+			tri->b[k] = sign * (x[j] - x[i]);
+			tri->c[k] = sign * (x[i] * y[j] - x[j] * y[i]);
+		}
+		tri->invArea = (float)(1.0 / fabs(area));
+
+		tri->minX = (int)fmax(floor(fmin(fmin(x[0], x[1]), x[2]) / SUBPIXEL), 0.0);
+		tri->minY = (int)fmax(floor(fmin(fmin(y[0], y[1]), y[2]) / SUBPIXEL), 0.0);
+		tri->maxX = (int)fmin(ceil(fmax(fmax(x[0], x[1]), x[2]) / SUBPIXEL), width - 1.0);
+		tri->maxY = (int)fmin(ceil(fmax(fmax(y[0], y[1]), y[2]) / SUBPIXEL), height - 1.0);
+		if (tri->maxY < tri->minY)
+			tri->maxX = -1;
+	}
+}
+
+/* Sorts triangles into per tile lists, keeping draw order */
+static void binTriangles(SoftDraw* d)
+{
+	int numTiles = d->tilesX * d->tilesY;
+	int* fill = (int*)calloc(numTiles, sizeof(int));
+	int t, x, y, total = 0;
+
+	memset(d->binStart, 0, sizeof(int) * (numTiles + 1));
+	for (t = 0; t < d->numTriangles; ++t) {
+		const SoftTriangle* tri = &d->triangles[t];
+		if (tri->maxX < tri->minX)
+			continue;
+		for (y = tri->minY / SOFT_TILE; y <= tri->maxY / SOFT_TILE; ++y)
+			for (x = tri->minX / SOFT_TILE; x <= tri->maxX / SOFT_TILE; ++x)
+				d->binStart[x + y * d->tilesX]++;
+	}
+	for (t = 0; t < numTiles; ++t) {
+		int count = d->binStart[t];
+		d->binStart[t] = total;
+		total += count;
+	}
+	d->binStart[numTiles] = total;
+
+	d->binned = (int*)malloc(sizeof(int) * (total ? total : 1));
+	for (t = 0; t < d->numTriangles; ++t) {
+		const SoftTriangle* tri = &d->triangles[t];
+		if (tri->maxX < tri->minX)
+			continue;
+		for (y = tri->minY / SOFT_TILE; y <= tri->maxY / SOFT_TILE; ++y) {
+			for (x = tri->minX / SOFT_TILE; x <= tri->maxX / SOFT_TILE; ++x) {
+				int tile = x + y * d->tilesX;
+				d->binned[d->binStart[tile] + fill[tile]++] = t;
+			}
+		}
+	}
+	free(fill);
+}
+
+/* Colour of one covered pixel, w being the screen space weights */
+static void shadePixel(const SoftDraw* d, const SoftTriangle* tri, const float w[3], unsigned char* rgb)
+{
+	const SoftVertex* v[3];
+	float p[3], color[4], sum = 0.0f;
+	int i, k;
+
+	for (k = 0; k < 3; ++k)
+		v[k] = &d->vertices[tri->v[k]];
+
+	/* Perspective correct weights */
+	for (k = 0; k < 3; ++k) {
+		p[k] = w[k] * tri->invW[k];
+		sum += p[k];
+	}
+	for (k = 0; k < 3; ++k)
+		p[k] /= sum;
+
+	if (d->lighting->shaderType == 1 && d->lighting->normalView == 0 && d->lighting->lighting == 1) {
+		float n[3], pos[3];
+		for (i = 0; i < 3; ++i) {
+			pos[i] = p[0] * v[0]->eye[i] + p[1] * v[1]->eye[i] + p[2] * v[2]->eye[i];
+			if (d->flat)
+				n[i] = v[2]->normal[i];
+			else
+				n[i] = p[0] * v[0]->normal[i] + p[1] * v[1]->normal[i] + p[2] * v[2]->normal[i];
+		}
+		normalize3(n);
+		shade(color, d->lighting, n, pos);
+	} else if (d->flat) {
+		memcpy(color, v[2]->color, sizeof(color));
+	} else {
+		for (i = 0; i < 4; ++i)
+			color[i] = p[0] * v[0]->color[i] + p[1] * v[1]->color[i] + p[2] * v[2]->color[i];
+	}
+
+	for (i = 0; i < 3; ++i)
+		rgb[i] = (unsigned char)(fminf(fmaxf(color[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+/* Rasterizes one tile's triangles, four pixels of a row at a time */
+static void rasterTile(int tile, void* arg)
+{
+	SoftDraw* d = (SoftDraw*)arg;
+	SoftTarget* target = d->target;
+	int tileX = (tile % d->tilesX) * SOFT_TILE;
+	int tileY = (tile / d->tilesX) * SOFT_TILE;
+	/* Pixel centres */
+	double4 offsets = {0.5 * SUBPIXEL, 1.5 * SUBPIXEL, 2.5 * SUBPIXEL, 3.5 * SUBPIXEL};
+	int i, x, y, lane;
+
+	for (i = d->binStart[tile]; i < d->binStart[tile + 1]; ++i) {
+		const SoftTriangle* tri = &d->triangles[d->binned[i]];
+		/* Rows start on a multiple of four, which never leaves the tile */
+		int minX = (tri->minX > tileX ? tri->minX : tileX) & ~3;
+		int maxX = tri->maxX < tileX + SOFT_TILE - 1 ? tri->maxX : tileX + SOFT_TILE - 1;
+		int minY = tri->minY > tileY ? tri->minY : tileY;
+		int maxY = tri->maxY < tileY + SOFT_TILE - 1 ? tri->maxY : tileY + SOFT_TILE - 1;
+
+		for (y = minY; y <= maxY; ++y) {
+			double py = (y + 0.5) * SUBPIXEL;
+			float* depthRow = target->depth + y * target->stride;
+			double row0 = tri->b[0] * py + tri->c[0];
+			double row1 = tri->b[1] * py + tri->c[1];
+			double row2 = tri->b[2] * py + tri->c[2];
+
+			for (x = minX; x <= maxX; x += 4) {
+				double4 px = offsets + x * SUBPIXEL;
+				double4 e0 = tri->a[0] * px + row0;
+				double4 e1 = tri->a[1] * px + row1;
+				double4 e2 = tri->a[2] * px + row2;
+				long4 inside = (e0 >= 0.0) & (e1 >= 0.0) & (e2 >= 0.0);
+
+				if (!(inside[0] | inside[1] | inside[2] | inside[3]))
+					continue;
+
+				/* Depth test and shade the covered pixels */
+				for (lane = 0; lane < 4; ++lane) {
+					float w[3], z;
+					if (!inside[lane])
+						continue;
+					w[0] = (float)e0[lane] * tri->invArea;
+					w[1] = (float)e1[lane] * tri->invArea;
+					w[2] = (float)e2[lane] * tri->invArea;
+					z = w[0] * tri->z[0] + w[1] * tri->z[1] + w[2] * tri->z[2];
+					if (z >= depthRow[x + lane])
+						continue;
+					depthRow[x + lane] = z;
+					shadePixel(d, tri, w, target->color + (y * target->stride + x + lane) * 3);
+				}
+			}
+		}
+	}
+}
+
+void softDrawObject(SoftTarget* target, const ObjectData* data, const mat4_t* projection,
+	const mat4_t* modelView, const CoreLighting* lighting, int flat)
+{
+	SoftDraw d;
+
+	if (data->vertexSize != sizeof(vertex_t) || data->numIndices < 3)
+		return;
+
+	d.target = target;
+	d.data = data;
+	d.projection = projection;
+	d.modelView = modelView;
+	d.lighting = lighting;
+	d.flat = flat;
+	d.indexStep = data->mode == GL_TRIANGLES ? 3 : 1;
+	d.numTriangles = data->mode == GL_TRIANGLES ? data->numIndices / 3 : data->numIndices - 2;
+	d.tilesX = (target->width + SOFT_TILE - 1) / SOFT_TILE;
+	d.tilesY = (target->height + SOFT_TILE - 1) / SOFT_TILE;
+	d.vertices = (SoftVertex*)malloc(sizeof(SoftVertex) * data->numVertices);
+	d.triangles = (SoftTriangle*)malloc(sizeof(SoftTriangle) * d.numTriangles);
+	d.binStart = (int*)malloc(sizeof(int) * (d.tilesX * d.tilesY + 1));
+
+	parallelFor((data->numVertices + VERTEX_BATCH - 1) / VERTEX_BATCH, transformVertices, &d);
+	parallelFor((d.numTriangles + TRIANGLE_BATCH - 1) / TRIANGLE_BATCH, setupTriangles, &d);
+	binTriangles(&d);
+	parallelFor(d.tilesX * d.tilesY, rasterTile, &d);
+
+	free(d.vertices);
+	free(d.triangles);
+	free(d.binStart);
+	free(d.binned);
+}
+
+int softWritePPM(const SoftTarget* target, const char* filename)
+{
+	FILE* file = fopen(filename, "wb");
+	int y;
+
+	if (!file) {
+		printf("Error: could not write %s\n", filename);
+		return 0;
+	}
+	/* PPM rows go top to bottom */
+	fprintf(file, "P6\n%d %d\n255\n", target->width, target->height);
+	for (y = target->height - 1; y >= 0; --y)
+		fwrite(target->color + y * target->stride * 3, 3, target->width, file);
+	fclose(file);
+	return 1;
+}
+
+float softCompare(const SoftTarget* a, const SoftTarget* b, int* maxDiff)
+{
+	double total = 0.0;
+	int x, y, i, largest = 0;
+
+	for (y = 0; y < a->height; ++y) {
+		const unsigned char* rowA = a->color + y * a->stride * 3;
+		const unsigned char* rowB = b->color + y * b->stride * 3;
+		for (x = 0; x < a->width; ++x) {
+			for (i = 0; i < 3; ++i) {
+				int diff = abs(rowA[x * 3 + i] - rowB[x * 3 + i]);
+				total += diff;
+				if (diff > largest)
+					largest = diff;
+			}
+		}
+	}
+	if (maxDiff)
+		*maxDiff = largest;
+	return (float)(total / ((double)a->width * a->height * 3));
+}
@@ -0,0 +1,55 @@
+/* softrast.h - multithreaded tile based CPU rasterizer
+
+A reference renderer for machines without a GPU. Draws createObjectData
+meshes with the same lighting as the core profile backend (core.h) into
+an RGB image and depth buffer, which can be written out as a PPM.
+
+The screen is split into SOFT_TILE square tiles. Vertices are lit and
+transformed in parallel, triangles binned to the tiles they overlap, then
+each tile is rasterized by one thread with four pixel wide edge function
+tests. Tiles are spread over the parallelFor pool, so throughput scales
+with cores.
+
+USAGE:
+target = softCreateTarget(width, height)
+softClear(target, color), softDrawObject(target, data, ...) per object
+softWritePPM(target, "out.ppm")
+softFreeTarget(target)
+
+Not supported: clipping (triangles with a vertex behind the near plane are
+dropped), wireframe, the clustered point lights and shader.vert's bumps.
+*/
+
+#ifndef SOFTRAST_H
+#define SOFTRAST_H
+
+#include "objects.h"
+#include "matrix.h"
+#include "core.h"
+
+#define SOFT_TILE 32
+
+typedef struct {
+	int width, height;
+	int stride; /* pixels per row, width rounded up to whole tiles */
+	unsigned char* color; /* RGB, bottom row first like glReadPixels */
+	float* depth; /* window depth, 0 near to 1 far */
+} SoftTarget;
+
+SoftTarget* softCreateTarget(int width, int height);
+void softFreeTarget(SoftTarget* target);
+void softClear(SoftTarget* target, const float color[4]);
+
+/* data must come from createObjectData (vertex_t vertices). flat is
+ * glShadeModel(GL_FLAT), lit from each triangle's last vertex */
+void softDrawObject(SoftTarget* target, const ObjectData* data, const mat4_t* projection,
+	const mat4_t* modelView, const CoreLighting* lighting, int flat);
+
+/* Returns 0 on failure */
+int softWritePPM(const SoftTarget* target, const char* filename);
+
+/* Mean absolute difference of the colour channels, 0 to 255. The largest
+ * single difference goes in maxDiff if not NULL. Sizes must match */
+float softCompare(const SoftTarget* a, const SoftTarget* b, int* maxDiff);
+
+#endif
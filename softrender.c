@@ -0,0 +1,116 @@
+/* softrender.c - renders ass2-base's scene with the CPU rasterizer
+
+Build with "make softrender". Needs no window or GPU, only the GL headers
+and libraries to link objects.o and core.o. Camera, light and material are
+ass2-base's defaults.
+
+USAGE: softrender [options]
+  --size WxH      image size, default 640x480
+  --shape N       sphere(0), torus(1), grid(2)
+  --tess N        tessellation level as in ass2-base, default 6
+  --pixel         per pixel lighting
+  --phong         Phong instead of Blinn-Phong
+  --flat          flat shading
+  --local-viewer  local instead of infinite viewer
+  --normals       normals as colours
+  --threads N     default one per core
+  --repeat N      frames to time, default 10
+  -o FILE         output, default softrender.ppm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "softrast.h"
+#include "parallel.h"
+#include "timer.h"
+
+static void usage(const char* name)
+{
+	printf("Usage: %s [--size WxH] [--shape N] [--tess N] [--pixel] [--phong] [--flat]\n"
+		"       [--local-viewer] [--normals] [--threads N] [--repeat N] [-o FILE]\n", name);
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	static const ParametricObjFunc shapes[] = {parametricSphere, parametricTorus, parametricGrid};
+	static const float light0_position[] = {2.0, 2.0, 2.0, 0.0};
+	static const float material_ambient[] = {0.5, 0.5, 0.5, 1.0};
+	static const float material_diffuse[] = {1.0, 0.0, 0.0, 1.0};
+	static const float material_specular[] = {1.0, 1.0, 1.0, 1.0};
+	static const float clear[] = {0.0, 0.0, 0.0, 0.0};
+	int width = 640, height = 480, shape = 0, tess = 6, flat = 0, threads = 0, repeat = 10;
+	const char* output = "softrender.ppm";
+	CoreLighting lighting;
+	mat4_t projection, view;
+	ObjectData* data;
+	SoftTarget* target;
+	double start, elapsed;
+	int i;
+
+	coreDefaultLighting(&lighting);
+	memcpy(lighting.materialAmbient, material_ambient, sizeof(material_ambient));
+	memcpy(lighting.materialDiffuse, material_diffuse, sizeof(material_diffuse));
+	memcpy(lighting.materialSpecular, material_specular, sizeof(material_specular));
+	lighting.materialShininess = 50.0;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "--shape") && i + 1 < argc) {
+			shape = atoi(argv[++i]);
+			if (shape < 0 || shape > 2)
+				usage(argv[0]);
+		} else if (!strcmp(argv[i], "--tess") && i + 1 < argc)
+			tess = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--pixel"))
+			lighting.shaderType = 1;
+		else if (!strcmp(argv[i], "--phong"))
+			lighting.lightingModel = 1;
+		else if (!strcmp(argv[i], "--flat"))
+			flat = 1;
+		else if (!strcmp(argv[i], "--local-viewer"))
+			lighting.viewer = 1;
+		else if (!strcmp(argv[i], "--normals"))
+			lighting.normalView = 1;
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			output = argv[++i];
+		else
+			usage(argv[0]);
+	}
+	if (tess < 1 || tess > 12 || repeat < 1)
+		usage(argv[0]);
+
+	/* Same camera and light as ass2-base starts with */
+	mat4Identity(&projection);
+	mat4Perspective(&projection, 60.0, width / (float)height, 0.1, 100.0);
+	mat4Identity(&view);
+	mat4Translate(&view, 0, 0, -5.0);
+	mat4TransformVec4(lighting.lightPosition, &view, light0_position);
+
+	data = createObjectData(shapes[shape], (1 << tess) + 1, (1 << tess) + 1, 1.0, 0.5, 0.4);
+	target = softCreateTarget(width, height);
+	parallelInit(threads);
+
+	start = timerNow();
+	for (i = 0; i < repeat; ++i) {
+		softClear(target, clear);
+		softDrawObject(target, data, &projection, &view, &lighting, flat);
+	}
+	elapsed = (timerNow() - start) / repeat;
+	printf("%dx%d, %d triangles, %d threads: %.2f ms per frame\n",
+		width, height, data->numIndices - 2, parallelThreads(), elapsed * 1e3);
+
+	softWritePPM(target, output);
+	parallelCleanup();
+	softFreeTarget(target);
+	freeObjectData(data);
+	return 0;
+}
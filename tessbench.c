@@ -0,0 +1,167 @@
+/* tessbench.c - adaptive against uniform tessellation at equal quality
+
+Build with "make tessbench". Needs no window or GL context. For each shape
+and tolerance, builds an adaptive mesh and measures its largest distance
+from the surface, then finds the smallest uniform n by n grid, as
+createObjectData builds, that is at least as close, and the smallest
+tessellation level ass2-base offers (n = 2^level + 1). Cracks counts mesh
+edges with a triangle on only one side, other than the surface's own
+border, welding vertices at the same (u, v) as createObjectData's seams.
+USAGE: tessbench [max depth], default 10
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "objects.h"
+#include "tessellate.h"
+#include "timer.h"
+
+#define MAX_UNIFORM 2049
+#define WELD_SCALE 1048576.0f /* (u, v) resolution for welding, finer than any grid */
+
+typedef struct {
+	const char* name;
+	ParametricObjFunc func;
+	int periodicU, periodicV;
+	int poles; /* every u at v = 0 and at v = 1 is the same point */
+} Shape;
+
+/* Same arguments as ass2-base */
+static const Shape shapes[] = {
+	{"sphere", parametricSphere, 1, 0, 1},
+	{"torus", parametricTorus, 1, 1, 0},
+	{"grid", parametricGrid, 0, 0, 0},
+};
+static const float tolerances[] = {1e-2f, 1e-3f, 1e-4f};
+
+static float meshError(const Shape* shape, const ObjectData* data)
+{
+	return measureObjectError(data, shape->func, 1.0, 0.5);
+}
+
+static float uniformError(const Shape* shape, int n, int* triangles)
+{
+	ObjectData* data = createObjectData(shape->func, n, n, 1.0, 0.5);
+	float error;
+
+	setObjectDataParams(data, n, n);
+	error = meshError(shape, data);
+	*triangles = countObjectTriangles(data);
+	freeObjectData(data);
+	return error;
+}
+
+/* One id per distinct point of the surface, from its (u, v) */
+static long long weldKey(const Shape* shape, parametric_t p)
+{
+	long long u = (long long)rintf(p.u * WELD_SCALE), v = (long long)rintf(p.v * WELD_SCALE);
+	long long end = (long long)WELD_SCALE;
+
+	if (shape->periodicU && u == end)
+		u = 0;
+	if (shape->periodicV && v == end)
+		v = 0;
+	if (shape->poles && (v == 0 || v == end))
+		u = 0;
+	return u * (end + 1) + v;
+}
+
+/* Whether (u, v) is on an edge of the domain the surface doesn't wrap at */
+static int onBorder(const Shape* shape, parametric_t p)
+{
+	return (!shape->periodicU && (p.u == 0.0f || p.u == 1.0f)) ||
+		(!shape->periodicV && !shape->poles && (p.v == 0.0f || p.v == 1.0f));
+}
+
+typedef struct {
+	long long a, b; /* welded ends, a < b */
+	int border;
+} Edge;
+
+static int compareEdges(const void* x, const void* y)
+{
+	const Edge* e = (const Edge*)x;
+	const Edge* f = (const Edge*)y;
+	if (e->a != f->a)
+		return e->a < f->a ? -1 : 1;
+	return e->b < f->b ? -1 : e->b > f->b;
+}
+
+/* Edges of a GL_TRIANGLES mesh used by one triangle only, off the border */
+static int countCracks(const Shape* shape, const ObjectData* data)
+{
+	int numTriangles = data->numIndices / 3, numEdges = 0, cracks = 0, t, k, run;
+	Edge* edges = (Edge*)malloc(sizeof(Edge) * numTriangles * 3);
+
+	for (t = 0; t < numTriangles; ++t) {
+		const unsigned int* tri = data->indices + t * 3;
+		long long key[3];
+		for (k = 0; k < 3; ++k)
+			key[k] = weldKey(shape, data->params[tri[k]]);
+		if (key[0] == key[1] || key[1] == key[2] || key[0] == key[2])
+			continue; /* at a pole */
+		for (k = 0; k < 3; ++k) {
+			parametric_t p = data->params[tri[k]], q = data->params[tri[(k + 1) % 3]];
+			Edge* e = &edges[numEdges++];
+			e->a = key[k] < key[(k + 1) % 3] ? key[k] : key[(k + 1) % 3];
+			e->b = key[k] < key[(k + 1) % 3] ? key[(k + 1) % 3] : key[k];
+			e->border = onBorder(shape, p) && onBorder(shape, q) && (p.u == q.u || p.v == q.v);
+		}
+	}
+	qsort(edges, numEdges, sizeof(Edge), compareEdges);
+	for (t = 0; t < numEdges; t += run) {
+		for (run = 1; t + run < numEdges && !compareEdges(&edges[t], &edges[t + run]); ++run)
+			;
+		if (run == 1 && !edges[t].border)
+			cracks++;
+	}
+	free(edges);
+	return cracks;
+}
+
+int main(int argc, char** argv)
+{
+	int maxDepth = argc > 1 ? atoi(argv[1]) : 10;
+	int s, k;
+
+	printf("max depth %d, uniform grids up to %d by %d\n", maxDepth, MAX_UNIFORM, MAX_UNIFORM);
+	printf("%-8s %9s | %10s %9s %10s %8s %6s | %6s %10s %10s | %5s %10s\n", "shape", "tolerance",
+		"triangles", "vertices", "max error", "ms", "cracks", "grid", "triangles", "max error", "level", "triangles");
+	for (s = 0; s < (int)(sizeof(shapes) / sizeof(shapes[0])); ++s) {
+		const Shape* shape = &shapes[s];
+		for (k = 0; k < (int)(sizeof(tolerances) / sizeof(tolerances[0])); ++k) {
+			ObjectData* data;
+			double start = timerNow(), elapsed;
+			float error, uniform;
+			int triangles, uniformTriangles, levelTriangles, level, low = 2, high = MAX_UNIFORM;
+
+			data = createObjectDataAdaptive(shape->func, tolerances[k], maxDepth, 1.0, 0.5);
+			elapsed = timerNow() - start;
+			error = meshError(shape, data);
+			triangles = countObjectTriangles(data);
+
+			/* Smallest grid at least as close to the surface. Error only
+			 * falls as n grows, give or take rounding */
+			while (low < high) {
+				int n = (low + high) / 2;
+				if (uniformError(shape, n, &uniformTriangles) <= error + 1e-6f)
+					high = n;
+				else
+					low = n + 1;
+			}
+			uniform = uniformError(shape, low, &uniformTriangles);
+			for (level = 0; (1 << level) + 1 < low; ++level)
+				;
+			uniformError(shape, (1 << level) + 1, &levelTriangles);
+
+			printf("%-8s %9.0e | %10d %9d %10.2e %8.2f %6d | %6d %10d %10.2e | %5d %10d%s\n", shape->name, tolerances[k],
+				triangles, data->numVertices, error, elapsed * 1e3, countCracks(shape, data),
+				low, uniformTriangles, uniform, level, levelTriangles,
+				uniform > error + 1e-6f ? " (largest grid)" : "");
+			freeObjectData(data);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,425 @@
+/* tessellate.c - curvature adaptive tessellation of parametric surfaces */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tessellate.h"
+
+#define MAX_DEPTH 15
+
+/* Open addressing map from a grid point to its vertex */
+typedef struct {
+	unsigned long long* keys; /* packed (i, j) + 1, 0 when empty */
+	int* values;
+	int capacity; /* a power of two */
+	int count;
+} VertexMap;
+
+/* A rectangle of the (u, v) domain, in grid units. Every split halves a
+ * side, so sides are dyadic and a cell's edge is either inside or around a
+ * neighbour's */
+typedef struct {
+	int i, j, width, height;
+} Cell;
+
+typedef struct {
+	ParametricObjFunc func;
+	va_list* args;
+	float tolerance;
+	int maxDepth;
+	int res; /* grid units along u and v, two per finest cell */
+	int periodicU, periodicV;
+	VertexMap map;
+
+	vertex_t* vertices;
+	parametric_t* params;
+	int numVertices, vertexCapacity;
+	Cell* leaves;
+	int numLeaves, leafCapacity;
+	unsigned int* indices;
+	int numIndices, indexCapacity;
+} Tessellator;
+
+/* The function consumes its arguments, so each call gets a fresh copy */
+static vertex_t evaluate(ParametricObjFunc func, va_list* baseArgs, float u, float v)
+{
+	va_list args;
+	vertex_t ret;
+
+	va_copy(args, *baseArgs);
+	ret = func(u, v, &args);
+	va_end(args);
+	return ret;
+}
+
+static float distance(vector_t a, vector_t b)
+{
+	float x = a.x - b.x, y = a.y - b.y, z = a.z - b.z;
+	return sqrtf(x * x + y * y + z * z);
+}
+
+static unsigned int hashKey(unsigned long long key, int capacity)
+{
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+static void mapInsert(VertexMap* map, unsigned long long key, int value)
+{
+	unsigned int h;
+
+	if (map->count * 2 >= map->capacity) {
+		VertexMap bigger;
+		int k;
+
+		bigger.capacity = map->capacity ? map->capacity * 2 : 1024;
+		bigger.count = 0;
+		bigger.keys = (unsigned long long*)calloc(bigger.capacity, sizeof(unsigned long long));
+		bigger.values = (int*)malloc(sizeof(int) * bigger.capacity);
+		for (k = 0; k < map->capacity; ++k)
+			if (map->keys[k])
+				mapInsert(&bigger, map->keys[k], map->values[k]);
+		free(map->keys);
+		free(map->values);
+		*map = bigger;
+	}
+	for (h = hashKey(key, map->capacity); map->keys[h]; h = (h + 1) & (map->capacity - 1))
+		;
+	map->keys[h] = key;
+	map->values[h] = value;
+	map->count++;
+}
+
+static int mapFind(const VertexMap* map, unsigned long long key)
+{
+	unsigned int h;
+
+	if (!map->capacity)
+		return -1;
+	for (h = hashKey(key, map->capacity); map->keys[h]; h = (h + 1) & (map->capacity - 1))
+		if (map->keys[h] == key)
+			return map->values[h];
+	return -1;
+}
+
+static unsigned long long gridKey(const Tessellator* t, int i, int j)
+{
+	return (unsigned long long)i * (t->res + 1) + j + 1;
+}
+
+/* Index of the vertex at grid point (i, j), evaluating it if it's new */
+static int vertexAt(Tessellator* t, int i, int j)
+{
+	unsigned long long key = gridKey(t, i, j);
+	int index = mapFind(&t->map, key);
+	float u = i / (float)t->res, v = j / (float)t->res;
+
+	if (index >= 0)
+		return index;
+	if (t->numVertices == t->vertexCapacity) {
+		t->vertexCapacity = t->vertexCapacity ? t->vertexCapacity * 2 : 1024;
+		t->vertices = (vertex_t*)realloc(t->vertices, sizeof(vertex_t) * t->vertexCapacity);
+		t->params = (parametric_t*)realloc(t->params, sizeof(parametric_t) * t->vertexCapacity);
+	}
+	index = t->numVertices++;
+	t->vertices[index] = evaluate(t->func, t->args, u, v);
+	t->params[index].u = u;
+	t->params[index].v = v;
+	mapInsert(&t->map, key, index);
+	return index;
+}
+
+/* Index of an existing vertex at (i, j), -1 if there is none. Across a
+ * periodic seam the other side's vertex counts, and gets a twin on this side */
+static int findVertex(Tessellator* t, int i, int j)
+{
+	int index = mapFind(&t->map, gridKey(t, i, j));
+
+	if (index >= 0)
+		return index;
+	if (t->periodicU && (i == 0 || i == t->res) && mapFind(&t->map, gridKey(t, t->res - i, j)) >= 0)
+		return vertexAt(t, i, j);
+	if (t->periodicV && (j == 0 || j == t->res) && mapFind(&t->map, gridKey(t, i, t->res - j)) >= 0)
+		return vertexAt(t, i, j);
+	return -1;
+}
+
+/* Largest distance between the surface and the cell's two triangles, split
+ * along the (i, j) to (i + width, j + height) diagonal, at edge midpoints,
+ * centre and quarter points. alongU and alongV get the midpoint distances
+ * of the edges running in u and in v, what halving that way would reduce */
+static float cellError(Tessellator* t, const Cell* c, float* alongU, float* alongV)
+{
+	static const int samples[9][2] = {{2, 0}, {2, 4}, {0, 2}, {4, 2}, {2, 2}, {1, 1}, {3, 1}, {1, 3}, {3, 3}};
+	/* Indices first, vertexAt can move the vertices */
+	int i00 = vertexAt(t, c->i, c->j), i10 = vertexAt(t, c->i + c->width, c->j);
+	int i01 = vertexAt(t, c->i, c->j + c->height), i11 = vertexAt(t, c->i + c->width, c->j + c->height);
+	vector_t c00 = t->vertices[i00].vert, c10 = t->vertices[i10].vert;
+	vector_t c01 = t->vertices[i01].vert, c11 = t->vertices[i11].vert;
+	float error = 0.0f, d;
+	int k;
+
+	*alongU = *alongV = 0.0f;
+	for (k = 0; k < 9; ++k) {
+		float x = samples[k][0] * 0.25f, y = samples[k][1] * 0.25f;
+		float u = (c->i + c->width * x) / t->res, v = (c->j + c->height * y) / t->res;
+		vector_t s = evaluate(t->func, t->args, u, v).vert;
+		vector_t p;
+
+		if (x >= y) {
+			p.x = c00.x + x * (c10.x - c00.x) + y * (c11.x - c10.x);
+			p.y = c00.y + x * (c10.y - c00.y) + y * (c11.y - c10.y);
+			p.z = c00.z + x * (c10.z - c00.z) + y * (c11.z - c10.z);
+		} else {
+			p.x = c00.x + y * (c01.x - c00.x) + x * (c11.x - c01.x);
+			p.y = c00.y + y * (c01.y - c00.y) + x * (c11.y - c01.y);
+			p.z = c00.z + y * (c01.z - c00.z) + x * (c11.z - c01.z);
+		}
+		d = distance(s, p);
+		if (k < 2)
+			*alongU = fmaxf(*alongU, d);
+		else if (k < 4)
+			*alongV = fmaxf(*alongV, d);
+		error = fmaxf(error, d);
+	}
+	return error;
+}
+
+/* Halves cells out of tolerance across whichever of u and v bends more,
+ * down to two grid units. The halves are tested again, so a cell bent both
+ * ways ends up split both ways */
+static void refine(Tessellator* t, int i, int j, int width, int height)
+{
+	Cell cell = {i, j, width, height};
+	float alongU, alongV;
+
+	if (cellError(t, &cell, &alongU, &alongV) > t->tolerance && (width > 2 || height > 2)) {
+		if (height <= 2 || (width > 2 && alongU >= alongV)) {
+			refine(t, i, j, width / 2, height);
+			refine(t, i + width / 2, j, width / 2, height);
+		} else {
+			refine(t, i, j, width, height / 2);
+			refine(t, i, j + height / 2, width, height / 2);
+		}
+		return;
+	}
+	if (t->numLeaves == t->leafCapacity) {
+		t->leafCapacity = t->leafCapacity ? t->leafCapacity * 2 : 256;
+		t->leaves = (Cell*)realloc(t->leaves, sizeof(Cell) * t->leafCapacity);
+	}
+	t->leaves[t->numLeaves++] = cell;
+}
+
+/* Appends the vertices strictly between two grid points, in order. A finer
+ * neighbour always has a vertex at the midpoint, so stop where there's none */
+static int collectEdge(Tessellator* t, int i0, int j0, int i1, int j1, int* out)
+{
+	int mi = (i0 + i1) / 2, mj = (j0 + j1) / 2;
+	int index, count;
+
+	if (abs(i1 - i0) + abs(j1 - j0) < 2 || (index = findVertex(t, mi, mj)) < 0)
+		return 0;
+	count = collectEdge(t, i0, j0, mi, mj, out);
+	out[count++] = index;
+	return count + collectEdge(t, mi, mj, i1, j1, out + count);
+}
+
+static void addTriangle(Tessellator* t, int a, int b, int c)
+{
+	if (t->numIndices + 3 > t->indexCapacity) {
+		t->indexCapacity = t->indexCapacity ? t->indexCapacity * 2 : 3072;
+		t->indices = (unsigned int*)realloc(t->indices, sizeof(unsigned int) * t->indexCapacity);
+	}
+	t->indices[t->numIndices++] = a;
+	t->indices[t->numIndices++] = b;
+	t->indices[t->numIndices++] = c;
+}
+
+/* Two triangles, wound as createObjectData's strip (anticlockwise in u and
+ * v), or a fan from the centre through every vertex on the cell's boundary */
+static void triangulate(Tessellator* t, const Cell* cell, int* boundary)
+{
+	int i = cell->i, j = cell->j, w = cell->width, h = cell->height;
+	int n = 0, k, centre;
+
+	boundary[n++] = vertexAt(t, i, j);
+	n += collectEdge(t, i, j, i, j + h, boundary + n);
+	boundary[n++] = vertexAt(t, i, j + h);
+	n += collectEdge(t, i, j + h, i + w, j + h, boundary + n);
+	boundary[n++] = vertexAt(t, i + w, j + h);
+	n += collectEdge(t, i + w, j + h, i + w, j, boundary + n);
+	boundary[n++] = vertexAt(t, i + w, j);
+	n += collectEdge(t, i + w, j, i, j, boundary + n);
+
+	if (n == 4) {
+		addTriangle(t, boundary[0], boundary[2], boundary[1]);
+		addTriangle(t, boundary[0], boundary[3], boundary[2]);
+		return;
+	}
+	centre = vertexAt(t, i + w / 2, j + h / 2);
+	for (k = 0; k < n; ++k)
+		addTriangle(t, centre, boundary[(k + 1) % n], boundary[k]);
+}
+
+/* Whether the surface meets itself at the two ends of u, or of v */
+static int isPeriodic(Tessellator* t, int alongU)
+{
+	static const float at[] = {0.37f, 0.71f};
+	int k;
+
+	for (k = 0; k < 2; ++k) {
+		vertex_t a = evaluate(t->func, t->args, alongU ? 0.0f : at[k], alongU ? at[k] : 0.0f);
+		vertex_t b = evaluate(t->func, t->args, alongU ? 1.0f : at[k], alongU ? at[k] : 1.0f);
+		vector_t origin = {0.0f, 0.0f, 0.0f};
+		if (distance(a.vert, b.vert) > 1e-5f * (1.0f + distance(a.vert, origin)))
+			return 0;
+	}
+	return 1;
+}
+
+static ObjectData* generateAdaptive(ParametricObjFunc func, float tolerance, int maxDepth, va_list* args)
+{
+	Tessellator t;
+	ObjectData* data;
+	int* boundary;
+	int k;
+
+	memset(&t, 0, sizeof(t));
+	t.func = func;
+	t.args = args;
+	t.tolerance = tolerance;
+	t.maxDepth = maxDepth < 0 ? 0 : maxDepth > MAX_DEPTH ? MAX_DEPTH : maxDepth;
+	t.res = 2 << t.maxDepth; /* so the smallest cells still have a centre */
+	t.periodicU = isPeriodic(&t, 1);
+	t.periodicV = isPeriodic(&t, 0);
+
+	/* Every vertex of the refined cells exists before any is triangulated */
+	refine(&t, 0, 0, t.res, t.res);
+	boundary = (int*)malloc(sizeof(int) * (2 * t.res + 4));
+	for (k = 0; k < t.numLeaves; ++k)
+		triangulate(&t, &t.leaves[k], boundary);
+	free(boundary);
+	free(t.leaves);
+	free(t.map.keys);
+	free(t.map.values);
+
+	data = (ObjectData*)malloc(sizeof(ObjectData));
+	data->vertices = t.vertices;
+	data->vertexSize = sizeof(vertex_t);
+	data->numVertices = t.numVertices;
+	data->indices = t.indices;
+	data->numIndices = t.numIndices;
+	data->mode = GL_TRIANGLES;
+	data->params = t.params;
+	data->patches = NULL;
+	data->numPatches = 0;
+	data->release = NULL;
+	data->owner = NULL;
+	data->trackedBytes = data->trackedNormals = 0;
+
+	/* Normal lines, as createObjectData */
+	data->normals = (vector_t*)malloc(sizeof(vector_t) * t.numVertices * 2);
+	for (k = 0; k < t.numVertices; ++k) {
+		vertex_t* v = &t.vertices[k];
+		data->normals[k * 2] = v->vert;
+		data->normals[k * 2 + 1].x = v->vert.x + v->norm.x * 0.2f;
+		data->normals[k * 2 + 1].y = v->vert.y + v->norm.y * 0.2f;
+		data->normals[k * 2 + 1].z = v->vert.z + v->norm.z * 0.2f;
+	}
+	trackObjectData(data);
+	return data;
+}
+
+ObjectData* createObjectDataAdaptive(ParametricObjFunc parametric, float tolerance, int maxDepth, ...)
+{
+	va_list args;
+	ObjectData* data;
+
+	va_start(args, maxDepth);
+	data = generateAdaptive(parametric, tolerance, maxDepth, &args);
+	va_end(args);
+	return data;
+}
+
+/* First index of triangle t, -1 for a strip's degenerate joins */
+static int triangleStart(const ObjectData* data, int t)
+{
+	const unsigned int* i;
+
+	if (data->mode == GL_TRIANGLES)
+		return t * 3;
+	i = data->indices + t;
+	return i[0] == i[1] || i[1] == i[2] || i[0] == i[2] ? -1 : t;
+}
+
+static int triangleSlots(const ObjectData* data)
+{
+	if (data->mode == GL_TRIANGLES)
+		return data->numIndices / 3;
+	return data->numIndices < 3 ? 0 : data->numIndices - 2;
+}
+
+float measureObjectError(const ObjectData* data, ParametricObjFunc parametric, ...)
+{
+	static const float weights[7][3] = {
+		{1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f},
+		{0.5f, 0.5f, 0.0f}, {0.0f, 0.5f, 0.5f}, {0.5f, 0.0f, 0.5f},
+		{2.0f / 3.0f, 1.0f / 6.0f, 1.0f / 6.0f},
+		{1.0f / 6.0f, 2.0f / 3.0f, 1.0f / 6.0f},
+		{1.0f / 6.0f, 1.0f / 6.0f, 2.0f / 3.0f}};
+	const vertex_t* vertices = (const vertex_t*)data->vertices;
+	va_list args;
+	float error = 0.0f;
+	int t, s, k, first, slots = triangleSlots(data);
+
+	if (!data->params || data->vertexSize != sizeof(vertex_t))
+		return -1.0f;
+
+	va_start(args, parametric);
+	for (t = 0; t < slots; ++t) {
+		if ((first = triangleStart(data, t)) < 0)
+			continue;
+		for (s = 0; s < 7; ++s) {
+			float u = 0.0f, v = 0.0f;
+			vector_t p = {0.0f, 0.0f, 0.0f};
+			for (k = 0; k < 3; ++k) {
+				unsigned int index = data->indices[first + k];
+				float w = weights[s][k];
+				u += w * data->params[index].u;
+				v += w * data->params[index].v;
+				p.x += w * vertices[index].vert.x;
+				p.y += w * vertices[index].vert.y;
+				p.z += w * vertices[index].vert.z;
+			}
+			error = fmaxf(error, distance(evaluate(parametric, &args, u, v).vert, p));
+		}
+	}
+	va_end(args);
+	return error;
+}
+
+void setObjectDataParams(ObjectData* data, int x, int y)
+{
+	int i, j;
+
+	free(data->params);
+	data->params = (parametric_t*)malloc(sizeof(parametric_t) * x * y);
+	for (i = 0; i < x; ++i) {
+		for (j = 0; j < y; ++j) {
+			data->params[i * y + j].u = i / (float)(x - 1);
+			data->params[i * y + j].v = j / (float)(y - 1);
+		}
+	}
+	trackObjectData(data);
+}
+
+int countObjectTriangles(const ObjectData* data)
+{
+	int t, count = 0, slots = triangleSlots(data);
+
+	if (data->mode == GL_TRIANGLES)
+		return slots;
+	for (t = 0; t < slots; ++t)
+		count += triangleStart(data, t) >= 0;
+	return count;
+}
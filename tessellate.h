@@ -0,0 +1,44 @@
+/* tessellate.h - curvature adaptive tessellation of parametric surfaces
+
+createObjectData samples u and v uniformly, so flat parts of a surface get
+as many triangles as the most curved. createObjectDataAdaptive instead
+starts from one cell over the whole (u, v) domain and halves cells while
+the surface strays more than a tolerance from the two triangles the cell
+would become, measured at its edge midpoints, centre and quarter points.
+Each split is across u or v, whichever the surface bends more along.
+Cells next to finer ones have the extra vertices on their shared edges,
+so they are fanned from their centre instead of split in two, leaving no
+T-junctions to crack.
+
+tessbench compares the result with uniform grids of the same error.
+
+Surfaces that meet themselves across u = 0 and u = 1, or v = 0 and v = 1,
+are detected and the two sides are matched up the same way.
+
+USAGE:
+data = createObjectDataAdaptive(parametricTorus, 0.001f, 10, 1.0, 0.5)
+uploadObject(data), as createObjectData. data->mode is GL_TRIANGLES
+error = measureObjectError(data, parametricTorus, 1.0, 0.5)
+*/
+
+#ifndef TESSELLATE_H
+#define TESSELLATE_H
+
+#include "objects.h"
+
+/* Cells are split until within tolerance, in object space units, or until
+ * they are 1 / 2^maxDepth of the domain. Keeps data->params */
+ObjectData* createObjectDataAdaptive(ParametricObjFunc parametric, float tolerance, int maxDepth, ...);
+
+/* Largest distance between the mesh and the surface at the same (u, v),
+ * sampled at 7 points per triangle. Needs data->params, see
+ * setObjectDataParams for createObjectData meshes */
+float measureObjectError(const ObjectData* data, ParametricObjFunc parametric, ...);
+
+/* Fills data->params for an x by y createObjectData mesh */
+void setObjectDataParams(ObjectData* data, int x, int y);
+
+/* Triangles drawn, without a strip's degenerate joins */
+int countObjectTriangles(const ObjectData* data);
+
+#endif
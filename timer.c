@@ -0,0 +1,48 @@
+/* timer.c - high resolution monotonic clock */
+
+/* clock_gettime and nanosleep are hidden by -std=c99 otherwise */
+#ifndef __APPLE__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "timer.h"
+
+/* Leave this much of a wait to the spin loop. OS sleeps routinely overshoot
+by a millisecond or more. */
+#define SPIN_THRESHOLD 0.002
+
+double timerNow()
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return (double)mach_absolute_time() * timebase.numer / timebase.denom * 1e-9;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+void timerSleepUntil(double deadline)
+{
+	double remaining;
+	struct timespec ts;
+
+	remaining = deadline - timerNow();
+	if (remaining > SPIN_THRESHOLD) {
+		remaining -= SPIN_THRESHOLD;
+		ts.tv_sec = (time_t)remaining;
+		ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+	}
+	while (timerNow() < deadline)
+		; /* spin */
+}
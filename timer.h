@@ -0,0 +1,13 @@
+/* timer.h - high resolution monotonic clock */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Seconds since an arbitrary fixed point. Use differences only. */
+double timerNow();
+
+/* Sleeps until timerNow() >= deadline. Coarse OS sleep followed by a short
+spin, so the wakeup is accurate to well under a millisecond. */
+void timerSleepUntil(double deadline);
+
+#endif